@@ -30,6 +30,225 @@ static char kRSDPSignature[8] = {'R','S','D',' ','P','T','R',' '};
 #define ACPI_APIC_TAG MAKE_HEADER_TAG('A','P','I','C')
 #define ACPI_HPET_TAG MAKE_HEADER_TAG('H','P','E','T')
 #define ACPI_BGRT_TAG MAKE_HEADER_TAG('B','G','R','T')
+#define ACPI_SRAT_TAG MAKE_HEADER_TAG('S','R','A','T')
+#define ACPI_SLIT_TAG MAKE_HEADER_TAG('S','L','I','T')
+
+// NUMA topology, filled in by acpi_numa_initialise
+typedef struct _numa_memory_range {
+    uintptr_t   _base;
+    size_t      _size;
+    size_t      _node;
+} numa_memory_range_t;
+
+typedef struct _numa_processor {
+    uint32_t    _apic_id;
+    size_t      _node;
+} numa_processor_t;
+
+static size_t               _numa_num_nodes = 1;
+// proximity domain of each node
+static uint32_t             _numa_domains[ACPI_MAX_NUMA_NODES];
+static numa_memory_range_t  _numa_ranges[ACPI_MAX_NUMA_MEMORY_RANGES];
+static size_t               _numa_num_ranges = 0;
+static numa_processor_t     _numa_processors[ACPI_MAX_NUMA_PROCESSORS];
+static size_t               _numa_num_processors = 0;
+static const acpi_slit_header_t*    _slit = 0;
+static const acpi_srat_header_t*    _srat = 0;
+
+static const char* kAcpiChannel = "acpi";
+
+static const _xsdt_header_t* _find_xsdt(CEfiSystemTable* st) {
+
+    CEfiConfigurationTable* config_tables = (CEfiConfigurationTable*)st->configuration_table;
+    for(size_t n = 0; n < st->number_of_table_entries; ++n) {
+        if ( memcmp(&C_EFI_ACPI_2_0_GUID, &config_tables[n].vendor_guid, sizeof(CEfiGuid))==0 ) {
+            const rsdp_descriptor20_t* rsdp = (const rsdp_descriptor20_t*)config_tables[n].vendor_table;
+            if ( memcmp(rsdp->_rsdp_descriptor._signature, kRSDPSignature, sizeof(kRSDPSignature))==0 ) {
+                const _xsdt_header_t* xsdt = (const _xsdt_header_t*)rsdp->_xsdt_address;
+                if ( do_checksum((const uint8_t*)&xsdt->_std, xsdt->_std._length) ) {
+                    return xsdt;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static size_t _numa_node_for_domain(uint32_t domain) {
+    for(size_t node = 0; node < _numa_num_nodes; ++node) {
+        if ( _numa_domains[node] == domain ) {
+            return node;
+        }
+    }
+    if ( _numa_num_nodes == ACPI_MAX_NUMA_NODES ) {
+        _JOS_KTRACE_CHANNEL(kAcpiChannel, "too many proximity domains, domain %d folded into node 0", domain);
+        return 0;
+    }
+    _numa_domains[_numa_num_nodes] = domain;
+    return _numa_num_nodes++;
+}
+
+static void _numa_add_processor(uint32_t apic_id, uint32_t domain) {
+    if ( _numa_num_processors == ACPI_MAX_NUMA_PROCESSORS ) {
+        return;
+    }
+    _numa_processors[_numa_num_processors]._apic_id = apic_id;
+    _numa_processors[_numa_num_processors]._node = _numa_node_for_domain(domain);
+    ++_numa_num_processors;
+}
+
+static void _parse_srat(const acpi_srat_header_t* srat) {
+
+    // node 0 is assigned to the first domain found
+    _numa_num_nodes = 0;
+    const uint8_t* entry = (const uint8_t*)srat + sizeof(acpi_srat_header_t);
+    const uint8_t* end = (const uint8_t*)srat + srat->_std._length;
+    while ( entry + sizeof(acpi_srat_entry_header_t) <= end ) {
+        const acpi_srat_entry_header_t* header = (const acpi_srat_entry_header_t*)entry;
+        if ( !header->_length || entry + header->_length > end ) {
+            break;
+        }
+        switch(header->_type) {
+            case kAcpiSrat_LocalApicAffinity:
+            {
+                const acpi_srat_local_apic_affinity_t* lapic = (const acpi_srat_local_apic_affinity_t*)entry;
+                if ( lapic->_flags & ACPI_SRAT_ENTRY_ENABLED ) {
+                    const uint32_t domain = (uint32_t)lapic->_proximity_domain_lo 
+                                            | ((uint32_t)lapic->_proximity_domain_hi[0] << 8)
+                                            | ((uint32_t)lapic->_proximity_domain_hi[1] << 16)
+                                            | ((uint32_t)lapic->_proximity_domain_hi[2] << 24);
+                    _numa_add_processor(lapic->_apic_id, domain);
+                }
+            }
+            break;
+            case kAcpiSrat_LocalX2ApicAffinity:
+            {
+                const acpi_srat_local_x2apic_affinity_t* x2apic = (const acpi_srat_local_x2apic_affinity_t*)entry;
+                if ( x2apic->_flags & ACPI_SRAT_ENTRY_ENABLED ) {
+                    _numa_add_processor(x2apic->_x2apic_id, x2apic->_proximity_domain);
+                }
+            }
+            break;
+            case kAcpiSrat_MemoryAffinity:
+            {
+                const acpi_srat_memory_affinity_t* memory = (const acpi_srat_memory_affinity_t*)entry;
+                if ( (memory->_flags & ACPI_SRAT_ENTRY_ENABLED) && memory->_length 
+                    && _numa_num_ranges < ACPI_MAX_NUMA_MEMORY_RANGES ) {
+                    _numa_ranges[_numa_num_ranges]._base = (uintptr_t)memory->_base_address;
+                    _numa_ranges[_numa_num_ranges]._size = (size_t)memory->_length;
+                    _numa_ranges[_numa_num_ranges]._node = _numa_node_for_domain(memory->_proximity_domain);
+                    ++_numa_num_ranges;
+                }
+            }
+            break;
+            default:;
+        }
+        entry += header->_length;
+    }
+    if ( !_numa_num_nodes ) {
+        _numa_num_nodes = 1;
+        _numa_domains[0] = 0;
+    }
+}
+
+_JOS_API_FUNC jo_status_t acpi_numa_initialise(CEfiSystemTable* st) {
+
+    _numa_num_nodes = 1;
+    _numa_domains[0] = 0;
+    _numa_num_ranges = 0;
+    _numa_num_processors = 0;
+    _srat = 0;
+    _slit = 0;
+
+    const _xsdt_header_t* xsdt = _find_xsdt(st);
+    if ( !xsdt ) {
+        return _JO_STATUS_NOT_FOUND;
+    }
+    size_t total = (xsdt->_std._length - sizeof(acpi_sdt_header_t)) / 8;
+    const char* header_ptrs = (const char*)xsdt + sizeof(acpi_sdt_header_t);
+    while(total) {
+        const acpi_sdt_header_t* sdt = (const acpi_sdt_header_t*)((uintptr_t)(*(uint64_t*) header_ptrs));
+        const uint32_t sig = *(const uint32_t*)sdt->_signature;
+        switch(sig) {
+            case ACPI_SRAT_TAG:
+                if ( do_checksum((const uint8_t*)sdt, sdt->_length) ) {
+                    _srat = (const acpi_srat_header_t*)sdt;
+                }
+            break;
+            case ACPI_SLIT_TAG:
+                if ( do_checksum((const uint8_t*)sdt, sdt->_length) ) {
+                    _slit = (const acpi_slit_header_t*)sdt;
+                }
+            break;
+            default:;
+        }
+        header_ptrs += sizeof(uint64_t*);
+        --total;
+    }
+
+    if ( _srat ) {
+        _parse_srat(_srat);
+    }
+    // the SLIT is only useful if it covers the domains we know about
+    if ( _slit ) {
+        const size_t localities = (size_t)_slit->_num_localities;
+        bool valid = sizeof(acpi_slit_header_t) + localities*localities <= _slit->_std._length;
+        for(size_t node = 0; valid && node < _numa_num_nodes; ++node) {
+            valid = _numa_domains[node] < localities;
+        }
+        if ( !valid ) {
+            _JOS_KTRACE_CHANNEL(kAcpiChannel, "SLIT doesn't match SRAT, ignored");
+            _slit = 0;
+        }
+    }
+
+    _JOS_KTRACE_CHANNEL(kAcpiChannel, "%d NUMA node(s), %d memory ranges, %d processors, %s", 
+        _numa_num_nodes, _numa_num_ranges, _numa_num_processors, _slit ? "SLIT" : "no SLIT");
+    return _JO_STATUS_SUCCESS;
+}
+
+_JOS_API_FUNC size_t acpi_numa_node_count(void) {
+    return _numa_num_nodes;
+}
+
+_JOS_API_FUNC size_t acpi_numa_node_for_apic_id(uint32_t apic_id) {
+    for(size_t p = 0; p < _numa_num_processors; ++p) {
+        if ( _numa_processors[p]._apic_id == apic_id ) {
+            return _numa_processors[p]._node;
+        }
+    }
+    return 0;
+}
+
+_JOS_API_FUNC size_t acpi_numa_node_for_address(uintptr_t address) {
+    for(size_t r = 0; r < _numa_num_ranges; ++r) {
+        if ( address >= _numa_ranges[r]._base && address - _numa_ranges[r]._base < _numa_ranges[r]._size ) {
+            return _numa_ranges[r]._node;
+        }
+    }
+    return 0;
+}
+
+_JOS_API_FUNC uint8_t acpi_numa_distance(size_t from, size_t to) {
+    if ( from == to ) {
+        return ACPI_NUMA_LOCAL_DISTANCE;
+    }
+    if ( !_slit || from >= _numa_num_nodes || to >= _numa_num_nodes ) {
+        return ACPI_NUMA_REMOTE_DISTANCE;
+    }
+    const uint8_t* matrix = (const uint8_t*)_slit + sizeof(acpi_slit_header_t);
+    return matrix[_numa_domains[from] * (size_t)_slit->_num_localities + _numa_domains[to]];
+}
+
+_JOS_API_FUNC jo_status_t acpi_numa_memory_range(size_t index, uintptr_t* out_base, size_t* out_size, size_t* out_node) {
+    if ( index >= _numa_num_ranges ) {
+        return _JO_STATUS_OUT_OF_RANGE;
+    }
+    *out_base = _numa_ranges[index]._base;
+    *out_size = _numa_ranges[index]._size;
+    *out_node = _numa_ranges[index]._node;
+    return _JO_STATUS_SUCCESS;
+}
 
 _JOS_API_FUNC jo_status_t    acpi_intitialise(CEfiSystemTable* st) {
     
@@ -65,6 +284,12 @@ _JOS_API_FUNC jo_status_t    acpi_intitialise(CEfiSystemTable* st) {
                             case ACPI_BGRT_TAG:
                                 hive_set(kernel_hive(), "BGRT", HIVE_VALUE_PTR(sdt), HIVE_VALUELIST_END);
                             break;
+                            case ACPI_SRAT_TAG:
+                                hive_set(kernel_hive(), "SRAT", HIVE_VALUE_PTR(sdt), HIVE_VALUELIST_END);
+                            break;
+                            case ACPI_SLIT_TAG:
+                                hive_set(kernel_hive(), "SLIT", HIVE_VALUE_PTR(sdt), HIVE_VALUELIST_END);
+                            break;
                             default:;
                         }
                         header_ptrs += sizeof(uint64_t*);
@@ -82,6 +307,12 @@ _JOS_API_FUNC jo_status_t    acpi_intitialise(CEfiSystemTable* st) {
            }
         }
     }
+
+    hive_set(kernel_hive(), "acpi:numa_nodes", HIVE_VALUE_INT(_numa_num_nodes), HIVE_VALUELIST_END);
+    for(size_t r = 0; r < _numa_num_ranges; ++r) {
+        hive_lpush(kernel_hive(), "acpi:numa_ranges", HIVE_VALUE_PTR(_numa_ranges[r]._base), HIVE_VALUE_INT(_numa_ranges[r]._size), 
+            HIVE_VALUE_INT(_numa_ranges[r]._node), HIVE_VALUELIST_END);
+    }
     
     return _JO_STATUS_SUCCESS;    
 }
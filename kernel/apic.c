@@ -4,13 +4,13 @@
 
 static uint32_t read_local_apic_register(processor_information_t* info, local_apic_register_t reg) {
     uint64_t register_address = info->_local_apic_info._base_address | (uint64_t)reg;
-    const uint32_t* reg_ptr = (const uint32_t*)register_address;
+    const volatile uint32_t* reg_ptr = (const volatile uint32_t*)register_address;
     return *reg_ptr;
 }
 
 static void write_local_apic_register(processor_information_t* info, local_apic_register_t reg, uint32_t val) {
     uint64_t register_address = info->_local_apic_info._base_address | (uint64_t)reg;
-    uint32_t* reg_ptr = (uint32_t*)register_address;
+    volatile uint32_t* reg_ptr = (volatile uint32_t*)register_address;
     reg_ptr[0] = val;
 }
 
@@ -37,6 +37,24 @@ static _JOS_MAYBE_UNUSED void reset_local_apic(processor_information_t* info) {
     // int max_num_lvts = (info->_local_apic_info._version >> 15) & 0xff;
 }
 
+// IA dev guide vol 3a, figure 10-12
+#define _ICR_DELIVERY_STATUS_PENDING    (1<<12)
+#define _ICR_LEVEL_ASSERT               (1<<14)
+
+void apic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    processor_information_t* info = per_cpu_this_cpu_info();
+    write_local_apic_register(info, kLApic_Reg_IcrHi, apic_id << 24);
+    // writing the low dword sends the IPI (fixed delivery mode, physical destination)
+    write_local_apic_register(info, kLApic_Reg_IcrLo, (uint32_t)vector | _ICR_LEVEL_ASSERT);
+    while ( read_local_apic_register(info, kLApic_Reg_IcrLo) & _ICR_DELIVERY_STATUS_PENDING ) {
+        x86_64_pause_cpu();
+    }
+}
+
+void apic_eoi(void) {
+    write_local_apic_register(per_cpu_this_cpu_info(), kLApic_Reg_Eoi, 0);
+}
+
 void apic_collect_this_cpu_information(processor_information_t* info) {
 
      // yes, but is it enabled?
@@ -7,6 +7,7 @@
 #include <stddef.h>
 
 #include <kernel.h>
+#include <memory.h>
 #include <clock.h>
 #include <video.h>
 #include <tasks.h>
@@ -53,6 +54,11 @@ void uefi_init(CEfiHandle h) {
     // we use our PE image to look up code and provide helpful information to the debugger 
     peutil_bind(&_pe_ctx, (const void*)_lip->image_base, kPe_Relocated); 
 
+    // pool budgets can be given as load options, they have to be known before the pools are created
+    if ( _lip->load_options && _lip->load_options_size ) {
+        memory_configure_pool_budgets((const wchar_t*)_lip->load_options, _lip->load_options_size / sizeof(wchar_t));
+    }
+
     // initialise memory manager, serial comms, video, and any modules that require access 
     // to uefi boot services
     // here we also request a bit of memory for use by this efi application
@@ -4,6 +4,7 @@
 #include <x86_64.h>
 #include <interrupts.h>
 #include <i8253.h>
+#include <smp.h>
 
 #include <stdio.h>
 #include <output_console.h>
@@ -23,8 +24,16 @@ typedef struct {
 
 } clock_pit_interval_t;
 
-static uint64_t _clock_ms_elapsed = 0;
-static uint64_t _clock_ticks_elapsed = 0;
+// counters written by the clock IRQs on the BSP, kept on their own cache line so that 
+// every tick doesn't invalidate the read-mostly state below in other CPUs' caches
+typedef struct _clock_irq_counters {
+    uint64_t    _ms_elapsed;
+    uint64_t    _ticks_elapsed;
+    uint64_t    _1khz_counter;
+    uint8_t     _pad[JOSX_CACHE_LINE_SIZE - 3*sizeof(uint64_t)];
+} clock_irq_counters_t;
+
+static _JOS_ALIGNED_TYPE(clock_irq_counters_t, _irq_counters, JOSX_CACHE_LINE_SIZE);
 static clock_pit_interval_t _pit_interval;
 // will be ~1us, for less-than-accurate timekeeping
 static uint64_t _micro_epsilon = 0;
@@ -71,10 +80,9 @@ static uint64_t _est_cpu_freq(void)
     return _est_freq = (max_cpu_hz + min_cpu_hz)/2;
 }
 
-static uint64_t _1khz_counter = 0;
 static void _irq_8_handler(int irq_id) {
     (void)irq_id;
-    ++_1khz_counter; 
+    ++_irq_counters._1khz_counter; 
     // read register C to ack the interrupt   
     x86_64_outb(0x70, 0x0c);
     x86_64_inb(0x71);
@@ -98,14 +106,14 @@ static  clock_pit_interval_t _make_pit_interval(uint32_t hz)
 }
 
 uint64_t clock_ms_since_boot(void) {
-    return _clock_ms_elapsed>>32;
+    return _irq_counters._ms_elapsed>>32;
 }
 
 static void _irq_0_handler(int i)
 {
     (void)i;
-    ++_clock_ticks_elapsed;    
-    _clock_ms_elapsed += _pit_interval._ms_per_tick_fp32;
+    ++_irq_counters._ticks_elapsed;    
+    _irq_counters._ms_elapsed += _pit_interval._ms_per_tick_fp32;
 }
 
 void clock_initialise(void) {
@@ -158,7 +166,7 @@ void clock_initialise(void) {
     uint64_t delta = __rdtsc() - tsc_start;
     _micro_epsilon = delta/10000;
 
-    swprintf(buf,128,L"clock: bsp freq estimated ~ %llu MHz, 1ue = %llu, %llu 1KHz ticks measured\n", bsp_freq/1000000, _micro_epsilon, _1khz_counter);
+    swprintf(buf,128,L"clock: bsp freq estimated ~ %llu MHz, 1ue = %llu, %llu 1KHz ticks measured\n", bsp_freq/1000000, _micro_epsilon, _irq_counters._1khz_counter);
     output_console_output_string_w(buf);
 
     _JOS_KTRACE_CHANNEL(kClockChannel, "initialised");
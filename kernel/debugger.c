@@ -7,6 +7,7 @@
 #include <debugger.h>
 #include <serial.h>
 #include <collections.h>
+#include <range_map.h>
 #include <arena_allocator.h>
 #include <extensions/json.h>
 #include <extensions/base64.h>
@@ -14,8 +15,10 @@
 #include <pagetables.h>
 #include <cpuid.h>
 #include <memory.h>
+#include <clock.h>
 #include <tasks.h>
 #include <pe.h>
+#include <scratch.h>
 #include <internal/_tasks.h>
 
 #include <Zydis/Zydis.h>
@@ -30,6 +33,7 @@ static bool _debugger_connected = false;
 #define FLAGS_TRAP_FLAG 0x100
 
 static peutil_pe_context_t* _pe_ctx = 0;
+static uint64_t _image_base = 0;
 static ZydisDecoder _zydis_decoder;
 static const char* kDebuggerChannel = "debugger";
 
@@ -46,6 +50,8 @@ typedef struct _debugger_breakpoint {
 
 #define _BREAKPOINT_INSTR 0xcc
 static vector_t _breakpoints;
+// breakpoint address -> index in _breakpoints
+static range_map_t _breakpoint_map;
 static generic_allocator_t*  _allocator = 0;
 // tracks the last runtime bp we've hit so that we can restore it after a trap
 static debugger_breakpoint_t _last_rt_bp;
@@ -66,36 +72,41 @@ if (!bp->_active) {\
             bp->_active = true;\
 }
 
+static debugger_breakpoint_t* _debugger_breakpoint_at(uintptr_t at)  {
+    range_map_entry_t* entry = range_map_find(&_breakpoint_map, at);
+    // TODO: strictly this should be the index since the vector can re-scale
+    // but we're invoking this function in a controlled serial way so we're good for now...
+    return entry ? (debugger_breakpoint_t*)vector_at(&_breakpoints, entry->_value) : 0;
+}
+
+static debugger_breakpoint_t* _add_breakpoint(debugger_breakpoint_t* bp) {
+    vector_push_back(&_breakpoints, bp);
+    range_map_insert(&_breakpoint_map, bp->_at, bp->_at + 1, vector_size(&_breakpoints) - 1);
+    return vector_at(&_breakpoints, vector_size(&_breakpoints) - 1);
+}
+
 // create a new or update existing breakpoint to ACTIVE
 static debugger_breakpoint_t* _set_breakpoint(uintptr_t at) {
     // first check if the breakpoint is already set
-    bool existing = false;
-    const size_t num_bps = vector_size(&_breakpoints);
-    debugger_breakpoint_t* bp = vector_data(&_breakpoints);
-    for ( size_t bpi = 0; bpi < num_bps; ++bpi ) {
-        if ( bp->_at == at ) {
-            // re-activate
-            //_JOS_KTRACE_CHANNEL(kDebuggerChannel, "breakpoint re-activated at 0x%llx", at);
-
-            uint8_t instr_byte = ((uint8_t*)at)[0];
-            if ( instr_byte!=_BREAKPOINT_INSTR ) {
-                bp->_instr_byte = instr_byte;
-                ((uint8_t*)at)[0] = _BREAKPOINT_INSTR;
-            }            
-            bp->_active = true;
-            bp->_transient = false;
-            existing = true;
-            break;
-        }
-        ++bp;
+    debugger_breakpoint_t* bp = _debugger_breakpoint_at(at);
+    if ( bp ) {
+        // re-activate
+        //_JOS_KTRACE_CHANNEL(kDebuggerChannel, "breakpoint re-activated at 0x%llx", at);
+
+        uint8_t instr_byte = ((uint8_t*)at)[0];
+        if ( instr_byte!=_BREAKPOINT_INSTR ) {
+            bp->_instr_byte = instr_byte;
+            ((uint8_t*)at)[0] = _BREAKPOINT_INSTR;
+        }            
+        bp->_active = true;
+        bp->_transient = false;
     }
-    if ( !existing ) {
+    else {
         //_JOS_KTRACE_CHANNEL(kDebuggerChannel, "breakpoint set at 0x%llx", at);
 
         debugger_breakpoint_t new_bp = { ._at = at, ._instr_byte = ((uint8_t*)at)[0], ._active = true };
         ((uint8_t*)at)[0] = _BREAKPOINT_INSTR;
-        vector_push_back(&_breakpoints, &new_bp);
-        bp = vector_at(&_breakpoints, vector_size(&_breakpoints)-1);
+        bp = _add_breakpoint(&new_bp);
     }
     return bp;
 }
@@ -104,26 +115,16 @@ _JOS_API_FUNC void debugger_set_breakpoint(uintptr_t at) {
     _set_breakpoint(at);
 }
 
-static size_t _remove_breakpoint(debugger_breakpoint_t* bp_to_remove) {
-    // swap in last element to remove this one	
-    debugger_breakpoint_t* bps = vector_data(&_breakpoints);
-    const size_t end = vector_size(&_breakpoints);
-    memcpy(bp_to_remove, bps + end - 1, sizeof(debugger_breakpoint_t));
-    return end - 1;
-}
-
-static debugger_breakpoint_t* _debugger_breakpoint_at(uintptr_t at)  {
-    const size_t num_bps = vector_size(&_breakpoints);
-    debugger_breakpoint_t* bp = vector_data(&_breakpoints);
-    for ( size_t bpi = 0; bpi < num_bps; ++bpi ) {
-        if ( bp->_at == at ) {
-            // TODO: strictly this should be the index since the vector can re-scale
-            // but we're invoking this function in a controlled serial way so we're good for now...
-            return bp;
-        }
-        ++bp;
+static void _remove_breakpoint(debugger_breakpoint_t* bp_to_remove) {
+    // the last element is swapped in to remove this one, so its index changes
+    const size_t at = (size_t)(bp_to_remove - (debugger_breakpoint_t*)vector_data(&_breakpoints));
+    const size_t last = vector_size(&_breakpoints) - 1;
+    range_map_remove(&_breakpoint_map, bp_to_remove->_at, bp_to_remove->_at + 1);
+    if ( at != last ) {
+        debugger_breakpoint_t* moved = (debugger_breakpoint_t*)vector_at(&_breakpoints, last);
+        range_map_find(&_breakpoint_map, moved->_at)->_value = at;
     }
-    return 0;
+    vector_remove(&_breakpoints, at);
 }
 
 static void _decode_instruction(const void* at, void* buffer) {
@@ -181,6 +182,30 @@ static void _trace_hive_values(const char* key, vector_t* values, void* user_dat
     }
 }
 
+// a stream which only counts what's written to it, to size a buffer before writing into it
+static void _counting_stream_flush(IO_FILE* stream) {
+    stream->_buffer._wp = stream->_buffer._begin;
+}
+
+typedef struct _heap_profile_writer {
+    debugger_heap_call_site_t*  _call_sites;
+    uint32_t                    _count;
+    uint32_t                    _capacity;
+} _heap_profile_writer_t;
+
+static void _write_heap_call_site(const tracking_call_site_t* site, void* user_data) {
+    _heap_profile_writer_t* writer = (_heap_profile_writer_t*)user_data;
+    if (writer->_count == writer->_capacity) {
+        return;
+    }
+    debugger_heap_call_site_t* out = writer->_call_sites + writer->_count++;
+    out->_rva = (uint32_t)(site->_call_site - (_image_base + _pe_ctx->_text_va));
+    out->_live_bytes = site->_live_bytes;
+    out->_peak_bytes = site->_peak_bytes;
+    out->_live_count = site->_live_count;
+    out->_total_allocs = site->_total_allocs;
+}
+
 // wait for debugger commands.
 // if isr_stack == 0 this will not allow continuing or single stepping (used by asserts)
 static void _debugger_loop(interrupt_stack_t * isr_stack) {	
@@ -217,10 +242,12 @@ static void _debugger_loop(interrupt_stack_t * isr_stack) {
                         _DISABLE_BP_IF_ACTIVE(bp);
                     }					
                     vector_clear(&_breakpoints);
+                    range_map_clear(&_breakpoint_map);
                 }
                 else {
                     // update specific breakpoints
-                    void* packet_buffer = _allocator->alloc(_allocator, packet._length);
+                    scratch_t scratch = scratch_begin();
+                    void* packet_buffer = scratch_alloc(&scratch, packet._length);
                     _JOS_ASSERT(packet_buffer);
                     debugger_read_packet_body(&packet, packet_buffer, packet._length);
                     debugger_packet_breakpoint_info_t* bpinfo = (debugger_packet_breakpoint_info_t*)packet_buffer;
@@ -257,13 +284,13 @@ static void _debugger_loop(interrupt_stack_t * isr_stack) {
                             if (new_bp._active) {
                                 ((uint8_t*)bpinfo->_at)[0] = _BREAKPOINT_INSTR;
                             }							
-                            vector_push_back(&_breakpoints, &new_bp);
+                            _add_breakpoint(&new_bp);
                             
                             //_JOS_KTRACE_CHANNEL(kDebuggerChannel, "adding new breakpoint @ 0x%llx", bpinfo->_at);
                         }
                     }
                     
-                    _allocator->free(_allocator, packet_buffer);					
+                    scratch_end(&scratch);
                 }
             }
             break;
@@ -362,12 +389,88 @@ static void _debugger_loop(interrupt_stack_t * isr_stack) {
             //     hive_get(kernel_hive(), key_name_ptr, values);
             // }
             // break;
+            case kDebuggerPacket_HeapProfile:
+            {
+                tracking_allocator_t* tracker = kernel_heap_tracker();
+                debugger_packet_heap_profile_resp_t resp_packet;
+                memset(&resp_packet, 0, sizeof(resp_packet));
+                if (tracker) {
+                    resp_packet._live_bytes = tracker->_live_bytes;
+                    resp_packet._peak_bytes = tracker->_peak_bytes;
+                    resp_packet._alloc_count = tracker->_alloc_count;
+                    resp_packet._free_count = tracker->_free_count;
+                    resp_packet._untracked_count = tracker->_untracked_count;
+                    resp_packet._ms_since_boot = clock_ms_since_boot();
+                    resp_packet._num_call_sites = (uint32_t)tracker->_call_sites_count;
+                }
+                // header and call sites go out as a single packet
+                const size_t packet_size = sizeof(resp_packet) + resp_packet._num_call_sites * sizeof(debugger_heap_call_site_t);
+                scratch_t scratch = scratch_begin();
+                char* packet_buffer = (char*)scratch_alloc(&scratch, packet_size);
+                _JOS_ASSERT(packet_buffer);
+                if (resp_packet._num_call_sites) {
+                    _heap_profile_writer_t writer = {
+                        ._call_sites = (debugger_heap_call_site_t*)(packet_buffer + sizeof(resp_packet)),
+                        ._count = 0,
+                        ._capacity = resp_packet._num_call_sites
+                    };
+                    tracking_allocator_visit_call_sites(tracker, _write_heap_call_site, &writer);
+                    resp_packet._num_call_sites = writer._count;
+                }
+                memcpy(packet_buffer, &resp_packet, sizeof(resp_packet));
+                debugger_send_packet(kDebuggerPacket_HeapProfile_Resp, packet_buffer, 
+                    (uint32_t)(sizeof(resp_packet) + resp_packet._num_call_sites * sizeof(debugger_heap_call_site_t)));
+                scratch_end(&scratch);
+            }
+            break;
             case kDebuggerPacket_HiveDump:
             {
+                // the body, if any, is a key prefix (not 0 terminated); only that namespace is dumped
+                scratch_t scratch = scratch_begin();
+                char* prefix = (char*)scratch_alloc(&scratch, packet._length + 1);
+                _JOS_ASSERT(prefix);
+                debugger_read_packet_body(&packet, prefix, packet._length);
+                prefix[packet._length] = 0;
+
+                kernel_update_heap_stats();
+                hive_value_t values[16];
                 vector_t value_storage;
-                vector_create(&value_storage, 16, sizeof(hive_value_t), _allocator);
-                hive_visit_values(kernel_hive(), _trace_hive_values, &value_storage, 0);
+                vector_create_with_storage(&value_storage, values, sizeof(values) / sizeof(values[0]), sizeof(hive_value_t), _allocator);
+                hive_visit_prefix(kernel_hive(), prefix, _trace_hive_values, &value_storage, 0);
                 vector_destroy(&value_storage);
+                scratch_end(&scratch);
+            }
+            break;
+            case kDebuggerPacket_HiveSnapshot:
+            {
+                uint64_t since = 0;
+                debugger_read_packet_body(&packet, (void*)&since, sizeof(since));
+                kernel_update_heap_stats();
+                hive_t* hive = kernel_hive();
+
+                uint8_t counting_buffer[64];
+                IO_FILE stream;
+                memset(&stream, 0, sizeof(stream));
+                _io_file_from_buffer(&stream, counting_buffer, sizeof(counting_buffer));
+                stream.flush = _counting_stream_flush;
+                hive_write_snapshot(hive, since, &stream);
+                const size_t snapshot_size = ftell(&stream);
+
+                // an empty response if we can't allocate it, or if an interned key changed in between and it no longer fits;
+                // the debugger just asks again
+                uint32_t response_size = 0;
+                char* snapshot = (char*)_allocator->alloc(_allocator, snapshot_size);
+                if (snapshot) {
+                    memset(&stream, 0, sizeof(stream));
+                    _io_file_from_buffer(&stream, snapshot, snapshot_size);
+                    if (_JO_SUCCEEDED(hive_write_snapshot(hive, since, &stream))) {
+                        response_size = (uint32_t)ftell(&stream);
+                    }
+                }
+                debugger_send_packet(kDebuggerPacket_HiveSnapshot_Resp, snapshot, response_size);
+                if (snapshot) {
+                    _allocator->free(_allocator, snapshot);
+                }
             }
             break;
             case kDebuggerPacket_TraceStep:
@@ -554,10 +657,13 @@ static void _debugger_isr_handler(interrupt_stack_t * stack) {
 
 _JOS_API_FUNC void debugger_trigger_assert(const char* cond, const char* file, int line) {
     
-    char json_buffer[512];
+    scratch_t scratch = scratch_begin();
+    const size_t json_buffer_size = 512;
+    char* json_buffer = (char*)scratch_alloc(&scratch, json_buffer_size);
+    _JOS_ASSERT(json_buffer);
     IO_FILE stream;
     memset(&stream,0,sizeof(FILE));
-    _io_file_from_buffer(&stream, json_buffer, sizeof(json_buffer));
+    _io_file_from_buffer(&stream, json_buffer, json_buffer_size);
 
     json_writer_context_t ctx;
     json_initialise_writer(&ctx, &stream);
@@ -576,6 +682,7 @@ _JOS_API_FUNC void debugger_trigger_assert(const char* cond, const char* file, i
 
     uint32_t json_size = (uint32_t)ftell(&stream);
     debugger_send_packet(kDebuggerPacket_Assert, (void*)json_buffer, json_size);
+    scratch_end(&scratch);
     _debugger_loop(0);
 }
 
@@ -655,6 +762,7 @@ _JOS_API_FUNC void debugger_initialise(generic_allocator_t* allocator) {
     ZydisDecoderInit(&_zydis_decoder, ZYDIS_MACHINE_MODE_LONG_64, ZYDIS_ADDRESS_WIDTH_64);
 
     vector_create(&_breakpoints, 16, sizeof(debugger_breakpoint_t), _allocator);
+    range_map_create(&_breakpoint_map, 16, _allocator);
 
     output_console_output_string_w(L"debug handler initialised\n");    
 }
@@ -662,6 +770,7 @@ _JOS_API_FUNC void debugger_initialise(generic_allocator_t* allocator) {
 _JOS_API_FUNC void debugger_wait_for_connection(peutil_pe_context_t* pe_ctx, uint64_t image_base) {
     
     _pe_ctx = pe_ctx;
+    _image_base = image_base;
 
     static const char dbg_conn_id[4] = {'j','o','s','x'};
     int conn_id_pos = 0;
@@ -691,10 +800,13 @@ _JOS_API_FUNC void debugger_wait_for_connection(peutil_pe_context_t* pe_ctx, uin
     // page fault
     interrupts_set_isr_handler(&(isr_handler_def_t){ ._isr_number=14, ._handler=_debugger_isr_handler });
 
-    char json_buffer[1024];
+    scratch_t scratch = scratch_begin();
+    const size_t json_buffer_size = 1024;
+    char* json_buffer = (char*)scratch_alloc(&scratch, json_buffer_size);
+    _JOS_ASSERT(json_buffer);
     IO_FILE stream;
     memset(&stream,0,sizeof(FILE));
-    _io_file_from_buffer(&stream, json_buffer, sizeof(json_buffer));
+    _io_file_from_buffer(&stream, json_buffer, json_buffer_size);
 
     json_writer_context_t ctx;
     json_initialise_writer(&ctx, &stream);
@@ -749,6 +861,7 @@ _JOS_API_FUNC void debugger_wait_for_connection(peutil_pe_context_t* pe_ctx, uin
 
     uint32_t json_size = (uint32_t)ftell(&stream);
     debugger_send_packet(kDebuggerPacket_KernelConnectionInfo, json_buffer, json_size);
+    scratch_end(&scratch);
 
     
     _JOS_KTRACE_CHANNEL(kDebuggerChannel, "connected");
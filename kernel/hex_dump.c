@@ -7,6 +7,7 @@
 #ifdef _JOS_KERNEL_BUILD
 #include <jos.h>
 #include <output_console.h>
+#include <scratch.h>
 #endif
 
 #include "hex_dump.h"
@@ -16,24 +17,25 @@
 #define _undef_min
 #endif
 
-#define CHARS_IN_BUFFER(buff) sizeof(buff)/sizeof(wchar_t)
+#define LINE_CHARS 128u
 //NOTE: explicitly for 64 bit
 #define PRINT_WIDTH 66u
 
 typedef struct _line_ctx
 {
-	wchar_t		_line[128];
+	wchar_t*	_line;
 	wchar_t*	_wp;
 	size_t		_chars_left;
 	void*		_mem;
 	
 } line_ctx_t;
 
-static void _hex_dump_line_init(line_ctx_t* ctx, void* mem)
+static void _hex_dump_line_init(line_ctx_t* ctx, wchar_t* line, void* mem)
 {
+	ctx->_line = line;
 	ctx->_wp = ctx->_line;
 	ctx->_mem = mem;
-	ctx->_chars_left = CHARS_IN_BUFFER(ctx->_line);
+	ctx->_chars_left = LINE_CHARS;
 	// address prefix
 	size_t n = swprintf(ctx->_wp, ctx->_chars_left,L"%016llx ", (uintptr_t)mem);
 	ctx->_wp += n;
@@ -77,7 +79,7 @@ static void _hex_dump_line_write_raw(line_ctx_t* ctx, size_t byte_run)
 	}
 	
 	wchar_t* wp = ctx->_line + PRINT_WIDTH;
-	ctx->_chars_left = CHARS_IN_BUFFER(ctx->_line) - PRINT_WIDTH;
+	ctx->_chars_left = LINE_CHARS - PRINT_WIDTH;
 	const char* rp = (char*)ctx->_mem;
 	for (unsigned i = 0u; i < byte_run; ++i)
 	{
@@ -96,14 +98,14 @@ static void _hex_dump_line_write_raw(line_ctx_t* ctx, size_t byte_run)
 	}
 }
 
-static size_t _hex_dump_hex_line(void* mem, size_t bytes, enum hex_dump_unit_size unit_size)
+static size_t _hex_dump_hex_line(wchar_t* line, void* mem, size_t bytes, enum hex_dump_unit_size unit_size)
 {
 	line_ctx_t ctx;
 	size_t read = 0;	
 	
 	if (bytes)
 	{				
-		_hex_dump_line_init(&ctx, mem);		
+		_hex_dump_line_init(&ctx, line, mem);		
 		const unsigned byte_run = (const unsigned)(bytes< 16u ? bytes:16u);
 
 		switch (unit_size)
@@ -198,12 +200,27 @@ static size_t _hex_dump_hex_line(void* mem, size_t bytes, enum hex_dump_unit_siz
 
 void hex_dump_mem(void* mem, size_t bytes, enum hex_dump_unit_size unit_size)
 {	
+#ifdef _JOS_KERNEL_BUILD
+	// one line buffer for the whole dump, released when we're done
+	scratch_t scratch = scratch_begin();
+	wchar_t* line = (wchar_t*)scratch_alloc(&scratch, LINE_CHARS*sizeof(wchar_t));
+	if (!line)
+	{
+		scratch_end(&scratch);
+		return;
+	}
+#else
+	wchar_t line[LINE_CHARS];
+#endif
 	while (bytes)
 	{
-		size_t written = _hex_dump_hex_line(mem, bytes, unit_size);		
+		size_t written = _hex_dump_hex_line(line, mem, bytes, unit_size);		
 		mem = (void*)((char*)mem + written);
 		bytes -= written;
 	}
+#ifdef _JOS_KERNEL_BUILD
+	scratch_end(&scratch);
+#endif
 }
 
 #ifdef _undef_min
@@ -46,6 +46,103 @@ typedef struct _xsdt_header {
 
 } _JOS_PACKED_ _xsdt_header_t;
 
+// System Resource Affinity Table (SRAT), see ACPI 6.4 section 5.2.16
+typedef struct _acpi_srat_header {
+
+    acpi_sdt_header_t   _std;
+    uint32_t            _reserved0;
+    uint64_t            _reserved1;
+
+} _JOS_PACKED_ acpi_srat_header_t;
+
+typedef enum _acpi_srat_entry_type {
+
+    kAcpiSrat_LocalApicAffinity = 0,
+    kAcpiSrat_MemoryAffinity = 1,
+    kAcpiSrat_LocalX2ApicAffinity = 2,
+
+} acpi_srat_entry_type_t;
+
+typedef struct _acpi_srat_entry_header {
+
+    uint8_t     _type;
+    uint8_t     _length;
+
+} _JOS_PACKED_ acpi_srat_entry_header_t;
+
+typedef struct _acpi_srat_local_apic_affinity {
+
+    acpi_srat_entry_header_t    _header;
+    uint8_t                     _proximity_domain_lo;
+    uint8_t                     _apic_id;
+    uint32_t                    _flags;
+    uint8_t                     _local_sapic_eid;
+    uint8_t                     _proximity_domain_hi[3];
+    uint32_t                    _clock_domain;
+
+} _JOS_PACKED_ acpi_srat_local_apic_affinity_t;
+
+typedef struct _acpi_srat_memory_affinity {
+
+    acpi_srat_entry_header_t    _header;
+    uint32_t                    _proximity_domain;
+    uint16_t                    _reserved0;
+    uint64_t                    _base_address;
+    uint64_t                    _length;
+    uint32_t                    _reserved1;
+    uint32_t                    _flags;
+    uint64_t                    _reserved2;
+
+} _JOS_PACKED_ acpi_srat_memory_affinity_t;
+
+typedef struct _acpi_srat_local_x2apic_affinity {
+
+    acpi_srat_entry_header_t    _header;
+    uint16_t                    _reserved0;
+    uint32_t                    _proximity_domain;
+    uint32_t                    _x2apic_id;
+    uint32_t                    _flags;
+    uint32_t                    _clock_domain;
+    uint32_t                    _reserved1;
+
+} _JOS_PACKED_ acpi_srat_local_x2apic_affinity_t;
+
+// bit 0 of the flags of all SRAT entries
+#define ACPI_SRAT_ENTRY_ENABLED     1
+
+// System Locality Information Table (SLIT), see ACPI 6.4 section 5.2.17
+// followed by a _num_localities x _num_localities matrix of relative distances
+typedef struct _acpi_slit_header {
+
+    acpi_sdt_header_t   _std;
+    uint64_t            _num_localities;
+
+} _JOS_PACKED_ acpi_slit_header_t;
+
 _JOS_API_FUNC jo_status_t    acpi_intitialise(CEfiSystemTable* st);
 
+// ==============================================================================================
+// NUMA topology
+
+#define ACPI_MAX_NUMA_NODES             8
+#define ACPI_MAX_NUMA_MEMORY_RANGES     32
+#define ACPI_MAX_NUMA_PROCESSORS        256
+// SLIT distances are relative to 10 for local access, this is used for remote access if there is no SLIT
+#define ACPI_NUMA_LOCAL_DISTANCE        10
+#define ACPI_NUMA_REMOTE_DISTANCE       20
+
+// discover the NUMA topology from the SRAT and SLIT, if there are any. otherwise the system is one node, 0.
+// proximity domains are mapped to node ids 0..acpi_numa_node_count()-1 in the order they are found.
+//NOTE: called before any memory pools have been created, it doesn't allocate
+_JOS_API_FUNC jo_status_t    acpi_numa_initialise(CEfiSystemTable* st);
+_JOS_API_FUNC size_t         acpi_numa_node_count(void);
+// node of a processor by its (x2)APIC id, 0 if it isn't listed
+_JOS_API_FUNC size_t         acpi_numa_node_for_apic_id(uint32_t apic_id);
+// node of a physical address, 0 if it isn't in any of the memory ranges
+_JOS_API_FUNC size_t         acpi_numa_node_for_address(uintptr_t address);
+// relative distance between two nodes, ACPI_NUMA_LOCAL_DISTANCE if from==to
+_JOS_API_FUNC uint8_t        acpi_numa_distance(size_t from, size_t to);
+// enumerate the memory ranges, returns _JO_STATUS_OUT_OF_RANGE when index is past the last one
+_JOS_API_FUNC jo_status_t    acpi_numa_memory_range(size_t index, uintptr_t* out_base, size_t* out_size, size_t* out_node);
+
 #endif // _JOS_ACPI_H
\ No newline at end of file
@@ -14,6 +14,8 @@ typedef enum _local_apic_register {
     kLApic_Reg_Spiv             = 0xf0,
     kLApic_Reg_ErrorStatus      = 0x280,
     kLApic_Reg_LvtCmci          = 0x2f0,
+    kLApic_Reg_IcrLo            = 0x300,
+    kLApic_Reg_IcrHi            = 0x310,
     kLApic_Reg_LvtTimer         = 0x320,
     kLApic_Reg_LvtLint0         = 0x350,
     kLApic_Reg_LvtLint1         = 0x360,
@@ -29,4 +31,9 @@ typedef enum _local_apic_register {
 // invoked internally in processors.c to collect information for each cpu in the system  
 void apic_collect_this_cpu_information(processor_information_t* info);
 
+// send a fixed IPI with the given vector to the processor with the given (xAPIC) local APIC id
+void apic_send_ipi(uint32_t apic_id, uint8_t vector);
+// signal end of interrupt to this CPU's local APIC, required at the end of IPI handlers
+void apic_eoi(void);
+
 #endif // _JOS_KERNEL_APIC_H
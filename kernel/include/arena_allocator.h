@@ -67,20 +67,26 @@ typedef struct arena_allocator_struct
     size_t                  _size;
     size_t                  _capacity;
     vmem_block_head_t*     _free_head;
+    size_t                  _alloc_count;
+    size_t                  _free_count;
 } arena_allocator_t;
 
 _JOS_API_FUNC arena_allocator_t* arena_allocator_create(void* mem, size_t size);
 _JOS_API_FUNC void* arena_allocator_alloc(arena_allocator_t* arena, size_t size);
 _JOS_API_FUNC void arena_allocator_free(arena_allocator_t* arena, void* block);
 _JOS_API_FUNC void* arena_allocator_realloc(arena_allocator_t* arena, void* block, size_t size);
+// blocks allocated with this can be freed with arena_allocator_free
+_JOS_API_FUNC void* arena_allocator_alloc_aligned(arena_allocator_t* arena, size_t size, alloc_alignment_t alignment);
+// walks the free list
+_JOS_API_FUNC void arena_allocator_stats(arena_allocator_t* arena, allocator_stats_t* stats);
 
 #if defined(_JOS_IMPLEMENT_ALLOCATORS) && !defined(_JOS_arena_allocator_ALLOCATOR_IMPLEMENTED)
 #define _JOS_arena_allocator_ALLOCATOR_IMPLEMENTED
 
-//NOTE: +7 because we align all allocations to nearest 8 bytes
-#define _JOS_arena_allocator_ALLOC_OVERHEAD (sizeof(vmem_block_head_t) + sizeof(vmem_block_tail_t) + 7)
+//NOTE: all block sizes are multiples of 8 bytes, so the tail always ends exactly where the next header begins
+#define _JOS_arena_allocator_ALLOC_OVERHEAD (sizeof(vmem_block_head_t) + sizeof(vmem_block_tail_t))
 #define _JOS_VMEM_ABS_BLOCK_SIZE(size) ((size) & ~kVmemBlockFree)
-#define _JOS_VMEM_BLOCK_MIN_SIZE _JOS_arena_allocator_ALLOC_OVERHEAD + 16
+#define _JOS_VMEM_BLOCK_MIN_SIZE (_JOS_arena_allocator_ALLOC_OVERHEAD + 16)
 #define _JOS_arena_allocator_MIN_SIZE (sizeof(arena_allocator_t) + _JOS_arena_allocator_ALLOC_OVERHEAD)
 
 _JOS_INLINE_FUNC size_t arena_allocator_available(arena_allocator_t* arena) {
@@ -185,6 +191,45 @@ _JOS_INLINE_FUNC void _arena_allocator_disconnect(arena_allocator_t* arena, vmem
 	block->_links[0] = block->_links[1] = 0;
 }
 
+// split size bytes off the front of the free block and return a pointer to the area beyond its header
+_JOS_INLINE_FUNC void* _arena_allocator_carve(arena_allocator_t* arena, vmem_block_head_t* free, size_t size)
+{
+	//DEBUG:printf("free was 0x%x; prev = 0x%x, next = 0x%x\n", free, free->_links[0], free->_links[1]);
+
+	// unlink this free block (we'll insert a new one below if we split)		
+	_arena_allocator_disconnect(arena, free);
+	
+	size_t org_size = _JOS_VMEM_ABS_BLOCK_SIZE(free->_size);		
+	free->_size = (size+_JOS_arena_allocator_ALLOC_OVERHEAD);
+	if(org_size - free->_size < _JOS_VMEM_BLOCK_MIN_SIZE)
+	{
+		// just absorb the whole free chunk to avoid small fragments
+		free->_size = org_size;
+	}
+	vmem_block_tail_t* new_tail = _vmem_tail_from_head(free);
+	new_tail->_size = _vmem_tail_size(free);
+
+	// space for at least one more free block?
+	org_size -= free->_size;
+	if(org_size >= _JOS_VMEM_BLOCK_MIN_SIZE)
+	{
+		vmem_block_head_t* new_head = (vmem_block_head_t*)_JOS_ALIGN(new_tail+1, kAllocAlign_8);
+		// adjust by bytes required by alignment 
+		new_head->_size = org_size - ((size_t)new_head - (size_t)(new_tail + 1));
+		new_tail = _vmem_tail_from_head(new_head);
+		new_tail->_size = _vmem_tail_free_size(new_head);
+		new_head->_size |= kVmemBlockFree;
+		_arena_allocator_block_insert_as_free(arena, new_head);
+
+		//DEBUG:printf("new free is 0x%x\n", arena->_free_head);
+	}
+	
+	arena->_size -= free->_size;
+	++arena->_alloc_count;
+	// return pointer to area beyond header
+	return (void*)(free+1);
+}
+
 // ============================== public API
 
 _JOS_API_FUNC arena_allocator_t*   arena_allocator_create(void* mem, size_t size)
@@ -196,7 +241,7 @@ _JOS_API_FUNC arena_allocator_t*   arena_allocator_create(void* mem, size_t size
 
 	arena_allocator_t*   arena = (arena_allocator_t*)mem;
 	arena->_free_head = (vmem_block_head_t*)(arena+1);
-	arena->_size = arena->_capacity = size - sizeof(arena_allocator_t);
+	arena->_size = arena->_capacity = (size - sizeof(arena_allocator_t)) & ~(size_t)7;
     arena->_free_head->_size = arena->_size | kVmemBlockFree;
     arena->_free_head->_links[0] = 0;
     arena->_free_head->_links[1] = 0;
@@ -207,6 +252,10 @@ _JOS_API_FUNC arena_allocator_t*   arena_allocator_create(void* mem, size_t size
 	arena->_super.free = (generic_allocator_free_func_t)arena_allocator_free;
 	arena->_super.realloc = (generic_allocator_realloc_func_t)arena_allocator_realloc;
     arena->_super.available = (generic_allocator_avail_func_t)arena_allocator_available;
+	arena->_super.alloc_aligned = (generic_allocator_alloc_aligned_func_t)arena_allocator_alloc_aligned;
+	arena->_super.free_aligned = (generic_allocator_free_aligned_func_t)arena_allocator_free;
+	arena->_super.stats = (generic_allocator_stats_func_t)arena_allocator_stats;
+	arena->_alloc_count = arena->_free_count = 0;
 
     return arena;
 }
@@ -234,44 +283,73 @@ _JOS_API_FUNC void* arena_allocator_alloc(arena_allocator_t* arena, size_t size)
         free = free->_links[1];
     }
 
-    if(free)
-    {
-		//DEBUG:printf("free was 0x%x; prev = 0x%x, next = 0x%x\n", free, free->_links[0], free->_links[1]);
+    return free ? _arena_allocator_carve(arena, free, size) : 0;
+}
 
-        // unlink this free block (we'll insert a new one below if we split)		
-		_arena_allocator_disconnect(arena, free);
-		
-        size_t org_size = _JOS_VMEM_ABS_BLOCK_SIZE(free->_size);		
-        free->_size = (size+_JOS_arena_allocator_ALLOC_OVERHEAD);
-		if(org_size - free->_size < _JOS_VMEM_BLOCK_MIN_SIZE)
+_JOS_API_FUNC void* arena_allocator_alloc_aligned(arena_allocator_t* arena, size_t size, alloc_alignment_t alignment)
+{
+	if(alignment <= kAllocAlign_8)
+	{
+		return arena_allocator_alloc(arena, size);
+	}
+	if(!size)
+	{
+		return 0;
+	}
+
+	size = (size < _JOS_VMEM_BLOCK_MIN_SIZE) ? _JOS_VMEM_BLOCK_MIN_SIZE : (size+7)&~7;
+
+	if(!arena || arena->_size<size+_JOS_arena_allocator_ALLOC_OVERHEAD )
+	{
+        return 0;
+	}
+
+	// look for a free block which can hold an aligned allocation, either directly or after 
+	// splitting off a leading free fragment large enough to be a block in its own right.
+	// the allocation itself gets a regular header so it can be freed like any other block.
+	vmem_block_head_t* free = arena->_free_head;
+	size_t lead = 0;
+	while(free)
+	{
+		uintptr_t payload = _JOS_ALIGN(free+1, alignment);
+		lead = payload - (uintptr_t)(free+1);
+		if(lead && lead < _JOS_VMEM_BLOCK_MIN_SIZE)
 		{
-			// just absorb the whole free chunk to avoid small fragments
-			free->_size = org_size;
+			payload += (uintptr_t)alignment * ((_JOS_VMEM_BLOCK_MIN_SIZE - lead + (size_t)alignment - 1)/(size_t)alignment);
+			lead = payload - (uintptr_t)(free+1);
 		}
-        vmem_block_tail_t* new_tail = _vmem_tail_from_head(free);
-        new_tail->_size = _vmem_tail_size(free);
-
-        // space for at least one more free block?
-		org_size -= free->_size;
-        if(org_size >= _JOS_VMEM_BLOCK_MIN_SIZE)
-        {
-            vmem_block_head_t* new_head = (vmem_block_head_t*)_JOS_ALIGN(new_tail+1, kAllocAlign_8);
-			// adjust by bytes required by alignment 
-			new_head->_size = org_size - ((size_t)new_head - (size_t)(new_tail + 1));
-            new_tail = _vmem_tail_from_head(new_head);
-            new_tail->_size = _vmem_tail_free_size(new_head);
-			new_head->_size |= kVmemBlockFree;
-			_arena_allocator_block_insert_as_free(arena, new_head);
-
-			//DEBUG:printf("new free is 0x%x\n", arena->_free_head);
-        }
-		
-		arena->_size -= free->_size;
-		// return pointer to area beyond header
-		++free;
-    }
+		const size_t free_size = _JOS_VMEM_ABS_BLOCK_SIZE(free->_size);
+		if(free_size > lead && free_size - lead >= (size+_JOS_arena_allocator_ALLOC_OVERHEAD))
+			break;
+		free = free->_links[1];
+	}
 
-    return free;
+	if(!free)
+	{
+		return 0;
+	}
+
+	if(lead)
+	{
+		// turn the leading fragment into a free block of its own and carve from what's left
+		_arena_allocator_disconnect(arena, free);
+		const size_t org_size = _JOS_VMEM_ABS_BLOCK_SIZE(free->_size);
+		vmem_block_head_t* aligned_head = (vmem_block_head_t*)((uintptr_t)free + lead);
+		aligned_head->_size = (org_size - lead) | kVmemBlockFree;
+		aligned_head->_links[0] = aligned_head->_links[1] = 0;
+		vmem_block_tail_t* aligned_tail = _vmem_tail_from_head(aligned_head);
+		aligned_tail->_size = _vmem_tail_free_size(aligned_head);
+
+		free->_size = lead;
+		vmem_block_tail_t* lead_tail = _vmem_tail_from_head(free);
+		lead_tail->_size = _vmem_tail_free_size(free);
+		free->_size |= kVmemBlockFree;
+		_arena_allocator_block_insert_as_free(arena, free);
+
+		free = aligned_head;
+	}
+
+	return _arena_allocator_carve(arena, free, size);
 }
 
 _JOS_API_FUNC void* arena_allocator_realloc(arena_allocator_t* arena, void* block, size_t size) {
@@ -291,14 +369,16 @@ _JOS_API_FUNC void* arena_allocator_realloc(arena_allocator_t* arena, void* bloc
 	}
 
 	vmem_block_head_t* head = (vmem_block_head_t*)block - 1;
-	if (_JOS_VMEM_ABS_BLOCK_SIZE(head->_size) >= size) {
+	const size_t block_size = _vmem_tail_size(head);
+	if (block_size >= size) {
 		//TODO: if needed; shrink the block
 		return block;
 	}
 
 	void* new_block = arena->_super.alloc((generic_allocator_t*)arena, size);
 	if (new_block) {
-		memcpy(new_block, block, _JOS_VMEM_ABS_BLOCK_SIZE(head->_size));
+		memcpy(new_block, block, block_size);
+		arena->_super.free((generic_allocator_t*)arena, block);
 	}
 
 	return new_block;
@@ -323,6 +403,7 @@ _JOS_API_FUNC void arena_allocator_free(arena_allocator_t* arena, void* block)
 
 	// basic mark-as-delete...
 	((uint32_t*)block)[0] = 0xcdcdcdcd;
+	++arena->_free_count;
 
 	arena->_size += head->_size;
     // if there's a block before this and it's free we need to combine
@@ -354,6 +435,26 @@ _JOS_API_FUNC void arena_allocator_free(arena_allocator_t* arena, void* block)
     _arena_allocator_block_insert_as_free(arena, head);	
 }
 
+_JOS_API_FUNC void arena_allocator_stats(arena_allocator_t* arena, allocator_stats_t* stats)
+{
+	stats->_used = arena->_capacity - arena->_size;
+	stats->_free = arena->_size;
+	stats->_largest_free = 0;
+	stats->_free_blocks = 0;
+	// the free list is sorted by size, smallest first
+	const vmem_block_head_t* free = arena->_free_head;
+	while(free)
+	{
+		++stats->_free_blocks;
+		stats->_largest_free = _JOS_VMEM_ABS_BLOCK_SIZE(free->_size) - _JOS_arena_allocator_ALLOC_OVERHEAD;
+		free = free->_links[1];
+	}
+	stats->_allocated_blocks = arena->_alloc_count - arena->_free_count;
+	stats->_alloc_count = arena->_alloc_count;
+	stats->_free_count = arena->_free_count;
+	stats->_fragmentation = allocator_fragmentation(stats->_free, stats->_largest_free);
+}
+
 #endif // _JOS_arena_allocator_ALLOCATOR_IMPLEMENTED
 
 #endif // _JOS_arena_allocator_ALLOCATOR_H
@@ -34,6 +34,14 @@ _JOS_INLINE_FUNC int atomic_compare_exchange_strong(volatile int *object, int ex
 	return expected;
 }
 
+// add value to *object with full bus lock, returns the previous value
+_JOS_INLINE_FUNC int atomic_fetch_add(volatile int* object, int value) {
+	__asm__ __volatile__ (
+		"lock ; xaddl %0, %1"
+		: "+r"(value), "+m"(*object) : : "memory" );
+	return value;
+}
+
 // weakly check if *object == expected before attempting a bus lock
 _JOS_INLINE_FUNC int atomic_compare_exchange_weak(volatile int* object, int expected, int desired) {
     // weak check; we may early out here but that's the point
@@ -45,3 +53,31 @@ _JOS_INLINE_FUNC int atomic_compare_exchange_weak(volatile int* object, int expe
     return atomic_compare_exchange_strong(object, expected, desired);
 }
 
+// 64 bit CAS with full bus lock, returns the previous value of *object; i.e. it succeeded if that's expected
+_JOS_INLINE_FUNC uint64_t atomic_compare_exchange_strong_64(volatile uint64_t* object, uint64_t expected, uint64_t desired) {
+	__asm__ __volatile__ (
+		"lock ; cmpxchgq %3, %1"
+		: "=a"(expected), "+m"(*object) : "a"(expected), "r"(desired) : "memory" );
+	return expected;
+}
+
+// 64 bit version of atomic_fetch_add, returns the previous value
+_JOS_INLINE_FUNC uint64_t atomic_fetch_add_64(volatile uint64_t* object, uint64_t value) {
+	__asm__ __volatile__ (
+		"lock ; xaddq %0, %1"
+		: "+r"(value), "+m"(*object) : : "memory" );
+	return value;
+}
+
+// x86 doesn't re-order loads with other loads, or stores with other stores, so acquire and release
+// semantics only need to stop the compiler from moving memory accesses across them
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uint64_t atomic_load_acquire_64(const volatile uint64_t* object) {
+	const uint64_t value = *object;
+	__asm__ __volatile__ ("" ::: "memory");
+	return value;
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE void atomic_store_release_64(volatile uint64_t* object, uint64_t value) {
+	__asm__ __volatile__ ("" ::: "memory");
+	*object = value;
+}
@@ -20,12 +20,18 @@ typedef struct _bb_page_allocator {
 	uintptr_t* _zones;
 	// the highest order for this allocator, i.e. the largest single allocation possible (in number of pages)
 	size_t		_max_order;
+	size_t		_num_pages;
+	size_t		_free_pages;
+	size_t		_alloc_count;
+	size_t		_free_count;
 
 } bb_page_allocator_t;
 
 _JOS_API_FUNC void bb_page_allocator_create(bb_page_allocator_t* palloc, void* pool_base, size_t pool_num_pages, static_allocation_policy_t* static_allocator);
 _JOS_API_FUNC void* bb_page_allocator_allocate(bb_page_allocator_t* allocator, size_t page_count);
 _JOS_API_FUNC void bb_page_allocator_free(bb_page_allocator_t* allocator, void* ptr, size_t page_count);
+// NOTE: the page allocator isn't a generic_allocator_t but reports the same statistics, walking the free block lists
+_JOS_API_FUNC void bb_page_allocator_stats(bb_page_allocator_t* allocator, allocator_stats_t* stats);
 
 #if defined(_JOS_IMPLEMENT_ALLOCATORS) && !defined(_JOS_BB_PAGE_ALLOCATOR_IMPLEMENTED)
 #define _JOS_BB_PAGE_ALLOCATOR_IMPLEMENTED
@@ -83,6 +89,7 @@ _JOS_API_FUNC void bb_page_allocator_create(bb_page_allocator_t* palloc, void* p
 
 	const size_t n = (size_t)_BB_PAGE_ALLOC_ORDER_LO(pool_num_pages);
 	palloc->_max_order = n;
+	palloc->_alloc_count = palloc->_free_count = 0;
 
 	if (static_allocator) {
 		palloc->_zones = static_allocator->allocator->alloc(static_allocator->allocator, sizeof(uintptr_t) * (n + 1));
@@ -94,6 +101,7 @@ _JOS_API_FUNC void bb_page_allocator_create(bb_page_allocator_t* palloc, void* p
 	}
 
 	// populate zones and link buddy blocks so that we can combine them later (when things are freed)
+	const uintptr_t first_page = aligned_pool_base;
 	uintptr_t last_page_block = 0;
 	size_t pages = (1ull << n);
 	for (int z = (int)n; z >= 0; --z) {
@@ -111,6 +119,7 @@ _JOS_API_FUNC void bb_page_allocator_create(bb_page_allocator_t* palloc, void* p
 		}
 		pages >>= 1;
 	}
+	palloc->_num_pages = palloc->_free_pages = (size_t)(aligned_pool_base - first_page) / kAllocAlign_4k;
 }
 
 _JOS_INLINE_FUNC void _bb_page_allocator_insert_pages(bb_page_allocator_t* allocator, size_t order, uintptr_t page_block, uintptr_t prev_page_block) {
@@ -178,6 +187,8 @@ _JOS_API_FUNC void* bb_page_allocator_allocate(bb_page_allocator_t* allocator, s
 	size_t pages_to_relocate = (pages_in_zone - page_count);
 	//printf("\torder %d allocated @ 0x%llx, %d pages left of %d\n", (int)order, (uintptr_t)ptr, (int)pages_to_relocate, (int)page_count);
 
+	allocator->_free_pages -= page_count;
+	++allocator->_alloc_count;
 	if (!pages_to_relocate) {
 		// we're done
 		return ptr;
@@ -207,6 +218,8 @@ _JOS_API_FUNC void bb_page_allocator_free(bb_page_allocator_t* allocator, void*
 
 	size_t order = (size_t)_BB_PAGE_ALLOC_ORDER_HI(page_count);
 	_JOS_ASSERT(order <= allocator->_max_order);
+	allocator->_free_pages += page_count;
+	++allocator->_free_count;
 	// the number of pages originally relocated
 	size_t pages_relocated = (1ull << order) - page_count;
 	if (!pages_relocated) {
@@ -266,4 +279,24 @@ _JOS_API_FUNC void bb_page_allocator_free(bb_page_allocator_t* allocator, void*
 		}
 	}
 }
+
+_JOS_API_FUNC void bb_page_allocator_stats(bb_page_allocator_t* allocator, allocator_stats_t* stats) {
+
+	stats->_used = (allocator->_num_pages - allocator->_free_pages) * kAllocAlign_4k;
+	stats->_free = allocator->_free_pages * kAllocAlign_4k;
+	stats->_largest_free = 0;
+	stats->_free_blocks = 0;
+	for (size_t z = 0; z <= allocator->_max_order; ++z) {
+		const _bb_page_block_header_t* page_block_header = (const _bb_page_block_header_t*)allocator->_zones[z];
+		while (page_block_header) {
+			++stats->_free_blocks;
+			stats->_largest_free = (1ull << z) * kAllocAlign_4k;
+			page_block_header = page_block_header->_next_block;
+		}
+	}
+	stats->_allocated_blocks = allocator->_alloc_count - allocator->_free_count;
+	stats->_alloc_count = allocator->_alloc_count;
+	stats->_free_count = allocator->_free_count;
+	stats->_fragmentation = allocator_fragmentation(stats->_free, stats->_largest_free);
+}
 #endif 
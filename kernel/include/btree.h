@@ -0,0 +1,574 @@
+#pragma once
+#ifndef _JOS_BTREE_H
+#define _JOS_BTREE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <jos.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// btree
+//
+// a B+-tree mapping uintptr_t keys to uintptr_t values.
+// every node is four cache lines; the first two hold the (up to 14) sorted keys, padded with
+// BTREE_KEY_SENTINEL, which are searched in full by a scalar loop that counts the smaller keys with branchless 
+// compares instead of a branchy binary search.
+// values live in the leaves and the leaves are linked in key order for range iteration.
+// compared to binary_search_tree_t a lookup touches two cache lines per level of a tree with a
+// fan-out of 8 to 15, instead of one node per level of a binary tree.
+//
+// for example:
+//
+// btree_t tree;
+// btree_create(&tree, allocator);
+// btree_insert(&tree, 0x1000, (uintptr_t)symbol);
+// uintptr_t start, value;
+// if (btree_floor(&tree, address, &start, &value)) {
+//	  ...the symbol with the highest start <= address
+// }
+// btree_iterator_t iter = btree_iterator_lower_bound(&tree, 0x1000);
+// while (!btree_iterator_at_end(&iter) && btree_iterator_key(&iter) < 0x2000) {
+//	  ...
+//	  btree_iterator_next(&iter);
+// }
+// btree_destroy(&tree);
+
+#define BTREE_NODE_SIZE			256
+#define BTREE_MAX_KEYS			14
+#define BTREE_MIN_KEYS			(BTREE_MAX_KEYS/2)
+#define BTREE_KEY_SLOTS			16
+#define BTREE_KEY_SENTINEL		(~(uintptr_t)0)
+
+typedef struct _btree_node {
+
+	// sorted keys, unused slots hold BTREE_KEY_SENTINEL
+	uintptr_t	_keys[BTREE_KEY_SLOTS];
+	// leaf: _count values, and the last slot links to the next leaf
+	// inner: _count+1 children, child n holds the keys in [_keys[n-1], _keys[n])
+	uintptr_t	_slots[BTREE_MAX_KEYS + 1];
+	uint16_t	_count;
+	uint16_t	_leaf;
+	uint32_t	_reserved;
+
+} btree_node_t;
+
+typedef struct _btree {
+
+	generic_allocator_t*	_allocator;
+	btree_node_t*			_root;
+	size_t					_size;
+	size_t					_height;
+
+} btree_t;
+
+_JOS_API_FUNC void btree_create(btree_t* tree, generic_allocator_t* allocator);
+_JOS_API_FUNC void btree_destroy(btree_t* tree);
+// returns true if key was added, false if it was already in the tree (the value is updated) or we're out of memory
+_JOS_API_FUNC bool btree_insert(btree_t* tree, uintptr_t key, uintptr_t value);
+_JOS_API_FUNC bool btree_remove(btree_t* tree, uintptr_t key);
+// out_value is optional
+_JOS_API_FUNC bool btree_find(btree_t* tree, uintptr_t key, uintptr_t* out_value);
+// finds the largest key <= key, both outputs are optional
+_JOS_API_FUNC bool btree_floor(btree_t* tree, uintptr_t key, uintptr_t* out_key, uintptr_t* out_value);
+// builds the tree from count strictly ascending keys, much faster than count inserts. the tree must be empty.
+_JOS_API_FUNC jo_status_t btree_bulk_load(btree_t* tree, const uintptr_t* keys, const uintptr_t* values, size_t count);
+
+_JOS_INLINE_FUNC size_t btree_size(btree_t* tree) {
+	return tree->_size;
+}
+
+// iterator, visits keys in ascending order
+typedef struct _btree_iterator {
+
+	btree_node_t*	_leaf;
+	size_t			_i;
+
+} btree_iterator_t;
+
+// the first key >= key
+_JOS_API_FUNC btree_iterator_t btree_iterator_lower_bound(btree_t* tree, uintptr_t key);
+
+_JOS_INLINE_FUNC btree_iterator_t btree_iterator_begin(btree_t* tree) {
+	return btree_iterator_lower_bound(tree, 0);
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE bool btree_iterator_at_end(btree_iterator_t* iter) {
+	return iter->_leaf == 0;
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uintptr_t btree_iterator_key(btree_iterator_t* iter) {
+	return iter->_leaf->_keys[iter->_i];
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uintptr_t btree_iterator_value(btree_iterator_t* iter) {
+	return iter->_leaf->_slots[iter->_i];
+}
+
+_JOS_INLINE_FUNC void btree_iterator_next(btree_iterator_t* iter) {
+	if (++iter->_i < iter->_leaf->_count) {
+		return;
+	}
+	// leaves are never empty, unless the root is
+	iter->_leaf = (btree_node_t*)iter->_leaf->_slots[BTREE_MAX_KEYS];
+	iter->_i = 0;
+}
+
+#if defined(_JOS_IMPLEMENT_BTREE) && !defined(_JOS_BTREE_IMPLEMENTED)
+#define _JOS_BTREE_IMPLEMENTED
+
+#define _BTREE_LEAF_NEXT(node)		((node)->_slots[BTREE_MAX_KEYS])
+#define _BTREE_CHILD(node, n)		((btree_node_t*)(node)->_slots[(n)])
+
+// the number of keys < key (or <= key if inclusive). the sentinels are included in the compare but
+// they're never smaller than any key and only equal to the largest one, hence the clamp.
+// every slot is compared without branching, so there are no mispredicts whatever the key
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t _btree_rank(const btree_node_t* node, uintptr_t key, bool inclusive) {
+	const uintptr_t* keys = node->_keys;
+	size_t rank = 0;
+	if (inclusive) {
+		for (size_t n = 0; n < BTREE_KEY_SLOTS; ++n) {
+			rank += (size_t)(keys[n] <= key);
+		}
+	}
+	else {
+		for (size_t n = 0; n < BTREE_KEY_SLOTS; ++n) {
+			rank += (size_t)(keys[n] < key);
+		}
+	}
+	return rank < node->_count ? rank : node->_count;
+}
+
+static btree_node_t* _btree_alloc_node(btree_t* tree, bool leaf) {
+	btree_node_t* node = (btree_node_t*)allocator_alloc_aligned(tree->_allocator, sizeof(btree_node_t), kAllocAlign_64);
+	if (node) {
+		for (size_t n = 0; n < BTREE_KEY_SLOTS; ++n) {
+			node->_keys[n] = BTREE_KEY_SENTINEL;
+		}
+		memset(node->_slots, 0, sizeof(node->_slots));
+		node->_count = 0;
+		node->_leaf = leaf ? 1 : 0;
+		node->_reserved = 0;
+	}
+	return node;
+}
+
+static void _btree_free_node(btree_t* tree, btree_node_t* node) {
+	allocator_free_aligned(tree->_allocator, node);
+}
+
+static void _btree_free_subtree(btree_t* tree, btree_node_t* node) {
+	if (!node->_leaf) {
+		for (size_t n = 0; n <= node->_count; ++n) {
+			_btree_free_subtree(tree, _BTREE_CHILD(node, n));
+		}
+	}
+	_btree_free_node(tree, node);
+}
+
+_JOS_API_FUNC void btree_create(btree_t* tree, generic_allocator_t* allocator) {
+	_JOS_ASSERT(tree && allocator);
+	memset(tree, 0, sizeof(btree_t));
+	tree->_allocator = allocator;
+}
+
+_JOS_API_FUNC void btree_destroy(btree_t* tree) {
+	if (tree->_root) {
+		_btree_free_subtree(tree, tree->_root);
+	}
+	tree->_root = 0;
+	tree->_size = tree->_height = 0;
+}
+
+static btree_node_t* _btree_find_leaf(btree_t* tree, uintptr_t key) {
+	btree_node_t* node = tree->_root;
+	while (node && !node->_leaf) {
+		node = _BTREE_CHILD(node, _btree_rank(node, key, true));
+	}
+	return node;
+}
+
+_JOS_API_FUNC bool btree_find(btree_t* tree, uintptr_t key, uintptr_t* out_value) {
+	btree_node_t* leaf = _btree_find_leaf(tree, key);
+	if (!leaf) {
+		return false;
+	}
+	const size_t i = _btree_rank(leaf, key, false);
+	if (i == leaf->_count || leaf->_keys[i] != key) {
+		return false;
+	}
+	if (out_value) {
+		*out_value = leaf->_slots[i];
+	}
+	return true;
+}
+
+_JOS_API_FUNC bool btree_floor(btree_t* tree, uintptr_t key, uintptr_t* out_key, uintptr_t* out_value) {
+	btree_node_t* node = tree->_root;
+	// the subtree just left of our path, its largest key is the floor if the leaf we end up in has none
+	btree_node_t* left = 0;
+	while (node && !node->_leaf) {
+		const size_t c = _btree_rank(node, key, true);
+		if (c) {
+			left = _BTREE_CHILD(node, c - 1);
+		}
+		node = _BTREE_CHILD(node, c);
+	}
+	if (!node) {
+		return false;
+	}
+	size_t i = _btree_rank(node, key, true);
+	if (!i) {
+		if (!left) {
+			return false;
+		}
+		while (!left->_leaf) {
+			left = _BTREE_CHILD(left, left->_count);
+		}
+		node = left;
+		i = node->_count;
+	}
+	if (out_key) {
+		*out_key = node->_keys[i - 1];
+	}
+	if (out_value) {
+		*out_value = node->_slots[i - 1];
+	}
+	return true;
+}
+
+_JOS_API_FUNC btree_iterator_t btree_iterator_lower_bound(btree_t* tree, uintptr_t key) {
+	btree_iterator_t iter = { ._leaf = _btree_find_leaf(tree, key), ._i = 0 };
+	if (iter._leaf) {
+		iter._i = _btree_rank(iter._leaf, key, false);
+		if (iter._i == iter._leaf->_count) {
+			// every key in this leaf is smaller, the next one starts with a larger key
+			iter._leaf = (btree_node_t*)_BTREE_LEAF_NEXT(iter._leaf);
+			iter._i = 0;
+		}
+	}
+	return iter;
+}
+
+// insert key and slot at position i of a node with room for it
+_JOS_INLINE_FUNC void _btree_insert_at(btree_node_t* node, size_t i, uintptr_t key, size_t slot_i, uintptr_t slot) {
+	memmove(node->_keys + i + 1, node->_keys + i, (node->_count - i) * sizeof(uintptr_t));
+	node->_keys[i] = key;
+	const size_t num_slots = node->_leaf ? node->_count : node->_count + 1;
+	memmove(node->_slots + slot_i + 1, node->_slots + slot_i, (num_slots - slot_i) * sizeof(uintptr_t));
+	node->_slots[slot_i] = slot;
+	++node->_count;
+}
+
+// remove key i and slot slot_i
+_JOS_INLINE_FUNC void _btree_remove_at(btree_node_t* node, size_t i, size_t slot_i) {
+	memmove(node->_keys + i, node->_keys + i + 1, (node->_count - i - 1) * sizeof(uintptr_t));
+	const size_t num_slots = node->_leaf ? node->_count : node->_count + 1;
+	memmove(node->_slots + slot_i, node->_slots + slot_i + 1, (num_slots - slot_i - 1) * sizeof(uintptr_t));
+	--node->_count;
+	node->_keys[node->_count] = BTREE_KEY_SENTINEL;
+	if (!node->_leaf) {
+		node->_slots[node->_count + 1] = 0;
+	}
+}
+
+// splits a full node in two, the upper half moves to a new right sibling.
+// returns the right sibling and the key that separates it from node, or 0 if we're out of memory
+static btree_node_t* _btree_split(btree_t* tree, btree_node_t* node, uintptr_t* out_separator) {
+	btree_node_t* right = _btree_alloc_node(tree, node->_leaf);
+	if (!right) {
+		return 0;
+	}
+	const size_t half = BTREE_MAX_KEYS / 2;
+	if (node->_leaf) {
+		// B+ tree: the separator is copied up, the leaf keeps it
+		right->_count = (uint16_t)(node->_count - half);
+		memcpy(right->_keys, node->_keys + half, right->_count * sizeof(uintptr_t));
+		memcpy(right->_slots, node->_slots + half, right->_count * sizeof(uintptr_t));
+		_BTREE_LEAF_NEXT(right) = _BTREE_LEAF_NEXT(node);
+		_BTREE_LEAF_NEXT(node) = (uintptr_t)right;
+		*out_separator = right->_keys[0];
+	}
+	else {
+		// the middle key moves up
+		right->_count = (uint16_t)(node->_count - half - 1);
+		memcpy(right->_keys, node->_keys + half + 1, right->_count * sizeof(uintptr_t));
+		memcpy(right->_slots, node->_slots + half + 1, (right->_count + 1) * sizeof(uintptr_t));
+		*out_separator = node->_keys[half];
+		for (size_t n = half + 1; n <= node->_count; ++n) {
+			node->_slots[n] = 0;
+		}
+	}
+	for (size_t n = half; n < node->_count; ++n) {
+		node->_keys[n] = BTREE_KEY_SENTINEL;
+	}
+	node->_count = (uint16_t)half;
+	return right;
+}
+
+typedef enum _btree_insert_result {
+	kBtree_Inserted,
+	kBtree_Updated,
+	kBtree_NoMemory,
+} _btree_insert_result_t;
+
+// full nodes are split on the way down so there's always room for a split below
+static _btree_insert_result_t _btree_insert(btree_t* tree, btree_node_t* node, uintptr_t key, uintptr_t value) {
+	while (!node->_leaf) {
+		size_t c = _btree_rank(node, key, true);
+		btree_node_t* child = _BTREE_CHILD(node, c);
+		if (child->_count == BTREE_MAX_KEYS) {
+			if (child->_leaf) {
+				// don't split a leaf only to update a value in it
+				const size_t i = _btree_rank(child, key, false);
+				if (i < child->_count && child->_keys[i] == key) {
+					child->_slots[i] = value;
+					return kBtree_Updated;
+				}
+			}
+			uintptr_t separator;
+			btree_node_t* right = _btree_split(tree, child, &separator);
+			if (!right) {
+				return kBtree_NoMemory;
+			}
+			_btree_insert_at(node, c, separator, c + 1, (uintptr_t)right);
+			if (key >= separator) {
+				child = right;
+			}
+		}
+		node = child;
+	}
+	const size_t i = _btree_rank(node, key, false);
+	if (i < node->_count && node->_keys[i] == key) {
+		node->_slots[i] = value;
+		return kBtree_Updated;
+	}
+	_btree_insert_at(node, i, key, i, value);
+	return kBtree_Inserted;
+}
+
+_JOS_API_FUNC bool btree_insert(btree_t* tree, uintptr_t key, uintptr_t value) {
+	if (!tree->_root) {
+		tree->_root = _btree_alloc_node(tree, true);
+		if (!tree->_root) {
+			return false;
+		}
+		tree->_height = 1;
+	}
+	if (tree->_root->_count == BTREE_MAX_KEYS) {
+		if (tree->_root->_leaf) {
+			const size_t i = _btree_rank(tree->_root, key, false);
+			if (i < tree->_root->_count && tree->_root->_keys[i] == key) {
+				tree->_root->_slots[i] = value;
+				return false;
+			}
+		}
+		btree_node_t* root = _btree_alloc_node(tree, false);
+		if (!root) {
+			return false;
+		}
+		uintptr_t separator;
+		btree_node_t* right = _btree_split(tree, tree->_root, &separator);
+		if (!right) {
+			_btree_free_node(tree, root);
+			return false;
+		}
+		root->_keys[0] = separator;
+		root->_slots[0] = (uintptr_t)tree->_root;
+		root->_slots[1] = (uintptr_t)right;
+		root->_count = 1;
+		tree->_root = root;
+		++tree->_height;
+	}
+	if (_btree_insert(tree, tree->_root, key, value) == kBtree_Inserted) {
+		++tree->_size;
+		return true;
+	}
+	return false;
+}
+
+// child c of node has fewer than BTREE_MIN_KEYS keys; borrow from, or merge with, a sibling
+static void _btree_rebalance(btree_t* tree, btree_node_t* node, size_t c) {
+	btree_node_t* child = _BTREE_CHILD(node, c);
+	btree_node_t* left = c > 0 ? _BTREE_CHILD(node, c - 1) : 0;
+	btree_node_t* right = c < node->_count ? _BTREE_CHILD(node, c + 1) : 0;
+
+	if (left && left->_count > BTREE_MIN_KEYS) {
+		if (child->_leaf) {
+			_btree_insert_at(child, 0, left->_keys[left->_count - 1], 0, left->_slots[left->_count - 1]);
+			_btree_remove_at(left, left->_count - 1, left->_count - 1);
+			node->_keys[c - 1] = child->_keys[0];
+		}
+		else {
+			_btree_insert_at(child, 0, node->_keys[c - 1], 0, left->_slots[left->_count]);
+			node->_keys[c - 1] = left->_keys[left->_count - 1];
+			_btree_remove_at(left, left->_count - 1, left->_count);
+		}
+		return;
+	}
+	if (right && right->_count > BTREE_MIN_KEYS) {
+		if (child->_leaf) {
+			_btree_insert_at(child, child->_count, right->_keys[0], child->_count, right->_slots[0]);
+			_btree_remove_at(right, 0, 0);
+			node->_keys[c] = right->_keys[0];
+		}
+		else {
+			_btree_insert_at(child, child->_count, node->_keys[c], child->_count + 1, right->_slots[0]);
+			node->_keys[c] = right->_keys[0];
+			_btree_remove_at(right, 0, 0);
+		}
+		return;
+	}
+
+	// merge the right one of the pair into the left one
+	if (!left) {
+		left = child;
+		child = right;
+		++c;
+	}
+	_JOS_ASSERT(child);
+	if (left->_leaf) {
+		memcpy(left->_keys + left->_count, child->_keys, child->_count * sizeof(uintptr_t));
+		memcpy(left->_slots + left->_count, child->_slots, child->_count * sizeof(uintptr_t));
+		_BTREE_LEAF_NEXT(left) = _BTREE_LEAF_NEXT(child);
+		left->_count = (uint16_t)(left->_count + child->_count);
+	}
+	else {
+		left->_keys[left->_count] = node->_keys[c - 1];
+		memcpy(left->_keys + left->_count + 1, child->_keys, child->_count * sizeof(uintptr_t));
+		memcpy(left->_slots + left->_count + 1, child->_slots, (child->_count + 1) * sizeof(uintptr_t));
+		left->_count = (uint16_t)(left->_count + child->_count + 1);
+	}
+	_JOS_ASSERT(left->_count <= BTREE_MAX_KEYS);
+	_btree_remove_at(node, c - 1, c);
+	_btree_free_node(tree, child);
+}
+
+static bool _btree_remove(btree_t* tree, btree_node_t* node, uintptr_t key) {
+	if (node->_leaf) {
+		const size_t i = _btree_rank(node, key, false);
+		if (i == node->_count || node->_keys[i] != key) {
+			return false;
+		}
+		_btree_remove_at(node, i, i);
+		return true;
+	}
+	const size_t c = _btree_rank(node, key, true);
+	if (!_btree_remove(tree, _BTREE_CHILD(node, c), key)) {
+		return false;
+	}
+	if (_BTREE_CHILD(node, c)->_count < BTREE_MIN_KEYS) {
+		_btree_rebalance(tree, node, c);
+	}
+	return true;
+}
+
+_JOS_API_FUNC bool btree_remove(btree_t* tree, uintptr_t key) {
+	if (!tree->_root || !_btree_remove(tree, tree->_root, key)) {
+		return false;
+	}
+	--tree->_size;
+	btree_node_t* root = tree->_root;
+	if (!root->_count) {
+		// the root shrinks by one level, or the tree is empty
+		tree->_root = root->_leaf ? 0 : _BTREE_CHILD(root, 0);
+		--tree->_height;
+		_btree_free_node(tree, root);
+	}
+	return true;
+}
+
+// a node being built by btree_bulk_load, and the smallest key in its subtree
+typedef struct _btree_bulk_entry {
+	btree_node_t*	_node;
+	uintptr_t		_min_key;
+} _btree_bulk_entry_t;
+
+_JOS_API_FUNC jo_status_t btree_bulk_load(btree_t* tree, const uintptr_t* keys, const uintptr_t* values, size_t count) {
+	if (tree->_root) {
+		return _JO_STATUS_FAILED_PRECONDITION;
+	}
+	if (!count) {
+		return _JO_STATUS_SUCCESS;
+	}
+	for (size_t n = 1; n < count; ++n) {
+		if (keys[n] <= keys[n - 1]) {
+			return _JO_STATUS_INVALID_INPUT;
+		}
+	}
+
+	// spreading the keys evenly over the fewest nodes keeps every node at least half full
+	size_t num_nodes = (count + BTREE_MAX_KEYS - 1) / BTREE_MAX_KEYS;
+	_btree_bulk_entry_t* level = (_btree_bulk_entry_t*)tree->_allocator->alloc(tree->_allocator, num_nodes * sizeof(_btree_bulk_entry_t));
+	if (!level) {
+		return _JO_STATUS_RESOURCE_EXHAUSTED;
+	}
+
+	btree_node_t* prev = 0;
+	size_t at = 0;
+	for (size_t n = 0; n < num_nodes; ++n) {
+		btree_node_t* leaf = _btree_alloc_node(tree, true);
+		if (!leaf) {
+			for (size_t m = 0; m < n; ++m) {
+				_btree_free_node(tree, level[m]._node);
+			}
+			tree->_allocator->free(tree->_allocator, level);
+			return _JO_STATUS_RESOURCE_EXHAUSTED;
+		}
+		const size_t leaf_count = count / num_nodes + (n < count % num_nodes ? 1 : 0);
+		memcpy(leaf->_keys, keys + at, leaf_count * sizeof(uintptr_t));
+		if (values) {
+			memcpy(leaf->_slots, values + at, leaf_count * sizeof(uintptr_t));
+		}
+		leaf->_count = (uint16_t)leaf_count;
+		if (prev) {
+			_BTREE_LEAF_NEXT(prev) = (uintptr_t)leaf;
+		}
+		prev = leaf;
+		level[n] = (_btree_bulk_entry_t){ ._node = leaf, ._min_key = keys[at] };
+		at += leaf_count;
+	}
+	size_t height = 1;
+
+	// then the inner levels, bottom up, re-using the level array since there are fewer parents than children
+	while (num_nodes > 1) {
+		const size_t num_children = num_nodes;
+		num_nodes = (num_children + BTREE_MAX_KEYS) / (BTREE_MAX_KEYS + 1);
+		at = 0;
+		for (size_t n = 0; n < num_nodes; ++n) {
+			const size_t child_count = num_children / num_nodes + (n < num_children % num_nodes ? 1 : 0);
+			btree_node_t* inner = _btree_alloc_node(tree, false);
+			if (!inner) {
+				for (size_t m = 0; m < n; ++m) {
+					_btree_free_subtree(tree, level[m]._node);
+				}
+				for (size_t m = at; m < num_children; ++m) {
+					_btree_free_subtree(tree, level[m]._node);
+				}
+				tree->_allocator->free(tree->_allocator, level);
+				return _JO_STATUS_RESOURCE_EXHAUSTED;
+			}
+			for (size_t i = 0; i < child_count; ++i) {
+				inner->_slots[i] = (uintptr_t)level[at + i]._node;
+				if (i) {
+					inner->_keys[i - 1] = level[at + i]._min_key;
+				}
+			}
+			inner->_count = (uint16_t)(child_count - 1);
+			const uintptr_t min_key = level[at]._min_key;
+			at += child_count;
+			level[n] = (_btree_bulk_entry_t){ ._node = inner, ._min_key = min_key };
+		}
+		++height;
+	}
+
+	tree->_root = level[0]._node;
+	tree->_size = count;
+	tree->_height = height;
+	tree->_allocator->free(tree->_allocator, level);
+	return _JO_STATUS_SUCCESS;
+}
+
+#endif // _JOS_IMPLEMENT_BTREE
+
+#endif // _JOS_BTREE_H
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <jos.h>
+#include <hash.h>
 
 ////////////////////////////////////////////////////////////////////////////////
 // vector
@@ -34,8 +35,17 @@ typedef struct _vector
 _JOS_API_FUNC void vector_create(vector_t* vec, size_t capacity, size_t element_size, generic_allocator_t* allocator);
 // create and initialise a vector with an initial capacity and allocation units aligned to alignment
 _JOS_API_FUNC void vector_create_aligned(vector_t* vec, size_t capacity, size_t element_size, alloc_alignment_t alignment, generic_allocator_t* allocator);
+// create a vector which uses storage, capacity elements provided by the caller (i.e. on the stack), until it
+// outgrows it. small vectors never touch the allocator
+_JOS_API_FUNC void vector_create_with_storage(vector_t* vec, void* storage, size_t capacity, size_t element_size, generic_allocator_t* allocator);
+// make sure the vector can hold at least capacity elements without growing
+_JOS_API_FUNC void vector_reserve(vector_t* vec, size_t capacity);
+// grow or shrink the vector to size elements, new elements are zeroed
+_JOS_API_FUNC void vector_resize(vector_t* vec, size_t size);
 // add element to the end of vector
 _JOS_API_FUNC void vector_push_back(vector_t* vec, void* element);
+// add count elements, packed element_size apart, to the end of vector
+_JOS_API_FUNC void vector_push_back_n(vector_t* vec, const void* elements, size_t count);
 // push one element as two packed elements (used for maps, for example)
 // NOTE: alignment is not guaranteed, unless the combined item size ensures it
 _JOS_API_FUNC void vector_push_back_pair(vector_t* vec, const void* first, size_t first_size, const void* second, size_t second_size);
@@ -70,29 +80,17 @@ _JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t vector_element_stride(vector_t* vec)
 
 _JOS_INLINE_FUNC _JOS_ALWAYS_INLINE void vector_destroy(vector_t* vec)
 {
-	vec->_allocator->free(vec->_allocator, vec->_memory);
+	// no _memory if we're still using storage provided by the caller
+	if (vec->_memory) {
+		vec->_allocator->free(vec->_allocator, vec->_memory);
+	}
 	memset(vec, 0, sizeof(vector_t));
 }
 
 _JOS_INLINE_FUNC _JOS_ALWAYS_INLINE void vector_swap(vector_t* veca, vector_t* vecb) {
-#if defined(_JOS_SWAP_PTR)
-	_JOS_SWAP_PTR(veca->_allocator, vecb->_allocator);
-	_JOS_SWAP_PTR(veca->_data, vecb->_data);
-#else
-	uintptr_t tmp_a = (uintptr_t)veca->_allocator;
-	uintptr_t tmp_b = (uintptr_t)vecb->_allocator;
-	_JOS_SWAP(tmp_a, tmp_b);
-	veca->_allocator = (generic_allocator_t*)tmp_a;
-	vecb->_allocator = (generic_allocator_t*)tmp_b;
-	tmp_a = (uintptr_t)veca->_data;
-	tmp_b = (uintptr_t)vecb->_data;
-	_JOS_SWAP(tmp_a, tmp_b);
-	veca->_data = (void*)tmp_a;
-	vecb->_data = (void*)tmp_b;
-#endif
-	_JOS_SWAP(veca->_capacity, vecb->_capacity);
-	_JOS_SWAP(veca->_size, vecb->_size);
-	_JOS_SWAP(veca->_element_size, vecb->_element_size);
+	const vector_t tmp = *veca;
+	*veca = *vecb;
+	*vecb = tmp;
 }
 
 _JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t vector_size(vector_t* vec)
@@ -194,7 +192,7 @@ static const vector_t kEmptyVector = { ._data = 0, ._capacity = 0, ._size = 0, .
 // unordered_map_create(&umap, &(unordered_map_create_args_t){
 //	.value_size = sizeof(test_data_t),
 //		.key_size = sizeof(int),
-//		.hash_func = identity_hash_func,
+//		.hash_func = int_hash_func, // e.g. hash_fold32(hash_mix64(*(const int*)key))
 //		.cmp_func = int_cmp_func
 // },
 // & _malloc_allocator);
@@ -222,7 +220,7 @@ typedef const void* map_value_t;
 typedef uint32_t(*map_key_hash_func)(map_key_t);
 typedef bool(*map_key_cmp_func)(map_key_t, map_key_t);
 
-// helper: returns 32 bit hash (Pearson) for a key as const char*
+// helper: returns 32 bit hash (wyhash, see hash.h) for a key as const char*
 _JOS_API_FUNC uint32_t map_str_hash_func(const void* key);
 // helper: string compare function
 _JOS_INLINE_FUNC _JOS_ALWAYS_INLINE bool map_str_cmp_func(const void* a, const void* b) {
@@ -238,13 +236,146 @@ typedef enum _map_type_trait {
 
 } map_type_trait_t;
 
+// the map is an open addressing "Swiss table"; one control byte per slot holding 7 bits of the key's hash, 
+// probed a group of 16 at a time with SSE2, and key/value pairs stored inline in a single allocation.
+// the capacity is a power of two and the table is resized when it's more than 7/8 full.
+// deletion doesn't leave tombstones; every group instead counts the keys that probed past it when they 
+// were inserted and a lookup stops at the first group that doesn't match and that no key has overflowed.
+//NOTE: values move when the table is resized, pointers returned by find are only valid until the next insert
+
+#define UNORDERED_MAP_GROUP_SIZE		16
+#define UNORDERED_MAP_MIN_CAPACITY		UNORDERED_MAP_GROUP_SIZE
+#define UNORDERED_MAP_CTRL_EMPTY		0x80
+// overflow counts saturate, a saturated group is never decremented again
+#define UNORDERED_MAP_OVERFLOW_MAX		0xff
+
+// SSE2 group probing, see https://abseil.io/about/design/swisstables
+// (also used by the typed maps in hashmap.h)
+//NOTE: the kernel is built with -nostdinc so the intrinsics headers are only available to the lab build
+#if defined(_MSC_VER)
+#include <emmintrin.h>
+
+// bit n is set if control byte n of the group equals h2
+_JOS_INLINE_FUNC uint32_t _unordered_map_group_match(const uint8_t* ctrl, uint8_t h2) {
+	const __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)h2)));
+}
+
+// bit n is set if slot n of the group is empty
+_JOS_INLINE_FUNC uint32_t _unordered_map_group_empty(const uint8_t* ctrl) {
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+}
+#else
+typedef char _unordered_map_group_t __attribute__((vector_size(UNORDERED_MAP_GROUP_SIZE)));
+typedef char _unordered_map_group_u_t __attribute__((vector_size(UNORDERED_MAP_GROUP_SIZE), aligned(1)));
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uint32_t _unordered_map_group_match(const uint8_t* ctrl, uint8_t h2) {
+	const _unordered_map_group_t group = *(const _unordered_map_group_u_t*)ctrl;
+	const _unordered_map_group_t splat = (_unordered_map_group_t){ 0 } + (char)h2;
+	return (uint32_t)__builtin_ia32_pmovmskb128((_unordered_map_group_t)(group == splat));
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uint32_t _unordered_map_group_empty(const uint8_t* ctrl) {
+	return (uint32_t)__builtin_ia32_pmovmskb128(*(const _unordered_map_group_u_t*)ctrl);
+}
+#endif
+
+// table probing, shared with the typed maps in hashmap.h which only differ in how slots are stored.
+// ctrl and overflow are the control bytes and overflow counts of a table of capacity slots
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uint8_t _unordered_map_h2(uint32_t hash) {
+	return (uint8_t)(hash & 0x7f);
+}
+
+// triangular probing over a power of two number of groups visits each group exactly once
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t _unordered_map_first_group(uint32_t hash, size_t capacity) {
+	return (size_t)(hash >> 7) & (capacity / UNORDERED_MAP_GROUP_SIZE - 1);
+}
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t _unordered_map_next_group(size_t group, size_t probe, size_t capacity) {
+	return (group + probe) & (capacity / UNORDERED_MAP_GROUP_SIZE - 1);
+}
+
+// lookup state: the group being probed and the slots in it whose control byte matches
+typedef struct _unordered_map_probe {
+	size_t		_group;
+	size_t		_probe;
+	uint32_t	_match;
+	uint8_t		_h2;
+} unordered_map_probe_t;
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE unordered_map_probe_t _unordered_map_probe_begin(const uint8_t* ctrl, size_t capacity, uint32_t hash) {
+	unordered_map_probe_t probe = { ._group = _unordered_map_first_group(hash, capacity), ._probe = 1, ._h2 = _unordered_map_h2(hash) };
+	probe._match = _unordered_map_group_match(ctrl + probe._group * UNORDERED_MAP_GROUP_SIZE, probe._h2);
+	return probe;
+}
+
+// returns the next slot whose control byte matches the hash, for the caller to compare keys, or capacity 
+// when there are no more. probing stops at the first group no key has overflowed
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t _unordered_map_probe_next(unordered_map_probe_t* probe, const uint8_t* ctrl, const uint8_t* overflow, size_t capacity) {
+	while (!probe->_match) {
+		if (!overflow[probe->_group] || probe->_probe == capacity / UNORDERED_MAP_GROUP_SIZE) {
+			return capacity;
+		}
+		probe->_group = _unordered_map_next_group(probe->_group, probe->_probe++, capacity);
+		probe->_match = _unordered_map_group_match(ctrl + probe->_group * UNORDERED_MAP_GROUP_SIZE, probe->_h2);
+	}
+	const size_t i = probe->_group * UNORDERED_MAP_GROUP_SIZE + (size_t)jos_ctz32(probe->_match);
+	probe->_match &= probe->_match - 1;
+	return i;
+}
+
+// returns the first empty slot for hash, counting the overflow for every full group we pass
+//NOTE: there must be room in the table
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t _unordered_map_claim(uint8_t* ctrl, uint8_t* overflow, size_t capacity, uint32_t hash) {
+	size_t group = _unordered_map_first_group(hash, capacity);
+	for (size_t probe = 1; ; ++probe) {
+		uint8_t* group_ctrl = ctrl + group * UNORDERED_MAP_GROUP_SIZE;
+		const uint32_t empty = _unordered_map_group_empty(group_ctrl);
+		if (empty) {
+			const size_t n = (size_t)jos_ctz32(empty);
+			group_ctrl[n] = _unordered_map_h2(hash);
+			return group * UNORDERED_MAP_GROUP_SIZE + n;
+		}
+		if (overflow[group] != UNORDERED_MAP_OVERFLOW_MAX) {
+			++overflow[group];
+		}
+		group = _unordered_map_next_group(group, probe, capacity);
+	}
+}
+
+// empty slot i, which was claimed for hash, and undo the overflow counts of every group it passed
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE void _unordered_map_unclaim(uint8_t* ctrl, uint8_t* overflow, size_t capacity, uint32_t hash, size_t i) {
+	const size_t key_group = i / UNORDERED_MAP_GROUP_SIZE;
+	size_t group = _unordered_map_first_group(hash, capacity);
+	for (size_t probe = 1; group != key_group; ++probe) {
+		if (overflow[group] != UNORDERED_MAP_OVERFLOW_MAX) {
+			_JOS_ASSERT(overflow[group]);
+			--overflow[group];
+		}
+		group = _unordered_map_next_group(group, probe, capacity);
+	}
+	ctrl[i] = UNORDERED_MAP_CTRL_EMPTY;
+}
+
+// an empty table, ready to have the old contents claimed into it on resize
+_JOS_INLINE_FUNC void _unordered_map_clear_table(uint8_t* ctrl, uint8_t* overflow, size_t capacity) {
+	memset(ctrl, UNORDERED_MAP_CTRL_EMPTY, capacity);
+	memset(overflow, 0, capacity / UNORDERED_MAP_GROUP_SIZE);
+}
+
 typedef struct _unordered_map {
 
-	vector_t* _slots;
+	// _capacity control bytes, UNORDERED_MAP_CTRL_EMPTY or the low 7 bits of the key hash
+	uint8_t* _ctrl;
+	// one overflow count per group
+	uint8_t* _overflow;
+	// _capacity key/value pairs, _slot_stride apart
+	uint8_t* _slots;
 	size_t  _value_size;
 	size_t  _key_size;
+	size_t  _slot_stride;
 	map_type_trait_t _key_type;
-	size_t  _num_slots;
+	size_t  _capacity;
 	size_t  _occupancy;
 	generic_allocator_t* _allocator;
 	map_key_hash_func _hash_func;
@@ -262,6 +393,7 @@ typedef struct _unordered_map_create_args {
 
 } unordered_map_create_args_t;
 
+// nothing is allocated until the first insert
 _JOS_API_FUNC void unordered_map_create(unordered_map_t* umap, unordered_map_create_args_t* args, generic_allocator_t* allocator);
 _JOS_API_FUNC void unordered_map_destroy(unordered_map_t* umap);
 _JOS_API_FUNC map_value_t unordered_map_find(unordered_map_t* umap, map_key_t key);
@@ -275,6 +407,10 @@ _JOS_INLINE_FUNC generic_allocator_t* unordered_map_allocator(unordered_map_t* u
 	return umap->_allocator;
 }
 
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE void* _unordered_map_slot(unordered_map_t* umap, size_t i) {
+	return (void*)(umap->_slots + i*umap->_slot_stride);
+}
+
 /* iterator for unordered_map
 * example usage:
 *  
@@ -289,41 +425,36 @@ _JOS_INLINE_FUNC generic_allocator_t* unordered_map_allocator(unordered_map_t* u
 typedef struct _unordered_map_iterator {
 
 	unordered_map_t* _umap;
+	// slot index
 	size_t	_i;
-	size_t	_j;
 
 } unordered_map_iterator_t;
 
 _JOS_INLINE_FUNC _JOS_ALWAYS_INLINE bool unordered_map_iterator_at_end(unordered_map_iterator_t* iter) {
-	return iter->_i == iter->_umap->_num_slots;
+	return iter->_i == iter->_umap->_capacity;
 }
 
+_JOS_API_FUNC void unordered_map_iterator_next(unordered_map_iterator_t* iter);
+
 _JOS_INLINE_FUNC _JOS_ALWAYS_INLINE unordered_map_iterator_t unordered_map_iterator_begin(unordered_map_t* umap) {
 	unordered_map_iterator_t iter = {
 		._umap = umap
 	};
-	// make sure we're starting on a non-empty slot
-	do {
-		if (!unordered_map_iterator_at_end(&iter)
-			&&
-			vector_size(iter._umap->_slots + iter._i)) {
-			break;
-		}
-		++iter._i;
-	} while (!unordered_map_iterator_at_end(&iter));
+	// make sure we're starting on a full slot
+	if (!unordered_map_iterator_at_end(&iter) && (umap->_ctrl[0] & UNORDERED_MAP_CTRL_EMPTY)) {
+		unordered_map_iterator_next(&iter);
+	}
 	return iter;
 }
 
-_JOS_API_FUNC void unordered_map_iterator_next(unordered_map_iterator_t* iter);
-
 _JOS_INLINE_FUNC _JOS_ALWAYS_INLINE map_key_t unordered_map_iterator_key(unordered_map_iterator_t* iter) {
 	if ( iter->_umap->_key_type == kMap_Type_Value )
-		return (map_key_t)vector_at(iter->_umap->_slots + iter->_i, iter->_j);
-	return *(map_key_t**)vector_at(iter->_umap->_slots + iter->_i, iter->_j);
+		return (map_key_t)_unordered_map_slot(iter->_umap, iter->_i);
+	return *(map_key_t**)_unordered_map_slot(iter->_umap, iter->_i);
 }
 
 _JOS_INLINE_FUNC _JOS_ALWAYS_INLINE map_value_t unordered_map_iterator_value(unordered_map_iterator_t* iter) {
-	return (map_value_t)((uintptr_t)vector_at(iter->_umap->_slots + iter->_i, iter->_j) + iter->_umap->_key_size);
+	return (map_value_t)((uintptr_t)_unordered_map_slot(iter->_umap, iter->_i) + iter->_umap->_key_size);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -447,27 +578,49 @@ _JOS_INLINE_FUNC _JOS_ALWAYS_INLINE void* _vector_at(vector_t* vec, size_t n)
 	return (void*)((char*)vec->_data + n*vec->_stride);
 }
 
-_JOS_INLINE_FUNC void _vector_check_grow(vector_t* vec) {
-	// is this contrived, or really better for a branch? only profiling will show...
-	if (vec->_size == vec->_capacity) {
+// move to an allocation for capacity elements, which may be the current one resized in place
+_JOS_INLINE_FUNC void _vector_set_capacity(vector_t* vec, size_t capacity) {
+	_JOS_ASSERT(capacity >= vec->_size);
+	void* base;
+	void* aligned;
+	if (!vec->_memory) {
+		// moving out of storage provided by the caller
 		if (vec->_alignment == kAllocAlign_None) {
-			// optimal growth ratio if we want to stand a chance to re-use memory for future growth		
-			vec->_capacity += vec->_capacity >> 1;
-			vec->_data = vec->_memory = vec->_allocator->realloc(vec->_allocator, vec->_memory, vec->_capacity * vec->_stride);
+			base = aligned = vec->_allocator->alloc(vec->_allocator, capacity * vec->_stride);
 		}
 		else {
-			//ZZZ: inefficient!
-			//TODO: realloc should support alignment (all allocations should)
-			const size_t data_size = vec->_capacity * vec->_stride;
-			vec->_capacity += vec->_capacity >> 1;
-			void* base;
-			void* aligned;
-			aligned_alloc(vec->_allocator, vec->_capacity * vec->_stride, vec->_alignment, &base, &aligned);
-			memcpy(aligned, vec->_data, data_size);
-			vec->_allocator->free(vec->_allocator, vec->_memory);
-			vec->_memory = base;
-			vec->_data = aligned;
+			aligned_alloc(vec->_allocator, capacity * vec->_stride, vec->_alignment, &base, &aligned);
+		}
+		_JOS_ASSERT(aligned);
+		memcpy(aligned, vec->_data, vec->_size * vec->_stride);
+	}
+	else if (vec->_alignment == kAllocAlign_None) {
+		base = aligned = vec->_allocator->realloc(vec->_allocator, vec->_memory, capacity * vec->_stride);
+	}
+	else {
+		aligned_realloc(vec->_allocator, vec->_memory, vec->_data, vec->_size * vec->_stride, capacity * vec->_stride, vec->_alignment, &base, &aligned);
+	}
+	vec->_memory = base;
+	vec->_data = aligned;
+	vec->_capacity = capacity;
+}
+
+// make room for count more elements
+_JOS_INLINE_FUNC void _vector_check_grow_n(vector_t* vec, size_t count) {
+	if (vec->_size + count > vec->_capacity) {
+		// optimal growth ratio if we want to stand a chance to re-use memory for future growth
+		size_t capacity = vec->_capacity + (vec->_capacity >> 1);
+		if (capacity < vec->_size + count) {
+			capacity = vec->_size + count;
 		}
+		_vector_set_capacity(vec, capacity);
+	}
+}
+
+_JOS_INLINE_FUNC void _vector_check_grow(vector_t* vec) {
+	// is this contrived, or really better for a branch? only profiling will show...
+	if (vec->_size == vec->_capacity) {
+		_vector_check_grow_n(vec, 1);
 	}
 }
 
@@ -498,6 +651,32 @@ _JOS_API_FUNC void vector_create_aligned(vector_t* vec, size_t capacity, size_t
 	vec->_size = 0;
 }
 
+_JOS_API_FUNC void vector_create_with_storage(vector_t* vec, void* storage, size_t capacity, size_t element_size, generic_allocator_t* allocator) {
+	assert(vec && storage && element_size && capacity && allocator);
+
+	vec->_allocator = allocator;
+	vec->_alignment = kAllocAlign_None;
+	vec->_memory = 0;
+	vec->_data = storage;
+	vec->_capacity = capacity;
+	vec->_stride = vec->_element_size = element_size;
+	vec->_size = 0;
+}
+
+_JOS_API_FUNC void vector_reserve(vector_t* vec, size_t capacity) {
+	if (capacity > vec->_capacity) {
+		_vector_set_capacity(vec, capacity);
+	}
+}
+
+_JOS_API_FUNC void vector_resize(vector_t* vec, size_t size) {
+	vector_reserve(vec, size);
+	if (size > vec->_size) {
+		memset((char*)vec->_data + vec->_size * vec->_stride, 0, (size - vec->_size) * vec->_stride);
+	}
+	vec->_size = size;
+}
+
 // add element to the end of vector
 _JOS_API_FUNC void vector_push_back(vector_t* vec, void* element)
 {
@@ -533,34 +712,49 @@ _JOS_API_FUNC void* vector_at(vector_t* vec, size_t n)
 }
 
 _JOS_API_FUNC jo_status_t vector_remove(vector_t* vec, const size_t at) {
-	if (!vec || at > vec->_size)
+	if (!vec || at >= vec->_size)
 		return _JO_STATUS_OUT_OF_RANGE;
 
-	if (vec->_size > 1) {
-		memcpy((char*)vec->_data + at, (char*)vec->_data + ((vec->_size - 1) * vec->_stride), vec->_stride);
+	if (at != vec->_size - 1) {
+		memcpy((char*)vec->_data + (at * vec->_stride), (char*)vec->_data + ((vec->_size - 1) * vec->_stride), vec->_stride);
 	}
 	--vec->_size;
 
 	return _JO_STATUS_SUCCESS;
 }
 
+_JOS_API_FUNC void vector_push_back_n(vector_t* vec, const void* elements, size_t count) {
+	_JOS_ASSERT(vec && (elements || !count));
+	_vector_check_grow_n(vec, count);
+	char* dest = (char*)vec->_data + vec->_size * vec->_stride;
+	if (vec->_stride == vec->_element_size) {
+		memcpy(dest, elements, count * vec->_element_size);
+	}
+	else {
+		const char* src = (const char*)elements;
+		for (size_t n = 0; n < count; ++n) {
+			memcpy(dest, src, vec->_element_size);
+			dest += vec->_stride;
+			src += vec->_element_size;
+		}
+	}
+	vec->_size += count;
+}
+
 _JOS_API_FUNC void vector_append(vector_t* dest, const vector_t* src) {
 	_JOS_ASSERT(src->_element_size == dest->_element_size);
 
-	size_t chunk_size = min(dest->_capacity - dest->_size, src->_size);
-	const char* src_ptr = src->_data;
-	if (chunk_size) {
-		memcpy((char*)dest->_data + dest->_size, src_ptr, src->_stride * chunk_size);
-		dest->_size += chunk_size;
-		src_ptr += src->_stride * chunk_size;
-		chunk_size = src->_size - chunk_size;
+	if (src->_stride == dest->_stride) {
+		_vector_check_grow_n(dest, src->_size);
+		memcpy((char*)dest->_data + dest->_size * dest->_stride, src->_data, src->_size * src->_stride);
+		dest->_size += src->_size;
 	}
 	else {
-		chunk_size = src->_size;
-	}
-	for (size_t n = 0; n < chunk_size; ++n) {
-		vector_push_back(dest, (void*)src_ptr);
-		src_ptr += src->_stride;
+		const char* src_ptr = (const char*)src->_data;
+		for (size_t n = 0; n < src->_size; ++n) {
+			vector_push_back(dest, (void*)src_ptr);
+			src_ptr += src->_stride;
+		}
 	}
 }
 
@@ -676,153 +870,146 @@ _JOS_API_FUNC void paged_list_destroy(paged_list_t* paged_list) {
 }
 
 _JOS_API_FUNC uint32_t map_str_hash_func(const void* key) {
-	const char* str = (const char*)key;
-	if (!str)
-		return 0;
-	const size_t str_len = strlen(str);
-	if (!str_len)
-		return 0;
-
-	// https://en.wikipedia.org/wiki/Pearson_hashing
-
-	static unsigned char kPermutations[256] = { 0 };
-	// first time we need to initialise with random permutations of [0..255]
-	if (kPermutations[0] == kPermutations[1]) {
-		for (int i = 0; i < 256; ++i) {
-			kPermutations[i] = (unsigned char)i;
-		}
-		for (int i = 0; i < 254; ++i) {
-			int idx = i + 1 + (rand() % (254 - i));
-			_JOS_SWAP(kPermutations[i], kPermutations[idx]);
-		}
-		// always swap the last two elements
-		_JOS_SWAP(kPermutations[254], kPermutations[255]);
-	}
+	return hash_fold32(hash_str64((const char*)key));
+}
 
-	unsigned char hash[4];
-	// 8 bit sub hashes
-	hash[0] = (str[0] + 0) % 255;
-	hash[1] = (str[0] + 1) % 255;
-	hash[2] = (str[0] + 2) % 255;
-	hash[3] = (str[0] + 3) % 255;
-	for (size_t n = 0; n < str_len; ++n) {
-		const unsigned char c = (unsigned char)str[n];
-		hash[0] = kPermutations[hash[0] ^ c];
-		hash[1] = kPermutations[hash[1] ^ c];
-		hash[2] = kPermutations[hash[2] ^ c];
-		hash[3] = kPermutations[hash[3] ^ c];
-	}
-	return *(uint32_t*)(hash);
+_JOS_INLINE_FUNC map_key_t _unordered_map_typed_key(unordered_map_t* umap, map_key_t key) {
+	return umap->_key_type == kMap_Type_Value ? key : *(map_key_t**)key;
 }
 
 _JOS_API_FUNC void unordered_map_create(unordered_map_t* umap, unordered_map_create_args_t* args, generic_allocator_t* allocator) {
 
+	_JOS_ASSERT(args->key_type == kMap_Type_Value || args->key_size == sizeof(void*));
+	memset(umap, 0, sizeof(unordered_map_t));
 	umap->_hash_func = args->hash_func;
 	umap->_cmp_func = args->cmp_func;
 	umap->_allocator = allocator;
 	umap->_value_size = args->value_size;
 	umap->_key_size = args->key_size;
 	umap->_key_type = args->key_type;
-	umap->_num_slots = 511;
-	umap->_occupancy = 0;
-	umap->_slots = allocator->alloc(allocator, sizeof(vector_t) * umap->_num_slots);
-	_JOS_ASSERT(args->key_type == kMap_Type_Value || sizeof(args->key_size) == sizeof(void*));
-	_JOS_ASSERT(umap->_slots);
-	for (size_t i = 0; i < umap->_num_slots; ++i) {
-		vector_create(umap->_slots + i, 32, args->key_size + args->value_size, allocator);
-	}
+	umap->_slot_stride = _JOS_ALIGN(args->key_size + args->value_size, sizeof(void*));
+}
+
+// control bytes, overflow counts, and slots, in one allocation
+_JOS_INLINE_FUNC size_t _unordered_map_slots_offset(size_t capacity) {
+	return _JOS_ALIGN(capacity + capacity / UNORDERED_MAP_GROUP_SIZE, sizeof(void*));
+}
+_JOS_INLINE_FUNC size_t _unordered_map_allocation_size(unordered_map_t* umap, size_t capacity) {
+	return _unordered_map_slots_offset(capacity) + capacity * umap->_slot_stride;
 }
 
 _JOS_API_FUNC size_t unordered_map_memory_footprint(unordered_map_t* umap) {
 	_JOS_ASSERT(umap);
-	size_t size = 0;
-	for (size_t i = 0; i < umap->_num_slots; ++i) {
-		size += vector_capacity(umap->_slots + i);
-	}
-	return (size* umap->_key_size + umap->_value_size) + umap->_num_slots*sizeof(vector_t);
+	return umap->_capacity ? _unordered_map_allocation_size(umap, umap->_capacity) : 0;
 }
 
 _JOS_API_FUNC void unordered_map_destroy(unordered_map_t* umap) {
-	for (size_t i = 0; i < umap->_num_slots; ++i) {
-		vector_destroy(umap->_slots + i);
+	if (umap->_ctrl) {
+		umap->_allocator->free(umap->_allocator, umap->_ctrl);
 	}
+	umap->_ctrl = umap->_overflow = umap->_slots = 0;
+	umap->_capacity = umap->_occupancy = 0;
 }
 
-_JOS_INLINE_FUNC map_key_t _unordered_map_typed_key(unordered_map_t* umap, map_key_t key) {
-	return umap->_key_type == kMap_Type_Value ? key : *(map_key_t**)key;
+// returns the slot index of key, or _capacity if it isn't in the map
+_JOS_INLINE_FUNC size_t _unordered_map_find(unordered_map_t* umap, map_key_t key, uint32_t hash) {	
+	unordered_map_probe_t probe = _unordered_map_probe_begin(umap->_ctrl, umap->_capacity, hash);
+	size_t i;
+	while ((i = _unordered_map_probe_next(&probe, umap->_ctrl, umap->_overflow, umap->_capacity)) != umap->_capacity) {
+		if (umap->_cmp_func(_unordered_map_typed_key(umap, _unordered_map_slot(umap, i)), key)) {
+			break;
+		}
+	}
+	return i;
 }
 
-typedef struct _map_slot_value {
-	vector_t* _slot;
-	size_t _i;
-	void* _value;
-} _map_slot_value_t;
-_JOS_INLINE_FUNC _map_slot_value_t _unordered_map_find(unordered_map_t* umap, map_key_t key) {	
-	uint32_t hash = umap->_hash_func(key);
-	size_t i = hash % umap->_num_slots;		
-	vector_t* slot_vector = umap->_slots + i;
-	for (size_t n = 0u; n < vector_size(slot_vector); ++n) {
-		const void* pair = vector_at(slot_vector, n);
-		const map_key_t typed_key = _unordered_map_typed_key(umap, pair);
-		if (umap->_cmp_func(typed_key, key)) {
-			return (struct _map_slot_value) {
-				._slot = slot_vector,
-					._i = n,
-					._value = (void*)((uintptr_t)pair + umap->_key_size)
-			};
+static bool _unordered_map_resize(unordered_map_t* umap, size_t capacity) {
+
+	uint8_t* memory = (uint8_t*)umap->_allocator->alloc(umap->_allocator, _unordered_map_allocation_size(umap, capacity));
+	if (!memory) {
+		return false;
+	}
+
+	unordered_map_t old = *umap;
+	umap->_ctrl = memory;
+	umap->_overflow = memory + capacity;
+	umap->_slots = memory + _unordered_map_slots_offset(capacity);
+	umap->_capacity = capacity;
+	_unordered_map_clear_table(umap->_ctrl, umap->_overflow, capacity);
+
+	for (size_t i = 0; i < old._capacity; ++i) {
+		if ((old._ctrl[i] & UNORDERED_MAP_CTRL_EMPTY) == 0) {
+			const void* pair = _unordered_map_slot(&old, i);
+			const uint32_t hash = umap->_hash_func(_unordered_map_typed_key(umap, pair));
+			memcpy(_unordered_map_slot(umap, _unordered_map_claim(umap->_ctrl, umap->_overflow, capacity, hash)), pair, umap->_slot_stride);
 		}
 	}
-	return (struct _map_slot_value) {
-		._slot = slot_vector
-	};
+	if (old._ctrl) {
+		umap->_allocator->free(umap->_allocator, old._ctrl);
+	}
+	return true;
 }
 
 _JOS_API_FUNC map_value_t unordered_map_find(unordered_map_t* umap, map_key_t key) {	
-	_map_slot_value_t sv = _unordered_map_find(umap, key);
-	return (map_value_t)sv._value;
+	if (!umap->_occupancy) {
+		return 0;
+	}
+	const size_t i = _unordered_map_find(umap, key, umap->_hash_func(key));
+	if (i == umap->_capacity) {
+		return 0;
+	}
+	return (map_value_t)((uintptr_t)_unordered_map_slot(umap, i) + umap->_key_size);
 }
 
 _JOS_API_FUNC bool unordered_map_insert(unordered_map_t* umap, map_key_t key, map_value_t item) {
-	_map_slot_value_t sv = _unordered_map_find(umap, key);
-	if (sv._value) {
-		// found, just poke the value
-		memcpy(sv._value, item, umap->_value_size);
-		return false;
+	const uint32_t hash = umap->_hash_func(key);
+	if (umap->_occupancy) {
+		const size_t i = _unordered_map_find(umap, key, hash);
+		if (i != umap->_capacity) {
+			// found, just poke the value
+			memcpy((void*)((uintptr_t)_unordered_map_slot(umap, i) + umap->_key_size), item, umap->_value_size);
+			return false;
+		}
+	}
+	// otherwise we need to add it, keeping the load factor at or below 7/8
+	if ((umap->_occupancy + 1) * 8 > umap->_capacity * 7) {
+		const size_t capacity = umap->_capacity ? umap->_capacity * 2 : UNORDERED_MAP_MIN_CAPACITY;
+		if (!_unordered_map_resize(umap, capacity)) {
+			return false;
+		}
 	}
-	// otherwise we need to add it 
+	uint8_t* pair = (uint8_t*)_unordered_map_slot(umap, _unordered_map_claim(umap->_ctrl, umap->_overflow, umap->_capacity, hash));
 	if (umap->_key_type == kMap_Type_Value) {
-		vector_push_back_pair(sv._slot, key, umap->_key_size, item, umap->_value_size);
+		memcpy(pair, key, umap->_key_size);
 	}
 	else {
-		vector_push_back_pair(sv._slot, &key, umap->_key_size, item, umap->_value_size);
+		memcpy(pair, &key, umap->_key_size);
 	}
+	memcpy(pair + umap->_key_size, item, umap->_value_size);
 	umap->_occupancy++;
 	return true;
 }
 
 _JOS_API_FUNC bool unordered_map_remove(unordered_map_t* umap, map_key_t key) {
-	_map_slot_value_t sv = _unordered_map_find(umap, key);
-	if (sv._value) {
-		vector_remove(sv._slot, sv._i);
-		return true;
+	if (!umap->_occupancy) {
+		return false;
+	}
+	const uint32_t hash = umap->_hash_func(key);
+	const size_t i = _unordered_map_find(umap, key, hash);
+	if (i == umap->_capacity) {
+		return false;
 	}
-	return false;
+	_unordered_map_unclaim(umap->_ctrl, umap->_overflow, umap->_capacity, hash, i);
+	umap->_occupancy--;
+	return true;
 }
 
 _JOS_API_FUNC void unordered_map_iterator_next(unordered_map_iterator_t* iter) {
-	if ((iter->_j + 1) < vector_size(iter->_umap->_slots + iter->_i)) {
-		++iter->_j;
-	}
-	else {
-		do {
-			++iter->_i;
-			if (!unordered_map_iterator_at_end(iter)
-				&&
-				vector_size(iter->_umap->_slots + iter->_i)) {
-				break;
-			}
-		} while (!unordered_map_iterator_at_end(iter));
-		iter->_j = 0;
+	unordered_map_t* umap = iter->_umap;
+	while (++iter->_i < umap->_capacity) {
+		if ((umap->_ctrl[iter->_i] & UNORDERED_MAP_CTRL_EMPTY) == 0) {
+			break;
+		}
 	}
 }
 
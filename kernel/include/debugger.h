@@ -27,9 +27,13 @@ typedef enum _debugger_packet_id {
     kDebuggerPacket_CPUID,
     kDebuggerPacket_MemoryMap,
 
+    // optional body: a key prefix, e.g. "kernel:", to dump just that namespace
     kDebuggerPacket_HiveDump,
     kDebuggerPacket_HiveSet,
     kDebuggerPacket_HiveGet,
+    kDebuggerPacket_HeapProfile,
+    // optional body: a u64 hive version, the response is a delta since then instead of a full snapshot (see hive.h)
+    kDebuggerPacket_HiveSnapshot,
     
     // response packets have a high bit set so that they can be filtered in the debugger
     kDebuggerPacket_Response_Mask = 0x800,
@@ -39,6 +43,8 @@ typedef enum _debugger_packet_id {
     kDebuggerPacket_RDMSR_Resp = (kDebuggerPacket_RDMSR + kDebuggerPacket_Response_Mask),
     kDebuggerPacket_CPUID_Resp = (kDebuggerPacket_CPUID + kDebuggerPacket_Response_Mask),
     kDebuggerPacket_HiveGet_Resp = (kDebuggerPacket_HiveGet + kDebuggerPacket_Response_Mask),
+    kDebuggerPacket_HeapProfile_Resp = (kDebuggerPacket_HeapProfile + kDebuggerPacket_Response_Mask),
+    kDebuggerPacket_HiveSnapshot_Resp = (kDebuggerPacket_HiveSnapshot + kDebuggerPacket_Response_Mask),
     
     kDebuggerPacket_End,
     
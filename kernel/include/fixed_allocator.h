@@ -19,13 +19,21 @@ typedef struct _fixed_allocator
     size_t      _count;
     uint32_t    _free;      // index of first free
 	uintptr_t	_end;		// upper memory bound for pool
+    size_t      _alloc_count;
+    size_t      _free_count;
 } fixed_allocator_t;
 
 // NOTE: size must include sizeof(fixed_allocator_t)
 _JOS_API_FUNC fixed_allocator_t* fixed_allocator_create(void* mem, size_t size, size_t allocUnitPow2);
 _JOS_API_FUNC void* fixed_allocator_alloc(fixed_allocator_t* pool, size_t size);
 _JOS_API_FUNC void fixed_allocator_free(fixed_allocator_t* pool, void* block);
+// returns the first free unit that is aligned, blocks can be freed with fixed_allocator_free
+_JOS_API_FUNC void* fixed_allocator_alloc_aligned(fixed_allocator_t* pool, size_t size, alloc_alignment_t alignment);
 _JOS_API_FUNC void fixed_allocator_clear(fixed_allocator_t* pool);
+// bytes left in free units
+_JOS_API_FUNC size_t fixed_allocator_available(fixed_allocator_t* pool);
+// all units are the same size so a fixed pool is never fragmented
+_JOS_API_FUNC void fixed_allocator_stats(fixed_allocator_t* pool, allocator_stats_t* stats);
 _JO_INLINE_FUNC bool fixed_allocator_in_pool(fixed_allocator_t* pool, void* ptr)
 {
 	const uintptr_t begin = (uintptr_t)(pool + 1);
@@ -57,6 +65,11 @@ _JOS_API_FUNC fixed_allocator_t* fixed_allocator_create(void* mem, size_t size,
     pool->_super.alloc = (generic_allocator_alloc_func_t)fixed_allocator_alloc;
     pool->_super.free = (generic_allocator_free_func_t)fixed_allocator_free;
     pool->_super.realloc = 0;
+    pool->_super.alloc_aligned = (generic_allocator_alloc_aligned_func_t)fixed_allocator_alloc_aligned;
+    pool->_super.free_aligned = (generic_allocator_free_aligned_func_t)fixed_allocator_free;
+    pool->_super.available = (generic_allocator_avail_func_t)fixed_allocator_available;
+    pool->_super.stats = (generic_allocator_stats_func_t)fixed_allocator_stats;
+    pool->_alloc_count = pool->_free_count = 0;
 
     return pool;
 }
@@ -71,6 +84,7 @@ _JOS_API_FUNC void* fixed_allocator_alloc(fixed_allocator_t* pool, size_t size)
     const uint32_t unit_size = 1<<pool->_size_p2;
     uint32_t* block = (uint32_t*)((uint8_t*)(pool+1) + pool->_free*unit_size);
     pool->_free = *block; // whatever next it points to
+    ++pool->_alloc_count;
     return block;
 }
 
@@ -80,9 +94,44 @@ _JOS_API_FUNC void fixed_allocator_free(fixed_allocator_t* pool, void* block)
         return;	
     const uint32_t unit_size = 1<<pool->_size_p2;    
     uint32_t* fblock = (uint32_t*)block;
+    // push onto the head of the free list
     *fblock = pool->_free;
-    uint32_t* free = (uint32_t*)((uint8_t*)(pool+1) + pool->_free*unit_size);
-    *free = (uint32_t)((uintptr_t)fblock - (uintptr_t)(pool+1))/unit_size;
+    pool->_free = (uint32_t)(((uintptr_t)fblock - (uintptr_t)(pool+1))/unit_size);
+    ++pool->_free_count;
+}
+
+_JOS_API_FUNC void* fixed_allocator_alloc_aligned(fixed_allocator_t* pool, size_t size, alloc_alignment_t alignment)
+{
+    const uintptr_t base = (uintptr_t)(pool+1);
+    if ( (size_t)alignment <= ((size_t)1<<pool->_size_p2) && _JOS_PTR_IS_ALIGNED(base, alignment) ) {
+        // every unit is aligned
+        return fixed_allocator_alloc(pool, size);
+    }
+    if((size_t)(1<<pool->_size_p2) < size)
+    {
+        return 0;
+    }
+
+    // walk the free list for an aligned unit and unlink it
+    const uint32_t unit_size = 1<<pool->_size_p2;
+    uint32_t* prev = 0;
+    uint32_t index = pool->_free;
+    while(index != (uint32_t)~0)
+    {
+        uint32_t* block = (uint32_t*)(base + (uintptr_t)index*unit_size);
+        if(_JOS_PTR_IS_ALIGNED(block, alignment))
+        {
+            if(prev)
+                *prev = *block;
+            else
+                pool->_free = *block;
+            ++pool->_alloc_count;
+            return block;
+        }
+        prev = block;
+        index = *block;
+    }
+    return 0;
 }
 
 _JOS_API_FUNC void fixed_allocator_clear(fixed_allocator_t* pool)
@@ -96,6 +145,26 @@ _JOS_API_FUNC void fixed_allocator_clear(fixed_allocator_t* pool)
         block += (unit_size >> 2);
     }
     *block = ~0u;
+    // everything is implicitly freed
+    pool->_free_count = pool->_alloc_count;
+}
+
+_JOS_API_FUNC size_t fixed_allocator_available(fixed_allocator_t* pool)
+{
+    return (pool->_count - (pool->_alloc_count - pool->_free_count)) << pool->_size_p2;
+}
+
+_JOS_API_FUNC void fixed_allocator_stats(fixed_allocator_t* pool, allocator_stats_t* stats)
+{
+    const size_t live = pool->_alloc_count - pool->_free_count;
+    stats->_used = live << pool->_size_p2;
+    stats->_free = (pool->_count - live) << pool->_size_p2;
+    stats->_largest_free = pool->_free != (uint32_t)~0 ? ((size_t)1 << pool->_size_p2) : 0;
+    stats->_allocated_blocks = live;
+    stats->_free_blocks = pool->_count - live;
+    stats->_alloc_count = pool->_alloc_count;
+    stats->_free_count = pool->_free_count;
+    stats->_fragmentation = 0;
 }
 
 
@@ -0,0 +1,208 @@
+#pragma once
+#ifndef _JOS_HASH_H
+#define _JOS_HASH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <jos.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// non-cryptographic hash functions
+//
+// hash_wy64 is wyhash (final4, public domain, https://github.com/wangyi-fudan/wyhash); it consumes
+// 16 bytes per step for medium keys and 48 bytes per step for long ones, so namespaced keys like
+// "kernel:hive_boot_size" are hashed in two steps.
+// hash_mix64 is the murmur3 64 bit finaliser, use it for integer and pointer keys; identity hashes
+// cluster badly in power of two tables.
+// hash_crc32c uses the SSE4.2 crc32 instruction if it's present and a table otherwise, it's meant
+// for checksums rather than for hash tables.
+
+#define HASH_WY64_DEFAULT_SEED	0
+
+// 64x64->128 bit multiply, low half in a and high half in b
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE void _hash_wymum(uint64_t* a, uint64_t* b) {
+#if defined(_MSC_VER)
+	unsigned __int64 hi;
+	*a = _umul128(*a, *b, &hi);
+	*b = hi;
+#else
+	const __uint128_t r = (__uint128_t)*a * *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#endif
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uint64_t _hash_wymix(uint64_t a, uint64_t b) {
+	_hash_wymum(&a, &b);
+	return a ^ b;
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uint64_t _hash_wyr8(const uint8_t* p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uint64_t _hash_wyr4(const uint8_t* p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uint64_t _hash_wyr3(const uint8_t* p, size_t k) {
+	return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+_JOS_INLINE_FUNC uint64_t hash_wy64(const void* data, size_t len, uint64_t seed) {
+
+	static const uint64_t kSecret[4] = { 0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull };
+
+	const uint8_t* p = (const uint8_t*)data;
+	seed ^= _hash_wymix(seed ^ kSecret[0], kSecret[1]);
+	uint64_t a, b;
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (_hash_wyr4(p) << 32) | _hash_wyr4(p + ((len >> 3) << 2));
+			b = (_hash_wyr4(p + len - 4) << 32) | _hash_wyr4(p + len - 4 - ((len >> 3) << 2));
+		}
+		else if (len > 0) {
+			a = _hash_wyr3(p, len);
+			b = 0;
+		}
+		else {
+			a = b = 0;
+		}
+	}
+	else {
+		size_t i = len;
+		if (i > 48) {
+			uint64_t see1 = seed, see2 = seed;
+			do {
+				seed = _hash_wymix(_hash_wyr8(p) ^ kSecret[1], _hash_wyr8(p + 8) ^ seed);
+				see1 = _hash_wymix(_hash_wyr8(p + 16) ^ kSecret[2], _hash_wyr8(p + 24) ^ see1);
+				see2 = _hash_wymix(_hash_wyr8(p + 32) ^ kSecret[3], _hash_wyr8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = _hash_wymix(_hash_wyr8(p) ^ kSecret[1], _hash_wyr8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = _hash_wyr8(p + i - 16);
+		b = _hash_wyr8(p + i - 8);
+	}
+	a ^= kSecret[1];
+	b ^= seed;
+	_hash_wymum(&a, &b);
+	return _hash_wymix(a ^ kSecret[0] ^ len, b ^ kSecret[1]);
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uint64_t hash_str64(const char* str) {
+	return str ? hash_wy64(str, strlen(str), HASH_WY64_DEFAULT_SEED) : 0;
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uint64_t hash_mix64(uint64_t key) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdull;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ull;
+	key ^= key >> 33;
+	return key;
+}
+
+// all 64 bits of a hash folded into 32
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uint32_t hash_fold32(uint64_t hash) {
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
+// CRC32C (Castagnoli), crc is the value returned from a previous call or 0 to start
+_JOS_API_FUNC uint32_t hash_crc32c(const void* data, size_t len, uint32_t crc);
+
+#if defined(_JOS_IMPLEMENT_HASH) && !defined(_JOS_HASH_IMPLEMENTED)
+#define _JOS_HASH_IMPLEMENTED
+
+// SSE4.2 crc32 instructions; the kernel is built with -nostdinc so only the lab (MSVC) build uses the intrinsics headers
+#if defined(_MSC_VER)
+#include <nmmintrin.h>
+#define _HASH_TARGET_SSE42
+#define _HASH_CRC32C_U64(crc, v)	_mm_crc32_u64((crc), (v))
+#define _HASH_CRC32C_U8(crc, v)		_mm_crc32_u8((crc), (v))
+#else
+#include <cpuid.h>
+#define _HASH_TARGET_SSE42			__attribute__((target("sse4.2")))
+#define _HASH_CRC32C_U64(crc, v)	__builtin_ia32_crc32di((crc), (v))
+#define _HASH_CRC32C_U8(crc, v)		__builtin_ia32_crc32qi((crc), (v))
+#endif
+
+// reflected Castagnoli polynomial
+#define _HASH_CRC32C_POLY	0x82f63b78u
+
+static uint32_t _hash_crc32c_table[256];
+// 0 until we've checked, then 1 for software and 2 for SSE4.2
+static int _hash_crc32c_impl = 0;
+
+_HASH_TARGET_SSE42
+static uint32_t _hash_crc32c_sse42(const uint8_t* p, size_t len, uint32_t crc) {
+	uint64_t crc64 = crc;
+	while (len >= sizeof(uint64_t)) {
+		crc64 = _HASH_CRC32C_U64(crc64, _hash_wyr8(p));
+		p += sizeof(uint64_t);
+		len -= sizeof(uint64_t);
+	}
+	crc = (uint32_t)crc64;
+	while (len--) {
+		crc = _HASH_CRC32C_U8(crc, *p++);
+	}
+	return crc;
+}
+
+static uint32_t _hash_crc32c_sw(const uint8_t* p, size_t len, uint32_t crc) {
+	while (len--) {
+		crc = _hash_crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+static bool _hash_has_sse42(void) {
+#if defined(_MSC_VER)
+	int regs[4];
+	__cpuid(regs, 1);
+	// ecx bit 20
+	return (regs[2] & (1 << 20)) != 0;
+#else
+	unsigned int eax, ebx, ecx = 0, edx;
+	return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE42);
+#endif
+}
+
+static void _hash_crc32c_initialise(void) {
+	if (_hash_has_sse42()) {
+		_hash_crc32c_impl = 2;
+		return;
+	}
+	for (uint32_t n = 0; n < 256; ++n) {
+		uint32_t crc = n;
+		for (int k = 0; k < 8; ++k) {
+			crc = (crc >> 1) ^ (_HASH_CRC32C_POLY & (0u - (crc & 1)));
+		}
+		_hash_crc32c_table[n] = crc;
+	}
+	_hash_crc32c_impl = 1;
+}
+
+_JOS_API_FUNC uint32_t hash_crc32c(const void* data, size_t len, uint32_t crc) {
+	if (!_hash_crc32c_impl) {
+		_hash_crc32c_initialise();
+	}
+	crc = ~crc;
+	crc = _hash_crc32c_impl == 2 ? _hash_crc32c_sse42((const uint8_t*)data, len, crc) : _hash_crc32c_sw((const uint8_t*)data, len, crc);
+	return ~crc;
+}
+
+#endif // _JOS_IMPLEMENT_HASH
+
+#endif // _JOS_HASH_H
@@ -0,0 +1,202 @@
+#pragma once
+#ifndef _JOS_HASHMAP_H
+#define _JOS_HASHMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <jos.h>
+#include <collections.h>
+#include <hash.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// typed hash maps
+//
+// _JOS_DEFINE_HASHMAP(name, key_type, value_type, hash_func, eq_func) defines name_t and its functions
+// for one key and value type. Keys and values are stored by value, the hash and equality functions are
+// called directly so they can be inlined, and everything is fixed stride; i.e. there is none of the
+// function pointer and memcpy overhead of unordered_map_t.
+// The table itself is the same SSE2 probed Swiss table as unordered_map_t, and is probed, claimed, and
+// emptied by the same helpers, see collections.h.
+//
+//  uint32_t hash_func(key_type key);
+//  bool eq_func(key_type a, key_type b);
+//
+// for example:
+//
+// _JOS_DEFINE_HASHMAP(symbol_map, const char*, uintptr_t, hashmap_str_hash, hashmap_str_eq)
+//
+// symbol_map_t map;
+// symbol_map_create(&map, allocator);
+// symbol_map_insert(&map, "kernel_main", 0x1000);
+// uintptr_t* address = symbol_map_find(&map, "kernel_main");
+//
+// size_t cursor = 0;
+// symbol_map_entry_t* entry;
+// while ((entry = symbol_map_iterate(&map, &cursor)) != 0) {
+//	...entry->_key, entry->_value
+// }
+// symbol_map_destroy(&map);
+//
+//NOTE: like unordered_map_t, entries move when the table grows. Keys are stored as given, string keys
+//      must outlive the map.
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uint32_t hashmap_u64_hash(uint64_t key) {
+	return hash_fold32(hash_mix64(key));
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE bool hashmap_u64_eq(uint64_t a, uint64_t b) {
+	return a == b;
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uint32_t hashmap_str_hash(const char* key) {
+	return hash_fold32(hash_str64(key));
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE bool hashmap_str_eq(const char* a, const char* b) {
+	return a == b || !strcmp(a, b);
+}
+
+#define _JOS_DEFINE_HASHMAP(name, key_type, value_type, hash_func, eq_func)\
+\
+typedef struct _##name##_entry {\
+	key_type	_key;\
+	value_type	_value;\
+} name##_entry_t;\
+\
+typedef struct _##name {\
+	uint8_t*			_ctrl;\
+	uint8_t*			_overflow;\
+	name##_entry_t*		_entries;\
+	size_t				_capacity;\
+	size_t				_occupancy;\
+	generic_allocator_t* _allocator;\
+} name##_t;\
+\
+_JOS_INLINE_FUNC void name##_create(name##_t* map, generic_allocator_t* allocator) {\
+	memset(map, 0, sizeof(name##_t));\
+	map->_allocator = allocator;\
+}\
+\
+_JOS_INLINE_FUNC void name##_destroy(name##_t* map) {\
+	if (map->_ctrl) {\
+		map->_allocator->free(map->_allocator, map->_ctrl);\
+	}\
+	map->_ctrl = map->_overflow = 0;\
+	map->_entries = 0;\
+	map->_capacity = map->_occupancy = 0;\
+}\
+\
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t name##_size(name##_t* map) {\
+	return map->_occupancy;\
+}\
+\
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t _##name##_entries_offset(size_t capacity) {\
+	return _JOS_ALIGN(capacity + capacity / UNORDERED_MAP_GROUP_SIZE, _Alignof(name##_entry_t));\
+}\
+\
+_JOS_INLINE_FUNC size_t name##_memory_footprint(name##_t* map) {\
+	return map->_capacity ? _##name##_entries_offset(map->_capacity) + map->_capacity * sizeof(name##_entry_t) : 0;\
+}\
+\
+/* returns the index of key, or _capacity if it isn't in the map */\
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t _##name##_find(name##_t* map, key_type key, uint32_t hash) {\
+	unordered_map_probe_t probe = _unordered_map_probe_begin(map->_ctrl, map->_capacity, hash);\
+	size_t i;\
+	while ((i = _unordered_map_probe_next(&probe, map->_ctrl, map->_overflow, map->_capacity)) != map->_capacity) {\
+		if (eq_func(map->_entries[i]._key, key)) {\
+			break;\
+		}\
+	}\
+	return i;\
+}\
+\
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t _##name##_claim(name##_t* map, uint32_t hash) {\
+	return _unordered_map_claim(map->_ctrl, map->_overflow, map->_capacity, hash);\
+}\
+\
+_JOS_INLINE_FUNC bool _##name##_resize(name##_t* map, size_t capacity) {\
+	const size_t entries_offset = _##name##_entries_offset(capacity);\
+	uint8_t* memory = (uint8_t*)map->_allocator->alloc(map->_allocator, entries_offset + capacity * sizeof(name##_entry_t));\
+	if (!memory) {\
+		return false;\
+	}\
+	name##_t old = *map;\
+	map->_ctrl = memory;\
+	map->_overflow = memory + capacity;\
+	map->_entries = (name##_entry_t*)(memory + entries_offset);\
+	map->_capacity = capacity;\
+	_unordered_map_clear_table(map->_ctrl, map->_overflow, capacity);\
+	for (size_t i = 0; i < old._capacity; ++i) {\
+		if ((old._ctrl[i] & UNORDERED_MAP_CTRL_EMPTY) == 0) {\
+			map->_entries[_##name##_claim(map, hash_func(old._entries[i]._key))] = old._entries[i];\
+		}\
+	}\
+	if (old._ctrl) {\
+		map->_allocator->free(map->_allocator, old._ctrl);\
+	}\
+	return true;\
+}\
+\
+/* returns 0 if key isn't in the map */\
+_JOS_INLINE_FUNC value_type* name##_find(name##_t* map, key_type key) {\
+	if (!map->_occupancy) {\
+		return 0;\
+	}\
+	const size_t i = _##name##_find(map, key, hash_func(key));\
+	return i == map->_capacity ? 0 : &map->_entries[i]._value;\
+}\
+\
+/* returns true if key was added, false if it was already in the map (the value is updated) or we're out of memory */\
+_JOS_INLINE_FUNC bool name##_insert(name##_t* map, key_type key, value_type value) {\
+	const uint32_t hash = hash_func(key);\
+	if (map->_occupancy) {\
+		const size_t i = _##name##_find(map, key, hash);\
+		if (i != map->_capacity) {\
+			map->_entries[i]._value = value;\
+			return false;\
+		}\
+	}\
+	if ((map->_occupancy + 1) * 8 > map->_capacity * 7) {\
+		if (!_##name##_resize(map, map->_capacity ? map->_capacity * 2 : UNORDERED_MAP_MIN_CAPACITY)) {\
+			return false;\
+		}\
+	}\
+	name##_entry_t* entry = map->_entries + _##name##_claim(map, hash);\
+	entry->_key = key;\
+	entry->_value = value;\
+	++map->_occupancy;\
+	return true;\
+}\
+\
+_JOS_INLINE_FUNC bool name##_remove(name##_t* map, key_type key) {\
+	if (!map->_occupancy) {\
+		return false;\
+	}\
+	const uint32_t hash = hash_func(key);\
+	const size_t i = _##name##_find(map, key, hash);\
+	if (i == map->_capacity) {\
+		return false;\
+	}\
+	_unordered_map_unclaim(map->_ctrl, map->_overflow, map->_capacity, hash, i);\
+	--map->_occupancy;\
+	return true;\
+}\
+\
+/* returns the entry at or after *cursor and moves the cursor past it, or 0 at the end */\
+_JOS_INLINE_FUNC name##_entry_t* name##_iterate(name##_t* map, size_t* cursor) {\
+	for (size_t i = *cursor; i < map->_capacity; ++i) {\
+		if ((map->_ctrl[i] & UNORDERED_MAP_CTRL_EMPTY) == 0) {\
+			*cursor = i + 1;\
+			return map->_entries + i;\
+		}\
+	}\
+	*cursor = map->_capacity;\
+	return 0;\
+}
+
+// common instantiations
+_JOS_DEFINE_HASHMAP(u64_ptr_map, uint64_t, void*, hashmap_u64_hash, hashmap_u64_eq)
+_JOS_DEFINE_HASHMAP(str_u32_map, const char*, uint32_t, hashmap_str_hash, hashmap_str_eq)
+
+#endif // _JOS_HASHMAP_H
@@ -53,6 +53,16 @@ Usage example:
 		}
 	}
 
+	// interned keys are hashed once, and have a single typed value which can be updated from hot paths.
+	// readers never take a lock and writers never block them, see hive_intern
+	hive_key_t pool_key = hive_intern(&hive, "kernel:pool");
+	hive_set_int(&hive, pool_key, available);
+	hive_add_int(&hive, pool_key, -4096);
+	long long pool;
+	if (hive_get_int(&hive, pool_key, &pool)) {
+		...
+	}
+
 */
 
 #include <jos.h>
@@ -61,11 +71,28 @@ Usage example:
 #include <stdlib.h>
 #include <stdarg.h>
 #include <collections.h>
+#include <hashmap.h>
 #include <string.h>
-
-typedef struct _hive {
-	unordered_map_t _keys;
-} hive_t;
+#include <stdio.h>
+
+// the few atomics the interned slots need; atomic.h and x86_64.h are GNU inline assembly so the MSVC lab build uses intrinsics
+#if defined(_MSC_VER)
+#define _hive_compiler_barrier()	_ReadWriteBarrier()
+#define _hive_pause()				_mm_pause()
+_JOS_INLINE_FUNC int _hive_cas(volatile int* object, int expected, int desired) {
+	return (int)_InterlockedCompareExchange((volatile long*)object, (long)desired, (long)expected);
+}
+_JOS_INLINE_FUNC uint64_t _hive_fetch_add_64(volatile uint64_t* object, uint64_t value) {
+	return (uint64_t)_InterlockedExchangeAdd64((volatile long long*)object, (long long)value);
+}
+#else
+#include <atomic.h>
+#include <x86_64.h>
+#define _hive_compiler_barrier()	__asm__ __volatile__ ("" ::: "memory")
+#define _hive_pause()				x86_64_pause_cpu()
+#define _hive_cas(object, expected, desired)	atomic_compare_exchange_strong((object), (expected), (desired))
+#define _hive_fetch_add_64(object, value)		atomic_fetch_add_64((object), (value))
+#endif
 
 typedef enum _hive_value_type {
 	kHiveValue_Int = 1,
@@ -73,6 +100,63 @@ typedef enum _hive_value_type {
 	kHiveValue_Ptr = 3,	
 } hive_value_type_t;
 
+typedef struct _hive_value {
+
+	hive_value_type_t   type;
+	union {
+		long long   as_int;
+		const char* as_str;
+		uintptr_t   as_ptr;
+	} value;
+
+} hive_value_t;
+
+// handle to an interned key, see hive_intern
+typedef uint32_t hive_key_t;
+#define HIVE_KEY_INVALID				0
+// interned keys live in fixed chunks of slots which never move, so readers don't need a lock
+#define HIVE_INTERNED_CHUNK_SLOTS		64
+#define HIVE_MAX_INTERNED_CHUNKS		64
+
+typedef struct _hive_slot_value {
+	// type 0 until the key is first set
+	hive_value_t		_value;
+	// hive version of the write
+	uint64_t			_version;
+} _hive_slot_value_t;
+
+// one slot per cache line, counters updated from different CPUs don't share one.
+// the value is double buffered; every write updates both copies in turn, bumping _sequence before each, 
+// and readers use the copy selected by the parity of _sequence, which the writer isn't touching. 
+// a reader only retries if a write completed while it was reading, it never waits for a writer.
+typedef struct _hive_slot {
+
+	volatile uint32_t	_sequence;
+	// serialises writers of this slot
+	volatile int		_write_lock;
+	const char*			_key;
+	_hive_slot_value_t	_values[2];
+
+} hive_slot_t;
+
+typedef struct _hive {
+	unordered_map_t _keys;
+	// interned key -> slot index
+	str_u32_map_t	_interned;
+	hive_slot_t*	_slot_chunks[HIVE_MAX_INTERNED_CHUNKS];
+	volatile uint32_t _num_slots;
+	// serialises hive_intern
+	volatile int	_intern_lock;
+	// every key, sorted, for hive_visit_prefix
+	const char**	_index;
+	size_t			_index_size;
+	size_t			_index_capacity;
+	// the version changes are stamped with, advanced by every snapshot. each key remembers the version it was last changed in
+	volatile uint64_t _version;
+	// deleted keys and when, for snapshot deltas
+	vector_t		_deleted;
+} hive_t;
+
 _JOS_API_FUNC  void hive_create(hive_t* hive, generic_allocator_t* allocator);
 // set/create a key -> value
 _JOS_API_FUNC  void hive_set(hive_t* hive, const char* key, ...);
@@ -86,11 +170,95 @@ _JOS_API_FUNC jo_status_t hive_lget(hive_t* hive, const char* key, vector_t* out
 _JOS_API_FUNC jo_status_t hive_delete(hive_t* hive, const char* key);
 // get the current hive in-memory size in bytes
 _JOS_API_FUNC size_t hive_memory_footprint(hive_t* hive);
-// iterate over each hive entry and invoke the callback
+// iterate over each hive entry and invoke the callback, in key order
 _JOS_API_FUNC void hive_visit_values(hive_t* hive, 
 	void (*visitor)(const char* key, vector_t* values, void*),
 	vector_t* values_storage,
 	void* user_data);
+// iterate over the entries with keys starting with prefix, i.e. a namespace like "kernel:", in key order.
+// only the matching keys are visited, not the whole hive
+_JOS_API_FUNC void hive_visit_prefix(hive_t* hive, const char* prefix,
+	void (*visitor)(const char* key, vector_t* values, void*),
+	vector_t* values_storage,
+	void* user_data);
+
+// returns a handle for key, the same one every time it's called with the same key string, or HIVE_KEY_INVALID if we're out of room.
+// interned keys hold a single int, string or pointer value and stay in the hive for as long as it exists.
+// they show up in hive_get and hive_visit_values like any other key but are only written through their handle,
+// don't use hive_set, hive_lpush or hive_delete with the same key string.
+//NOTE: like other keys the string is not copied and must outlive the hive.
+//      interning a new key adds it to the key index, so like hive_set it must not race with a hive_visit_*
+_JOS_API_FUNC hive_key_t hive_intern(hive_t* hive, const char* key);
+// setting an interned key never blocks readers, concurrent writers of the same key are serialised
+_JOS_API_FUNC void hive_set_int(hive_t* hive, hive_key_t key, long long value);
+_JOS_API_FUNC void hive_set_str(hive_t* hive, hive_key_t key, const char* value);
+_JOS_API_FUNC void hive_set_ptr(hive_t* hive, hive_key_t key, uintptr_t value);
+// atomically adds delta to an int value (a key which isn't set, or isn't an int, counts as 0) and returns the result
+_JOS_API_FUNC long long hive_add_int(hive_t* hive, hive_key_t key, long long delta);
+// lock free snapshot of an interned value, false if it hasn't been set
+_JOS_API_FUNC bool hive_get_value(hive_t* hive, hive_key_t key, hive_value_t* out_value);
+
+// typed getters, false if the key hasn't been set or holds a different type
+_JOS_INLINE_FUNC bool hive_get_int(hive_t* hive, hive_key_t key, long long* out_value) {
+	hive_value_t value;
+	if (!hive_get_value(hive, key, &value) || value.type != kHiveValue_Int) {
+		return false;
+	}
+	*out_value = value.value.as_int;
+	return true;
+}
+
+_JOS_INLINE_FUNC bool hive_get_str(hive_t* hive, hive_key_t key, const char** out_value) {
+	hive_value_t value;
+	if (!hive_get_value(hive, key, &value) || value.type != kHiveValue_Str) {
+		return false;
+	}
+	*out_value = value.value.as_str;
+	return true;
+}
+
+_JOS_INLINE_FUNC bool hive_get_ptr(hive_t* hive, hive_key_t key, uintptr_t* out_value) {
+	hive_value_t value;
+	if (!hive_get_value(hive, key, &value) || value.type != kHiveValue_Ptr) {
+		return false;
+	}
+	*out_value = value.value.as_ptr;
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// binary snapshots
+//
+// a snapshot is the whole hive, a delta is just the keys changed or deleted after a given hive version;
+// the header carries the version of the snapshot, pass it back in for the next delta.
+// everything is little endian and unaligned:
+//
+//	header:	u32 magic, u16 format, u16 flags, u64 since, u64 version
+//	record:	u8 kind, u16 key length, key (not 0 terminated), u32 value count, values
+//	value:	u8 hive_value_type_t, then an i64 or a u64 pointer, or a u16 length followed by the string
+//
+// and a kHiveRecord_End byte after the last record. kHiveRecord_Deleted records have no values.
+//NOTE: every snapshot advances the hive version, so changes made while one is taken are in the next delta
+
+#define HIVE_SNAPSHOT_MAGIC				0x53564948	// "HIVS"
+#define HIVE_SNAPSHOT_FORMAT			2
+#define HIVE_SNAPSHOT_FLAG_DELTA		1
+
+typedef enum _hive_record_kind {
+	kHiveRecord_End = 0,
+	kHiveRecord_Key = 1,
+	kHiveRecord_List = 2,
+	kHiveRecord_Deleted = 3,
+} hive_record_kind_t;
+
+// the version current changes are stamped with, the next snapshot will carry it
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uint64_t hive_version(hive_t* hive) {
+	return hive->_version;
+}
+
+// writes a snapshot of the hive to stream, or a delta of the changes after version since if it isn't 0.
+// returns _JO_STATUS_RESOURCE_EXHAUSTED if the stream didn't take all of it
+_JOS_API_FUNC jo_status_t hive_write_snapshot(hive_t* hive, uint64_t since, FILE* stream);
 
 #define _JOS_HIVE_VALUE_INT          (char)kHiveValue_Int
 #define _JOS_HIVE_VALUE_STR          (char)kHiveValue_Str
@@ -101,17 +269,6 @@ _JOS_API_FUNC void hive_visit_values(hive_t* hive,
 #define HIVE_VALUE_STR(x)       _JOS_HIVE_VALUE_STR, (const char*)(x)
 #define HIVE_VALUE_PTR(x)       _JOS_HIVE_VALUE_PTR, (uintptr_t)(x)
 
-typedef struct _hive_value {
-
-	hive_value_type_t   type;
-	union {
-		long long   as_int;
-		const char* as_str;
-		uintptr_t   as_ptr;
-	} value;
-
-} hive_value_t;
-
 #if defined(_JOS_IMPLEMENT_HIVE) && !defined(_JOS_HIVE_IMPLEMENTED)
 #define _JOS_HIVE_IMPLEMENTED
 
@@ -126,6 +283,8 @@ typedef enum _hive_entry_type_impl {
 typedef struct _hive_entry_impl {
 
 	_hive_entry_type_t _type;
+	// hive version of the last change
+	uint64_t	_version;
 	// > 0 if we're using _storage, < 0 if _storage contains a pointer to allocated memory (or a list)
 	int         _size;
 	//NOTE: this is used for a lot of things; if the number of values stored with this key is 
@@ -134,6 +293,12 @@ typedef struct _hive_entry_impl {
 
 } _hive_entry_t;
 
+typedef struct _hive_tombstone {
+	const char*	_key;
+	// hive version it was deleted in
+	uint64_t	_version;
+} _hive_tombstone_t;
+
 _JOS_INLINE_FUNC size_t _hive_param_pack_size(va_list* pack) {
 
 	size_t size = 0;
@@ -224,11 +389,201 @@ _JOS_API_FUNC  void hive_create(hive_t* hive, generic_allocator_t* allocator) {
 		.key_type = kMap_Type_Pointer
 	}, 
 	allocator);
+	str_u32_map_create(&hive->_interned, allocator);
+	memset(hive->_slot_chunks, 0, sizeof(hive->_slot_chunks));
+	hive->_num_slots = 0;
+	hive->_intern_lock = 0;
+	hive->_index = 0;
+	hive->_index_size = hive->_index_capacity = 0;
+	// 0 is reserved for "since the beginning"
+	hive->_version = 1;
+	vector_create(&hive->_deleted, 8, sizeof(_hive_tombstone_t), allocator);
+}
+
+// changes are stamped with the current version. it's only written when a snapshot is taken, so the cache line 
+// stays shared between the processors making changes
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE uint64_t _hive_current_version(hive_t* hive) {
+	return hive->_version;
+}
+
+static void _hive_tombstone_set(hive_t* hive, const char* key, uint64_t version) {
+	const size_t count = vector_size(&hive->_deleted);
+	for (size_t n = 0; n < count; ++n) {
+		_hive_tombstone_t* tombstone = (_hive_tombstone_t*)vector_at(&hive->_deleted, n);
+		if (!strcmp(tombstone->_key, key)) {
+			tombstone->_version = version;
+			return;
+		}
+	}
+	vector_push_back(&hive->_deleted, &(_hive_tombstone_t){ ._key = key, ._version = version });
+}
+
+// when a deleted key comes back
+static void _hive_tombstone_clear(hive_t* hive, const char* key) {
+	const size_t count = vector_size(&hive->_deleted);
+	for (size_t n = 0; n < count; ++n) {
+		_hive_tombstone_t* tombstone = (_hive_tombstone_t*)vector_at(&hive->_deleted, n);
+		if (!strcmp(tombstone->_key, key)) {
+			vector_remove(&hive->_deleted, n);
+			return;
+		}
+	}
+}
+
+// the position of the first key in the index which is not less than key
+_JOS_INLINE_FUNC size_t _hive_index_lower_bound(hive_t* hive, const char* key) {
+	size_t lo = 0;
+	size_t hi = hive->_index_size;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (strcmp(hive->_index[mid], key) < 0) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// if we can't grow the index the key still works, it just won't be visited
+static void _hive_index_insert(hive_t* hive, const char* key) {
+	if (hive->_index_size == hive->_index_capacity) {
+		generic_allocator_t* allocator = unordered_map_allocator(&hive->_keys);
+		const size_t capacity = hive->_index_capacity ? hive->_index_capacity * 2 : 32;
+		const char** index = (const char**)allocator->alloc(allocator, capacity * sizeof(const char*));
+		if (!index) {
+			return;
+		}
+		if (hive->_index) {
+			memcpy(index, hive->_index, hive->_index_size * sizeof(const char*));
+			allocator->free(allocator, hive->_index);
+		}
+		hive->_index = index;
+		hive->_index_capacity = capacity;
+	}
+	const size_t i = _hive_index_lower_bound(hive, key);
+	memmove(hive->_index + i + 1, hive->_index + i, (hive->_index_size - i) * sizeof(const char*));
+	hive->_index[i] = key;
+	++hive->_index_size;
+}
+
+static void _hive_index_remove(hive_t* hive, const char* key) {
+	const size_t i = _hive_index_lower_bound(hive, key);
+	if (i < hive->_index_size && !strcmp(hive->_index[i], key)) {
+		memmove(hive->_index + i, hive->_index + i + 1, (hive->_index_size - i - 1) * sizeof(const char*));
+		--hive->_index_size;
+	}
+}
+
+_JOS_INLINE_FUNC void _hive_intern_lock(hive_t* hive) {
+	while (_hive_cas(&hive->_intern_lock, 0, 1) != 0) {
+		_hive_pause();
+	}
+}
+
+_JOS_INLINE_FUNC void _hive_intern_unlock(hive_t* hive) {
+	_hive_compiler_barrier();
+	hive->_intern_lock = 0;
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE hive_slot_t* _hive_slot(hive_t* hive, uint32_t index) {
+	return hive->_slot_chunks[index / HIVE_INTERNED_CHUNK_SLOTS] + (index % HIVE_INTERNED_CHUNK_SLOTS);
+}
+
+// lock free read of an interned value.
+//NOTE: x86 doesn't reorder loads with other loads, so compiler barriers are all we need here
+_JOS_INLINE_FUNC bool _hive_slot_read(hive_slot_t* slot, hive_value_t* out_value) {
+	for (;;) {
+		const uint32_t sequence = slot->_sequence;
+		_hive_compiler_barrier();
+		const _hive_slot_value_t* value = slot->_values + (sequence & 1);
+		*out_value = value->_value;
+		_hive_compiler_barrier();
+		if (slot->_sequence == sequence) {
+			return out_value->type != 0;
+		}
+	}
+}
+
+// a writer may be interrupted by an IRQ handler that writes the same slot, so in the kernel interrupts are 
+// disabled while the slot's write lock is held
+#if defined(_JOS_KERNEL_BUILD) && !defined(_MSC_VER)
+typedef uint64_t _hive_irq_state_t;
+_JOS_INLINE_FUNC _hive_irq_state_t _hive_irq_save(void) {
+	const uint64_t rflags = x86_64_get_rflags();
+	x86_64_cli();
+	return rflags;
+}
+_JOS_INLINE_FUNC void _hive_irq_restore(_hive_irq_state_t rflags) {
+	// IF
+	if (rflags & (1 << 9)) {
+		x86_64_sti();
+	}
+}
+#else
+typedef int _hive_irq_state_t;
+#define _hive_irq_save()			0
+#define _hive_irq_restore(state)	(void)(state)
+#endif
+
+_JOS_INLINE_FUNC _hive_irq_state_t _hive_slot_lock(hive_slot_t* slot) {
+	const _hive_irq_state_t irq_state = _hive_irq_save();
+	while (_hive_cas(&slot->_write_lock, 0, 1) != 0) {
+		_hive_pause();
+	}
+	return irq_state;
+}
+
+_JOS_INLINE_FUNC void _hive_slot_unlock(hive_slot_t* slot, _hive_irq_state_t irq_state) {
+	_hive_compiler_barrier();
+	slot->_write_lock = 0;
+	_hive_irq_restore(irq_state);
+}
+
+_JOS_INLINE_FUNC hive_slot_t* _hive_slot_write_begin(hive_t* hive, hive_key_t key, _hive_irq_state_t* out_irq_state) {
+	_JOS_ASSERT(key != HIVE_KEY_INVALID && key <= hive->_num_slots);
+	hive_slot_t* slot = _hive_slot(hive, key - 1);
+	*out_irq_state = _hive_slot_lock(slot);
+	return slot;
+}
+
+// the current value and version, only valid while the slot is locked
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE const _hive_slot_value_t* _hive_slot_current(hive_slot_t* slot) {
+	return slot->_values;
+}
+
+// publish value to readers and release the slot.
+// the version is read with the slot locked, a snapshot locks the slot after advancing it (see hive_write_snapshot)
+_JOS_INLINE_FUNC void _hive_slot_write_end(hive_t* hive, hive_slot_t* slot, const hive_value_t* value, _hive_irq_state_t irq_state) {
+	const _hive_slot_value_t update = { ._value = *value, ._version = _hive_current_version(hive) };
+	// readers move to copy 1 while we update copy 0, then back to copy 0 while we update copy 1.
+	// x86 doesn't reorder stores with other stores so, again, compiler barriers are enough
+	slot->_sequence = slot->_sequence + 1;
+	_hive_compiler_barrier();
+	slot->_values[0] = update;
+	_hive_compiler_barrier();
+	slot->_sequence = slot->_sequence + 1;
+	_hive_compiler_barrier();
+	slot->_values[1] = update;
+	_hive_slot_unlock(slot, irq_state);
+}
+
+// the slot of an interned key string, or 0
+_JOS_INLINE_FUNC hive_slot_t* _hive_find_slot(hive_t* hive, const char* key) {
+	_hive_intern_lock(hive);
+	const uint32_t* index = str_u32_map_find(&hive->_interned, key);
+	_hive_intern_unlock(hive);
+	return index ? _hive_slot(hive, *index) : 0;
 }
 
 _JOS_API_FUNC size_t hive_memory_footprint(hive_t* hive) {
 	_JOS_ASSERT(hive);
 	size_t size = sizeof(hive_t) + unordered_map_memory_footprint(&hive->_keys);
+	size += str_u32_map_memory_footprint(&hive->_interned);
+	size += ((hive->_num_slots + HIVE_INTERNED_CHUNK_SLOTS - 1) / HIVE_INTERNED_CHUNK_SLOTS) * HIVE_INTERNED_CHUNK_SLOTS * sizeof(hive_slot_t);
+	size += hive->_index_capacity * sizeof(const char*);
+	size += vector_capacity(&hive->_deleted) * vector_element_size(&hive->_deleted);
 	unordered_map_iterator_t iter = unordered_map_iterator_begin(&hive->_keys);
 	while (!unordered_map_iterator_at_end(&iter)) {
 
@@ -302,9 +657,10 @@ _JOS_API_FUNC void hive_set(hive_t* hive, const char* key, ...) {
 		}
 
 		_hive_parse_parameter_pack(&args, pack);
+		existing->_version = _hive_current_version(hive);
 	}
 	else {
-		_hive_entry_t entry = { ._type = kHiveEntry_Key };
+		_hive_entry_t entry = { ._type = kHiveEntry_Key, ._version = _hive_current_version(hive) };
 		char* pack;
 
 		// if we can store the entry in-situ instead of allocating memory we will
@@ -322,6 +678,8 @@ _JOS_API_FUNC void hive_set(hive_t* hive, const char* key, ...) {
 		_hive_parse_parameter_pack(&args, pack);
 
 		unordered_map_insert(&hive->_keys, (map_key_t)key, (map_value_t)&entry);
+		_hive_index_insert(hive, key);
+		_hive_tombstone_clear(hive, key);
 	}
 
 	va_end(args);
@@ -378,7 +736,13 @@ _JOS_API_FUNC void hive_lpush(hive_t* hive, const char* key, ...) {
 
 	if (!entry) {
 		// add as new entry to the hive
+		base._version = _hive_current_version(hive);
 		unordered_map_insert(&hive->_keys, (map_key_t)key, (map_value_t)&base);
+		_hive_index_insert(hive, key);
+		_hive_tombstone_clear(hive, key);
+	}
+	else {
+		entry->_version = _hive_current_version(hive);
 	}
 }
 
@@ -388,7 +752,19 @@ _JOS_API_FUNC jo_status_t hive_get(hive_t* hive, const char* key, vector_t* out_
 
 	_hive_entry_t* entry = _hive_find(hive, key);
 	if (!entry) {
-		return _JO_STATUS_NOT_FOUND;
+		// it may be an interned key
+		if (!hive || !key) {
+			return _JO_STATUS_NOT_FOUND;
+		}
+		hive_slot_t* slot = _hive_find_slot(hive, key);
+		hive_value_t hive_value;
+		if (!slot || !_hive_slot_read(slot, &hive_value)) {
+			return _JO_STATUS_NOT_FOUND;
+		}
+		if (out_values) {
+			vector_push_back(out_values, &hive_value);
+		}
+		return _JO_STATUS_SUCCESS;
 	}
 	if (!out_values) {
 		return _JO_STATUS_SUCCESS;
@@ -488,38 +864,265 @@ _JOS_API_FUNC jo_status_t hive_delete(hive_t* hive, const char* key) {
 
 	//ZZZ: this is a bit inefficient (we've already located the key above)
 	unordered_map_remove(&hive->_keys, key);
+	_hive_index_remove(hive, key);
+	_hive_tombstone_set(hive, key, _hive_current_version(hive));
 
 	return _JO_STATUS_SUCCESS;
 }
 
+_JOS_API_FUNC void hive_visit_prefix(hive_t* hive, const char* prefix,
+		void (*visitor)(const char* key, vector_t* values, void*),
+		vector_t* values_storage,
+		void* user_data) {
+	if (!hive || !hive->_index_size)
+		return;
+	vector_reset(values_storage);
+
+	for (size_t i = _hive_index_lower_bound(hive, prefix); i < hive->_index_size; ++i) {
+
+		const char* key = hive->_index[i];
+		const char* p = prefix;
+		while (*p && *p == key[p - prefix]) {
+			++p;
+		}
+		if (*p) {
+			// past the last key with this prefix
+			break;
+		}
+
+		_hive_entry_t* entry = _hive_find(hive, key);
+		if (entry) {
+			switch (entry->_type) {
+			case kHiveEntry_Key:
+				hive_get(hive, key, values_storage);
+				break;
+			case kHiveEntry_List:
+				hive_lget(hive, key, values_storage);
+				break;
+			}
+		}
+		else if (_JO_FAILED(hive_get(hive, key, values_storage))) {
+			// an interned key which hasn't been set yet
+			continue;
+		}
+		visitor(key, values_storage, user_data);
+		vector_reset(values_storage);
+	}
+}
+
 _JOS_API_FUNC void hive_visit_values(hive_t* hive, 
 		void (*visitor)(const char* key, vector_t* values, void*), 
 		vector_t* values_storage, 
 		void* user_data) {
-	size_t count = hive ? unordered_map_size(&hive->_keys) : 0;
-	if (!count)
-		return;
-	vector_reset(values_storage);
+	hive_visit_prefix(hive, "", visitor, values_storage, user_data);
+}
 
-	unordered_map_iterator_t iter = unordered_map_iterator_begin(&hive->_keys);
-	while (!unordered_map_iterator_at_end(&iter)) {
+_JOS_API_FUNC hive_key_t hive_intern(hive_t* hive, const char* key) {
 
-		const char* key = (const char*)unordered_map_iterator_key(&iter);
-		_hive_entry_t* entry = (_hive_entry_t*)unordered_map_iterator_value(&iter);
+	_JOS_ASSERT(hive && key);
+	hive_key_t handle = HIVE_KEY_INVALID;
+	_hive_intern_lock(hive);
+	const uint32_t* index = str_u32_map_find(&hive->_interned, key);
+	if (index) {
+		handle = *index + 1;
+	}
+	else {
+		const uint32_t n = hive->_num_slots;
+		const size_t chunk = n / HIVE_INTERNED_CHUNK_SLOTS;
+		if (chunk < HIVE_MAX_INTERNED_CHUNKS) {
+			if (!hive->_slot_chunks[chunk]) {
+				generic_allocator_t* allocator = unordered_map_allocator(&hive->_keys);
+				hive_slot_t* slots = (hive_slot_t*)allocator_alloc_aligned(allocator, HIVE_INTERNED_CHUNK_SLOTS * sizeof(hive_slot_t), kAllocAlign_64);
+				if (slots) {
+					memset(slots, 0, HIVE_INTERNED_CHUNK_SLOTS * sizeof(hive_slot_t));
+				}
+				hive->_slot_chunks[chunk] = slots;
+			}
+			if (hive->_slot_chunks[chunk] && str_u32_map_insert(&hive->_interned, key, n)) {
+				_hive_slot(hive, n)->_key = key;
+				_hive_index_insert(hive, key);
+				// publish the slot, readers of _num_slots (i.e. hive_get_value) see it fully initialised
+				_hive_compiler_barrier();
+				hive->_num_slots = n + 1;
+				handle = n + 1;
+			}
+		}
+	}
+	_hive_intern_unlock(hive);
+	return handle;
+}
+
+_JOS_API_FUNC void hive_set_int(hive_t* hive, hive_key_t key, long long value) {
+	_hive_irq_state_t irq_state;
+	hive_slot_t* slot = _hive_slot_write_begin(hive, key, &irq_state);
+	hive_value_t hive_value = { .type = kHiveValue_Int };
+	hive_value.value.as_int = value;
+	_hive_slot_write_end(hive, slot, &hive_value, irq_state);
+}
+
+_JOS_API_FUNC void hive_set_str(hive_t* hive, hive_key_t key, const char* value) {
+	_hive_irq_state_t irq_state;
+	hive_slot_t* slot = _hive_slot_write_begin(hive, key, &irq_state);
+	hive_value_t hive_value = { .type = kHiveValue_Str };
+	hive_value.value.as_str = value;
+	_hive_slot_write_end(hive, slot, &hive_value, irq_state);
+}
+
+_JOS_API_FUNC void hive_set_ptr(hive_t* hive, hive_key_t key, uintptr_t value) {
+	_hive_irq_state_t irq_state;
+	hive_slot_t* slot = _hive_slot_write_begin(hive, key, &irq_state);
+	hive_value_t hive_value = { .type = kHiveValue_Ptr };
+	hive_value.value.as_ptr = value;
+	_hive_slot_write_end(hive, slot, &hive_value, irq_state);
+}
+
+_JOS_API_FUNC long long hive_add_int(hive_t* hive, hive_key_t key, long long delta) {
+	_hive_irq_state_t irq_state;
+	hive_slot_t* slot = _hive_slot_write_begin(hive, key, &irq_state);
+	const hive_value_t* current = &_hive_slot_current(slot)->_value;
+	hive_value_t hive_value = { .type = kHiveValue_Int };
+	hive_value.value.as_int = (current->type == kHiveValue_Int ? current->value.as_int : 0) + delta;
+	_hive_slot_write_end(hive, slot, &hive_value, irq_state);
+	return hive_value.value.as_int;
+}
+
+_JOS_API_FUNC bool hive_get_value(hive_t* hive, hive_key_t key, hive_value_t* out_value) {
+	if (key == HIVE_KEY_INVALID || key > hive->_num_slots) {
+		return false;
+	}
+	return _hive_slot_read(_hive_slot(hive, key - 1), out_value);
+}
 
-		switch (entry->_type) {
-		case kHiveEntry_Key:
-			hive_get(hive, key, values_storage);
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE bool _hive_write(FILE* stream, const void* data, size_t size) {
+	return !size || (size_t)fwrite((const char*)data, 1, size, stream) == size;
+}
+
+_JOS_INLINE_FUNC bool _hive_write_u8(FILE* stream, uint8_t value) {
+	return _hive_write(stream, &value, sizeof(value));
+}
+
+_JOS_INLINE_FUNC bool _hive_write_u16(FILE* stream, uint16_t value) {
+	return _hive_write(stream, &value, sizeof(value));
+}
+
+_JOS_INLINE_FUNC bool _hive_write_u32(FILE* stream, uint32_t value) {
+	return _hive_write(stream, &value, sizeof(value));
+}
+
+_JOS_INLINE_FUNC bool _hive_write_u64(FILE* stream, uint64_t value) {
+	return _hive_write(stream, &value, sizeof(value));
+}
+
+// strings longer than 64K are truncated
+_JOS_INLINE_FUNC bool _hive_write_str(FILE* stream, const char* str) {
+	const size_t len = str ? strlen(str) : 0;
+	const uint16_t len16 = len > 0xffff ? 0xffff : (uint16_t)len;
+	return _hive_write_u16(stream, len16) && _hive_write(stream, str, len16);
+}
+
+static bool _hive_write_record(FILE* stream, hive_record_kind_t kind, const char* key, vector_t* values) {
+	const size_t count = values ? vector_size(values) : 0;
+	if (!_hive_write_u8(stream, (uint8_t)kind) || !_hive_write_str(stream, key)) {
+		return false;
+	}
+	if (kind == kHiveRecord_Deleted) {
+		return true;
+	}
+	// lists can hold any number of values
+	if (count > 0xffffffffull || !_hive_write_u32(stream, (uint32_t)count)) {
+		return false;
+	}
+	for (size_t n = 0; n < count; ++n) {
+		hive_value_t* hive_value = (hive_value_t*)vector_at(values, n);
+		if (!_hive_write_u8(stream, (uint8_t)hive_value->type)) {
+			return false;
+		}
+		bool ok;
+		switch (hive_value->type) {
+		case kHiveValue_Int:
+			ok = _hive_write_u64(stream, (uint64_t)hive_value->value.as_int);
+			break;
+		case kHiveValue_Str:
+			ok = _hive_write_str(stream, hive_value->value.as_str);
 			break;
-		case kHiveEntry_List:
-			hive_lget(hive, key, values_storage);
+		case kHiveValue_Ptr:
+			ok = _hive_write_u64(stream, (uint64_t)hive_value->value.as_ptr);
 			break;
+		default:
+			ok = false;
 		}
-		visitor(key, values_storage, user_data);
-		vector_reset(values_storage);
+		if (!ok) {
+			return false;
+		}
+	}
+	return true;
+}
 
-		unordered_map_iterator_next(&iter);
+_JOS_API_FUNC jo_status_t hive_write_snapshot(hive_t* hive, uint64_t since, FILE* stream) {
+
+	_JOS_ASSERT(hive && stream);
+
+	// the snapshot covers every change stamped with this version or earlier, later ones are stamped with the next.
+	// interned values are read with their slot locked so a write that read this version has been published by then
+	const uint64_t version = _hive_fetch_add_64(&hive->_version, 1);
+	
+	bool ok = _hive_write(stream, &(uint32_t){ HIVE_SNAPSHOT_MAGIC }, sizeof(uint32_t))
+		&& _hive_write_u16(stream, HIVE_SNAPSHOT_FORMAT)
+		&& _hive_write_u16(stream, since ? HIVE_SNAPSHOT_FLAG_DELTA : 0)
+		&& _hive_write_u64(stream, since)
+		&& _hive_write_u64(stream, version);
+
+	hive_value_t values_storage[16];
+	vector_t values;
+	vector_create_with_storage(&values, values_storage, 16, sizeof(hive_value_t), unordered_map_allocator(&hive->_keys));
+
+	for (size_t i = 0; ok && i < hive->_index_size; ++i) {
+
+		const char* key = hive->_index[i];
+		_hive_entry_t* entry = _hive_find(hive, key);
+		if (entry) {
+			if (entry->_version <= since) {
+				continue;
+			}
+			if (entry->_type == kHiveEntry_Key) {
+				hive_get(hive, key, &values);
+				ok = _hive_write_record(stream, kHiveRecord_Key, key, &values);
+			}
+			else {
+				hive_lget(hive, key, &values);
+				ok = _hive_write_record(stream, kHiveRecord_List, key, &values);
+			}
+		}
+		else {
+			hive_slot_t* slot = _hive_find_slot(hive, key);
+			if (!slot) {
+				continue;
+			}
+			const _hive_irq_state_t irq_state = _hive_slot_lock(slot);
+			_hive_slot_value_t current = *_hive_slot_current(slot);
+			_hive_slot_unlock(slot, irq_state);
+			if (!current._value.type || current._version <= since) {
+				continue;
+			}
+			vector_push_back(&values, &current._value);
+			ok = _hive_write_record(stream, kHiveRecord_Key, key, &values);
+		}
+		vector_reset(&values);
+	}
+	vector_destroy(&values);
+
+	if (since) {
+		const size_t count = vector_size(&hive->_deleted);
+		for (size_t n = 0; ok && n < count; ++n) {
+			_hive_tombstone_t* tombstone = (_hive_tombstone_t*)vector_at(&hive->_deleted, n);
+			if (tombstone->_version > since) {
+				ok = _hive_write_record(stream, kHiveRecord_Deleted, tombstone->_key, 0);
+			}
+		}
 	}
+
+	ok = ok && _hive_write_u8(stream, kHiveRecord_End);
+	return ok ? _JO_STATUS_SUCCESS : _JO_STATUS_RESOURCE_EXHAUSTED;
 }
 
 #endif
\ No newline at end of file
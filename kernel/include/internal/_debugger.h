@@ -69,6 +69,26 @@ typedef struct _debugger_packet_breakpoint_info {
 	uint8_t     _edc;
 } _JOS_PACKED debugger_packet_breakpoint_info_t;
 
+typedef struct _debugger_packet_heap_profile_resp {
+	uint64_t	_live_bytes;
+	uint64_t	_peak_bytes;
+	uint64_t	_alloc_count;
+	uint64_t	_free_count;
+	uint64_t	_untracked_count;
+	uint64_t	_ms_since_boot;
+	// NOTE: an array of _num_call_sites debugger_heap_call_site_t follows this packet
+	uint32_t	_num_call_sites;
+} _JOS_PACKED debugger_packet_heap_profile_resp_t;
+
+typedef struct _debugger_heap_call_site {
+	// relative to .text, i.e. what pdb_index_symbol_name_for_address expects
+	uint32_t	_rva;
+	uint64_t	_live_bytes;
+	uint64_t	_peak_bytes;
+	uint64_t	_live_count;
+	uint64_t	_total_allocs;
+} _JOS_PACKED debugger_heap_call_site_t;
+
 typedef struct _debugger_bstr {
 	uint16_t	_len;	
 } _JOS_PACKED _debugger_bstr_t;
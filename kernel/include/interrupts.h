@@ -5,6 +5,9 @@
 
 #define _JOS_KERNEL_NUM_EXCEPTIONS      32
 
+// inter-processor interrupt vectors (see x86_64.asm)
+#define _JOS_KERNEL_IPI_TLB_SHOOTDOWN   240
+
 typedef struct _interrupt_stack
 {    
     // bottom of stack (rsp)
@@ -3,6 +3,7 @@
 #define _JOS_H
 
 #include <joBase.h>
+#include <string.h>
 
 #if defined(__clang__) || defined(__GNUC__)
     #define ASM_SYNTAX_ATNT    
@@ -55,12 +56,39 @@ typedef void  (*generic_allocator_free_func_t)(struct _generic_allocator*, void*
 // allocate bytes. ALLWAYS a minimum of 8 byte aligned
 typedef void* (*generic_allocator_realloc_func_t)(struct _generic_allocator*, void*, size_t);
 typedef size_t (*generic_allocator_avail_func_t)(struct _generic_allocator*);
+// allocate bytes aligned to alignment, which must be a power of two
+typedef void* (*generic_allocator_alloc_aligned_func_t)(struct _generic_allocator*, size_t, alloc_alignment_t);
+// free memory returned by alloc_aligned
+typedef void  (*generic_allocator_free_aligned_func_t)(struct _generic_allocator*, void*);
+
+// allocator statistics, all sizes are in bytes
+typedef struct _allocator_stats {
+    // memory handed out, including any per-block overhead, and memory left
+    size_t      _used;
+    size_t      _free;
+    // the largest single allocation that can currently succeed
+    size_t      _largest_free;
+    // number of live allocations, and the number of separate free blocks the free memory is split into
+    size_t      _allocated_blocks;
+    size_t      _free_blocks;
+    // running totals
+    size_t      _alloc_count;
+    size_t      _free_count;
+    // 0 when all free memory is in one block, approaching 100 as it is spread over many small blocks 
+    unsigned    _fragmentation;
+} allocator_stats_t;
+typedef void  (*generic_allocator_stats_func_t)(struct _generic_allocator*, allocator_stats_t*);
 
 typedef struct _generic_allocator {
     generic_allocator_alloc_func_t      alloc;
     generic_allocator_free_func_t       free;
     generic_allocator_realloc_func_t    realloc;
     generic_allocator_avail_func_t      available;
+    //NOTE: optional, see allocator_alloc_aligned for the fallback used if these are 0
+    generic_allocator_alloc_aligned_func_t  alloc_aligned;
+    generic_allocator_free_aligned_func_t   free_aligned;
+    //NOTE: optional, see allocator_get_stats
+    generic_allocator_stats_func_t          stats;
 
 } generic_allocator_t;
 
@@ -89,8 +117,11 @@ typedef struct _dynamic_allocation_policy {
 #define PAGE_EXECUTE_READ       0x20
 #define PAGE_EXECUTE_READWRITE  0x40
 #define PAGE_GUARD             0x100
+// memory types, the default is write-back. 
+// only one of these should be given; write-combining and write-through need PAT support, see pagetables.c
 #define PAGE_NOCACHE           0x200
 #define PAGE_WRITECOMBINE      0x400
+#define PAGE_WRITETHROUGH      0x800
 
 // page allocator interface
 // pages can be allocated and protected
@@ -161,6 +192,8 @@ extern uint16_t kJosKernelCS;
 
 #define _JOS_PACKED_ __attribute((packed))
 #define _JOS_UNREACHABLE() __builtin_unreachable()
+// address the current function will return to, i.e. the call site
+#define _JOS_RETURN_ADDRESS() ((uintptr_t)__builtin_return_address(0))
 
 void trace(const char* channel, const char* msg,...);
 #define _JOS_KTRACE_CHANNEL(channel, msg, ...) trace(channel, msg, ##__VA_ARGS__)
@@ -210,6 +243,12 @@ if(!(cond))\
 #define _JOS_INLINE_FUNC static
 #define _JOS_API_FUNC extern
 #define _JOS_BOCHS_DBGBREAK() __debugbreak()
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define _JOS_RETURN_ADDRESS() ((uintptr_t)_ReturnAddress())
+#else
+#define _JOS_RETURN_ADDRESS() ((uintptr_t)__builtin_return_address(0))
+#endif
 
 #define _JOS_KTRACE_CHANNEL(channel, msg,...)
 #define _JOS_KTRACE(msg,...)
@@ -240,6 +279,28 @@ if(!(cond))\
 #define _JOS_ALIGN(val, alignment)\
     (((uintptr_t)val + ((uintptr_t)alignment - 1)) & ~((uintptr_t)alignment - 1))
 
+// index of the lowest set bit of x, x must not be 0
+_JOS_INLINE_FUNC unsigned jos_ctz32(uint32_t x) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(x);
+#endif
+}
+
+// number of leading zero bits of x, x must not be 0
+_JOS_INLINE_FUNC unsigned jos_clz64(uint64_t x) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - (unsigned)index;
+#else
+    return (unsigned)__builtin_clzll(x);
+#endif
+}
+
 _JOS_INLINE_FUNC void aligned_alloc(generic_allocator_t* allocator, size_t bytes, alloc_alignment_t alignment, 
                                     void** out_alloc_base, void** out_alloc_aligned) {
     if (!allocator || !bytes) {
@@ -256,6 +317,80 @@ _JOS_INLINE_FUNC void aligned_alloc(generic_allocator_t* allocator, size_t bytes
     }
 }
 
+// resize memory allocated with aligned_alloc from bytes to new_bytes, keeping the contents.
+// this goes through the allocator's realloc, which may be able to resize the block in place; if the block 
+// moves and its alignment offset changes the contents are moved down into the new aligned position.
+_JOS_INLINE_FUNC void aligned_realloc(generic_allocator_t* allocator, void* alloc_base, void* alloc_aligned, size_t bytes,
+                                    size_t new_bytes, alloc_alignment_t alignment, 
+                                    void** out_alloc_base, void** out_alloc_aligned) {
+    const size_t offset = (size_t)((uintptr_t)alloc_aligned - (uintptr_t)alloc_base);
+    void* ptr = allocator->realloc(allocator, alloc_base, new_bytes + (size_t)alignment - 1);
+    *out_alloc_base = ptr;
+    if (!ptr) {
+        *out_alloc_aligned = 0;
+        return;
+    }
+    *out_alloc_aligned = (void*)_JOS_ALIGN(ptr, alignment);
+    if ((uintptr_t)*out_alloc_aligned - (uintptr_t)ptr != offset) {
+        memmove(*out_alloc_aligned, (char*)ptr + offset, bytes < new_bytes ? bytes : new_bytes);
+    }
+}
+
+// allocate bytes aligned to alignment. 
+// uses the allocator's native alloc_aligned if it has one, otherwise over-allocates and stashes the 
+// base pointer just below the aligned block so that allocator_free_aligned can release it.
+_JOS_INLINE_FUNC void* allocator_alloc_aligned(generic_allocator_t* allocator, size_t bytes, alloc_alignment_t alignment) {
+    if (!allocator || !bytes) {
+        return 0;
+    }
+    if (allocator->alloc_aligned) {
+        return allocator->alloc_aligned(allocator, bytes, alignment);
+    }
+    void* base = allocator->alloc(allocator, bytes + (size_t)alignment - 1 + sizeof(void*));
+    if (!base) {
+        return 0;
+    }
+    void** aligned = (void**)_JOS_ALIGN((uintptr_t)base + sizeof(void*), alignment);
+    aligned[-1] = base;
+    return (void*)aligned;
+}
+
+// free memory allocated with allocator_alloc_aligned
+_JOS_INLINE_FUNC void allocator_free_aligned(generic_allocator_t* allocator, void* ptr) {
+    if (!allocator || !ptr) {
+        return;
+    }
+    if (allocator->free_aligned) {
+        allocator->free_aligned(allocator, ptr);
+    }
+    else if (!allocator->alloc_aligned && allocator->free) {
+        allocator->free(allocator, ((void**)ptr)[-1]);
+    }
+    //NOTE: an allocator with a native alloc_aligned but no free_aligned never frees (i.e. it's linear)
+}
+
+// fragmentation index for allocator_stats_t
+_JOS_INLINE_FUNC unsigned allocator_fragmentation(size_t free, size_t largest_free) {
+    if (!free || largest_free >= free) {
+        return 0;
+    }
+    return (unsigned)(((free - largest_free) * 100) / free);
+}
+
+// fill in stats for allocator. 
+// returns false if the allocator doesn't keep statistics, in which case only _free is set, from available()
+_JOS_INLINE_FUNC bool allocator_get_stats(generic_allocator_t* allocator, allocator_stats_t* stats) {
+    *stats = (allocator_stats_t){ ._used = 0 };
+    if (allocator->stats) {
+        allocator->stats(allocator, stats);
+        return true;
+    }
+    if (allocator->available) {
+        stats->_free = allocator->available(allocator);
+    }
+    return false;
+}
+
 // ================================================
 // warnings
 
@@ -5,6 +5,7 @@
 #include <x86_64.h>
 #include <c-efi.h>
 #include <hive.h>
+#include <tracking_allocator.h>
 
 _JOS_NORETURN void halt_cpu();
 
@@ -20,12 +21,15 @@ _JO_INLINE_FUNC void lock_initialise(lock_t* lock) {
 _JO_INLINE_FUNC void lock_spinlock(lock_t* lock) {
     static int kZero = 0;
     // it can be weak, we expect to have to spin a few times
-    while(!atomic_compare_exchange_weak(&lock->atomic_val.value, kZero, 1)) {
+    // the previous value is returned, the lock is ours when that was 0
+    while(atomic_compare_exchange_weak(&lock->atomic_val.value, kZero, 1) != kZero) {
         x86_64_pause_cpu();
     }
 }
 
 _JO_INLINE_FUNC void lock_unlock(lock_t* lock) {
+    // make sure nothing from inside the lock is moved past the release by the compiler
+    __asm__ __volatile__ ("" ::: "memory");
     atomic_store(&lock->atomic_val, 0);
 }
 
@@ -35,5 +39,11 @@ _JOS_NORETURN void  kernel_runtime_start(void);
 
 _JOS_API_FUNC hive_t* kernel_hive(void);
 _JOS_API_FUNC void kernel_memory_available(size_t* on_boot, size_t* now);
+// the kernel heap tracker, or 0 if the kernel is built without JOSX_TRACK_HEAP_ALLOCATIONS
+_JOS_API_FUNC tracking_allocator_t* kernel_heap_tracker(void);
+// refresh "kernel:heap_tracking" (live, peak, allocs, frees, untracked, ms since boot) and 
+// "kernel:heap_sites" (call site, live bytes for the largest users) in the kernel hive, as well as the
+// statistics of all registered memory pools (see memory_update_pool_stats)
+_JOS_API_FUNC void kernel_update_heap_stats(void);
 
 #endif // _JOS_KERNEL_KERNEL_H
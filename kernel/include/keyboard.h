@@ -54,6 +54,7 @@ void        keyboard_initialise(void);
 short       keyboard_get_id(void);
 bool        keyboard_has_key(void);
 void        keyboard_get_state(keyboard_state_t* state);
+// keys are returned in the order they were pressed, 0 if there are none
 uint32_t    keyboard_get_last_key(void);
 
 #endif // _JOS_KERNEL_KEYBOARD_H
@@ -10,20 +10,52 @@ typedef struct _linear_allocator {
     void*       _begin;
     char*       _ptr;
     void*       _end;
+    // allocations since creation or the last clear, rewinding doesn't reset it
+    size_t      _alloc_count;
 
 } linear_allocator_t;
 
 // NOTE: size must include sizeof(linear_allocator_t)
 _JOS_API_FUNC linear_allocator_t* linear_allocator_create(void* memory, size_t size);
 _JOS_API_FUNC void* linear_allocator_alloc(linear_allocator_t* linalloc, size_t size);
+_JOS_API_FUNC void* linear_allocator_alloc_aligned(linear_allocator_t* linalloc, size_t size, alloc_alignment_t alignment);
 _JOS_INLINE_FUNC void linear_allocator_clear(linear_allocator_t* linalloc) {
     linalloc->_ptr = (char*)((char*)linalloc->_begin + sizeof(linear_allocator_t));
+    linalloc->_alloc_count = 0;
 }
 
 _JOS_INLINE_FUNC size_t linear_allocator_available(linear_allocator_t* linalloc) {
     return (size_t)linalloc->_end - (size_t)linalloc->_ptr;
 }
 
+// a linear allocator is never fragmented, everything above the top is one free block
+_JOS_INLINE_FUNC void linear_allocator_stats(linear_allocator_t* linalloc, allocator_stats_t* stats) {
+    stats->_used = (size_t)linalloc->_ptr - ((size_t)linalloc->_begin + sizeof(linear_allocator_t));
+    stats->_free = linear_allocator_available(linalloc);
+    stats->_largest_free = stats->_free;
+    stats->_allocated_blocks = linalloc->_alloc_count;
+    stats->_free_blocks = stats->_free ? 1 : 0;
+    stats->_alloc_count = linalloc->_alloc_count;
+    stats->_free_count = 0;
+    stats->_fragmentation = 0;
+}
+
+// a marker records the top of a linear allocator so that it can later be rewound to it, 
+// releasing everything allocated since in one go (stack-like, the spirit of UE's FMemStack/FMemMark).
+// markers must be rewound in reverse order of creation.
+typedef struct _linear_allocator_marker {
+    char*   _ptr;
+} linear_allocator_marker_t;
+
+_JOS_INLINE_FUNC linear_allocator_marker_t linear_allocator_mark(linear_allocator_t* linalloc) {
+    return (linear_allocator_marker_t){ ._ptr = linalloc->_ptr };
+}
+
+_JOS_INLINE_FUNC void linear_allocator_rewind(linear_allocator_t* linalloc, linear_allocator_marker_t marker) {
+    _JOS_ASSERT(marker._ptr >= (char*)linalloc->_begin + sizeof(linear_allocator_t) && marker._ptr <= linalloc->_ptr);
+    linalloc->_ptr = marker._ptr;
+}
+
 #if defined(_JOS_IMPLEMENT_ALLOCATORS) && !defined(_JOS_LINEAR_ALLOCATOR_IMPLEMENTED)
 #define _JOS_LINEAR_ALLOCATOR_IMPLEMENTED
 
@@ -39,6 +71,10 @@ _JOS_API_FUNC linear_allocator_t* linear_allocator_create(void* memory, size_t s
     linalloc->_super.free = 0;
     linalloc->_super.realloc = 0;
     linalloc->_super.available = (generic_allocator_avail_func_t)linear_allocator_available;
+    linalloc->_super.alloc_aligned = (generic_allocator_alloc_aligned_func_t)linear_allocator_alloc_aligned;
+    linalloc->_super.free_aligned = 0;
+    linalloc->_super.stats = (generic_allocator_stats_func_t)linear_allocator_stats;
+    linalloc->_alloc_count = 0;
 
     return linalloc;
 }
@@ -50,6 +86,19 @@ _JOS_API_FUNC void* linear_allocator_alloc(linear_allocator_t* linalloc, size_t
         return NULL;
     }
     linalloc->_ptr = (ptr + size);
+    ++linalloc->_alloc_count;
+    return ptr;
+}
+
+_JOS_API_FUNC void* linear_allocator_alloc_aligned(linear_allocator_t* linalloc, size_t size, alloc_alignment_t alignment) {
+    // we just bump past the padding, nothing needs to be stored since we never free
+    char* ptr = (char*)_JOS_ALIGN(linalloc->_ptr, (alignment < kAllocAlign_8 ? kAllocAlign_8 : alignment));
+    intptr_t capacity = (intptr_t)linalloc->_end - (intptr_t)ptr;
+    if ( capacity < (intptr_t)size ) {
+        return NULL;
+    }
+    linalloc->_ptr = (ptr + size);
+    ++linalloc->_alloc_count;
     return ptr;
 }
 #endif
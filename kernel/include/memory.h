@@ -6,6 +6,36 @@
 
 #define JOSX_MINIMUM_STARTUP_HEAP_SIZE   0x4000000
 
+// wrap the kernel heap in a tracking_allocator_t to record who allocated what. off by default in all builds,
+// define it as 1 to opt in; the tracking tables take about 1.1MB of the static pool
+#if !defined(JOSX_TRACK_HEAP_ALLOCATIONS)
+#define JOSX_TRACK_HEAP_ALLOCATIONS 0
+#endif
+// maximum number of live allocations and distinct call sites recorded by the heap tracker
+#define JOSX_TRACK_HEAP_MAX_ALLOCATIONS  0x4000
+#define JOSX_TRACK_HEAP_MAX_CALL_SITES   0x400
+// physical memory reserved for 4K page frames, see memory_frame_alloc
+#define JOSX_FRAME_POOL_SIZE    0x1000000
+// number of frames zeroed by each call to memory_zero_free_frames
+#define JOSX_FRAME_ZEROING_BATCH    16
+// on NUMA systems each node gets its own memory for frames (JOSX_FRAME_POOL_SIZE) and node local pools
+#define JOSX_NUMA_NODE_POOL_SIZE    0x800000
+#define JOSX_NUMA_NODE_MEMORY_ALIGN 0x200000
+// "any node" hint, which means the node of the calling CPU for frames and the startup memory for pools
+#define JOSX_MEMORY_NODE_ANY        ((size_t)-1)
+// growable pools grow by at least this much at a time, see memory_create_growable_pool
+#define JOSX_POOL_GROWTH_SIZE       0x100000
+// initial sizes and budgets of the kernel pools. 
+// the budgets can be changed at boot with pool.<name>=<size>[K|M|G] in the image's load options
+#define JOSX_KERNEL_STATIC_POOL_SIZE    0x800000
+#define JOSX_KERNEL_STATIC_POOL_BUDGET  0x10000000
+#define JOSX_KERNEL_HEAP_POOL_SIZE      0x800000
+#define JOSX_KERNEL_HEAP_POOL_BUDGET    0x20000000
+#define JOSX_KERNEL_SMP_POOL_SIZE       0x10000
+#define JOSX_KERNEL_SMP_POOL_BUDGET     0x400000
+// vmm allocates its segment tags while holding its own locks, so they come from a fixed size pool which never has to grow through vmm
+#define JOSX_KERNEL_VMM_POOL_SIZE       0x100000
+
 typedef enum _memory_pool_type {
 
     // pool supports arbitrarily sized allocations and frees
@@ -19,16 +49,61 @@ _JOS_API_FUNC jo_status_t     memory_uefi_init(CEfiBootServices* boot_services);
 _JOS_API_FUNC jo_status_t     memory_runtime_init(CEfiHandle h, CEfiBootServices* boot_services);
 // total memory is total usable system RAM 
 _JOS_API_FUNC size_t          memory_get_total(void);
+// end of the highest physical range reported by the firmware, of any type
+_JOS_API_FUNC uintptr_t       memory_get_highest_physical_address(void);
+// true if address is in usable RAM according to the firmware memory map, O(log n) in the number of regions
+_JOS_API_FUNC bool            memory_is_ram(uintptr_t address);
 // available memory is memory left for creating new pools
 _JOS_API_FUNC size_t          memory_get_available(void);
 // allocate a memory pool and allocator of a particular type.
 // NOTE: if size>0 it designates the amount of memory available to allocate from the pool, NOT including internal structures. 
 //       use memory_pool_real_size to calculate the actual amount of memory used by the pool
 // NOTE: if size==0 all available memory will be allocated.
-_JOS_API_FUNC generic_allocator_t*  memory_allocate_pool(memory_pool_type_t type, size_t size);
+// NOTE: node is a hint, the pool is allocated from that NUMA node's memory if it has enough, otherwise from the startup memory
+_JOS_API_FUNC generic_allocator_t*  memory_allocate_pool(memory_pool_type_t type, size_t size, size_t node);
+// the allocator for memory local to a NUMA node, 0 on single node systems or if the node has no memory of its own
+_JOS_API_FUNC generic_allocator_t*  memory_node_allocator(size_t node);
+// pools are registered automatically when they are created, anything else that carves up memory can register too.
+// memory_update_pool_stats publishes the allocator_stats_t of each as "memory:pool:<name>:<index>" in the kernel hive
+_JOS_API_FUNC void            memory_register_pool(const char* name, generic_allocator_t* allocator);
+_JOS_API_FUNC void            memory_update_pool_stats(void);
+// create a pool that starts out with size bytes and grows on demand, up to budget bytes in total, when it runs out.
+// before vmm is initialised it grows out of what is left of the startup memory, after that it gets pages from the 
+// kernel page allocator (i.e. frames) and returns them again when they're no longer used.
+// name is used for the hive statistics and to look up a budget set by memory_configure_pool_budgets, which takes precedence
+_JOS_API_FUNC generic_allocator_t*  memory_create_growable_pool(memory_pool_type_t type, const char* name, size_t size, size_t budget);
+// parse pool.<name>=<size>[K|M|G] options, separated by spaces, e.g. from the loaded image's load options. 
+// a size that isn't digits followed by at most a unit leaves the pool at its default budget, and is traced when the pool is created
+//NOTE: called before anything else, it doesn't trace or allocate
+_JOS_API_FUNC void            memory_configure_pool_budgets(const wchar_t* options, size_t length);
 // returns the size in bytes of the overhead for a memory pool of given type and given free size
 _JOS_API_FUNC size_t  memory_pool_overhead(memory_pool_type_t type);
 
+// reserve size bytes of physical memory as 4K page frames, per NUMA node (see acpi_numa_initialise). 
+// on a single node system the frames come out of the startup memory, otherwise from memory allocated inside each node.
+//NOTE: called once, before the kernel pools are created since they take whatever memory is left
+_JOS_API_FUNC jo_status_t     memory_frames_initialise(CEfiBootServices* boot_services, size_t size);
+// allocate a 4K frame from the calling CPU's node, or the nearest node with frames left. returns 0 if there are none left. 
+// the frame is not zeroed
+_JOS_API_FUNC uintptr_t       memory_frame_alloc(void);
+// allocate a zeroed 4K frame, taken from the frames zeroed in the background if there are any
+_JOS_API_FUNC uintptr_t       memory_frame_alloc_zeroed(void);
+// as above, but prefer a given node. JOSX_MEMORY_NODE_ANY means the calling CPU's node
+_JOS_API_FUNC uintptr_t       memory_frame_alloc_on_node(size_t node);
+_JOS_API_FUNC uintptr_t       memory_frame_alloc_zeroed_on_node(size_t node);
+_JOS_API_FUNC void            memory_frame_free(uintptr_t frame);
+// true if frame was allocated by memory_frame_alloc(_zeroed)
+_JOS_API_FUNC bool            memory_is_frame(uintptr_t frame);
+// the node a frame belongs to, JOSX_MEMORY_NODE_ANY if it isn't a frame
+_JOS_API_FUNC size_t          memory_frame_node(uintptr_t frame);
+// number of frames left, and how many of those are already zeroed
+_JOS_API_FUNC size_t          memory_frames_available(void);
+_JOS_API_FUNC size_t          memory_frames_zeroed(void);
+// zero up to max_frames freed frames, using non-temporal stores, and move them to the zeroed list.
+// called from the idle loop of every processor, frames on the processor's own node are zeroed first.
+// returns the number of frames zeroed
+_JOS_API_FUNC size_t          memory_zero_free_frames(size_t max_frames);
+
 _JOS_API_FUNC void            _memory_debugger_dump_map(void);
 
 #endif // _JOS_KERNEL_MEMORY_H
@@ -4,8 +4,42 @@
 
 // set up page tables, mark 0th page as inaccessible, etc.
 _JOS_API_FUNC void  pagetables_uefi_initialise(void);
-_JOS_API_FUNC void pagetables_runtime_init(generic_allocator_t* allocator);
+// build the kernel direct map of all physical memory, using 1GB pages if supported and 2MB pages otherwise, and switch to it.
+// the 0th page is left not present
+_JOS_API_FUNC jo_status_t pagetables_runtime_init(generic_allocator_t* allocator);
 // traverse the page table entries for at and store each in the first four slots of entries
 _JOS_API_FUNC void   pagetables_traverse_tables(void* at, uintptr_t * entries, size_t num_entries);
-//WIP:
+// map, unmap, or change the protection of, a range of pages. at, phys, and size must be 4K aligned.
+// the largest page sizes possible are used for mappings, huge pages are split as needed and tables 
+// are merged back into huge pages when they map a contiguous range with identical flags.
+// the TLB is invalidated page by page for small changes and flushed completely for large ones, on every CPU (see tlb.h), 
+// and tables freed by a change are only released once that shootdown has completed.
+//NOTE: flags from jos.h. 
+//      prot_flags can include one memory type; PAGE_NOCACHE, PAGE_WRITECOMBINE, or PAGE_WRITETHROUGH (default is write-back)
+_JOS_API_FUNC jo_status_t pagetables_map_range(void* at, uintptr_t phys, size_t size, int prot_flags);
+_JOS_API_FUNC jo_status_t pagetables_unmap_range(void* at, size_t size);
+// returns _JO_STATUS_NOT_FOUND if any part of the range was not mapped (the rest is still protected)
+_JOS_API_FUNC jo_status_t pagetables_protect_range(void* at, size_t size, int prot_flags);
+// change the protection of the 4K page at, returns the previous flags of the entry that mapped it, 
+// or -1 if the protection could not be changed (for example if at isn't mapped)
 _JOS_API_FUNC int pagetables_protect_page(void* at, int prot_flags);
+// the physical address at is mapped to in the kernel tables, whatever size page maps it.
+// returns _JO_STATUS_NOT_FOUND if at isn't mapped
+_JOS_API_FUNC jo_status_t pagetables_virtual_to_physical(void* at, uintptr_t* out_phys);
+// true if at is mapped and accessible (i.e. not PAGE_NOACCESS)
+_JOS_API_FUNC bool pagetables_is_present(void* at);
+
+// an address space is a set of page tables tagged with a PCID (if supported, see tlb.h) so that 
+// switching between them doesn't flush the TLB.
+//NOTE: for now every address space mirrors the kernel mappings, changes made with the range functions 
+//      above are propagated to all of them.
+typedef struct _pagetables_address_space pagetables_address_space_t;
+
+// the address space of the kernel direct map, created by pagetables_runtime_init
+_JOS_API_FUNC pagetables_address_space_t* pagetables_kernel_address_space(void);
+// returns 0 if we're out of memory
+_JOS_API_FUNC pagetables_address_space_t* pagetables_create_address_space(void);
+//NOTE: the address space must not be current on any processor
+_JOS_API_FUNC void pagetables_destroy_address_space(pagetables_address_space_t* space);
+// make space current on this processor
+_JOS_API_FUNC void pagetables_switch_address_space(pagetables_address_space_t* space);
@@ -9,6 +9,10 @@
 #include <windows.h>
 #endif
 #include <jos.h>
+#include <range_map.h>
+
+// sections are looked up through a range map for images with up to this many sections, by a linear search otherwise
+#define PEUTIL_MAX_MAPPED_SECTIONS 32
 
 
 
@@ -35,6 +39,10 @@ typedef struct _peutil_pe_context {
     bool _is_64_bit : 1;
     bool _relocated : 1;
     bool _is_dot_net : 1;
+    // RVA ranges of the sections, _value is the section index.
+    //NOTE: the map uses the storage below so a bound context must not be copied
+    range_map_t _section_map;
+    range_map_entry_t _section_map_entries[PEUTIL_MAX_MAPPED_SECTIONS];
 
 } peutil_pe_context_t;
 
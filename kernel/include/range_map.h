@@ -0,0 +1,223 @@
+#pragma once
+#ifndef _JOS_RANGE_MAP_H
+#define _JOS_RANGE_MAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <jos.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// range map
+//
+// maps address ranges [_start, _end) to a uintptr_t value and answers "which range contains address X" in O(log n).
+// ranges may overlap, a lookup returns the containing range with the highest start (i.e. the innermost one if they nest).
+// the entries are kept in a sorted array, with the running maximum of _end, so a lookup is a binary search followed by
+// a short backwards walk which stops as soon as no earlier range can reach the address; for non-overlapping ranges
+// that's one entry. the entry found is also cached, and checked first, for repeated lookups in the same range.
+//
+// inserting and removing is O(n), a range map is meant for sets that are built once, or change rarely, and are
+// looked up often; memory regions, PE sections, breakpoints.
+//
+// the storage is either allocated (and grown) from an allocator or provided by the caller, the latter is for
+// early boot and for maps embedded in other structures.
+//
+//NOTE: lookups update the cache so they are not thread safe unless the map is only ever used from one CPU,
+//      or it's read-only; a stale cache is only a hint, it is always validated.
+//
+// for example:
+//
+// range_map_t sections;
+// range_map_create(&sections, 16, allocator);
+// range_map_insert(&sections, text_start, text_end, (uintptr_t)text_section);
+// range_map_entry_t* entry = range_map_find(&sections, rip);
+// if (entry) {
+//	  ...(const IMAGE_SECTION_HEADER*)entry->_value
+// }
+
+typedef struct _range_map_entry {
+
+	uintptr_t	_start;
+	// exclusive
+	uintptr_t	_end;
+	uintptr_t	_value;
+	// max(_end) of this and every entry before it
+	uintptr_t	_max_end;
+
+} range_map_entry_t;
+
+typedef struct _range_map {
+
+	range_map_entry_t*		_entries;
+	size_t					_size;
+	size_t					_capacity;
+	// the entry returned by the last successful lookup
+	size_t					_last_hit;
+	// 0 if the storage was provided by the caller
+	generic_allocator_t*	_allocator;
+
+} range_map_t;
+
+_JOS_API_FUNC void range_map_create(range_map_t* map, size_t capacity, generic_allocator_t* allocator);
+// use capacity entries of storage provided by the caller, the map will not grow beyond it
+_JOS_API_FUNC void range_map_create_fixed(range_map_t* map, range_map_entry_t* entries, size_t capacity);
+_JOS_API_FUNC void range_map_destroy(range_map_t* map);
+// returns _JO_STATUS_INVALID_INPUT if the range is empty and _JO_STATUS_RESOURCE_EXHAUSTED if the map is full
+_JOS_API_FUNC jo_status_t range_map_insert(range_map_t* map, uintptr_t start, uintptr_t end, uintptr_t value);
+// removes the range [start, end), returns false if it isn't in the map
+_JOS_API_FUNC bool range_map_remove(range_map_t* map, uintptr_t start, uintptr_t end);
+// the range containing address with the highest start, or 0.
+//NOTE: the entry is valid until the map is next modified, its _value can be changed in place
+_JOS_API_FUNC range_map_entry_t* range_map_find(range_map_t* map, uintptr_t address);
+// the next range containing address after entry, i.e. with a lower (or equal) start, or 0.
+// with range_map_find this visits every range containing an address
+_JOS_API_FUNC range_map_entry_t* range_map_find_next(range_map_t* map, uintptr_t address, range_map_entry_t* entry);
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t range_map_size(range_map_t* map) {
+	return map->_size;
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE void range_map_clear(range_map_t* map) {
+	map->_size = 0;
+	map->_last_hit = 0;
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE range_map_entry_t* range_map_at(range_map_t* map, size_t i) {
+	_JOS_ASSERT(i < map->_size);
+	return map->_entries + i;
+}
+
+#if defined(_JOS_IMPLEMENT_RANGE_MAP) && !defined(_JOS_RANGE_MAP_IMPLEMENTED)
+#define _JOS_RANGE_MAP_IMPLEMENTED
+
+_JOS_API_FUNC void range_map_create(range_map_t* map, size_t capacity, generic_allocator_t* allocator) {
+	_JOS_ASSERT(map && allocator);
+	memset(map, 0, sizeof(range_map_t));
+	map->_allocator = allocator;
+	if (capacity) {
+		map->_entries = (range_map_entry_t*)allocator->alloc(allocator, capacity * sizeof(range_map_entry_t));
+		map->_capacity = map->_entries ? capacity : 0;
+	}
+}
+
+_JOS_API_FUNC void range_map_create_fixed(range_map_t* map, range_map_entry_t* entries, size_t capacity) {
+	_JOS_ASSERT(map && entries && capacity);
+	memset(map, 0, sizeof(range_map_t));
+	map->_entries = entries;
+	map->_capacity = capacity;
+}
+
+_JOS_API_FUNC void range_map_destroy(range_map_t* map) {
+	if (map->_allocator && map->_entries) {
+		map->_allocator->free(map->_allocator, map->_entries);
+	}
+	memset(map, 0, sizeof(range_map_t));
+}
+
+// recalculate _max_end from entry i onwards
+static void _range_map_update_max_end(range_map_t* map, size_t i) {
+	uintptr_t max_end = i ? map->_entries[i - 1]._max_end : 0;
+	for (; i < map->_size; ++i) {
+		range_map_entry_t* entry = map->_entries + i;
+		max_end = entry->_end > max_end ? entry->_end : max_end;
+		entry->_max_end = max_end;
+	}
+}
+
+// the number of entries with _start <= address
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t _range_map_upper_bound(range_map_t* map, uintptr_t address) {
+	size_t lo = 0;
+	size_t hi = map->_size;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (map->_entries[mid]._start <= address) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// the first entry before entry n containing address, walking backwards
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE range_map_entry_t* _range_map_find_before(range_map_t* map, uintptr_t address, size_t n) {
+	while (n) {
+		range_map_entry_t* entry = map->_entries + --n;
+		if (entry->_max_end <= address) {
+			// nothing at or before this entry reaches address
+			break;
+		}
+		if (address < entry->_end) {
+			map->_last_hit = n;
+			return entry;
+		}
+	}
+	return 0;
+}
+
+_JOS_API_FUNC jo_status_t range_map_insert(range_map_t* map, uintptr_t start, uintptr_t end, uintptr_t value) {
+	if (end <= start) {
+		return _JO_STATUS_INVALID_INPUT;
+	}
+	if (map->_size == map->_capacity) {
+		if (!map->_allocator) {
+			return _JO_STATUS_RESOURCE_EXHAUSTED;
+		}
+		const size_t capacity = map->_capacity ? map->_capacity * 2 : 16;
+		range_map_entry_t* entries = (range_map_entry_t*)map->_allocator->alloc(map->_allocator, capacity * sizeof(range_map_entry_t));
+		if (!entries) {
+			return _JO_STATUS_RESOURCE_EXHAUSTED;
+		}
+		if (map->_entries) {
+			memcpy(entries, map->_entries, map->_size * sizeof(range_map_entry_t));
+			map->_allocator->free(map->_allocator, map->_entries);
+		}
+		map->_entries = entries;
+		map->_capacity = capacity;
+	}
+
+	// after any range with the same start, which means inserting in order is a push back
+	const size_t i = _range_map_upper_bound(map, start);
+	memmove(map->_entries + i + 1, map->_entries + i, (map->_size - i) * sizeof(range_map_entry_t));
+	map->_entries[i] = (range_map_entry_t){ ._start = start, ._end = end, ._value = value };
+	++map->_size;
+	_range_map_update_max_end(map, i);
+	return _JO_STATUS_SUCCESS;
+}
+
+_JOS_API_FUNC bool range_map_remove(range_map_t* map, uintptr_t start, uintptr_t end) {
+	size_t i = _range_map_upper_bound(map, start);
+	while (i && map->_entries[i - 1]._start == start) {
+		--i;
+		if (map->_entries[i]._end == end) {
+			memmove(map->_entries + i, map->_entries + i + 1, (map->_size - i - 1) * sizeof(range_map_entry_t));
+			--map->_size;
+			_range_map_update_max_end(map, i);
+			map->_last_hit = 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+_JOS_API_FUNC range_map_entry_t* range_map_find(range_map_t* map, uintptr_t address) {
+	const size_t i = map->_last_hit;
+	if (i < map->_size) {
+		range_map_entry_t* entry = map->_entries + i;
+		// it's only the answer if it's also the last range starting at or before address
+		if (entry->_start <= address && address < entry->_end && (i + 1 == map->_size || entry[1]._start > address)) {
+			return entry;
+		}
+	}
+	return _range_map_find_before(map, address, _range_map_upper_bound(map, address));
+}
+
+_JOS_API_FUNC range_map_entry_t* range_map_find_next(range_map_t* map, uintptr_t address, range_map_entry_t* entry) {
+	_JOS_ASSERT(entry >= map->_entries && entry < map->_entries + map->_size);
+	return _range_map_find_before(map, address, (size_t)(entry - map->_entries));
+}
+
+#endif // _JOS_IMPLEMENT_RANGE_MAP
+
+#endif // _JOS_RANGE_MAP_H
@@ -0,0 +1,361 @@
+#pragma once
+#ifndef _JOS_RING_H
+#define _JOS_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <jos.h>
+
+// the atomics the rings need; atomic.h and x86_64.h are GNU inline assembly so the MSVC lab build uses intrinsics.
+// x86 loads aren't reordered with older loads, nor stores with older stores, so acquire and release only need compiler barriers
+#if defined(_MSC_VER)
+_JOS_INLINE_FUNC uint64_t _ring_load_acquire_64(const volatile uint64_t* object) {
+	const uint64_t value = *object;
+	_ReadWriteBarrier();
+	return value;
+}
+_JOS_INLINE_FUNC void _ring_store_release_64(volatile uint64_t* object, uint64_t value) {
+	_ReadWriteBarrier();
+	*object = value;
+}
+_JOS_INLINE_FUNC uint64_t _ring_cas_64(volatile uint64_t* object, uint64_t expected, uint64_t desired) {
+	return (uint64_t)_InterlockedCompareExchange64((volatile long long*)object, (long long)desired, (long long)expected);
+}
+#define _ring_pause()							_mm_pause()
+#else
+#include <atomic.h>
+#include <x86_64.h>
+#define _ring_load_acquire_64(object)			atomic_load_acquire_64((object))
+#define _ring_store_release_64(object, value)	atomic_store_release_64((object), (value))
+#define _ring_cas_64(object, expected, desired)	atomic_compare_exchange_strong_64((object), (expected), (desired))
+#define _ring_pause()							x86_64_pause_cpu()
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// lock free ring buffers
+//
+// fixed size elements, copied in and out, and a power of two capacity so positions are free running 64 bit counters
+// which are masked to get a slot. the producer and consumer positions live on separate cache lines so the two sides
+// don't invalidate each other's line on every operation.
+//
+// spsc_ring_t: one producer and one consumer, each on any CPU (or in an IRQ handler), wait free.
+// the producer keeps a private copy of the consumer position, and vice versa, and only reads the other side's line
+// when the copy says the ring is full (or empty).
+//
+// mpmc_ring_t: any number of producers and consumers, bounded, after Dmitry Vyukov's queue
+// (https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue). every slot has a sequence number
+// which says whose turn it is; a push or pop claims a position with one CAS and never waits for another CPU
+// to finish, it fails if the ring is full (or empty) instead.
+//
+// the _n versions move up to count elements at once, with a single update of the shared position.
+//
+// for example:
+//
+// static spsc_ring_t ring;
+// spsc_ring_create(&ring, 64, sizeof(event_t), allocator);
+// ...IRQ handler:
+// spsc_ring_push(&ring, &event);
+// ...task:
+// event_t events[8];
+// size_t count = spsc_ring_pop_n(&ring, events, 8);
+
+// same as JOSX_CACHE_LINE_SIZE, without pulling in smp.h
+#define RING_CACHE_LINE_SIZE	64
+
+typedef struct _spsc_ring {
+
+	// written by the producer
+	_JOS_ALIGNED_TYPE(volatile uint64_t, _tail, RING_CACHE_LINE_SIZE);
+	uint64_t				_cached_head;
+	uint8_t					_pad0[RING_CACHE_LINE_SIZE - 2 * sizeof(uint64_t)];
+	// written by the consumer
+	volatile uint64_t		_head;
+	uint64_t				_cached_tail;
+	uint8_t					_pad1[RING_CACHE_LINE_SIZE - 2 * sizeof(uint64_t)];
+	// read only
+	uint8_t*				_data;
+	size_t					_mask;
+	size_t					_element_size;
+	// 0 if the storage was provided by the caller
+	generic_allocator_t*	_allocator;
+
+} spsc_ring_t;
+
+typedef struct _mpmc_ring {
+
+	_JOS_ALIGNED_TYPE(volatile uint64_t, _enqueue_pos, RING_CACHE_LINE_SIZE);
+	uint8_t					_pad0[RING_CACHE_LINE_SIZE - sizeof(uint64_t)];
+	volatile uint64_t		_dequeue_pos;
+	uint8_t					_pad1[RING_CACHE_LINE_SIZE - sizeof(uint64_t)];
+	// read only
+	uint8_t*				_cells;
+	size_t					_mask;
+	size_t					_element_size;
+	// sequence number and element
+	size_t					_cell_stride;
+	generic_allocator_t*	_allocator;
+
+} mpmc_ring_t;
+
+// bytes of storage needed for mpmc_ring_create_fixed
+#define MPMC_RING_STORAGE_SIZE(capacity, element_size) ((capacity) * _JOS_ALIGN(sizeof(uint64_t) + (element_size), sizeof(uint64_t)))
+
+// capacity is rounded up to a power of two
+_JOS_API_FUNC jo_status_t spsc_ring_create(spsc_ring_t* ring, size_t capacity, size_t element_size, generic_allocator_t* allocator);
+// capacity must be a power of two, storage is capacity * element_size bytes
+_JOS_API_FUNC jo_status_t spsc_ring_create_fixed(spsc_ring_t* ring, void* storage, size_t capacity, size_t element_size);
+_JOS_API_FUNC void spsc_ring_destroy(spsc_ring_t* ring);
+// returns false if the ring is full
+_JOS_API_FUNC bool spsc_ring_push(spsc_ring_t* ring, const void* element);
+// returns false if the ring is empty
+_JOS_API_FUNC bool spsc_ring_pop(spsc_ring_t* ring, void* element);
+// returns the number of elements pushed (or popped), which is less than count if the ring fills up (or runs empty)
+_JOS_API_FUNC size_t spsc_ring_push_n(spsc_ring_t* ring, const void* elements, size_t count);
+_JOS_API_FUNC size_t spsc_ring_pop_n(spsc_ring_t* ring, void* elements, size_t count);
+
+// a snapshot, it may be out of date as soon as it's returned
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t spsc_ring_size(spsc_ring_t* ring) {
+	const uint64_t head = _ring_load_acquire_64(&ring->_head);
+	return (size_t)(_ring_load_acquire_64(&ring->_tail) - head);
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE bool spsc_ring_is_empty(spsc_ring_t* ring) {
+	return spsc_ring_size(ring) == 0;
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t spsc_ring_capacity(spsc_ring_t* ring) {
+	return ring->_mask + 1;
+}
+
+// capacity is rounded up to a power of two
+_JOS_API_FUNC jo_status_t mpmc_ring_create(mpmc_ring_t* ring, size_t capacity, size_t element_size, generic_allocator_t* allocator);
+// capacity must be a power of two, storage is MPMC_RING_STORAGE_SIZE(capacity, element_size) bytes, 8 byte aligned
+_JOS_API_FUNC jo_status_t mpmc_ring_create_fixed(mpmc_ring_t* ring, void* storage, size_t capacity, size_t element_size);
+_JOS_API_FUNC void mpmc_ring_destroy(mpmc_ring_t* ring);
+_JOS_API_FUNC bool mpmc_ring_push(mpmc_ring_t* ring, const void* element);
+_JOS_API_FUNC bool mpmc_ring_pop(mpmc_ring_t* ring, void* element);
+_JOS_API_FUNC size_t mpmc_ring_push_n(mpmc_ring_t* ring, const void* elements, size_t count);
+_JOS_API_FUNC size_t mpmc_ring_pop_n(mpmc_ring_t* ring, void* elements, size_t count);
+
+// a snapshot, it may be out of date as soon as it's returned
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t mpmc_ring_size(mpmc_ring_t* ring) {
+	const uint64_t dequeue_pos = _ring_load_acquire_64(&ring->_dequeue_pos);
+	const uint64_t enqueue_pos = _ring_load_acquire_64(&ring->_enqueue_pos);
+	return enqueue_pos > dequeue_pos ? (size_t)(enqueue_pos - dequeue_pos) : 0;
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t mpmc_ring_capacity(mpmc_ring_t* ring) {
+	return ring->_mask + 1;
+}
+
+#if defined(_JOS_IMPLEMENT_RING) && !defined(_JOS_RING_IMPLEMENTED)
+#define _JOS_RING_IMPLEMENTED
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE size_t _ring_round_up_pow2(size_t n) {
+	return n <= 1 ? 1 : (size_t)1 << (64 - jos_clz64(n - 1));
+}
+
+// copy count elements to (or from) a ring starting at position pos, wrapping around the end of the storage
+_JOS_INLINE_FUNC void _ring_copy_in(uint8_t* data, size_t mask, size_t element_size, uint64_t pos, const uint8_t* src, size_t count) {
+	const size_t at = (size_t)pos & mask;
+	const size_t first = count < mask + 1 - at ? count : mask + 1 - at;
+	memcpy(data + at * element_size, src, first * element_size);
+	memcpy(data, src + first * element_size, (count - first) * element_size);
+}
+
+_JOS_INLINE_FUNC void _ring_copy_out(const uint8_t* data, size_t mask, size_t element_size, uint64_t pos, uint8_t* dest, size_t count) {
+	const size_t at = (size_t)pos & mask;
+	const size_t first = count < mask + 1 - at ? count : mask + 1 - at;
+	memcpy(dest, data + at * element_size, first * element_size);
+	memcpy(dest + first * element_size, data, (count - first) * element_size);
+}
+
+_JOS_API_FUNC jo_status_t spsc_ring_create_fixed(spsc_ring_t* ring, void* storage, size_t capacity, size_t element_size) {
+	if (!storage || !element_size || !capacity || (capacity & (capacity - 1))) {
+		return _JO_STATUS_INVALID_INPUT;
+	}
+	memset(ring, 0, sizeof(spsc_ring_t));
+	ring->_data = (uint8_t*)storage;
+	ring->_mask = capacity - 1;
+	ring->_element_size = element_size;
+	return _JO_STATUS_SUCCESS;
+}
+
+_JOS_API_FUNC jo_status_t spsc_ring_create(spsc_ring_t* ring, size_t capacity, size_t element_size, generic_allocator_t* allocator) {
+	_JOS_ASSERT(allocator);
+	capacity = _ring_round_up_pow2(capacity);
+	void* storage = allocator->alloc(allocator, capacity * element_size);
+	if (!storage) {
+		return _JO_STATUS_RESOURCE_EXHAUSTED;
+	}
+	const jo_status_t status = spsc_ring_create_fixed(ring, storage, capacity, element_size);
+	if (_JO_FAILED(status)) {
+		allocator->free(allocator, storage);
+		return status;
+	}
+	ring->_allocator = allocator;
+	return _JO_STATUS_SUCCESS;
+}
+
+_JOS_API_FUNC void spsc_ring_destroy(spsc_ring_t* ring) {
+	if (ring->_allocator && ring->_data) {
+		ring->_allocator->free(ring->_allocator, ring->_data);
+	}
+	memset(ring, 0, sizeof(spsc_ring_t));
+}
+
+_JOS_API_FUNC size_t spsc_ring_push_n(spsc_ring_t* ring, const void* elements, size_t count) {
+	const uint64_t tail = ring->_tail;
+	size_t room = ring->_mask + 1 - (size_t)(tail - ring->_cached_head);
+	if (room < count) {
+		ring->_cached_head = _ring_load_acquire_64(&ring->_head);
+		room = ring->_mask + 1 - (size_t)(tail - ring->_cached_head);
+	}
+	count = count < room ? count : room;
+	if (count) {
+		_ring_copy_in(ring->_data, ring->_mask, ring->_element_size, tail, (const uint8_t*)elements, count);
+		_ring_store_release_64(&ring->_tail, tail + count);
+	}
+	return count;
+}
+
+_JOS_API_FUNC size_t spsc_ring_pop_n(spsc_ring_t* ring, void* elements, size_t count) {
+	const uint64_t head = ring->_head;
+	size_t available = (size_t)(ring->_cached_tail - head);
+	if (available < count) {
+		ring->_cached_tail = _ring_load_acquire_64(&ring->_tail);
+		available = (size_t)(ring->_cached_tail - head);
+	}
+	count = count < available ? count : available;
+	if (count) {
+		_ring_copy_out(ring->_data, ring->_mask, ring->_element_size, head, (uint8_t*)elements, count);
+		_ring_store_release_64(&ring->_head, head + count);
+	}
+	return count;
+}
+
+_JOS_API_FUNC bool spsc_ring_push(spsc_ring_t* ring, const void* element) {
+	return spsc_ring_push_n(ring, element, 1) == 1;
+}
+
+_JOS_API_FUNC bool spsc_ring_pop(spsc_ring_t* ring, void* element) {
+	return spsc_ring_pop_n(ring, element, 1) == 1;
+}
+
+_JOS_INLINE_FUNC _JOS_ALWAYS_INLINE volatile uint64_t* _mpmc_ring_cell(mpmc_ring_t* ring, uint64_t pos) {
+	return (volatile uint64_t*)(ring->_cells + ((size_t)pos & ring->_mask) * ring->_cell_stride);
+}
+
+_JOS_API_FUNC jo_status_t mpmc_ring_create_fixed(mpmc_ring_t* ring, void* storage, size_t capacity, size_t element_size) {
+	if (!storage || ((uintptr_t)storage & (sizeof(uint64_t) - 1)) || !element_size || !capacity || (capacity & (capacity - 1))) {
+		return _JO_STATUS_INVALID_INPUT;
+	}
+	memset(ring, 0, sizeof(mpmc_ring_t));
+	ring->_cells = (uint8_t*)storage;
+	ring->_mask = capacity - 1;
+	ring->_element_size = element_size;
+	ring->_cell_stride = _JOS_ALIGN(sizeof(uint64_t) + element_size, sizeof(uint64_t));
+	// slot n is free for the producer of position n
+	for (size_t n = 0; n < capacity; ++n) {
+		*_mpmc_ring_cell(ring, n) = n;
+	}
+	return _JO_STATUS_SUCCESS;
+}
+
+_JOS_API_FUNC jo_status_t mpmc_ring_create(mpmc_ring_t* ring, size_t capacity, size_t element_size, generic_allocator_t* allocator) {
+	_JOS_ASSERT(allocator);
+	capacity = _ring_round_up_pow2(capacity);
+	void* storage = allocator->alloc(allocator, MPMC_RING_STORAGE_SIZE(capacity, element_size));
+	if (!storage) {
+		return _JO_STATUS_RESOURCE_EXHAUSTED;
+	}
+	const jo_status_t status = mpmc_ring_create_fixed(ring, storage, capacity, element_size);
+	if (_JO_FAILED(status)) {
+		allocator->free(allocator, storage);
+		return status;
+	}
+	ring->_allocator = allocator;
+	return _JO_STATUS_SUCCESS;
+}
+
+_JOS_API_FUNC void mpmc_ring_destroy(mpmc_ring_t* ring) {
+	if (ring->_allocator && ring->_cells) {
+		ring->_allocator->free(ring->_allocator, ring->_cells);
+	}
+	memset(ring, 0, sizeof(mpmc_ring_t));
+}
+
+// claims up to count consecutive positions from *position_counter whose cells have sequence number position + lag,
+// i.e. are ready for us. returns the number claimed, and the first one in out_pos, or 0 if there were none ready
+_JOS_INLINE_FUNC size_t _mpmc_ring_claim(mpmc_ring_t* ring, volatile uint64_t* position_counter, uint64_t lag, size_t count, uint64_t* out_pos) {
+	uint64_t pos = _ring_load_acquire_64(position_counter);
+	for (;;) {
+		// a cell that's ready stays ready until the position is claimed, so they can be checked before the CAS
+		size_t ready = 0;
+		int64_t diff = 0;
+		while (ready < count) {
+			const uint64_t seq = _ring_load_acquire_64(_mpmc_ring_cell(ring, pos + ready));
+			diff = (int64_t)(seq - (pos + ready + lag));
+			if (diff) {
+				break;
+			}
+			++ready;
+		}
+		if (ready) {
+			const uint64_t prev = _ring_cas_64(position_counter, pos, pos + ready);
+			if (prev == pos) {
+				*out_pos = pos;
+				return ready;
+			}
+			pos = prev;
+		}
+		else if (diff < 0) {
+			// the cell is still in use from the previous lap; full (or empty)
+			return 0;
+		}
+		else {
+			// another CPU claimed this position since we read the counter
+			pos = _ring_load_acquire_64(position_counter);
+		}
+		_ring_pause();
+	}
+}
+
+_JOS_API_FUNC size_t mpmc_ring_push_n(mpmc_ring_t* ring, const void* elements, size_t count) {
+	uint64_t pos;
+	count = _mpmc_ring_claim(ring, &ring->_enqueue_pos, 0, count, &pos);
+	const uint8_t* src = (const uint8_t*)elements;
+	for (size_t n = 0; n < count; ++n) {
+		volatile uint64_t* cell = _mpmc_ring_cell(ring, pos + n);
+		memcpy((uint8_t*)cell + sizeof(uint64_t), src + n * ring->_element_size, ring->_element_size);
+		// hand the cell to the consumer of this position
+		_ring_store_release_64(cell, pos + n + 1);
+	}
+	return count;
+}
+
+_JOS_API_FUNC size_t mpmc_ring_pop_n(mpmc_ring_t* ring, void* elements, size_t count) {
+	uint64_t pos;
+	count = _mpmc_ring_claim(ring, &ring->_dequeue_pos, 1, count, &pos);
+	uint8_t* dest = (uint8_t*)elements;
+	for (size_t n = 0; n < count; ++n) {
+		volatile uint64_t* cell = _mpmc_ring_cell(ring, pos + n);
+		memcpy(dest + n * ring->_element_size, (const uint8_t*)cell + sizeof(uint64_t), ring->_element_size);
+		// and back to the producer of this position in the next lap
+		_ring_store_release_64(cell, pos + n + ring->_mask + 1);
+	}
+	return count;
+}
+
+_JOS_API_FUNC bool mpmc_ring_push(mpmc_ring_t* ring, const void* element) {
+	return mpmc_ring_push_n(ring, element, 1) == 1;
+}
+
+_JOS_API_FUNC bool mpmc_ring_pop(mpmc_ring_t* ring, void* element) {
+	return mpmc_ring_pop_n(ring, element, 1) == 1;
+}
+
+#endif // _JOS_IMPLEMENT_RING
+
+#endif // _JOS_RING_H
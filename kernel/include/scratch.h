@@ -0,0 +1,47 @@
+#pragma once
+
+#ifndef _JOS_KERNEL_SCRATCH_H_
+#define _JOS_KERNEL_SCRATCH_H_
+
+#include <jos.h>
+#include <linear_allocator.h>
+
+// ==================================================================================================
+// scratch arenas for short lived, frame-lifetime, allocations.
+// each CPU owns a linear arena; scratch_begin marks its top and scratch_end rewinds to the mark, 
+// releasing everything allocated in between at zero cost. 
+// scopes nest (interrupt handlers can use scratch while the interrupted code has a scope open) but 
+// must be ended in reverse order, and must NOT be held across tasks_yield.
+// before scratch_initialise is called a small static boot arena is used.
+
+// size of each per-CPU arena
+#define JOSX_SCRATCH_SIZE_PER_CPU   0x10000
+// size of the static arena used during boot
+#define JOSX_SCRATCH_BOOT_SIZE      0x2000
+
+typedef struct _scratch {
+
+    linear_allocator_t*         _arena;
+    linear_allocator_marker_t   _marker;
+
+} scratch_t;
+
+//NOTE: called on the BSP *only*, after smp_initialise
+_JOS_API_FUNC jo_status_t scratch_initialise(static_allocation_policy_t* static_allocation_policy);
+
+_JOS_API_FUNC scratch_t scratch_begin(void);
+
+_JOS_INLINE_FUNC void scratch_end(scratch_t* scratch) {
+    linear_allocator_rewind(scratch->_arena, scratch->_marker);
+}
+
+// returns NULL if the arena is exhausted
+_JOS_INLINE_FUNC void* scratch_alloc(scratch_t* scratch, size_t bytes) {
+    return linear_allocator_alloc(scratch->_arena, bytes);
+}
+
+_JOS_INLINE_FUNC void* scratch_alloc_aligned(scratch_t* scratch, size_t bytes, alloc_alignment_t alignment) {
+    return linear_allocator_alloc_aligned(scratch->_arena, bytes, alignment);
+}
+
+#endif // _JOS_KERNEL_SCRATCH_H_
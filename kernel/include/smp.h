@@ -45,8 +45,13 @@ typedef struct _processor_information {
     bool                            _intel_64_arch : 1;
     bool                            _has_1GB_pages : 1;
     bool                            _xsave : 1;
+    bool                            _has_pcid : 1;
+    bool                            _has_invpcid : 1;
+    bool                            _has_pat : 1;
 
     xsave_information_t             _xsave_info;
+    // NUMA node of this processor, see acpi_numa_node_for_apic_id
+    size_t                          _numa_node;
     
 } processor_information_t;
 
@@ -66,6 +71,19 @@ per_cpu_ptr_t       per_cpu_create_ptr(void);
 per_cpu_queue_t     per_cpu_create_queue(void);
 per_cpu_qword_t     per_cpu_create_qword(void);
 
+// hot per-CPU state written by its owning CPU should not share cache lines with its neighbours;
+// a block holds one entry per CPU, each starting on its own cache line
+#define JOSX_CACHE_LINE_SIZE            64
+
+typedef struct _per_cpu_block {
+    void*       _base;
+    // size of each entry, rounded up to JOSX_CACHE_LINE_SIZE
+    size_t      _stride;
+} per_cpu_block_t;
+
+// allocates and zeroes a cache line aligned block of entries of size bytes, one per CPU
+jo_status_t         per_cpu_create_block(per_cpu_block_t* block, size_t size);
+
 _JOS_INLINE_FUNC    size_t per_cpu_this_cpu_id(void) {
     uint64_t val;
     x86_64_read_gs(0,&val);
@@ -90,6 +108,12 @@ _JOS_INLINE_FUNC    processor_information_t* per_cpu_this_cpu_info(void) {
 #define _JOS_PER_CPU_PTR(ptr, cpu)\
 (ptr)[(cpu)]
 
+#define _JOS_PER_CPU_BLOCK(block, type, cpu)\
+((type*)((uintptr_t)(block)._base + (cpu)*(block)._stride))
+
+#define _JOS_PER_CPU_THIS_BLOCK(block, type)\
+_JOS_PER_CPU_BLOCK(block, type, per_cpu_this_cpu_id())
+
 // ===============================================================================================
 
 //NOTE: called on the BSP *only*
@@ -101,5 +125,7 @@ jo_status_t     smp_get_processor_information(processor_information_t* out_info,
 _JOS_INLINE_FUNC jo_status_t     smp_get_this_processor_info(processor_information_t* out_info) {
     return smp_get_processor_information(out_info, per_cpu_this_cpu_id());
 }
+// NUMA node of a processor, 0 on single node systems
+size_t          smp_get_processor_node(size_t processor_index);
 
 #endif //_JOS_KERNEL_smp_H_
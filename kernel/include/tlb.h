@@ -0,0 +1,71 @@
+#pragma once
+
+#ifndef _JOS_KERNEL_TLB_H_
+#define _JOS_KERNEL_TLB_H_
+
+#include <jos.h>
+
+// ==================================================================================================
+// TLB invalidation across processors.
+// the kernel uses one set of page tables on all processors so any change to a mapping has to be invalidated 
+// on every processor that may have cached it. invalidations are queued on each target processor and 
+// one IPI is sent to each; targets invalidate page by page or flush everything depending on the size of 
+// what's been queued. processors that are idle can be "lazy", they are not interrupted but process whatever 
+// has been queued for them when they leave lazy mode (or take an interrupt).
+
+// invalidating more than this number of pages flushes the whole TLB instead
+#define TLB_FLUSH_ALL_THRESHOLD         32
+// maximum number of distinct ranges queued per processor before we fall back to a full flush
+#define TLB_MAX_INVALIDATE_RANGES       8
+
+// count pages of stride bytes each, starting at at
+typedef struct _tlb_range {
+    uintptr_t   _at;
+    size_t      _count;
+    size_t      _stride;
+} tlb_range_t;
+
+//NOTE: called on the BSP *only*, after smp_initialise and interrupts_initialise_early.
+// until this is called invalidations are local only
+_JOS_API_FUNC jo_status_t tlb_initialise(static_allocation_policy_t* static_allocation_policy);
+// called by a processor when it starts using the kernel page tables, after tlb_initialise.
+//NOTE: not called anywhere yet. APs only ever run initialise_this_ap in smp.c, on the firmware's page tables and 
+//      before tlb_initialise, and then go back to UEFI; they never run kernel code. until the kernel starts them 
+//      itself they stay offline, every invalidation is local to the BSP, and the shootdown path is inactive. 
+//      the AP entry point must call this before it touches any kernel mapping
+_JOS_API_FUNC void tlb_cpu_online(void);
+
+// invalidate the given ranges, or everything if flush_all, on this processor and all other online processors.
+// returns when every non-lazy processor has completed the invalidation.
+_JOS_API_FUNC void tlb_invalidate(const tlb_range_t* ranges, size_t num_ranges, bool flush_all);
+
+// idle processors enter lazy mode so that they are not interrupted by shootdowns
+_JOS_API_FUNC void tlb_enter_lazy(void);
+_JOS_API_FUNC void tlb_leave_lazy(void);
+// process any invalidations queued for this processor, called on interrupt entry
+_JOS_API_FUNC void tlb_process_pending(void);
+
+// ==================================================================================================
+// PCID tagged address spaces.
+// if the processor supports PCID (and INVPCID) each address space is tagged with a PCID when it is 
+// loaded, so that switching between address spaces does not flush the TLB. PCIDs are a per-processor 
+// resource; each processor recycles a small set of them between the address spaces it runs.
+// every shootdown bumps a global generation counter, a processor loading an address space whose PCID 
+// was tagged in an older generation flushes it since it may have missed invalidations while not current.
+
+// number of PCIDs each processor cycles through
+#define TLB_NUM_PCIDS                   8
+
+// identifies an address space to the TLB code
+typedef struct _tlb_context {
+    int     _id;
+} tlb_context_t;
+
+// give context a unique id, ids are never re-used so a stale PCID can never be mistaken for a current one
+_JOS_API_FUNC void tlb_context_create(tlb_context_t* context);
+// load pml4 into cr3 tagged with a PCID for context on this processor, without flushing if the PCID is still valid
+_JOS_API_FUNC void tlb_switch_context(tlb_context_t* context, uintptr_t pml4);
+// true if PCIDs are in use
+_JOS_API_FUNC bool tlb_pcid_enabled(void);
+
+#endif // _JOS_KERNEL_TLB_H_
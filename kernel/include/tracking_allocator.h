@@ -0,0 +1,338 @@
+#pragma once
+#ifndef _JOS_TRACKING_ALLOCATOR_H
+#define _JOS_TRACKING_ALLOCATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <jos.h>
+
+// atomic.h and x86_64.h are GNU inline assembly so the MSVC lab build uses intrinsics
+#if defined(_MSC_VER)
+#define _tracking_compiler_barrier()	_ReadWriteBarrier()
+#define _tracking_pause()				_mm_pause()
+_JOS_INLINE_FUNC int _tracking_cas(volatile int* object, int expected, int desired) {
+    return (int)_InterlockedCompareExchange((volatile long*)object, (long)desired, (long)expected);
+}
+#else
+#include <atomic.h>
+#include <x86_64.h>
+#define _tracking_compiler_barrier()	__asm__ __volatile__ ("" ::: "memory")
+#define _tracking_pause()				x86_64_pause_cpu()
+#define _tracking_cas(object, expected, desired)	atomic_compare_exchange_strong((object), (expected), (desired))
+#endif
+
+// ===============================================================
+//
+// Allocation tracking wrapper
+// Wraps any generic_allocator_t and records call site, size and tag for every live allocation.
+// Per call site it keeps live bytes, live count, peak and total number of allocations.
+//
+// Both tables are fixed size open addressed hash tables allocated up front from a separate
+// bookkeeping allocator, so tracking never allocates from the allocator it tracks and never grows.
+// Allocations made when the tables are full are still served, they're just counted as "untracked".
+// The tables are updated under a spin lock of their own so the tracker can wrap an allocator shared between
+// processors; the tracked allocator does its own locking, if any.
+//
+// Call sites are return addresses. Convert them to RVAs relative to .text and pass
+// them to pdb_index_symbol_name_for_address to get function names.
+
+typedef struct _tracking_allocation {
+    // 0 if this slot is empty
+    uintptr_t   _ptr;
+    size_t      _size;
+    uintptr_t   _call_site;
+    const char* _tag;
+} tracking_allocation_t;
+
+typedef struct _tracking_call_site {
+    // 0 if this slot is empty
+    uintptr_t   _call_site;
+    const char* _tag;
+    size_t      _live_bytes;
+    size_t      _peak_bytes;
+    size_t      _live_count;
+    uint64_t    _total_allocs;
+} tracking_call_site_t;
+
+typedef struct _tracking_allocator {
+
+	//NOTE: this must be the first entry in this struct as it is used as a super class
+	generic_allocator_t _super;
+
+    // the allocator being tracked
+    generic_allocator_t*    _allocator;
+    // tag recorded with each new allocation
+    const char*             _tag;
+    // held while the tables and counters are updated
+    volatile int            _lock;
+
+    tracking_allocation_t*  _allocations;
+    // power of two
+    size_t                  _allocations_capacity;
+    size_t                  _allocations_count;
+
+    tracking_call_site_t*   _call_sites;
+    // power of two
+    size_t                  _call_sites_capacity;
+    size_t                  _call_sites_count;
+
+    size_t                  _live_bytes;
+    size_t                  _peak_bytes;
+    uint64_t                _alloc_count;
+    uint64_t                _free_count;
+    // allocations we couldn't record because a table was full
+    uint64_t                _untracked_count;
+
+} tracking_allocator_t;
+
+typedef void (*tracking_allocator_call_site_visitor_t)(const tracking_call_site_t*, void*);
+
+// create a tracker for allocator. the tracker and its tables are allocated from bookkeeping_allocator.
+// max_allocations and max_call_sites are rounded up to powers of two.
+_JOS_API_FUNC tracking_allocator_t* tracking_allocator_create(generic_allocator_t* allocator, generic_allocator_t* bookkeeping_allocator,
+                                            size_t max_allocations, size_t max_call_sites, const char* tag);
+_JOS_API_FUNC void* tracking_allocator_alloc(tracking_allocator_t* tracker, size_t size);
+_JOS_API_FUNC void tracking_allocator_free(tracking_allocator_t* tracker, void* ptr);
+_JOS_API_FUNC void* tracking_allocator_realloc(tracking_allocator_t* tracker, void* ptr, size_t size);
+_JOS_API_FUNC void* tracking_allocator_alloc_aligned(tracking_allocator_t* tracker, size_t size, alloc_alignment_t alignment);
+_JOS_API_FUNC void tracking_allocator_free_aligned(tracking_allocator_t* tracker, void* ptr);
+// invoke visitor for each call site with at least one recorded allocation, with the tracker locked
+_JOS_API_FUNC void tracking_allocator_visit_call_sites(tracking_allocator_t* tracker, tracking_allocator_call_site_visitor_t visitor, void* user_data);
+
+_JOS_INLINE_FUNC void tracking_allocator_set_tag(tracking_allocator_t* tracker, const char* tag) {
+    tracker->_tag = tag;
+}
+
+_JOS_INLINE_FUNC size_t tracking_allocator_available(tracking_allocator_t* tracker) {
+    return tracker->_allocator->available(tracker->_allocator);
+}
+
+_JOS_INLINE_FUNC void tracking_allocator_stats(tracking_allocator_t* tracker, allocator_stats_t* stats) {
+    tracker->_allocator->stats(tracker->_allocator, stats);
+}
+
+#if defined(_JOS_IMPLEMENT_ALLOCATORS) && !defined(_JOS_TRACKING_ALLOCATOR_IMPLEMENTED)
+#define _JOS_TRACKING_ALLOCATOR_IMPLEMENTED
+
+// fibonacci hashing of pointers and call sites, the low bits carry little information
+_JOS_INLINE_FUNC size_t _tracking_hash(uintptr_t key, size_t capacity) {
+    return (size_t)(((uint64_t)(key >> 3) * 0x9e3779b97f4a7c15ull) >> 32) & (capacity - 1);
+}
+
+_JOS_INLINE_FUNC size_t _tracking_pow2(size_t n) {
+    size_t p2 = 16;
+    while (p2 < n) {
+        p2 <<= 1;
+    }
+    return p2;
+}
+
+_JOS_INLINE_FUNC tracking_call_site_t* _tracking_call_site(tracking_allocator_t* tracker, uintptr_t call_site, bool create) {
+    const size_t mask = tracker->_call_sites_capacity - 1;
+    size_t i = _tracking_hash(call_site, tracker->_call_sites_capacity);
+    while (tracker->_call_sites[i]._call_site) {
+        if (tracker->_call_sites[i]._call_site == call_site) {
+            return tracker->_call_sites + i;
+        }
+        i = (i + 1) & mask;
+    }
+    // keep at least one empty slot so that the probe above always terminates
+    if (!create || tracker->_call_sites_count + 1 >= tracker->_call_sites_capacity) {
+        return 0;
+    }
+    tracking_call_site_t* site = tracker->_call_sites + i;
+    memset(site, 0, sizeof(tracking_call_site_t));
+    site->_call_site = call_site;
+    site->_tag = tracker->_tag;
+    ++tracker->_call_sites_count;
+    return site;
+}
+
+_JOS_INLINE_FUNC void _tracking_lock(tracking_allocator_t* tracker) {
+    while (_tracking_cas(&tracker->_lock, 0, 1) != 0) {
+        _tracking_pause();
+    }
+}
+
+_JOS_INLINE_FUNC void _tracking_unlock(tracking_allocator_t* tracker) {
+    _tracking_compiler_barrier();
+    tracker->_lock = 0;
+}
+
+// called with the tracker locked
+_JOS_INLINE_FUNC void _tracking_record(tracking_allocator_t* tracker, void* ptr, size_t size, uintptr_t call_site) {
+    if (!ptr) {
+        return;
+    }
+    ++tracker->_alloc_count;
+    // load factor of max 3/4
+    tracking_call_site_t* site = tracker->_allocations_count < ((tracker->_allocations_capacity >> 2) * 3) ?
+        _tracking_call_site(tracker, call_site, true) : 0;
+    if (!site) {
+        ++tracker->_untracked_count;
+        return;
+    }
+
+    const size_t mask = tracker->_allocations_capacity - 1;
+    size_t i = _tracking_hash((uintptr_t)ptr, tracker->_allocations_capacity);
+    while (tracker->_allocations[i]._ptr) {
+        i = (i + 1) & mask;
+    }
+    tracker->_allocations[i] = (tracking_allocation_t){ ._ptr = (uintptr_t)ptr, ._size = size, ._call_site = call_site, ._tag = tracker->_tag };
+    ++tracker->_allocations_count;
+
+    site->_live_bytes += size;
+    ++site->_live_count;
+    ++site->_total_allocs;
+    if (site->_live_bytes > site->_peak_bytes) {
+        site->_peak_bytes = site->_live_bytes;
+    }
+    tracker->_live_bytes += size;
+    if (tracker->_live_bytes > tracker->_peak_bytes) {
+        tracker->_peak_bytes = tracker->_live_bytes;
+    }
+}
+
+// called with the tracker locked
+_JOS_INLINE_FUNC void _tracking_erase(tracking_allocator_t* tracker, void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    ++tracker->_free_count;
+    const size_t mask = tracker->_allocations_capacity - 1;
+    size_t i = _tracking_hash((uintptr_t)ptr, tracker->_allocations_capacity);
+    while (tracker->_allocations[i]._ptr != (uintptr_t)ptr) {
+        if (!tracker->_allocations[i]._ptr) {
+            // untracked allocation
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+
+    tracking_allocation_t* allocation = tracker->_allocations + i;
+    tracking_call_site_t* site = _tracking_call_site(tracker, allocation->_call_site, false);
+    if (site) {
+        site->_live_bytes -= allocation->_size;
+        --site->_live_count;
+    }
+    tracker->_live_bytes -= allocation->_size;
+    --tracker->_allocations_count;
+
+    // backward shift deletion; pull following entries of the same probe chain into the hole so we don't need tombstones
+    size_t hole = i;
+    size_t j = (i + 1) & mask;
+    while (tracker->_allocations[j]._ptr) {
+        const size_t home = _tracking_hash(tracker->_allocations[j]._ptr, tracker->_allocations_capacity);
+        // can the entry at j move to the hole without moving it before its home slot?
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            tracker->_allocations[hole] = tracker->_allocations[j];
+            hole = j;
+        }
+        j = (j + 1) & mask;
+    }
+    tracker->_allocations[hole]._ptr = 0;
+}
+
+_JOS_API_FUNC tracking_allocator_t* tracking_allocator_create(generic_allocator_t* allocator, generic_allocator_t* bookkeeping_allocator,
+                                            size_t max_allocations, size_t max_call_sites, const char* tag) {
+
+    _JOS_ASSERT(allocator && bookkeeping_allocator);
+
+    tracking_allocator_t* tracker = (tracking_allocator_t*)bookkeeping_allocator->alloc(bookkeeping_allocator, sizeof(tracking_allocator_t));
+    if (!tracker) {
+        return 0;
+    }
+    memset(tracker, 0, sizeof(tracking_allocator_t));
+    tracker->_allocator = allocator;
+    tracker->_tag = tag;
+    // capacity is 4/3 of the requested number to stay within the load factor
+    tracker->_allocations_capacity = _tracking_pow2(max_allocations + (max_allocations/3));
+    tracker->_call_sites_capacity = _tracking_pow2(max_call_sites + (max_call_sites/3));
+
+    const size_t allocations_size = tracker->_allocations_capacity * sizeof(tracking_allocation_t);
+    const size_t call_sites_size = tracker->_call_sites_capacity * sizeof(tracking_call_site_t);
+    tracker->_allocations = (tracking_allocation_t*)bookkeeping_allocator->alloc(bookkeeping_allocator, allocations_size);
+    tracker->_call_sites = (tracking_call_site_t*)bookkeeping_allocator->alloc(bookkeeping_allocator, call_sites_size);
+    if (!tracker->_allocations || !tracker->_call_sites) {
+        if (bookkeeping_allocator->free) {
+            if (tracker->_allocations) {
+                bookkeeping_allocator->free(bookkeeping_allocator, tracker->_allocations);
+            }
+            if (tracker->_call_sites) {
+                bookkeeping_allocator->free(bookkeeping_allocator, tracker->_call_sites);
+            }
+            bookkeeping_allocator->free(bookkeeping_allocator, tracker);
+        }
+        return 0;
+    }
+    memset(tracker->_allocations, 0, allocations_size);
+    memset(tracker->_call_sites, 0, call_sites_size);
+
+    tracker->_super.alloc = (generic_allocator_alloc_func_t)tracking_allocator_alloc;
+    // a tracked allocator has the same capabilities as the one it tracks
+    tracker->_super.free = allocator->free ? (generic_allocator_free_func_t)tracking_allocator_free : 0;
+    tracker->_super.realloc = allocator->realloc ? (generic_allocator_realloc_func_t)tracking_allocator_realloc : 0;
+    tracker->_super.available = (generic_allocator_avail_func_t)tracking_allocator_available;
+    tracker->_super.alloc_aligned = (generic_allocator_alloc_aligned_func_t)tracking_allocator_alloc_aligned;
+    tracker->_super.free_aligned = (generic_allocator_free_aligned_func_t)tracking_allocator_free_aligned;
+    tracker->_super.stats = allocator->stats ? (generic_allocator_stats_func_t)tracking_allocator_stats : 0;
+
+    return tracker;
+}
+
+_JOS_API_FUNC void* tracking_allocator_alloc(tracking_allocator_t* tracker, size_t size) {
+    void* ptr = tracker->_allocator->alloc(tracker->_allocator, size);
+    _tracking_lock(tracker);
+    _tracking_record(tracker, ptr, size, _JOS_RETURN_ADDRESS());
+    _tracking_unlock(tracker);
+    return ptr;
+}
+
+_JOS_API_FUNC void tracking_allocator_free(tracking_allocator_t* tracker, void* ptr) {
+    _tracking_lock(tracker);
+    _tracking_erase(tracker, ptr);
+    _tracking_unlock(tracker);
+    tracker->_allocator->free(tracker->_allocator, ptr);
+}
+
+_JOS_API_FUNC void* tracking_allocator_realloc(tracking_allocator_t* tracker, void* ptr, size_t size) {
+    void* new_ptr = tracker->_allocator->realloc(tracker->_allocator, ptr, size);
+    if (new_ptr || !size) {
+        _tracking_lock(tracker);
+        _tracking_erase(tracker, ptr);
+        _tracking_record(tracker, new_ptr, size, _JOS_RETURN_ADDRESS());
+        _tracking_unlock(tracker);
+    }
+    return new_ptr;
+}
+
+_JOS_API_FUNC void* tracking_allocator_alloc_aligned(tracking_allocator_t* tracker, size_t size, alloc_alignment_t alignment) {
+    void* ptr = allocator_alloc_aligned(tracker->_allocator, size, alignment);
+    _tracking_lock(tracker);
+    _tracking_record(tracker, ptr, size, _JOS_RETURN_ADDRESS());
+    _tracking_unlock(tracker);
+    return ptr;
+}
+
+_JOS_API_FUNC void tracking_allocator_free_aligned(tracking_allocator_t* tracker, void* ptr) {
+    _tracking_lock(tracker);
+    _tracking_erase(tracker, ptr);
+    _tracking_unlock(tracker);
+    allocator_free_aligned(tracker->_allocator, ptr);
+}
+
+_JOS_API_FUNC void tracking_allocator_visit_call_sites(tracking_allocator_t* tracker, tracking_allocator_call_site_visitor_t visitor, void* user_data) {
+    //NOTE: the visitor is called with the tracker locked, it mustn't allocate from the tracked allocator
+    _tracking_lock(tracker);
+    for (size_t i = 0; i < tracker->_call_sites_capacity; ++i) {
+        if (tracker->_call_sites[i]._call_site) {
+            visitor(tracker->_call_sites + i, user_data);
+        }
+    }
+    _tracking_unlock(tracker);
+}
+
+#endif // _JOS_TRACKING_ALLOCATOR_IMPLEMENTED
+
+#endif // _JOS_TRACKING_ALLOCATOR_H
@@ -5,6 +5,8 @@
 #ifdef _JOS_KERNEL_BUILD
 #include <c-efi.h>
 jo_status_t video_initialise(static_allocation_policy_t* static_allocation_policy, CEfiBootServices* boot_services);
+// maps the framebuffer write-combining, called once our own page tables are in place
+jo_status_t video_runtime_init(void);
 #else
 jo_status_t video_initialise(static_allocation_policy_t* static_allocation_policy);
 #endif
@@ -0,0 +1,379 @@
+#pragma once
+#ifndef _JOS_VMEM_H
+#define _JOS_VMEM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <jos.h>
+
+// ===============================================================
+//
+// vmem resource arena
+// Allocates ranges of an integer resource (usually virtual addresses) in multiples of a quantum,
+// after Bonwick & Adams, "Magazines and Vmem" (USENIX 2001).
+//
+// Every range, free or allocated, is described by a boundary tag (a segment) kept in address order.
+// Free segments are also kept in power-of-two freelists so that allocation is an instant fit; the
+// first segment in the smallest list guaranteed to hold the request is used. Allocated segments are
+// kept in a hash table so that a free only needs the address, and freed segments are coalesced with
+// free neighbours.
+//
+// Small allocations (up to qcache_max) go through quantum caches; a freed range of n quanta is kept
+// as-is in the cache for n instead of being coalesced, and handed out again without touching the freelists.
+// When the freelists can't satisfy an allocation the caches are drained back into the arena first.
+//
+// Segments are allocated from a separate tag allocator which must support free.
+// The arena itself is not thread safe.
+
+// freelist n holds free segments of [2^n, 2^(n+1)) bytes
+#define VMEM_NUM_FREELISTS      64
+// power of two
+#define VMEM_HASH_BUCKETS       64
+// quantum caches cover allocations up to this many quanta
+#define VMEM_MAX_QCACHE         16
+// ranges kept per quantum cache
+#define VMEM_QCACHE_DEPTH       16
+
+typedef enum _vmem_segment_type {
+    kVmemSegment_Free,
+    kVmemSegment_Allocated,
+    // allocated, but sitting in a quantum cache
+    kVmemSegment_Cached,
+} vmem_segment_type_t;
+
+typedef struct _vmem_segment {
+    uintptr_t               _base;
+    size_t                  _size;
+    vmem_segment_type_t     _type;
+    // all segments, in address order
+    struct _vmem_segment*   _prev;
+    struct _vmem_segment*   _next;
+    // freelist (doubly linked) or hash chain (singly linked)
+    struct _vmem_segment*   _link_prev;
+    struct _vmem_segment*   _link_next;
+} vmem_segment_t;
+
+typedef struct _vmem {
+    const char*             _name;
+    size_t                  _quantum;
+    size_t                  _qcache_max;
+    generic_allocator_t*    _tag_allocator;
+
+    vmem_segment_t*         _segments;
+    vmem_segment_t*         _freelists[VMEM_NUM_FREELISTS];
+    // bit n set if freelist n is not empty
+    uint64_t                _freemap;
+    vmem_segment_t*         _hash[VMEM_HASH_BUCKETS];
+
+    vmem_segment_t*         _qcache[VMEM_MAX_QCACHE][VMEM_QCACHE_DEPTH];
+    size_t                  _qcache_count[VMEM_MAX_QCACHE];
+
+    // bytes added to the arena, and bytes allocated from it (including quantum cached)
+    size_t                  _size;
+    size_t                  _in_use;
+} vmem_t;
+
+// create an arena for [base, base+size). quantum must be a power of two, base and size multiples of it.
+// base can't be 0 since vmem_alloc uses 0 to signal failure. size can be 0 and ranges added later with vmem_add.
+// qcache_max is the largest allocation, in bytes, served by the quantum caches; 0 for none.
+_JOS_API_FUNC jo_status_t vmem_create(vmem_t* vmem, const char* name, uintptr_t base, size_t size, size_t quantum,
+                                size_t qcache_max, generic_allocator_t* tag_allocator);
+// free all segments, outstanding allocations are simply forgotten
+_JOS_API_FUNC void vmem_destroy(vmem_t* vmem);
+// add [base, base+size) to the arena, it must not overlap anything already in it
+_JOS_API_FUNC jo_status_t vmem_add(vmem_t* vmem, uintptr_t base, size_t size);
+// allocate size bytes, rounded up to the quantum. returns 0 if there's no range large enough (or we can't allocate a tag)
+_JOS_API_FUNC uintptr_t vmem_alloc(vmem_t* vmem, size_t size);
+// returns the size of the allocation at addr, or 0 if addr is not the start of an allocation
+_JOS_API_FUNC size_t vmem_allocation_size(vmem_t* vmem, uintptr_t addr);
+// free the allocation at addr and return its size, or 0 if addr is not the start of an allocation
+_JOS_API_FUNC size_t vmem_free(vmem_t* vmem, uintptr_t addr);
+
+#if defined(_JOS_IMPLEMENT_ALLOCATORS) && !defined(_JOS_VMEM_IMPLEMENTED)
+#define _JOS_VMEM_IMPLEMENTED
+
+#ifdef _JOS_KERNEL_BUILD
+_JOS_INLINE_FUNC size_t _vmem_log2(size_t n) {
+    return 63 - (size_t)__builtin_clzll(n);
+}
+#else
+_JOS_INLINE_FUNC size_t _vmem_log2(size_t n) {
+    unsigned long l = 0;
+    _BitScanReverse64(&l, n);
+    return (size_t)l;
+}
+#endif
+
+_JOS_INLINE_FUNC size_t _vmem_hash(vmem_t* vmem, uintptr_t addr) {
+    // the low bits of addresses are always 0
+    const size_t h = (size_t)(addr / vmem->_quantum);
+    return (h ^ (h >> 6) ^ (h >> 12)) & (VMEM_HASH_BUCKETS - 1);
+}
+
+_JOS_INLINE_FUNC void _vmem_freelist_insert(vmem_t* vmem, vmem_segment_t* seg) {
+    const size_t list = _vmem_log2(seg->_size);
+    seg->_type = kVmemSegment_Free;
+    seg->_link_prev = 0;
+    seg->_link_next = vmem->_freelists[list];
+    if (seg->_link_next) {
+        seg->_link_next->_link_prev = seg;
+    }
+    vmem->_freelists[list] = seg;
+    vmem->_freemap |= (1ull << list);
+}
+
+_JOS_INLINE_FUNC void _vmem_freelist_remove(vmem_t* vmem, vmem_segment_t* seg) {
+    const size_t list = _vmem_log2(seg->_size);
+    if (seg->_link_prev) {
+        seg->_link_prev->_link_next = seg->_link_next;
+    }
+    else {
+        vmem->_freelists[list] = seg->_link_next;
+        if (!seg->_link_next) {
+            vmem->_freemap &= ~(1ull << list);
+        }
+    }
+    if (seg->_link_next) {
+        seg->_link_next->_link_prev = seg->_link_prev;
+    }
+}
+
+_JOS_INLINE_FUNC vmem_segment_t* _vmem_hash_find(vmem_t* vmem, uintptr_t addr, vmem_segment_t*** out_link) {
+    vmem_segment_t** link = vmem->_hash + _vmem_hash(vmem, addr);
+    while (*link && (*link)->_base != addr) {
+        link = &(*link)->_link_next;
+    }
+    if (out_link) {
+        *out_link = link;
+    }
+    return *link;
+}
+
+_JOS_INLINE_FUNC vmem_segment_t* _vmem_new_segment(vmem_t* vmem, uintptr_t base, size_t size) {
+    vmem_segment_t* seg = (vmem_segment_t*)vmem->_tag_allocator->alloc(vmem->_tag_allocator, sizeof(vmem_segment_t));
+    if (seg) {
+        memset(seg, 0, sizeof(vmem_segment_t));
+        seg->_base = base;
+        seg->_size = size;
+    }
+    return seg;
+}
+
+// remove seg from the address ordered list and free its tag
+_JOS_INLINE_FUNC void _vmem_delete_segment(vmem_t* vmem, vmem_segment_t* seg) {
+    if (seg->_prev) {
+        seg->_prev->_next = seg->_next;
+    }
+    else {
+        vmem->_segments = seg->_next;
+    }
+    if (seg->_next) {
+        seg->_next->_prev = seg->_prev;
+    }
+    vmem->_tag_allocator->free(vmem->_tag_allocator, seg);
+}
+
+// seg is free but not in a freelist; merge it with free neighbours and put the result in a freelist
+static void _vmem_coalesce(vmem_t* vmem, vmem_segment_t* seg) {
+    vmem_segment_t* next = seg->_next;
+    if (next && next->_type == kVmemSegment_Free && seg->_base + seg->_size == next->_base) {
+        _vmem_freelist_remove(vmem, next);
+        seg->_size += next->_size;
+        _vmem_delete_segment(vmem, next);
+    }
+    vmem_segment_t* prev = seg->_prev;
+    if (prev && prev->_type == kVmemSegment_Free && prev->_base + prev->_size == seg->_base) {
+        _vmem_freelist_remove(vmem, prev);
+        prev->_size += seg->_size;
+        _vmem_delete_segment(vmem, seg);
+        seg = prev;
+    }
+    _vmem_freelist_insert(vmem, seg);
+}
+
+// instant fit: the first segment of the smallest list where every segment is large enough,
+// falling back to searching the list size itself falls in
+static vmem_segment_t* _vmem_find_free(vmem_t* vmem, size_t size) {
+    const size_t lo = _vmem_log2(size);
+    const size_t hi = (size & (size - 1)) ? lo + 1 : lo;
+    if (hi < VMEM_NUM_FREELISTS) {
+        const uint64_t candidates = vmem->_freemap & ~((1ull << hi) - 1);
+        if (candidates) {
+            return vmem->_freelists[_vmem_log2(candidates & (~candidates + 1))];
+        }
+    }
+    if (hi != lo) {
+        for (vmem_segment_t* seg = vmem->_freelists[lo]; seg; seg = seg->_link_next) {
+            if (seg->_size >= size) {
+                return seg;
+            }
+        }
+    }
+    return 0;
+}
+
+// give everything in the quantum caches back to the arena, returns true if there was anything
+static bool _vmem_qcache_drain(vmem_t* vmem) {
+    bool drained = false;
+    for (size_t q = 0; q < VMEM_MAX_QCACHE; ++q) {
+        while (vmem->_qcache_count[q]) {
+            vmem_segment_t* seg = vmem->_qcache[q][--vmem->_qcache_count[q]];
+            vmem_segment_t** link;
+            _vmem_hash_find(vmem, seg->_base, &link);
+            *link = seg->_link_next;
+            vmem->_in_use -= seg->_size;
+            _vmem_coalesce(vmem, seg);
+            drained = true;
+        }
+    }
+    return drained;
+}
+
+_JOS_API_FUNC jo_status_t vmem_create(vmem_t* vmem, const char* name, uintptr_t base, size_t size, size_t quantum,
+                                size_t qcache_max, generic_allocator_t* tag_allocator) {
+    if (!vmem || !tag_allocator || !tag_allocator->free || !quantum || (quantum & (quantum - 1))) {
+        return _JO_STATUS_INVALID_INPUT;
+    }
+    memset(vmem, 0, sizeof(vmem_t));
+    vmem->_name = name;
+    vmem->_quantum = quantum;
+    vmem->_tag_allocator = tag_allocator;
+    qcache_max = _JOS_ALIGN(qcache_max, quantum);
+    vmem->_qcache_max = qcache_max > VMEM_MAX_QCACHE * quantum ? VMEM_MAX_QCACHE * quantum : qcache_max;
+    return size ? vmem_add(vmem, base, size) : _JO_STATUS_SUCCESS;
+}
+
+_JOS_API_FUNC void vmem_destroy(vmem_t* vmem) {
+    vmem_segment_t* seg = vmem->_segments;
+    while (seg) {
+        vmem_segment_t* next = seg->_next;
+        vmem->_tag_allocator->free(vmem->_tag_allocator, seg);
+        seg = next;
+    }
+    memset(vmem, 0, sizeof(vmem_t));
+}
+
+_JOS_API_FUNC jo_status_t vmem_add(vmem_t* vmem, uintptr_t base, size_t size) {
+    if (!base || !size
+        || !_JOS_PTR_IS_ALIGNED(base, vmem->_quantum)
+        || !_JOS_PTR_IS_ALIGNED(size, vmem->_quantum)
+        || base + size < base) {
+        return _JO_STATUS_INVALID_INPUT;
+    }
+    vmem_segment_t* prev = 0;
+    vmem_segment_t* next = vmem->_segments;
+    while (next && next->_base < base) {
+        prev = next;
+        next = next->_next;
+    }
+    if ((prev && prev->_base + prev->_size > base) || (next && base + size > next->_base)) {
+        return _JO_STATUS_INVALID_INPUT;
+    }
+    vmem_segment_t* seg = _vmem_new_segment(vmem, base, size);
+    if (!seg) {
+        return _JO_STATUS_RESOURCE_EXHAUSTED;
+    }
+    seg->_prev = prev;
+    seg->_next = next;
+    if (prev) {
+        prev->_next = seg;
+    }
+    else {
+        vmem->_segments = seg;
+    }
+    if (next) {
+        next->_prev = seg;
+    }
+    vmem->_size += size;
+    _vmem_coalesce(vmem, seg);
+    return _JO_STATUS_SUCCESS;
+}
+
+_JOS_API_FUNC uintptr_t vmem_alloc(vmem_t* vmem, size_t size) {
+    if (!size) {
+        return 0;
+    }
+    size = _JOS_ALIGN(size, vmem->_quantum);
+    if (!size) {
+        // overflow
+        return 0;
+    }
+
+    if (size <= vmem->_qcache_max) {
+        const size_t q = size / vmem->_quantum - 1;
+        if (vmem->_qcache_count[q]) {
+            vmem_segment_t* seg = vmem->_qcache[q][--vmem->_qcache_count[q]];
+            seg->_type = kVmemSegment_Allocated;
+            return seg->_base;
+        }
+    }
+
+    vmem_segment_t* seg = _vmem_find_free(vmem, size);
+    if (!seg && _vmem_qcache_drain(vmem)) {
+        // the ranges sitting in the quantum caches may coalesce into one that fits
+        seg = _vmem_find_free(vmem, size);
+    }
+    if (!seg) {
+        return 0;
+    }
+    if (seg->_size > size) {
+        // split off the tail and leave it free
+        vmem_segment_t* tail = _vmem_new_segment(vmem, seg->_base + size, seg->_size - size);
+        if (!tail) {
+            return 0;
+        }
+        _vmem_freelist_remove(vmem, seg);
+        seg->_size = size;
+        tail->_prev = seg;
+        tail->_next = seg->_next;
+        if (seg->_next) {
+            seg->_next->_prev = tail;
+        }
+        seg->_next = tail;
+        _vmem_freelist_insert(vmem, tail);
+    }
+    else {
+        _vmem_freelist_remove(vmem, seg);
+    }
+
+    seg->_type = kVmemSegment_Allocated;
+    vmem_segment_t** bucket = vmem->_hash + _vmem_hash(vmem, seg->_base);
+    seg->_link_prev = 0;
+    seg->_link_next = *bucket;
+    *bucket = seg;
+    vmem->_in_use += size;
+    return seg->_base;
+}
+
+_JOS_API_FUNC size_t vmem_allocation_size(vmem_t* vmem, uintptr_t addr) {
+    vmem_segment_t* seg = _vmem_hash_find(vmem, addr, 0);
+    return seg && seg->_type == kVmemSegment_Allocated ? seg->_size : 0;
+}
+
+_JOS_API_FUNC size_t vmem_free(vmem_t* vmem, uintptr_t addr) {
+    vmem_segment_t** link;
+    vmem_segment_t* seg = _vmem_hash_find(vmem, addr, &link);
+    if (!seg || seg->_type != kVmemSegment_Allocated) {
+        // not ours, or a double free
+        return 0;
+    }
+    const size_t size = seg->_size;
+
+    if (size <= vmem->_qcache_max) {
+        const size_t q = size / vmem->_quantum - 1;
+        if (vmem->_qcache_count[q] < VMEM_QCACHE_DEPTH) {
+            seg->_type = kVmemSegment_Cached;
+            vmem->_qcache[q][vmem->_qcache_count[q]++] = seg;
+            return size;
+        }
+    }
+
+    *link = seg->_link_next;
+    vmem->_in_use -= size;
+    _vmem_coalesce(vmem, seg);
+    return size;
+}
+
+#endif // _JOS_IMPLEMENT_ALLOCATORS
+#endif // _JOS_VMEM_H
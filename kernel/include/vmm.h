@@ -0,0 +1,44 @@
+#pragma once
+
+#ifndef _JOS_KERNEL_VMM_H_
+#define _JOS_KERNEL_VMM_H_
+
+#include <jos.h>
+
+// ==================================================================================================
+// kernel virtual memory.
+// virtual ranges are reserved from a vmem arena (see vmem.h) above the direct map, and backed by 
+// zeroed 4K frames from memory_frame_alloc_zeroed which don't need to be physically contiguous. 
+// the kernel page allocator (page_allocator_t) hands out mapped, zeroed, page aligned memory.
+// large, sparsely used, reservations can instead be committed lazily, page by page, from the #PF handler.
+
+// the range of kernel virtual addresses managed here, it must not overlap the direct map
+#define JOSX_VMM_BASE           0x0000100000000000ull
+#define JOSX_VMM_SIZE           0x0000100000000000ull
+// allocations up to this size are served by the vmem quantum caches
+#define JOSX_VMM_QCACHE_MAX     0x10000
+
+//NOTE: called on the BSP *only*, after pagetables_runtime_init. segment tags are allocated from the dynamic allocator
+_JOS_API_FUNC jo_status_t vmm_initialise(dynamic_allocation_policy_t* dynamic_allocation_policy);
+
+// reserve size bytes (rounded up to 4K) of kernel virtual address space, without mapping anything.
+// returns 0 if out of address space
+_JOS_API_FUNC void* vmm_reserve(size_t size);
+// release a reservation, anything mapped in it must have been unmapped first
+_JOS_API_FUNC void vmm_release(void* at);
+
+// reserve size bytes (rounded up to 4K) which are backed by zeroed frames, with prot_flags, the first time 
+// each page is touched. release with vmm_page_allocator()->free. returns 0 if out of address space
+_JOS_API_FUNC void* vmm_reserve_lazy(size_t size, int prot_flags);
+// commit every page of [at, at+size) that isn't committed yet. the range must be inside a lazy reservation.
+//NOTE: stacks must be committed up front; the #PF handler runs on the faulting stack so a fault on a stack 
+//      page can't be resolved
+_JOS_API_FUNC jo_status_t vmm_commit(void* at, size_t size);
+// called for every #PF; commits the page if addr is in a lazy reservation and not mapped yet.
+// returns false if the fault is not ours to resolve
+_JOS_API_FUNC bool vmm_handle_page_fault(uintptr_t addr, uint64_t error_code);
+
+// the kernel page allocator, flags are the PAGE_ protection flags from jos.h
+_JOS_API_FUNC page_allocator_t* vmm_page_allocator(void);
+
+#endif // _JOS_KERNEL_VMM_H_
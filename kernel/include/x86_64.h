@@ -71,6 +71,11 @@ _JOS_INLINE_FUNC uint64_t x86_64_read_cr3(void)
     return val;
 }
 
+_JOS_INLINE_FUNC void x86_64_write_cr3(uint64_t val)
+{
+    __asm__ volatile ( "mov %0, %%cr3" : : "r" (val) : "memory" );
+}
+
 _JOS_INLINE_FUNC uint64_t x86_64_read_cr4(void)
 {
     uint64_t val;
@@ -93,6 +98,27 @@ _JOS_INLINE_FUNC void x86_64_flush_tlb_for_address(uintptr_t addr) {
    __asm__ volatile("invlpg (%0)" ::"r" (addr) : "memory");
 }
 
+// INVPCID types
+#define X86_64_INVPCID_ADDRESS              0
+#define X86_64_INVPCID_SINGLE_CONTEXT       1
+#define X86_64_INVPCID_ALL_CONTEXTS         2
+#define X86_64_INVPCID_ALL_NON_GLOBAL       3
+
+_JOS_INLINE_FUNC void x86_64_invpcid(uint64_t type, uint64_t pcid, uintptr_t addr) {
+    struct { uint64_t pcid; uint64_t addr; } desc = { pcid, addr };
+    __asm__ volatile("invpcid %1, %0" :: "r"(type), "m"(desc) : "memory");
+}
+
+// write back and invalidate all caches
+_JOS_INLINE_FUNC void x86_64_wbinvd(void) {
+    __asm__ volatile("wbinvd" ::: "memory");
+}
+
+// drains write-combining buffers, making WC stores globally visible
+_JOS_INLINE_FUNC void x86_64_sfence(void) {
+    __asm__ volatile("sfence" ::: "memory");
+}
+
 // (safe) dummy write to POST port, this usually provides a ~usecond delay
 #define x86_64_io_wait() x86_64_outb(0x80, 0)
 #define x86_64_debugbreak() __asm__ volatile( "int $03" )
@@ -6,6 +6,9 @@
 #include <x86_64.h>
 #include <i8259a.h>
 #include <debugger.h>
+#include <tlb.h>
+#include <vmm.h>
+#include <apic.h>
 
 #include <stdio.h>
 #include <output_console.h>
@@ -114,6 +117,8 @@ EXTERN_ISR_HANDLER(28);
 EXTERN_ISR_HANDLER(29);
 EXTERN_ISR_HANDLER(30);
 EXTERN_ISR_HANDLER(31);
+// IPIs
+EXTERN_ISR_HANDLER(240);
 
 #define EXTERN_IRQ_HANDLER(N)\
     extern void interrupts_irq_handler_##N(void)
@@ -161,6 +166,12 @@ static void idt_init(idt_entry_t* entry, void* handler) {
 
 void interrupts_isr_handler(interrupt_stack_t *stack) {
 
+    // a lazy processor may have TLB invalidations queued which it must process before it touches anything
+    tlb_process_pending();
+    // faults on lazily committed memory are resolved here, before any handler (such as the debugger's) sees them
+    if ( stack->handler_id == 14 && vmm_handle_page_fault(x86_64_read_cr2(), stack->error_code) ) {
+        return;
+    }
     bool handled = false;
     if ( _interrupts_enabled )
     {        
@@ -174,6 +185,11 @@ void interrupts_isr_handler(interrupt_stack_t *stack) {
     }
 
     if ( !handled ) {
+        if ( stack->handler_id == _JOS_KERNEL_IPI_TLB_SHOOTDOWN ) {
+            // the shootdown has been processed above, but the local APIC won't deliver anything else until we EOI
+            apic_eoi();
+            return;
+        }
         _JOS_KTRACE_CHANNEL(kInterruptsChannel, "unhandled interrupt 0x%x", stack->handler_id);        
     }
 }
@@ -188,6 +204,8 @@ void interrupts_set_isr_handler(isr_handler_def_t* def) {
 
 void interrupts_irq_handler(int irq) {
     
+    // see interrupts_isr_handler
+    tlb_process_pending();
     // switch off the IRQ before we send EOI so we don't get doubled
     i8259a_disable_irq(irq);    
     // let the PIC get on with other IRQs
@@ -257,6 +275,8 @@ void interrupts_initialise_early(void) {
     SET_ISR_HANDLER(29);
     SET_ISR_HANDLER(30);
     SET_ISR_HANDLER(31);
+    // _JOS_KERNEL_IPI_TLB_SHOOTDOWN
+    SET_ISR_HANDLER(240);
 
 #define SET_IRQ_HANDLER(N)\
     idt_init(_idt+_JOS_i8259a_IRQ_BASE_OFFSET+N, interrupts_irq_handler_##N)
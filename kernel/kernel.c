@@ -17,6 +17,9 @@
 #include <keyboard.h>
 #include <tasks.h>
 #include <smp.h>
+#include <scratch.h>
+#include <tlb.h>
+#include <vmm.h>
 #include <acpi.h>
 
 
@@ -34,6 +37,10 @@ uint16_t kJosKernelCS;
 
 static const char* kKernelChannel = "kernel";
 static hive_t _hive;
+// frequently updated kernel values, interned once the hive exists
+static hive_key_t _hive_pool_key = HIVE_KEY_INVALID;
+static hive_key_t _hive_heap_key = HIVE_KEY_INVALID;
+static hive_key_t _hive_boot_size_key = HIVE_KEY_INVALID;
 
 _JOS_NORETURN void halt_cpu() {
     serial_write_str(kCom1, "\n\nkernel halting\n");
@@ -49,6 +56,10 @@ _JOS_NORETURN void halt_cpu() {
 // management themselves
 static generic_allocator_t*  _kernel_system_allocator = 0;
 static generic_allocator_t*  _kernel_heap_allocator = 0;
+static generic_allocator_t*  _kernel_smp_allocator = 0;
+static generic_allocator_t*  _kernel_vmm_allocator = 0;
+// non-zero if JOSX_TRACK_HEAP_ALLOCATIONS, wraps the heap allocator
+static tracking_allocator_t* _kernel_heap_tracker = 0;
 static size_t _initial_memory = 0;
 
 _JOS_API_FUNC void kernel_memory_available(size_t* on_boot, size_t* now) {
@@ -56,6 +67,68 @@ _JOS_API_FUNC void kernel_memory_available(size_t* on_boot, size_t* now) {
     *now = _kernel_system_allocator->available(_kernel_system_allocator);
 }
 
+_JOS_API_FUNC tracking_allocator_t* kernel_heap_tracker(void) {
+    return _kernel_heap_tracker;
+}
+
+#define _KERNEL_HEAP_TOP_CALL_SITES 16
+typedef struct _heap_top_call_sites {
+    tracking_call_site_t    _sites[_KERNEL_HEAP_TOP_CALL_SITES];
+    size_t                  _count;
+} _heap_top_call_sites_t;
+
+// keeps the call sites with the most live bytes, sorted largest first
+static void _collect_top_call_sites(const tracking_call_site_t* site, void* user_data) {
+    _heap_top_call_sites_t* top = (_heap_top_call_sites_t*)user_data;
+    if (!site->_live_bytes) {
+        return;
+    }
+    size_t i = top->_count;
+    if (i == _KERNEL_HEAP_TOP_CALL_SITES) {
+        if (top->_sites[i-1]._live_bytes >= site->_live_bytes) {
+            return;
+        }
+        --i;
+    }
+    else {
+        ++top->_count;
+    }
+    while (i && top->_sites[i-1]._live_bytes < site->_live_bytes) {
+        top->_sites[i] = top->_sites[i-1];
+        --i;
+    }
+    top->_sites[i] = *site;
+}
+
+_JOS_API_FUNC void kernel_update_heap_stats(void) {
+    memory_update_pool_stats();
+    if (_hive_heap_key != HIVE_KEY_INVALID) {
+        hive_set_int(&_hive, _hive_heap_key, (long long)_kernel_heap_allocator->available(_kernel_heap_allocator));
+    }
+    if (!_kernel_heap_tracker) {
+        return;
+    }
+
+    // NOTE: copy the call sites out first, the hive allocates from the heap we're looking at
+    _heap_top_call_sites_t top = { ._count = 0 };
+    tracking_allocator_visit_call_sites(_kernel_heap_tracker, _collect_top_call_sites, &top);
+
+    hive_set(&_hive, "kernel:heap_tracking", 
+        HIVE_VALUE_INT(_kernel_heap_tracker->_live_bytes),
+        HIVE_VALUE_INT(_kernel_heap_tracker->_peak_bytes),
+        HIVE_VALUE_INT(_kernel_heap_tracker->_alloc_count),
+        HIVE_VALUE_INT(_kernel_heap_tracker->_free_count),
+        HIVE_VALUE_INT(_kernel_heap_tracker->_untracked_count),
+        HIVE_VALUE_INT(clock_ms_since_boot()),
+        HIVE_VALUELIST_END);
+
+    // list of call site, live bytes pairs
+    hive_delete(&_hive, "kernel:heap_sites");
+    for (size_t n = 0; n < top._count; ++n) {
+        hive_lpush(&_hive, "kernel:heap_sites", HIVE_VALUE_PTR(top._sites[n]._call_site), HIVE_VALUE_INT(top._sites[n]._live_bytes), HIVE_VALUELIST_END);
+    }
+}
+
 _JOS_API_FUNC jo_status_t kernel_uefi_init(CEfiSystemTable* system_services) {
 
     _JOS_KTRACE_CHANNEL(kKernelChannel, "uefi init");
@@ -74,15 +147,45 @@ _JOS_API_FUNC jo_status_t kernel_uefi_init(CEfiSystemTable* system_services) {
         return status;
     }
 
-    // we use two pools of memory for the kernel:
+    // the NUMA topology decides where frames come from. failing to find it isn't fatal, we just treat the system as one node
+    status = acpi_numa_initialise(system_services);
+    if ( _JO_FAILED(status) ) {
+        _JOS_KTRACE_CHANNEL(kKernelChannel, "no ACPI NUMA information 0x%x", status);
+    }
+
+    // frames backing kernel virtual memory come out of the same startup memory, before the pools take the rest
+    status = memory_frames_initialise(system_services->boot_services, JOSX_FRAME_POOL_SIZE);
+    if ( _JO_FAILED(status) ) {
+        _JOS_KTRACE_CHANNEL(kKernelChannel, "***FATAL ERROR: failed to reserve page frames 0x%x", status);
+        return status;
+    }
+
+    // we use these pools of memory for the kernel:
     //   one STATIC pool from which modules create their heaps
     //   one DYNAMIC kernel heap
+    //   one STATIC pool for the per-CPU structures
+    // they start small and grow on demand within their budgets, the rest of the startup memory is what they can grow
+    // into until vmm is up. vmm itself gets a fixed pool.
     _initial_memory = memory_get_available();
-    //ZZZ: this is not a very clever algorithm, needs refinement
-    const size_t pool_size = (_initial_memory * 3) / 4;
-    _kernel_system_allocator = memory_allocate_pool(kMemoryPoolType_Static, pool_size);
-    // the heap gets whatever is left
-    _kernel_heap_allocator = memory_allocate_pool(kMemoryPoolType_Dynamic, 0);
+    _kernel_vmm_allocator = memory_allocate_pool(kMemoryPoolType_Dynamic, JOSX_KERNEL_VMM_POOL_SIZE, JOSX_MEMORY_NODE_ANY);
+    _kernel_system_allocator = memory_create_growable_pool(kMemoryPoolType_Static, "static", 
+                                    JOSX_KERNEL_STATIC_POOL_SIZE, JOSX_KERNEL_STATIC_POOL_BUDGET);
+    _kernel_heap_allocator = memory_create_growable_pool(kMemoryPoolType_Dynamic, "heap", 
+                                    JOSX_KERNEL_HEAP_POOL_SIZE, JOSX_KERNEL_HEAP_POOL_BUDGET);
+    _kernel_smp_allocator = memory_create_growable_pool(kMemoryPoolType_Static, "smp", 
+                                    JOSX_KERNEL_SMP_POOL_SIZE, JOSX_KERNEL_SMP_POOL_BUDGET);
+    if ( !_kernel_vmm_allocator || !_kernel_system_allocator || !_kernel_heap_allocator || !_kernel_smp_allocator ) {
+        _JOS_KTRACE_CHANNEL(kKernelChannel, "***FATAL ERROR: failed to create kernel pools");
+        return _JO_STATUS_RESOURCE_EXHAUSTED;
+    }
+#if JOSX_TRACK_HEAP_ALLOCATIONS
+    // tracking tables live in the static pool so that they don't show up in the statistics
+    _kernel_heap_tracker = tracking_allocator_create(_kernel_heap_allocator, _kernel_system_allocator, 
+                                JOSX_TRACK_HEAP_MAX_ALLOCATIONS, JOSX_TRACK_HEAP_MAX_CALL_SITES, "kernel:heap");
+    if (_kernel_heap_tracker) {
+        _kernel_heap_allocator = (generic_allocator_t*)_kernel_heap_tracker;
+    }
+#endif
 
     // create our hive storage
     hive_create(&_hive, (generic_allocator_t*)_kernel_heap_allocator);    
@@ -93,12 +196,18 @@ _JOS_API_FUNC jo_status_t kernel_uefi_init(CEfiSystemTable* system_services) {
         return status;
     }
     
-    status = smp_initialise(&(static_allocation_policy_t){ .allocator = _kernel_system_allocator }, system_services->boot_services);
+    status = smp_initialise(&(static_allocation_policy_t){ .allocator = _kernel_smp_allocator }, system_services->boot_services);
     if ( !_JO_SUCCEEDED(status) ) {
         _JOS_KTRACE_CHANNEL(kKernelChannel, "***FATAL ERROR: SMP initialise returned 0x%x", status);
         return status;
     }
 
+    status = scratch_initialise(&(static_allocation_policy_t){ .allocator = _kernel_system_allocator });
+    if ( _JO_FAILED(status) ) {
+        _JOS_KTRACE_CHANNEL(kKernelChannel, "***FATAL ERROR: scratch initialise returned 0x%x", status);
+        return status;
+    }
+
     // port it to use module register
     status = video_initialise(&(static_allocation_policy_t){ .allocator = _kernel_system_allocator }, system_services->boot_services);
     if ( _JO_FAILED(status)  ) {
@@ -108,16 +217,37 @@ _JOS_API_FUNC jo_status_t kernel_uefi_init(CEfiSystemTable* system_services) {
     
     // =====================================================================
 
-    hive_set(&_hive, "kernel:pool", HIVE_VALUE_INT(_kernel_system_allocator->available(_kernel_system_allocator)), HIVE_VALUELIST_END);
-    hive_set(&_hive, "kernel:heap", HIVE_VALUE_INT(_kernel_heap_allocator->available(_kernel_heap_allocator)), HIVE_VALUELIST_END);
+    _hive_pool_key = hive_intern(&_hive, "kernel:pool");
+    _hive_heap_key = hive_intern(&_hive, "kernel:heap");
+    _hive_boot_size_key = hive_intern(&_hive, "kernel:hive_boot_size");
+    hive_set_int(&_hive, _hive_pool_key, (long long)_kernel_system_allocator->available(_kernel_system_allocator));
+    hive_set_int(&_hive, _hive_heap_key, (long long)_kernel_heap_allocator->available(_kernel_heap_allocator));
     
-    hive_set(&_hive, "kernel:hive_boot_size", HIVE_VALUE_INT(hive_memory_footprint(&_hive)), HIVE_VALUELIST_END);
+    hive_set_int(&_hive, _hive_boot_size_key, (long long)hive_memory_footprint(&_hive));
+    kernel_update_heap_stats();
     hive_set(&_hive, "kernel:booted", HIVE_VALUELIST_END);
 
     _JOS_KTRACE_CHANNEL(kKernelChannel, "uefi init ok");
     return _JO_STATUS_SUCCESS;
 }
 
+// create an address space, run on it, and destroy it again; a failure here is traced but isn't fatal
+static void _check_address_spaces(void) {
+    pagetables_address_space_t* space = pagetables_create_address_space();
+    if ( !space ) {
+        _JOS_KTRACE_CHANNEL(kKernelChannel, "failed to create an address space");
+        return;
+    }
+    pagetables_switch_address_space(space);
+    // it mirrors the kernel mappings so everything we use must still be there
+    const bool mirrored = pagetables_is_present((void*)&_hive);
+    pagetables_switch_address_space(pagetables_kernel_address_space());
+    pagetables_destroy_address_space(space);
+    if ( !mirrored ) {
+        _JOS_KTRACE_CHANNEL(kKernelChannel, "***ERROR: address spaces don't mirror the kernel mappings");
+    }
+}
+
 _JOS_API_FUNC jo_status_t kernel_runtime_init(CEfiHandle h, CEfiSystemTable* system_services) {
     
     jo_status_t k_stat = memory_runtime_init(h, system_services->boot_services);
@@ -125,7 +255,27 @@ _JOS_API_FUNC jo_status_t kernel_runtime_init(CEfiHandle h, CEfiSystemTable* sys
         return k_stat;
     }
 
+    // the UEFI identity map is replaced with our own direct map
+    k_stat = pagetables_runtime_init(_kernel_system_allocator);
+    if ( _JO_FAILED(k_stat) ) {
+        return k_stat;
+    }
+
     interrupts_initialise_early();
+    k_stat = tlb_initialise(&(static_allocation_policy_t){ .allocator = _kernel_system_allocator });
+    if ( _JO_FAILED(k_stat) ) {
+        return k_stat;
+    }
+    _check_address_spaces();
+    k_stat = vmm_initialise(&(dynamic_allocation_policy_t){ .allocator = _kernel_vmm_allocator });
+    if ( _JO_FAILED(k_stat) ) {
+        return k_stat;
+    }
+    // not fatal, the framebuffer is just slower to write to
+    k_stat = video_runtime_init();
+    if ( _JO_FAILED(k_stat) ) {
+        _JOS_KTRACE_CHANNEL(kKernelChannel, "video runtime init returned 0x%x, framebuffer not write-combining", k_stat);
+    }
 	debugger_initialise((generic_allocator_t*)_kernel_system_allocator);
     clock_initialise();
     keyboard_initialise();    
@@ -8,6 +8,7 @@
 #include <wchar.h>
 
 #include <keyboard.h>
+#include <ring.h>
 
 enum _kbd_encoder_ports {
     kKbdEncoder_Port    = 0x60,
@@ -32,16 +33,13 @@ enum _kbd_encoder_status_codes {
 #define SCAN_CODE_EXTENDED 0xe0
 
 #define KBD_BUFFER_SIZE 32
-static uint8_t _keyboard_buffer[KBD_BUFFER_SIZE];
-static size_t _keys_in_buffer = 0;
+// written by the IRQ handler and read by whoever polls the keyboard, extended keys have SCAN_CODE_EXTENDED in the high byte
+static uint16_t _keyboard_buffer_storage[KBD_BUFFER_SIZE];
+static spsc_ring_t _keyboard_buffer;
 static keyboard_state_t  _keyboard_state;
 static bool _extended_code = false;
 static short _keyboard_id_code = 0;
 
-static lock_t _keyboard_buffer_lock;
-#define LOCK_BUFFER() lock_spinlock(&_keyboard_buffer_lock)
-#define UNLOCK_BUFFER() lock_unlock(&_keyboard_buffer_lock)
-
 // used in the LUT to indicate a key that should be intercepted by the IRQ handler.
 #define KEYBOARD_VK_INVALID 0xff
 
@@ -170,7 +168,7 @@ static void _irq_1_handler(int irqNum) {
 
     (void)irqNum;
 
-    if(_keys_in_buffer == KBD_BUFFER_SIZE) {
+    if(spsc_ring_size(&_keyboard_buffer) == KBD_BUFFER_SIZE) {
         //TODO: "beep"..?
         return;
     }
@@ -180,9 +178,6 @@ static void _irq_1_handler(int irqNum) {
         uint8_t scan_code = KBD_ENCODER_READ();
         if ( scan_code == SCAN_CODE_EXTENDED ) {
             _extended_code = true;
-            LOCK_BUFFER();
-            _keyboard_buffer[_keys_in_buffer++] = SCAN_CODE_EXTENDED;
-            UNLOCK_BUFFER();
         }
         else {
             uint8_t pressed = (scan_code & 0x80) == 0;
@@ -216,9 +211,8 @@ static void _irq_1_handler(int irqNum) {
             default:
             {
                 // everything else we just store in the buffer
-                LOCK_BUFFER();
-                _keyboard_buffer[_keys_in_buffer++] = scan_code;
-                UNLOCK_BUFFER();
+                const uint16_t key = (uint16_t)((_extended_code ? SCAN_CODE_EXTENDED << 8 : 0) | scan_code);
+                spsc_ring_push(&_keyboard_buffer, &key);
             }
             break;
             }
@@ -226,7 +220,7 @@ static void _irq_1_handler(int irqNum) {
             _extended_code = false;
         }
 
-        if( _keys_in_buffer == KBD_BUFFER_SIZE ) {
+        if( spsc_ring_size(&_keyboard_buffer) == KBD_BUFFER_SIZE ) {
             //TODO: beep...
             break;
         }
@@ -235,7 +229,7 @@ static void _irq_1_handler(int irqNum) {
 
 void keyboard_initialise(void) {
     memset(&_keyboard_state , 0, sizeof(_keyboard_state));
-    lock_initialise(&_keyboard_buffer_lock);    
+    spsc_ring_create_fixed(&_keyboard_buffer, _keyboard_buffer_storage, KBD_BUFFER_SIZE, sizeof(uint16_t));
 
     //ZZZ: this does not appear to work very well
 
@@ -278,26 +272,15 @@ short       keyboard_get_id(void) {
 }
 
 bool        keyboard_has_key(void) {
-    LOCK_BUFFER();
-    bool has_keys = _keys_in_buffer>0;
-    UNLOCK_BUFFER();
-    return has_keys;
+    return !spsc_ring_is_empty(&_keyboard_buffer);
 }
 
 #define MAKE_VK(scancode, character) ((((uint32_t)scancode)<<24) | (uint32_t)character & 0xff)
 uint32_t     keyboard_get_last_key(void) {
-    uint8_t sc = 0;
-    bool extended = false;
-    LOCK_BUFFER();    
-    if (_keys_in_buffer) {
-         sc = _keyboard_buffer[--_keys_in_buffer];
-         //ZZZ: if the buffer is empty....it can happen!
-         if(sc == SCAN_CODE_EXTENDED && _keys_in_buffer) {
-             extended = true;             
-             sc = _keyboard_buffer[--_keys_in_buffer];
-         }
-    }
-    UNLOCK_BUFFER();
+    uint16_t key = 0;
+    spsc_ring_pop(&_keyboard_buffer, &key);
+    const uint8_t sc = (uint8_t)key;
+    const bool extended = (key >> 8) == SCAN_CODE_EXTENDED;
 
     if (sc) {
         if ( extended ) {
@@ -2,17 +2,28 @@
 
 #define _JOS_IMPLEMENT_ALLOCATORS
 #define _JOS_IMPLEMENT_CONTAINERS
+#define _JOS_IMPLEMENT_HASH
+#define _JOS_IMPLEMENT_RANGE_MAP
+#define _JOS_IMPLEMENT_RING
 
 #include <arena_allocator.h>
 #include <fixed_allocator.h>
 #include <linear_allocator.h>
+#include <tracking_allocator.h>
+#include <vmem.h>
 #include <collections.h>
+#include <range_map.h>
+#include <ring.h>
 
 #include <stdio.h>
 #include <string.h>
 #include <serial.h>
 #include <wchar.h>
 #include <memory.h>
+#include <kernel.h>
+#include <acpi.h>
+#include <smp.h>
+#include <vmm.h>
 
 static CEfiMemoryDescriptor *_boot_service_memory_map = 0;
 static CEfiUSize            _boot_service_memory_map_size = 0;
@@ -21,6 +32,8 @@ static CEfiUSize            _map_key = 0;
 static CEfiUSize            _descriptor_size = 0;
 static CEfiU32              _descriptor_version = 0;   
 static linear_allocator_t*  _main_allocator = 0;
+// end of the highest range of any type reported by the firmware
+static uintptr_t            _highest_physical_address = 0;
 
 static const char* kMemoryChannel = "memory";
 
@@ -50,10 +63,44 @@ typedef struct _memory_region {
 
 } memory_region_t;
 
+// 4K frames are handed out from [_next, _end) of each zone and recycled through free lists linked through the frames themselves.
+// freed frames are dirty until the background zeroing task moves them to the zeroed list.
+// there is one zone per NUMA node, frames are returned to the zone they came from.
+#define FRAME_SIZE  0x1000
+typedef struct _frame_zone {
+    uintptr_t   _begin;
+    uintptr_t   _next;
+    uintptr_t   _end;
+    uintptr_t   _free_frames;
+    size_t      _num_free_frames;
+    uintptr_t   _zeroed_frames;
+    size_t      _num_zeroed_frames;
+    lock_t      _lock;
+    // zones to allocate from, this one first and then the others nearest first
+    uint8_t     _fallback[ACPI_MAX_NUMA_NODES];
+} frame_zone_t;
+static frame_zone_t _zones[ACPI_MAX_NUMA_NODES];
+static size_t       _num_zones = 0;
+// node local memory for frames and pools, only on NUMA systems; on a single node system it's the main allocator
+static linear_allocator_t*  _node_allocators[ACPI_MAX_NUMA_NODES];
+
+// pools whose statistics are published in the hive, see memory_update_pool_stats
+#define MAX_REGISTERED_POOLS 16
+typedef struct _registered_pool {
+    // hive key
+    char                    _key[32];
+    generic_allocator_t*    _allocator;
+} registered_pool_t;
+static registered_pool_t    _pools[MAX_REGISTERED_POOLS];
+static size_t               _num_pools = 0;
+
 // TODO: allocate dynamically from each region and link them as a list?
 #define MAX_MEMORY_REGIONS 256
 static memory_region_t _regions[MAX_MEMORY_REGIONS];
 static size_t _num_regions = 0;
+// address lookup for the regions, _value is the index into _regions
+static range_map_t _region_map;
+static range_map_entry_t _region_map_entries[MAX_MEMORY_REGIONS];
 
 static void _add_memory_region(uintptr_t start, size_t size, memory_region_type_t type, CEfiU32 uefi_type) {
     _JOS_ASSERT(_num_regions < MAX_MEMORY_REGIONS);
@@ -186,6 +233,11 @@ static jo_status_t _build_memory_map(bool exit_bs) {
         if ( desc->number_of_pages==0 )
             continue;
 
+        const uintptr_t desc_end = desc->physical_start + desc->number_of_pages * UEFI_POOL_PAGE_SIZE;
+        if ( desc_end > _highest_physical_address ) {
+            _highest_physical_address = desc_end;
+        }
+
         // pre-exit boot services we don't merge boot services code and data with conventional memory
         if ( !exit_bs 
             && 
@@ -262,6 +314,12 @@ static jo_status_t _build_memory_map(bool exit_bs) {
         prev = _regions + _num_regions - 1;
         desc = (CEfiMemoryDescriptor*)((uintptr_t)desc + _descriptor_size);
     }
+
+    // regions are merged as we go so they're only indexed once they're final
+    range_map_create_fixed(&_region_map, _region_map_entries, MAX_MEMORY_REGIONS);
+    for ( size_t r = 0; r < _num_regions; ++r ) {
+        range_map_insert(&_region_map, _regions[r]._start, _regions[r]._start + _regions[r]._size, r);
+    }
     
     return _JO_STATUS_SUCCESS;
 }
@@ -316,6 +374,15 @@ _JOS_API_FUNC size_t      memory_get_total(void) {
     return (size_t)_main_allocator->_end - (size_t)_main_allocator->_begin;
 }
 
+_JOS_API_FUNC uintptr_t memory_get_highest_physical_address(void) {
+    return _highest_physical_address;
+}
+
+_JOS_API_FUNC bool memory_is_ram(uintptr_t address) {
+    range_map_entry_t* entry = range_map_find(&_region_map, address);
+    return entry && _regions[entry->_value]._type == kMemoryRegion_RAM;
+}
+
 _JOS_API_FUNC size_t memory_get_available(void) {
     return linear_allocator_available(_main_allocator);
 }
@@ -365,29 +432,690 @@ _JOS_API_FUNC size_t  memory_pool_overhead(memory_pool_type_t type) {
     return 0;
 }
 
-_JOS_API_FUNC generic_allocator_t*  memory_allocate_pool(memory_pool_type_t type, size_t size) {
+_JOS_API_FUNC generic_allocator_t*  memory_allocate_pool(memory_pool_type_t type, size_t size, size_t node) {
     
+    // the node is a hint, the pool comes out of the startup memory if the node has none of its own (or not enough)
+    linear_allocator_t* source = _main_allocator;
     const size_t overhead = memory_pool_overhead(type); 
-    size = size ? size + overhead : memory_get_available() - kAllocAlign_8;
+    if ( node < ACPI_MAX_NUMA_NODES && _node_allocators[node] 
+        && 
+        (!size || size + overhead <= linear_allocator_available(_node_allocators[node])) ) {
+        source = _node_allocators[node];
+    }
+    size = size ? size + overhead : linear_allocator_available(source) - kAllocAlign_8;
     switch (type) {
         case kMemoryPoolType_Dynamic:
         {
             // standard arena allocator
-            _JOS_ASSERT(size<=memory_get_available());
-            void* pool = _main_allocator->_super.alloc((generic_allocator_t*)_main_allocator, size);
-            return (generic_allocator_t*)arena_allocator_create(pool, size);
+            _JOS_ASSERT(size<=linear_allocator_available(source));
+            void* pool = source->_super.alloc((generic_allocator_t*)source, size);
+            generic_allocator_t* allocator = (generic_allocator_t*)arena_allocator_create(pool, size);
+            memory_register_pool("dynamic", allocator);
+            return allocator;
         }
         break;
         case kMemoryPoolType_Static:
         {
             // basic linear allocator
-            _JOS_ASSERT(size<=memory_get_available());
-            void* pool = _main_allocator->_super.alloc((generic_allocator_t*)_main_allocator, size);
-            return (generic_allocator_t*)linear_allocator_create(pool, size);
+            _JOS_ASSERT(size<=linear_allocator_available(source));
+            void* pool = source->_super.alloc((generic_allocator_t*)source, size);
+            generic_allocator_t* allocator = (generic_allocator_t*)linear_allocator_create(pool, size);
+            memory_register_pool("static", allocator);
+            return allocator;
         }
         break;
         default:;
     }
 
     return 0;
+}
+
+_JOS_API_FUNC generic_allocator_t* memory_node_allocator(size_t node) {
+    return node < ACPI_MAX_NUMA_NODES ? (generic_allocator_t*)_node_allocators[node] : 0;
+}
+
+_JOS_API_FUNC void memory_register_pool(const char* name, generic_allocator_t* allocator) {
+    if ( !allocator || _num_pools == MAX_REGISTERED_POOLS ) {
+        return;
+    }
+    // the index keeps keys unique when several pools share a name
+    snprintf(_pools[_num_pools]._key, sizeof(_pools[_num_pools]._key), "memory:pool:%s:%d", name, (int)_num_pools);
+    _pools[_num_pools]._allocator = allocator;
+    ++_num_pools;
+}
+
+_JOS_API_FUNC void memory_update_pool_stats(void) {
+
+    hive_t* hive = kernel_hive();
+    for ( size_t p = 0; p < _num_pools; ++p ) {
+        allocator_stats_t stats;
+        allocator_get_stats(_pools[p]._allocator, &stats);
+        hive_set(hive, _pools[p]._key, 
+            HIVE_VALUE_INT(stats._used),
+            HIVE_VALUE_INT(stats._free),
+            HIVE_VALUE_INT(stats._largest_free),
+            HIVE_VALUE_INT(stats._allocated_blocks),
+            HIVE_VALUE_INT(stats._free_blocks),
+            HIVE_VALUE_INT(stats._alloc_count),
+            HIVE_VALUE_INT(stats._free_count),
+            HIVE_VALUE_INT(stats._fragmentation),
+            HIVE_VALUELIST_END);
+    }
+}
+
+// ==============================================================================================
+// growable pools
+//
+// a growable pool is a list of segments, each holding an arena (dynamic) or linear (static) allocator.
+// when every segment is exhausted the pool adds a segment, from the kernel page allocator once vmm is up and
+// from the startup memory before that, as long as the pool stays within its budget. 
+// empty segments that came from vmm are returned, except for one which is kept as a spare to avoid 
+// mapping and unmapping a segment over and over at the boundary.
+
+typedef struct _pool_segment {
+    struct _pool_segment*   _next;
+    // the whole segment, including this header
+    size_t                  _size;
+    bool                    _from_vmm;
+} pool_segment_t;
+
+typedef struct _growable_pool {
+    //NOTE: this must be the first entry in this struct as it is used as a super class
+    generic_allocator_t     _super;
+    memory_pool_type_t      _type;
+    size_t                  _budget;
+    // bytes in all segments, never more than _budget
+    size_t                  _size;
+    // oldest first, allocations are made from the oldest segment with room so that newer ones can drain
+    pool_segment_t*         _segments;
+    pool_segment_t*         _spare;
+    size_t                  _alloc_count;
+    size_t                  _free_count;
+} growable_pool_t;
+
+// budgets set at boot, see memory_configure_pool_budgets
+#define MAX_POOL_BUDGETS 8
+typedef struct _pool_budget {
+    char    _name[16];
+    size_t  _budget;
+    // false if the size couldn't be parsed, it's reported when the pool is created
+    bool    _valid;
+} pool_budget_t;
+static pool_budget_t    _pool_budgets[MAX_POOL_BUDGETS];
+static size_t           _num_pool_budgets = 0;
+
+_JOS_INLINE_FUNC generic_allocator_t* _segment_allocator(pool_segment_t* segment) {
+    return (generic_allocator_t*)(segment+1);
+}
+
+_JOS_INLINE_FUNC bool _segment_contains(pool_segment_t* segment, void* ptr) {
+    return (uintptr_t)ptr > (uintptr_t)segment && (uintptr_t)ptr < (uintptr_t)segment + segment->_size;
+}
+
+_JOS_INLINE_FUNC bool _segment_is_empty(pool_segment_t* segment) {
+    arena_allocator_t* arena = (arena_allocator_t*)_segment_allocator(segment);
+    return arena->_size == arena->_capacity;
+}
+
+static pool_segment_t* _growable_pool_find_segment(growable_pool_t* pool, void* ptr) {
+    pool_segment_t* segment = pool->_segments;
+    while ( segment && !_segment_contains(segment, ptr) ) {
+        segment = segment->_next;
+    }
+    return segment;
+}
+
+static pool_segment_t* _growable_pool_add_segment(growable_pool_t* pool, void* memory, size_t size, bool from_vmm) {
+
+    pool_segment_t* segment = (pool_segment_t*)memory;
+    segment->_next = 0;
+    segment->_size = size;
+    segment->_from_vmm = from_vmm;
+    if ( pool->_type == kMemoryPoolType_Dynamic ) {
+        arena_allocator_create(segment+1, size - sizeof(pool_segment_t));
+    }
+    else {
+        linear_allocator_create(segment+1, size - sizeof(pool_segment_t));
+    }
+    pool_segment_t** link = &pool->_segments;
+    while ( *link ) {
+        link = &(*link)->_next;
+    }
+    *link = segment;
+    pool->_size += size;
+    return segment;
+}
+
+// add a segment with room for at least bytes
+static pool_segment_t* _growable_pool_grow(growable_pool_t* pool, size_t bytes) {
+
+    size_t size = bytes + sizeof(pool_segment_t) + memory_pool_overhead(pool->_type) + _JOS_arena_allocator_ALLOC_OVERHEAD;
+    size = _JOS_ALIGN(size < JOSX_POOL_GROWTH_SIZE ? JOSX_POOL_GROWTH_SIZE : size, FRAME_SIZE);
+    if ( pool->_size + size > pool->_budget ) {
+        // settle for whatever is left of the budget, if it's enough
+        const size_t left = pool->_budget > pool->_size ? ((pool->_budget - pool->_size) & ~(size_t)(FRAME_SIZE-1)) : 0;
+        if ( left < bytes + sizeof(pool_segment_t) + memory_pool_overhead(pool->_type) + _JOS_arena_allocator_ALLOC_OVERHEAD ) {
+            return 0;
+        }
+        size = left;
+    }
+
+    page_allocator_t* page_allocator = vmm_page_allocator();
+    if ( page_allocator ) {
+        void* memory = page_allocator->alloc(page_allocator, size, PAGE_READWRITE);
+        return memory ? _growable_pool_add_segment(pool, memory, size, true) : 0;
+    }
+    // before vmm is up we can only take what's left of the startup memory, and it doesn't go back
+    void* memory = linear_allocator_alloc_aligned(_main_allocator, size, kAllocAlign_64);
+    return memory ? _growable_pool_add_segment(pool, memory, size, false) : 0;
+}
+
+static void _growable_pool_release_segment(growable_pool_t* pool, pool_segment_t* segment) {
+
+    pool_segment_t** link = &pool->_segments;
+    while ( *link != segment ) {
+        link = &(*link)->_next;
+    }
+    *link = segment->_next;
+    pool->_size -= segment->_size;
+    page_allocator_t* page_allocator = vmm_page_allocator();
+    page_allocator->free(page_allocator, segment);
+}
+
+static void* _growable_pool_alloc_aligned(growable_pool_t* pool, size_t size, alloc_alignment_t alignment) {
+
+    if ( !size ) {
+        return 0;
+    }
+    pool_segment_t* segment = pool->_segments;
+    void* ptr = 0;
+    while ( segment && !ptr ) {
+        ptr = allocator_alloc_aligned(_segment_allocator(segment), size, alignment);
+        if ( !ptr ) {
+            segment = segment->_next;
+        }
+    }
+    if ( !ptr ) {
+        segment = _growable_pool_grow(pool, size + (size_t)alignment);
+        ptr = segment ? allocator_alloc_aligned(_segment_allocator(segment), size, alignment) : 0;
+    }
+    if ( ptr ) {
+        if ( segment == pool->_spare ) {
+            pool->_spare = 0;
+        }
+        ++pool->_alloc_count;
+    }
+    return ptr;
+}
+
+static void* _growable_pool_alloc(growable_pool_t* pool, size_t size) {
+    return _growable_pool_alloc_aligned(pool, size, kAllocAlign_8);
+}
+
+static void _growable_pool_free(growable_pool_t* pool, void* ptr) {
+
+    if ( !ptr ) {
+        return;
+    }
+    pool_segment_t* segment = _growable_pool_find_segment(pool, ptr);
+    _JOS_ASSERT(segment);
+    if ( !segment ) {
+        return;
+    }
+    arena_allocator_free((arena_allocator_t*)_segment_allocator(segment), ptr);
+    ++pool->_free_count;
+
+    if ( segment->_from_vmm && _segment_is_empty(segment) ) {
+        if ( !pool->_spare ) {
+            pool->_spare = segment;
+        }
+        else if ( segment != pool->_spare ) {
+            _growable_pool_release_segment(pool, segment);
+        }
+    }
+}
+
+static void* _growable_pool_realloc(growable_pool_t* pool, void* block, size_t size) {
+
+    if ( !block ) {
+        return _growable_pool_alloc(pool, size);
+    }
+    if ( !size ) {
+        _growable_pool_free(pool, block);
+        return 0;
+    }
+    const size_t block_size = _vmem_tail_size((vmem_block_head_t*)block - 1);
+    if ( block_size >= size ) {
+        return block;
+    }
+    void* new_block = _growable_pool_alloc(pool, size);
+    if ( new_block ) {
+        memcpy(new_block, block, block_size);
+        _growable_pool_free(pool, block);
+    }
+    return new_block;
+}
+
+// what's left in the segments plus what the pool can still grow by
+static size_t _growable_pool_available(growable_pool_t* pool) {
+    size_t available = pool->_budget > pool->_size ? pool->_budget - pool->_size : 0;
+    for ( pool_segment_t* segment = pool->_segments; segment; segment = segment->_next ) {
+        generic_allocator_t* allocator = _segment_allocator(segment);
+        available += allocator->available(allocator);
+    }
+    return available;
+}
+
+static void _growable_pool_stats(growable_pool_t* pool, allocator_stats_t* stats) {
+    for ( pool_segment_t* segment = pool->_segments; segment; segment = segment->_next ) {
+        allocator_stats_t segment_stats;
+        allocator_get_stats(_segment_allocator(segment), &segment_stats);
+        stats->_used += segment_stats._used;
+        stats->_free += segment_stats._free;
+        stats->_free_blocks += segment_stats._free_blocks;
+        if ( segment_stats._largest_free > stats->_largest_free ) {
+            stats->_largest_free = segment_stats._largest_free;
+        }
+    }
+    stats->_alloc_count = pool->_alloc_count;
+    stats->_free_count = pool->_free_count;
+    stats->_allocated_blocks = pool->_alloc_count - (pool->_type == kMemoryPoolType_Dynamic ? pool->_free_count : 0);
+    stats->_fragmentation = allocator_fragmentation(stats->_free, stats->_largest_free);
+}
+
+static bool _is_space(wchar_t c) {
+    return c == L' ' || c == L'\t';
+}
+
+_JOS_API_FUNC void memory_configure_pool_budgets(const wchar_t* options, size_t length) {
+
+    static const wchar_t kPrefix[] = L"pool.";
+    const size_t prefix_length = sizeof(kPrefix)/sizeof(wchar_t) - 1;
+    size_t i = 0;
+    while ( i < length && options[i] ) {
+        while ( i < length && _is_space(options[i]) ) {
+            ++i;
+        }
+        const size_t token = i;
+        while ( i < length && options[i] && !_is_space(options[i]) ) {
+            ++i;
+        }
+        // pool.<name>=<size>[K|M|G]
+        if ( i - token <= prefix_length ) {
+            continue;
+        }
+        size_t c = 0;
+        while ( c < prefix_length && options[token + c] == kPrefix[c] ) {
+            ++c;
+        }
+        if ( c < prefix_length ) {
+            continue;
+        }
+        c += token;
+        char name[sizeof(_pool_budgets[0]._name)];
+        size_t name_length = 0;
+        while ( c < i && options[c] != L'=' && name_length < sizeof(name) - 1 ) {
+            name[name_length++] = (char)options[c++];
+        }
+        name[name_length] = 0;
+        if ( c == i || options[c] != L'=' || !name_length || _num_pool_budgets == MAX_POOL_BUDGETS ) {
+            continue;
+        }
+        ++c;
+        const size_t digits = c;
+        size_t budget = 0;
+        while ( c < i && options[c] >= L'0' && options[c] <= L'9' ) {
+            budget = budget*10 + (size_t)(options[c++] - L'0');
+        }
+        bool valid = c > digits;
+        if ( valid && c < i ) {
+            switch ( options[c++] ) {
+                case L'K': case L'k': budget <<= 10; break;
+                case L'M': case L'm': budget <<= 20; break;
+                case L'G': case L'g': budget <<= 30; break;
+                default: valid = false; break;
+            }
+            // nothing can follow the unit
+            valid = valid && c == i;
+        }
+        memcpy(_pool_budgets[_num_pool_budgets]._name, name, name_length + 1);
+        _pool_budgets[_num_pool_budgets]._budget = valid ? budget : 0;
+        _pool_budgets[_num_pool_budgets]._valid = valid;
+        ++_num_pool_budgets;
+    }
+}
+
+_JOS_API_FUNC generic_allocator_t* memory_create_growable_pool(memory_pool_type_t type, const char* name, size_t size, size_t budget) {
+
+    // budgets given at boot take precedence
+    for ( size_t b = 0; b < _num_pool_budgets; ++b ) {
+        if ( strcmp(_pool_budgets[b]._name, name) == 0 ) {
+            if ( _pool_budgets[b]._valid ) {
+                budget = _pool_budgets[b]._budget;
+            }
+            else {
+                _JOS_KTRACE_CHANNEL(kMemoryChannel, "ignoring invalid budget option for pool \"%s\"", name);
+            }
+        }
+    }
+
+    size = _JOS_ALIGN(size + sizeof(growable_pool_t) + sizeof(pool_segment_t) + memory_pool_overhead(type), FRAME_SIZE);
+    if ( size > memory_get_available() ) {
+        return 0;
+    }
+    void* memory = linear_allocator_alloc_aligned(_main_allocator, size, kAllocAlign_64);
+    if ( !memory ) {
+        return 0;
+    }
+    growable_pool_t* pool = (growable_pool_t*)memory;
+    memset(pool, 0, sizeof(growable_pool_t));
+    pool->_type = type;
+    // the initial segment counts against the budget too
+    pool->_budget = budget > size ? budget : size;
+    _growable_pool_add_segment(pool, pool+1, size - sizeof(growable_pool_t), false);
+
+    pool->_super.alloc = (generic_allocator_alloc_func_t)_growable_pool_alloc;
+    pool->_super.alloc_aligned = (generic_allocator_alloc_aligned_func_t)_growable_pool_alloc_aligned;
+    pool->_super.available = (generic_allocator_avail_func_t)_growable_pool_available;
+    pool->_super.stats = (generic_allocator_stats_func_t)_growable_pool_stats;
+    if ( type == kMemoryPoolType_Dynamic ) {
+        pool->_super.free = (generic_allocator_free_func_t)_growable_pool_free;
+        pool->_super.free_aligned = (generic_allocator_free_aligned_func_t)_growable_pool_free;
+        pool->_super.realloc = (generic_allocator_realloc_func_t)_growable_pool_realloc;
+    }
+
+    memory_register_pool(name, (generic_allocator_t*)pool);
+    _JOS_KTRACE_CHANNEL(kMemoryChannel, "growable pool %s: %d KB, budget %d KB", name, size >> 10, pool->_budget >> 10);
+    return (generic_allocator_t*)pool;
+}
+
+// node memory on a NUMA system is allocated from the firmware inside the node's SRAT memory ranges
+static jo_status_t _allocate_node_memory(CEfiBootServices* boot_services, size_t node, size_t size) {
+
+    uintptr_t base;
+    size_t range_size;
+    size_t range_node;
+    for ( size_t index = 0; _JO_SUCCEEDED(acpi_numa_memory_range(index, &base, &range_size, &range_node)); ++index ) {
+        if ( range_node != node ) {
+            continue;
+        }
+        const uintptr_t range_end = base + range_size;
+        for ( size_t r = 0; r < _num_regions; ++r ) {
+            if ( _regions[r]._type != kMemoryRegion_RAM ) {
+                continue;
+            }
+            // try successive, suitably aligned, addresses in the intersection of the node range and RAM region
+            uintptr_t start = _regions[r]._start > base ? _regions[r]._start : base;
+            const uintptr_t end = (_regions[r]._start + _regions[r]._size) < range_end ? (_regions[r]._start + _regions[r]._size) : range_end;
+            for ( start = _JOS_ALIGN(start, JOSX_NUMA_NODE_MEMORY_ALIGN); start + size <= end && start + size > start; start += size ) {
+                CEfiPhysicalAddress phys = (CEfiPhysicalAddress)start;
+                if ( !C_EFI_ERROR(boot_services->allocate_pages(C_EFI_ALLOCATE_ADDRESS, C_EFI_LOADER_DATA, size/UEFI_POOL_PAGE_SIZE, &phys)) ) {
+                    _node_allocators[node] = linear_allocator_create((void*)phys, size);
+                    memory_register_pool("node", (generic_allocator_t*)_node_allocators[node]);
+                    _JOS_KTRACE_CHANNEL(kMemoryChannel, "node %d memory @ 0x%llx", node, phys);
+                    return _JO_STATUS_SUCCESS;
+                }
+            }
+        }
+    }
+    return _JO_STATUS_RESOURCE_EXHAUSTED;
+}
+
+static void _zone_create(frame_zone_t* zone, uintptr_t pool, size_t size) {
+    lock_initialise(&zone->_lock);
+    zone->_begin = zone->_next = pool;
+    zone->_end = pool + size;
+}
+
+_JOS_API_FUNC jo_status_t memory_frames_initialise(CEfiBootServices* boot_services, size_t size) {
+
+    _JOS_ASSERT(!_num_zones);
+    size = _JOS_ALIGN(size, FRAME_SIZE);
+    if ( !size ) {
+        return _JO_STATUS_RESOURCE_EXHAUSTED;
+    }
+    _num_zones = acpi_numa_node_count();
+
+    if ( _num_zones == 1 ) {
+        // a single node owns all memory, frames come out of the startup memory like everything else
+        if ( size + FRAME_SIZE > memory_get_available() ) {
+            _num_zones = 0;
+            return _JO_STATUS_RESOURCE_EXHAUSTED;
+        }
+        // the kernel runs identity mapped so these addresses are physical
+        void* pool = allocator_alloc_aligned((generic_allocator_t*)_main_allocator, size, kAllocAlign_4k);
+        if ( !pool ) {
+            _num_zones = 0;
+            return _JO_STATUS_RESOURCE_EXHAUSTED;
+        }
+        _zone_create(_zones, (uintptr_t)pool, size);
+        _JOS_KTRACE_CHANNEL(kMemoryChannel, "%d frames reserved @ 0x%llx", size/FRAME_SIZE, _zones[0]._next);
+    }
+    else {
+        size_t num_frames = 0;
+        for ( size_t node = 0; node < _num_zones; ++node ) {
+            if ( _JO_FAILED(_allocate_node_memory(boot_services, node, _JOS_ALIGN(size + JOSX_NUMA_NODE_POOL_SIZE, JOSX_NUMA_NODE_MEMORY_ALIGN))) ) {
+                _JOS_KTRACE_CHANNEL(kMemoryChannel, "no memory for node %d, it will borrow from its neighbours", node);
+                continue;
+            }
+            void* pool = linear_allocator_alloc_aligned(_node_allocators[node], size, kAllocAlign_4k);
+            _JOS_ASSERT(pool);
+            _zone_create(_zones + node, (uintptr_t)pool, size);
+            num_frames += size/FRAME_SIZE;
+        }
+        if ( !num_frames ) {
+            _num_zones = 0;
+            return _JO_STATUS_RESOURCE_EXHAUSTED;
+        }
+        _JOS_KTRACE_CHANNEL(kMemoryChannel, "%d frames reserved across %d nodes", num_frames, _num_zones);
+    }
+
+    // each zone falls back to the others in order of distance when it runs out
+    for ( size_t node = 0; node < _num_zones; ++node ) {
+        uint8_t* fallback = _zones[node]._fallback;
+        for ( size_t n = 0; n < _num_zones; ++n ) {
+            fallback[n] = (uint8_t)n;
+        }
+        fallback[0] = (uint8_t)node;
+        fallback[node] = 0;
+        for ( size_t n = 1; n < _num_zones; ++n ) {
+            for ( size_t m = n; m > 1 && acpi_numa_distance(node, fallback[m]) < acpi_numa_distance(node, fallback[m-1]); --m ) {
+                const uint8_t t = fallback[m];
+                fallback[m] = fallback[m-1];
+                fallback[m-1] = t;
+            }
+        }
+    }
+    return _JO_STATUS_SUCCESS;
+}
+
+_JOS_INLINE_FUNC uintptr_t _pop_frame(uintptr_t* list, size_t* count) {
+    const uintptr_t frame = *list;
+    *list = *(uintptr_t*)frame;
+    --*count;
+    return frame;
+}
+
+_JOS_INLINE_FUNC void _push_frame(uintptr_t* list, size_t* count, uintptr_t frame) {
+    *(uintptr_t*)frame = *list;
+    *list = frame;
+    ++*count;
+}
+
+// zero a frame without pulling it into the cache
+static void _zero_frame_nt(uintptr_t frame) {
+    uint64_t* qwords = (uint64_t*)frame;
+    for ( size_t i = 0; i < FRAME_SIZE/sizeof(uint64_t); i += 4 ) {
+        __asm__ volatile ( 
+            "movnti %4, %0\n"
+            "movnti %4, %1\n"
+            "movnti %4, %2\n"
+            "movnti %4, %3\n"
+            : "=m"(qwords[i]), "=m"(qwords[i+1]), "=m"(qwords[i+2]), "=m"(qwords[i+3])
+            : "r"(0ull) );
+    }
+}
+
+// NOTE: only the BSP allocates frames before smp_initialise and there is only one node then
+static size_t _this_node(void) {
+    return _num_zones > 1 ? per_cpu_this_cpu_info()->_numa_node : 0;
+}
+
+static frame_zone_t* _zone_of(uintptr_t frame) {
+    for ( size_t node = 0; node < _num_zones; ++node ) {
+        if ( frame >= _zones[node]._begin && frame < _zones[node]._end ) {
+            return _zones + node;
+        }
+    }
+    return 0;
+}
+
+// take a frame from the zone, caller holds the lock. dirty frames first, leave the zeroed frames for those who need them
+static uintptr_t _zone_take(frame_zone_t* zone) {
+    uintptr_t frame = 0;
+    if ( zone->_free_frames ) {
+        frame = _pop_frame(&zone->_free_frames, &zone->_num_free_frames);
+    }
+    else if ( zone->_next < zone->_end ) {
+        frame = zone->_next;
+        zone->_next += FRAME_SIZE;
+    }
+    else if ( zone->_zeroed_frames ) {
+        frame = _pop_frame(&zone->_zeroed_frames, &zone->_num_zeroed_frames);
+    }
+    return frame;
+}
+
+_JOS_API_FUNC uintptr_t memory_frame_alloc_on_node(size_t node) {
+
+    if ( node >= _num_zones ) {
+        node = _this_node();
+    }
+    const uint8_t* fallback = _zones[node]._fallback;
+    for ( size_t n = 0; n < _num_zones; ++n ) {
+        frame_zone_t* zone = _zones + fallback[n];
+        lock_spinlock(&zone->_lock);
+        const uintptr_t frame = _zone_take(zone);
+        lock_unlock(&zone->_lock);
+        if ( frame ) {
+            return frame;
+        }
+    }
+    return 0;
+}
+
+_JOS_API_FUNC uintptr_t memory_frame_alloc(void) {
+    return memory_frame_alloc_on_node(JOSX_MEMORY_NODE_ANY);
+}
+
+_JOS_API_FUNC uintptr_t memory_frame_alloc_zeroed_on_node(size_t node) {
+
+    if ( node >= _num_zones ) {
+        node = _this_node();
+    }
+    const uint8_t* fallback = _zones[node]._fallback;
+    for ( size_t n = 0; n < _num_zones; ++n ) {
+        frame_zone_t* zone = _zones + fallback[n];
+        uintptr_t frame = 0;
+        bool zeroed = false;
+        lock_spinlock(&zone->_lock);
+        if ( zone->_zeroed_frames ) {
+            frame = _pop_frame(&zone->_zeroed_frames, &zone->_num_zeroed_frames);
+            zeroed = true;
+        }
+        else {
+            frame = _zone_take(zone);
+        }
+        lock_unlock(&zone->_lock);
+        if ( zeroed ) {
+            // only the link is left to clear
+            *(uintptr_t*)frame = 0;
+            return frame;
+        }
+        if ( frame ) {
+            // we're about to use it so a regular memset, which leaves it in the cache, is what we want
+            memset((void*)frame, 0, FRAME_SIZE);
+            return frame;
+        }
+    }
+    return 0;
+}
+
+_JOS_API_FUNC uintptr_t memory_frame_alloc_zeroed(void) {
+    return memory_frame_alloc_zeroed_on_node(JOSX_MEMORY_NODE_ANY);
+}
+
+_JOS_API_FUNC bool memory_is_frame(uintptr_t frame) {
+    return _zone_of(frame) != 0;
+}
+
+_JOS_API_FUNC size_t memory_frame_node(uintptr_t frame) {
+    frame_zone_t* zone = _zone_of(frame);
+    return zone ? (size_t)(zone - _zones) : JOSX_MEMORY_NODE_ANY;
+}
+
+static size_t _zone_zero_free_frames(frame_zone_t* zone, size_t max_frames) {
+
+    uintptr_t frames[JOSX_FRAME_ZEROING_BATCH];
+    size_t num_frames = 0;
+    lock_spinlock(&zone->_lock);
+    while ( zone->_free_frames && num_frames < max_frames ) {
+        frames[num_frames++] = _pop_frame(&zone->_free_frames, &zone->_num_free_frames);
+    }
+    lock_unlock(&zone->_lock);
+    if ( !num_frames ) {
+        return 0;
+    }
+
+    for ( size_t f = 0; f < num_frames; ++f ) {
+        _zero_frame_nt(frames[f]);
+    }
+    // non-temporal stores are weakly ordered, they must be visible before anyone else can get hold of the frames
+    __asm__ volatile ( "sfence" ::: "memory" );
+
+    lock_spinlock(&zone->_lock);
+    for ( size_t f = 0; f < num_frames; ++f ) {
+        _push_frame(&zone->_zeroed_frames, &zone->_num_zeroed_frames, frames[f]);
+    }
+    lock_unlock(&zone->_lock);
+    return num_frames;
+}
+
+_JOS_API_FUNC size_t memory_zero_free_frames(size_t max_frames) {
+
+    if ( max_frames > JOSX_FRAME_ZEROING_BATCH ) {
+        max_frames = JOSX_FRAME_ZEROING_BATCH;
+    }
+    // every processor zeroes from its idle loop, its own node first
+    const uint8_t* fallback = _zones[_this_node()]._fallback;
+    size_t num_frames = 0;
+    for ( size_t n = 0; n < _num_zones && num_frames < max_frames; ++n ) {
+        num_frames += _zone_zero_free_frames(_zones + fallback[n], max_frames - num_frames);
+    }
+    return num_frames;
+}
+
+_JOS_API_FUNC void memory_frame_free(uintptr_t frame) {
+
+    frame_zone_t* zone = _zone_of(frame);
+    _JOS_ASSERT(zone && _JOS_PTR_IS_ALIGNED(frame, FRAME_SIZE));
+    lock_spinlock(&zone->_lock);
+    _push_frame(&zone->_free_frames, &zone->_num_free_frames, frame);
+    lock_unlock(&zone->_lock);
+}
+
+_JOS_API_FUNC size_t memory_frames_available(void) {
+    size_t available = 0;
+    for ( size_t node = 0; node < _num_zones; ++node ) {
+        available += (_zones[node]._end - _zones[node]._next)/FRAME_SIZE + _zones[node]._num_free_frames + _zones[node]._num_zeroed_frames;
+    }
+    return available;
+}
+
+_JOS_API_FUNC size_t memory_frames_zeroed(void) {
+    size_t zeroed = 0;
+    for ( size_t node = 0; node < _num_zones; ++node ) {
+        zeroed += _zones[node]._num_zeroed_frames;
+    }
+    return zeroed;
 }
\ No newline at end of file
@@ -2,6 +2,10 @@
 #include <pagetables.h>
 #include <jos.h>
 #include <x86_64.h>
+#include <smp.h>
+#include <memory.h>
+#include <kernel.h>
+#include <tlb.h>
 #include <string.h>
 
 // this is an excellent article to use as a reference https://blog.llandsmeer.com/tech/2019/07/21/uefi-x64-userland.html
@@ -26,31 +30,136 @@ static const char* kPageTablesChannel = "pagetables";
 // see Intel Dev Guide Vol 3 4.5
 #define PAGE_HUGE               (1<<7)
 
+#define PAGE_SIZE_4K            0x1000ull
+#define PAGE_SIZE_2MB           0x200000ull
+#define PAGE_SIZE_1GB           0x40000000ull
+#define PAGE_SIZE_512GB         0x8000000000ull
+
 // by default pages are present, read/writable, and no-execute
-#define PAGE_CREATE_FLAGS       (uintptr_t)(PAGE_FLAGS_MASK | PAGE_BIT_RW_WRITABLE | PAGE_XD_NX)
+#define PAGE_CREATE_FLAGS       (uintptr_t)(PAGE_BIT_P_PRESENT | PAGE_BIT_RW_WRITABLE | PAGE_XD_NX)
+// entries pointing at lower level tables don't restrict access, the leaf entries do
+#define PAGE_TABLE_FLAGS        (uintptr_t)(PAGE_BIT_P_PRESENT | PAGE_BIT_RW_WRITABLE)
+//NOTE: the direct map is executable since the kernel image itself lives in it
+#define PAGE_DIRECT_MAP_FLAGS   (uintptr_t)(PAGE_BIT_P_PRESENT | PAGE_BIT_RW_WRITABLE | PAGE_HUGE)
+
+// we always map at least the low 4GB which holds the local APIC, IOAPIC, and other MMIO ranges
+#define DIRECT_MAP_MINIMUM_SIZE 0x100000000ull
 
 // https://wiki.osdev.org/CPU_Registers_x86-64#IA32_EFER
 #define MSR_IA32_EFER   0xc0000080
 
+// Intel Dev Guide Vol 3 11.12
+// the memory type of a page is selected by PAT entry (PAT<<2 | PCD<<1 | PWT). We use the same layout as Linux, 
+// i.e. the power-on default with entry 1 changed from WT to WC, and entry 7 from UC to WT
+#define MSR_IA32_PAT    0x277
+#define PAT_TYPE_UC     0x00ull
+#define PAT_TYPE_WC     0x01ull
+#define PAT_TYPE_WT     0x04ull
+#define PAT_TYPE_WB     0x06ull
+#define PAT_TYPE_UC_    0x07ull
+#define PAT_ENTRY(index, type) ((type) << ((index)*8))
+#define PAT_VALUE               (PAT_ENTRY(0, PAT_TYPE_WB) | PAT_ENTRY(1, PAT_TYPE_WC) | PAT_ENTRY(2, PAT_TYPE_UC_) | PAT_ENTRY(3, PAT_TYPE_UC) |\
+                                 PAT_ENTRY(4, PAT_TYPE_WB) | PAT_ENTRY(5, PAT_TYPE_WT) | PAT_ENTRY(6, PAT_TYPE_UC_) | PAT_ENTRY(7, PAT_TYPE_WT))
+
+#define PAGE_BIT_PWT            (1<<3)
+#define PAGE_BIT_PCD            (1<<4)
+// the PAT bit of a 4K entry, the same bit is PAGE_HUGE in higher level entries
+#define PAGE_BIT_PAT_4K         (1<<7)
+
 typedef struct _page_table {
     uint64_t entries[512];
 } _JOS_PACKED  page_table_t;
 
 // the kernel root page table
 static page_table_t* _pml4 = 0;
+// the allocator used for page tables, set by pagetables_runtime_init
+static generic_allocator_t* _table_allocator = 0;
+static bool _use_1gb_pages = false;
+// set once IA32_PAT has been programmed with PAT_VALUE, without it we can't map write-combining memory
+static bool _pat_enabled = false;
+
+struct _pagetables_address_space {
+    page_table_t*                   _pml4;
+    tlb_context_t                   _tlb_context;
+    struct _pagetables_address_space* _next;
+};
+static pagetables_address_space_t _kernel_address_space;
+// every address space other than the kernel's
+static pagetables_address_space_t* _address_spaces = 0;
 
 static page_table_t* _allocate_table(generic_allocator_t* allocator) {
-    void* base;
-    void* table;
-    aligned_alloc(allocator, sizeof(page_table_t), kAllocAlign_4k, &base, &table);
-    //NOTE: we're not keeping the base, we never intend to free this
-    return (page_table_t*)table;
+    // tables are frames, preferably ones that have already been zeroed in the background
+    page_table_t* table = (page_table_t*)memory_frame_alloc_zeroed();
+    if ( table ) {
+        return table;
+    }
+    table = (page_table_t*)allocator_alloc_aligned(allocator, sizeof(page_table_t), kAllocAlign_4k);
+    if ( table ) {
+        // make sure the entries are valid, albeit not-present
+        memset(table, 0, sizeof(page_table_t));
+    }
+    return table;
 }
 
-static void _map(page_table_t* pml4, uintptr_t phys_start, uintptr_t page_flags) {
-    
-    uintptr_t offs = PML4_IDX(phys_start);
-    pml4->entries[offs] = phys_start | page_flags;
+static void _release_table(page_table_t* table) {
+    if ( memory_is_frame((uintptr_t)table) ) {
+        memory_frame_free((uintptr_t)table);
+    }
+    else {
+        allocator_free_aligned(_table_allocator, table);
+    }
+}
+
+// identity map [0, phys_end) into pml4 using 1GB pages if use_1gb_pages, otherwise 2MB pages.
+// the first 2MB is mapped with 4K pages, leaving page 0 not present so that null pointer dereferences fault.
+// returns the number of tables allocated, or 0 if we ran out of memory
+static size_t _direct_map(page_table_t* pml4, uintptr_t phys_end, bool use_1gb_pages, generic_allocator_t* allocator) {
+
+    size_t num_tables = 0;
+    for ( uintptr_t pdpt_base = 0; pdpt_base < phys_end; pdpt_base += PAGE_SIZE_512GB ) {
+        
+        page_table_t* pdpt = _allocate_table(allocator);
+        if ( !pdpt ) {
+            return 0;
+        }
+        ++num_tables;
+        pml4->entries[PML4_IDX(pdpt_base)] = (uintptr_t)pdpt | PAGE_TABLE_FLAGS;
+
+        for ( size_t i = 0; i < 512; ++i ) {
+            const uintptr_t pd_base = pdpt_base + i*PAGE_SIZE_1GB;
+            if ( pd_base >= phys_end ) {
+                break;
+            }
+            if ( use_1gb_pages && pd_base ) {
+                pdpt->entries[i] = pd_base | PAGE_DIRECT_MAP_FLAGS;
+                continue;
+            }
+
+            page_table_t* pd = _allocate_table(allocator);
+            if ( !pd ) {
+                return 0;
+            }
+            ++num_tables;
+            pdpt->entries[i] = (uintptr_t)pd | PAGE_TABLE_FLAGS;
+            // always map the full GB, it's free and keeps the tail of memory on 2MB pages
+            for ( size_t j = 0; j < 512; ++j ) {
+                pd->entries[j] = (pd_base + j*PAGE_SIZE_2MB) | PAGE_DIRECT_MAP_FLAGS;
+            }
+            if ( !pd_base ) {
+                page_table_t* pt = _allocate_table(allocator);
+                if ( !pt ) {
+                    return 0;
+                }
+                ++num_tables;
+                // entry 0 stays not present
+                for ( size_t j = 1; j < 512; ++j ) {
+                    pt->entries[j] = (j*PAGE_SIZE_4K) | (PAGE_DIRECT_MAP_FLAGS & ~(uintptr_t)PAGE_HUGE);
+                }
+                pd->entries[0] = (uintptr_t)pt | PAGE_TABLE_FLAGS;
+            }
+        }
+    }
+    return num_tables;
 }
 
 _JOS_API_FUNC void    pagetables_uefi_initialise(void) {
@@ -73,17 +182,52 @@ _JOS_API_FUNC void    pagetables_uefi_initialise(void) {
     _JOS_ASSERT(_4_level_paging && _nxe);
 }
 
-_JOS_API_FUNC void pagetables_runtime_init(generic_allocator_t* allocator) {
+// see Intel Dev Guide Vol 3 11.12.4; caches are flushed around the change so that no line is left with a stale memory type.
+// the TLB is flushed when the caller switches to the new tables.
+//NOTE: the PAT should be the same on every processor, this must be done on APs too if they ever use our tables
+static void _program_pat(void) {
+    if ( !per_cpu_this_cpu_info()->_has_pat ) {
+        _JOS_KTRACE_CHANNEL(kPageTablesChannel, "PAT not supported, write-combining is not available");
+        return;
+    }
+    x86_64_wbinvd();
+    x86_64_wrmsr(MSR_IA32_PAT, (uint32_t)(PAT_VALUE & 0xffffffff), (uint32_t)(PAT_VALUE >> 32));
+    x86_64_wbinvd();
+    _pat_enabled = true;
+}
+
+_JOS_API_FUNC jo_status_t pagetables_runtime_init(generic_allocator_t* allocator) {
     
-    _pml4 = _allocate_table(allocator);
-    // make sure the entries are valid, albeit not-present
-    memset(_pml4, 0, sizeof(page_table_t));
-    // map pages: 
-    //  our default allocation is simply one level in pml4 to cover 
-    //  up to 512GB of RAM (who will ever need more than...etc)
-    _map(_pml4, 0, PAGE_CREATE_FLAGS);
+    page_table_t* pml4 = _allocate_table(allocator);
+    if ( !pml4 ) {
+        return _JO_STATUS_RESOURCE_EXHAUSTED;
+    }
 
+    // the kernel runs identity mapped so the direct map is simply all of physical memory at virtual == physical,
+    // using the largest pages we can to maximise TLB reach.
+    uintptr_t phys_end = memory_get_highest_physical_address();
+    if ( phys_end < DIRECT_MAP_MINIMUM_SIZE ) {
+        phys_end = DIRECT_MAP_MINIMUM_SIZE;
+    }
+    phys_end = _JOS_ALIGN(phys_end, PAGE_SIZE_1GB);
 
+    const bool use_1gb_pages = per_cpu_this_cpu_info()->_has_1GB_pages;
+    const size_t num_tables = _direct_map(pml4, phys_end, use_1gb_pages, allocator);
+    if ( !num_tables ) {
+        return _JO_STATUS_RESOURCE_EXHAUSTED;
+    }
+
+    _pml4 = pml4;
+    _table_allocator = allocator;
+    _use_1gb_pages = use_1gb_pages;
+    _kernel_address_space._pml4 = pml4;
+    tlb_context_create(&_kernel_address_space._tlb_context);
+    _program_pat();
+    x86_64_write_cr3((uint64_t)_pml4);
+    _JOS_KTRACE_CHANNEL(kPageTablesChannel, "direct mapped 0x%llx bytes using %s pages, %d tables", 
+        phys_end, use_1gb_pages ? "1GB" : "2MB", num_tables+1);
+
+    return _JO_STATUS_SUCCESS;
 }
 
 // see for example Intel Dev Guide Vol 3 4.2
@@ -92,7 +236,8 @@ _JOS_API_FUNC void    pagetables_traverse_tables(void* at, uintptr_t * entries,
     memset(entries, 0, 4*sizeof(uintptr_t));
 
     uintptr_t address =(uintptr_t)at;
-    page_table_t* cr3 = (page_table_t*)x86_64_get_pml4();
+    // the low bits of cr3 hold the PCID, if enabled
+    page_table_t* cr3 = (page_table_t*)(x86_64_get_pml4() & PAGE_ADDR_MASK);
     uintptr_t pml4e = cr3->entries[PML4_IDX(address)];
     entries[0] = pml4e;
     if ( pml4e & PAGE_BIT_P_PRESENT ) {
@@ -122,7 +267,8 @@ _JOS_API_FUNC void    pagetables_traverse_tables(void* at, uintptr_t * entries,
 static uintptr_t _prot_flags_to_page_flags(uintptr_t page_flags, int prot_flags) {
     
     if ( (prot_flags & PAGE_NOACCESS) ) {
-        return 0;
+        // keep the entry around, but not present
+        return page_flags & ~(uintptr_t)PAGE_BIT_P_PRESENT;
     }
 
     //ZZZ: uintptr_t page_flags = 0x8000000000000001; // default is present, read only, kernel, no execute
@@ -138,56 +284,526 @@ static uintptr_t _prot_flags_to_page_flags(uintptr_t page_flags, int prot_flags)
             page_flags &= ~0x8000000000000000;  // executable
         }
 
+    // see PAT_VALUE, PAGE_BIT_PAT_4K is converted for huge pages when entries are written
     if ( prot_flags & PAGE_NOCACHE) {
-        page_flags |= 0x10; // disable cache
+        page_flags |= PAGE_BIT_PCD | PAGE_BIT_PWT;
     }
-
-    if ( prot_flags & PAGE_WRITECOMBINE ) {
-        page_flags |= 0x8;  // write through
+    else if ( prot_flags & PAGE_WRITECOMBINE ) {
+        // without PAT the closest we can get is write-through
+        page_flags |= PAGE_BIT_PWT;
+    }
+    else if ( prot_flags & PAGE_WRITETHROUGH ) {
+        page_flags |= _pat_enabled ? (PAGE_BIT_PAT_4K | PAGE_BIT_PCD | PAGE_BIT_PWT) : PAGE_BIT_PWT;
     }
     
     return page_flags;
 }
 
-//NOTE: flags from jos.h 
-_JOS_API_FUNC int pagetables_protect_page(void* at, int prot_flags) {
+// ==================================================================================================
+// range operations
+//
+// leaf flags are passed around in their 4K PTE form and converted when written to, or read from, a 1GB or 2MB entry
+// (the only difference being the location of the PAT bit).
+
+#define PAGE_BIT_ACCESSED       (1<<5)
+#define PAGE_BIT_DIRTY          (1<<6)
+#define PAGE_BIT_PAT_HUGE       (1<<12)
+// available to software; set in every leaf we create so that a mapping is never 0, even when not present
+#define PAGE_BIT_SW_MAPPED      (1<<9)
+#define PAGE_LEAF_FLAGS_MASK    (uintptr_t)(PAGE_FLAGS_MASK | PAGE_XD_NX)
+// the CPU updates these behind our backs so they don't count when comparing entries
+#define PAGE_VOLATILE_FLAGS     (uintptr_t)(PAGE_BIT_ACCESSED | PAGE_BIT_DIRTY)
+
+#define PAGE_SHIFT_4K       12
+#define PAGE_SHIFT_2MB      21
+#define PAGE_SHIFT_1GB      30
+#define PAGE_SHIFT_512GB    39
+
+// we only support the lower half of the address space, the kernel is identity mapped
+#define VIRTUAL_ADDRESS_LIMIT   0x0000800000000000ull
+// tables queued for release before an operation has to flush early
+#define RANGE_OP_MAX_RELEASED_TABLES    64
+
+typedef enum _range_op_type {
+    kRangeOp_Map,
+    kRangeOp_Unmap,
+    kRangeOp_Protect,
+} _range_op_type_t;
+
+typedef struct _range_op {
+
+    _range_op_type_t    _type;
+    // physical = virtual + _phys_delta, for map
+    uintptr_t           _phys_delta;
+    // leaf flags (4K form), for map and protect
+    uintptr_t           _flags;
+    jo_status_t         _status;
+
+    // pending TLB invalidations
+    tlb_range_t         _invalidate[TLB_MAX_INVALIDATE_RANGES];
+    size_t              _num_invalidate;
+    size_t              _num_pages_invalidated;
+    bool                _flush_all;
+
+    // tables unlinked by this operation; they can't be released until the shootdown has completed 
+    // because another processor may still be walking them
+    page_table_t*       _released[RANGE_OP_MAX_RELEASED_TABLES];
+    size_t              _num_released;
+
+} _range_op_t;
+
+_JOS_INLINE_FUNC bool _is_leaf(uint64_t entry, unsigned shift) {
+    return shift == PAGE_SHIFT_4K || (entry & PAGE_HUGE);
+}
 
-    //TODO: sanity check flags
+_JOS_INLINE_FUNC bool _can_be_leaf(unsigned shift) {
+    return shift == PAGE_SHIFT_4K || shift == PAGE_SHIFT_2MB || (shift == PAGE_SHIFT_1GB && _use_1gb_pages);
+}
 
-    uintptr_t address =(uintptr_t)at;
-    page_table_t* cr3 = (page_table_t*)x86_64_get_pml4();
-    uintptr_t pml4e = cr3->entries[PML4_IDX(address)];
-    if ( pml4e & PAGE_BIT_P_PRESENT ) {
-        page_table_t*  pml4 = (page_table_t*)(pml4e & PAGE_ADDR_MASK);         
-        uintptr_t pdpte = pml4->entries[PDPT_IDX(address)];
-        
-        if ( (pdpte & PAGE_HUGE)==0 ) {
-            if ( pdpte & PAGE_BIT_P_PRESENT ) {
-                page_table_t* pdpt = (page_table_t*)(pdpte & PAGE_ADDR_MASK);
-                uintptr_t pde = pdpt->entries[PD_IDX(address)];
-                
-                if ( (pde & PAGE_HUGE)==0 ) {
-                    // 4KB pages
-                    page_table_t* pd = (page_table_t*)(pde & PAGE_ADDR_MASK);
-                    uintptr_t pte = pd->entries[PT_IDX(address)];
+_JOS_INLINE_FUNC uintptr_t _leaf_address(uint64_t entry, unsigned shift) {
+    return entry & PAGE_ADDR_MASK & ~((1ull << shift) - 1);
+}
+
+_JOS_INLINE_FUNC uintptr_t _leaf_flags(uint64_t entry, unsigned shift) {
+    if ( shift == PAGE_SHIFT_4K ) {
+        return entry & PAGE_LEAF_FLAGS_MASK;
+    }
+    uintptr_t flags = entry & PAGE_LEAF_FLAGS_MASK & ~(uintptr_t)PAGE_HUGE;
+    if ( entry & PAGE_BIT_PAT_HUGE ) {
+        flags |= PAGE_BIT_PAT_4K;
+    }
+    return flags;
+}
+
+_JOS_INLINE_FUNC uint64_t _make_leaf(uintptr_t phys, uintptr_t flags, unsigned shift) {
+    if ( shift == PAGE_SHIFT_4K ) {
+        return phys | flags | PAGE_BIT_SW_MAPPED;
+    }
+    uint64_t entry = phys | (flags & ~(uintptr_t)PAGE_BIT_PAT_4K) | PAGE_HUGE | PAGE_BIT_SW_MAPPED;
+    if ( flags & PAGE_BIT_PAT_4K ) {
+        entry |= PAGE_BIT_PAT_HUGE;
+    }
+    return entry;
+}
+
+_JOS_INLINE_FUNC page_table_t* _entry_table(uint64_t entry) {
+    return (page_table_t*)(entry & PAGE_ADDR_MASK);
+}
+
+// queue invalidation of count pages of size stride starting at at
+static void _invalidate(_range_op_t* op, uintptr_t at, size_t count, size_t stride) {
+    if ( op->_flush_all ) {
+        return;
+    }
+    op->_num_pages_invalidated += count;
+    if ( op->_num_pages_invalidated > TLB_FLUSH_ALL_THRESHOLD ) {
+        op->_flush_all = true;
+        return;
+    }
+    // extend the previous range if this one follows on from it
+    if ( op->_num_invalidate ) {
+        tlb_range_t* prev = op->_invalidate + op->_num_invalidate - 1;
+        if ( prev->_stride == stride && prev->_at + prev->_count*stride == at ) {
+            prev->_count += count;
+            return;
+        }
+    }
+    if ( op->_num_invalidate == TLB_MAX_INVALIDATE_RANGES ) {
+        op->_flush_all = true;
+        return;
+    }
+    op->_invalidate[op->_num_invalidate]._at = at;
+    op->_invalidate[op->_num_invalidate]._count = count;
+    op->_invalidate[op->_num_invalidate]._stride = stride;
+    ++op->_num_invalidate;
+}
+
+// the other address spaces share the kernel's tables below the pml4, but tables may have been created or freed
+static void _sync_address_spaces(void) {
+    for ( pagetables_address_space_t* space = _address_spaces; space; space = space->_next ) {
+        memcpy(space->_pml4, _pml4, sizeof(page_table_t));
+    }
+}
+
+// invalidate on this and all other processors, then release the tables no processor can be walking any more
+static void _flush(_range_op_t* op) {
+    if ( op->_flush_all || op->_num_invalidate ) {
+        tlb_invalidate(op->_invalidate, op->_num_invalidate, op->_flush_all);
+    }
+    for ( size_t i = 0; i < op->_num_released; ++i ) {
+        _release_table(op->_released[i]);
+    }
+    op->_num_released = 0;
+    op->_num_invalidate = 0;
+    op->_num_pages_invalidated = 0;
+    op->_flush_all = false;
+}
+
+// serialises modifications of the tables between processors
+static lock_t _tables_lock;
 
-                    //ZZZ: basically this, but more secure & correct
-                    int curr_flags = (int)(pte & 0xff);
-                    pte = _prot_flags_to_page_flags(pte, prot_flags);
-                    pd->entries[PT_IDX(address)] = pte;
-                    //NOTE: this flushes the TLB for this processor only
-                    x86_64_flush_tlb_for_address(address);
+static void _lock_tables(void) {
+    // the holder may be waiting for us to complete a shootdown, so keep servicing those while we wait
+    while ( atomic_compare_exchange_weak(&_tables_lock.atomic_val.value, 0, 1) != 0 ) {
+        tlb_process_pending();
+        x86_64_pause_cpu();
+    }
+}
 
-                    return curr_flags;
+// queue table and all tables below it for release once the TLBs have been flushed. shift is the shift of the entries in table.
+// the caller must have unlinked table and queued the invalidation of the range it covered.
+static void _free_table(page_table_t* table, unsigned shift, _range_op_t* op) {
+    if ( shift > PAGE_SHIFT_4K ) {
+        for ( size_t i = 0; i < 512; ++i ) {
+            const uint64_t entry = table->entries[i];
+            if ( entry && !_is_leaf(entry, shift) ) {
+                _free_table(_entry_table(entry), shift - 9, op);
+            }
+        }
+    }
+    if ( op->_num_released == RANGE_OP_MAX_RELEASED_TABLES ) {
+        // everything queued so far is already unlinked, so we can shoot it down and release it now
+        _sync_address_spaces();
+        _flush(op);
+    }
+    op->_released[op->_num_released++] = table;
+}
+
+// replace a huge leaf entry with a table of leaves one level down mapping the same range with the same flags
+static page_table_t* _split(uint64_t* entry, unsigned shift) {
+    page_table_t* table = _allocate_table(_table_allocator);
+    if ( !table ) {
+        return 0;
+    }
+    const unsigned child_shift = shift - 9;
+    const uintptr_t phys = _leaf_address(*entry, shift);
+    const uintptr_t flags = _leaf_flags(*entry, shift);
+    for ( size_t i = 0; i < 512; ++i ) {
+        table->entries[i] = _make_leaf(phys + (i << child_shift), flags, child_shift);
+    }
+    *entry = (uintptr_t)table | PAGE_TABLE_FLAGS;
+    return table;
+}
+
+// if every entry in table is a leaf mapping contiguous physical memory with identical flags, and the range is 
+// suitably aligned, return the single leaf entry that can replace it one level up. otherwise return 0.
+// shift is the shift of the entries in table.
+static uint64_t _try_merge(page_table_t* table, unsigned shift) {
+    const uint64_t first = table->entries[0];
+    if ( !first || !_is_leaf(first, shift) ) {
+        return 0;
+    }
+    const unsigned parent_shift = shift + 9;
+    const uintptr_t phys = _leaf_address(first, shift);
+    if ( phys & ((1ull << parent_shift) - 1) ) {
+        return 0;
+    }
+    const uintptr_t flags = _leaf_flags(first, shift) & ~PAGE_VOLATILE_FLAGS;
+    for ( size_t i = 1; i < 512; ++i ) {
+        const uint64_t entry = table->entries[i];
+        if ( !entry 
+            || !_is_leaf(entry, shift) 
+            || _leaf_address(entry, shift) != phys + (i << shift)
+            || (_leaf_flags(entry, shift) & ~PAGE_VOLATILE_FLAGS) != flags ) {
+            return 0;
+        }
+    }
+    return _make_leaf(phys, flags, parent_shift);
+}
+
+static bool _is_empty(page_table_t* table) {
+    for ( size_t i = 0; i < 512; ++i ) {
+        if ( table->entries[i] ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// apply op to [virt, end) in table, whose entries each cover 1<<shift bytes
+static void _update_range(page_table_t* table, unsigned shift, uintptr_t virt, uintptr_t end, _range_op_t* op) {
+
+    const uintptr_t entry_size = 1ull << shift;
+    while ( virt < end ) {
+
+        uint64_t* entry = table->entries + ((virt >> shift) & 0x1ff);
+        const uintptr_t entry_base = virt & ~(entry_size - 1);
+        const uintptr_t entry_end = entry_base + entry_size;
+        const uintptr_t chunk_end = end < entry_end ? end : entry_end;
+        // true if this operation covers everything mapped by this entry
+        const bool covers = virt == entry_base && chunk_end == entry_end;
+
+        switch ( op->_type ) {
+            case kRangeOp_Map:
+            {
+                const uintptr_t phys = entry_base + op->_phys_delta;
+                if ( covers && _can_be_leaf(shift) && (phys & (entry_size - 1)) == 0 ) {
+                    const uint64_t old = *entry;
+                    *entry = _make_leaf(phys, op->_flags, shift);
+                    if ( old ) {
+                        if ( !_is_leaf(old, shift) ) {
+                            _invalidate(op, entry_base, entry_size >> PAGE_SHIFT_4K, 1ull << PAGE_SHIFT_4K);
+                            _free_table(_entry_table(old), shift - 9, op);
+                        }
+                        else {
+                            _invalidate(op, entry_base, 1, entry_size);
+                        }
+                    }
+                    virt = chunk_end;
+                    continue;
                 }
-                // else 2MB pages    
-                // TODO: SET FLAGS pde
             }
+            break;
+            case kRangeOp_Unmap:
+            {
+                if ( !*entry ) {
+                    virt = chunk_end;
+                    continue;
+                }
+                if ( covers ) {
+                    const uint64_t old = *entry;
+                    *entry = 0;
+                    if ( _is_leaf(old, shift) ) {
+                        _invalidate(op, entry_base, 1, entry_size);
+                    }
+                    else {
+                        _invalidate(op, entry_base, entry_size >> PAGE_SHIFT_4K, 1ull << PAGE_SHIFT_4K);
+                        _free_table(_entry_table(old), shift - 9, op);
+                    }
+                    virt = chunk_end;
+                    continue;
+                }
+            }
+            break;
+            case kRangeOp_Protect:
+            {
+                if ( !*entry ) {
+                    // can't protect what isn't mapped, but we'll do the rest
+                    op->_status = _JO_STATUS_NOT_FOUND;
+                    virt = chunk_end;
+                    continue;
+                }
+                if ( covers && _is_leaf(*entry, shift) ) {
+                    const uintptr_t volatile_flags = _leaf_flags(*entry, shift) & PAGE_VOLATILE_FLAGS;
+                    *entry = _make_leaf(_leaf_address(*entry, shift), op->_flags | volatile_flags, shift);
+                    _invalidate(op, entry_base, 1, entry_size);
+                    virt = chunk_end;
+                    continue;
+                }
+            }
+            break;
+            default:;
         }
-        // else 1GB pages
-        // TODO: SET FLAGS pdpte
+
+        // we need to go one level down
+        _JOS_ASSERT(shift > PAGE_SHIFT_4K);
+        page_table_t* next;
+        if ( !*entry ) {
+            next = _allocate_table(_table_allocator);
+            if ( next ) {
+                *entry = (uintptr_t)next | PAGE_TABLE_FLAGS;
+            }
+        }
+        else if ( _is_leaf(*entry, shift) ) {
+            next = _split(entry, shift);
+            if ( next ) {
+                _invalidate(op, entry_base, 1, entry_size);
+            }
+        }
+        else {
+            next = _entry_table(*entry);
+        }
+        if ( !next ) {
+            op->_status = _JO_STATUS_RESOURCE_EXHAUSTED;
+            return;
+        }
+
+        _update_range(next, shift - 9, virt, chunk_end, op);
+
+        // collapse the table we've just modified if we can
+        if ( _is_empty(next) ) {
+            *entry = 0;
+            _invalidate(op, entry_base, 1, entry_size);
+            _free_table(next, shift - 9, op);
+        }
+        else if ( _can_be_leaf(shift) ) {
+            const uint64_t merged = _try_merge(next, shift - 9);
+            if ( merged ) {
+                *entry = merged;
+                // the TLB may hold any of the smaller translations
+                _invalidate(op, entry_base, 512, 1ull << (shift - 9));
+                _free_table(next, shift - 9, op);
+            }
+        }
+
+        if ( op->_status == _JO_STATUS_RESOURCE_EXHAUSTED ) {
+            return;
+        }
+        virt = chunk_end;
+    }
+}
+
+static jo_status_t _apply_range_op(void* at, size_t size, _range_op_t* op) {
+
+    if ( !_table_allocator ) {
+        // we don't modify the UEFI page tables
+        return _JO_STATUS_FAILED_PRECONDITION;
+    }
+    const uintptr_t virt = (uintptr_t)at;
+    if ( !size 
+        || !_JOS_PTR_IS_ALIGNED(virt, PAGE_SIZE_4K) 
+        || !_JOS_PTR_IS_ALIGNED(size, PAGE_SIZE_4K) ) {
+        return _JO_STATUS_INVALID_INPUT;
+    }
+    if ( virt >= VIRTUAL_ADDRESS_LIMIT || size > VIRTUAL_ADDRESS_LIMIT - virt ) {
+        return _JO_STATUS_OUT_OF_RANGE;
+    }
+
+    op->_status = _JO_STATUS_SUCCESS;
+    _lock_tables();
+    _update_range(_pml4, PAGE_SHIFT_512GB, virt, virt + size, op);
+    _sync_address_spaces();
+    // whatever we managed to change has to be made visible, and no table we've freed is released until 
+    // every processor has let go of it, so we hold on to the lock until the shootdown has completed
+    _flush(op);
+    lock_unlock(&_tables_lock);
+    return op->_status;
+}
+
+_JOS_API_FUNC jo_status_t pagetables_map_range(void* at, uintptr_t phys, size_t size, int prot_flags) {
+    if ( !_JOS_PTR_IS_ALIGNED(phys, PAGE_SIZE_4K) ) {
+        return _JO_STATUS_INVALID_INPUT;
+    }
+    _range_op_t op = { 
+        ._type = kRangeOp_Map, 
+        ._phys_delta = phys - (uintptr_t)at,
+        ._flags = _prot_flags_to_page_flags(PAGE_BIT_P_PRESENT | PAGE_XD_NX, prot_flags),
+    };
+    return _apply_range_op(at, size, &op);
+}
+
+_JOS_API_FUNC jo_status_t pagetables_unmap_range(void* at, size_t size) {
+    _range_op_t op = { ._type = kRangeOp_Unmap };
+    return _apply_range_op(at, size, &op);
+}
+
+_JOS_API_FUNC jo_status_t pagetables_protect_range(void* at, size_t size, int prot_flags) {
+    _range_op_t op = { 
+        ._type = kRangeOp_Protect, 
+        ._flags = _prot_flags_to_page_flags(PAGE_BIT_P_PRESENT | PAGE_XD_NX, prot_flags),
+    };
+    return _apply_range_op(at, size, &op);
+}
+
+//NOTE: flags from jos.h 
+_JOS_API_FUNC int pagetables_protect_page(void* at, int prot_flags) {
+
+    uintptr_t entries[4];
+    pagetables_traverse_tables(at, entries, 4);
+    // the last entry we found is the leaf, whatever size page it maps
+    int curr_flags = 0;
+    for ( size_t level = 4; level > 0; --level ) {
+        if ( entries[level-1] ) {
+            curr_flags = (int)(entries[level-1] & 0xff);
+            break;
+        }
+    }
+    const jo_status_t status = pagetables_protect_range((void*)((uintptr_t)at & ~(PAGE_SIZE_4K-1)), PAGE_SIZE_4K, prot_flags);
+    if ( _JO_FAILED(status) ) {
+        _JOS_KTRACE_CHANNEL(kPageTablesChannel, "protect_page 0x%llx failed with %d", (uintptr_t)at, status);
+        return -1;
+    }
+    return curr_flags;
+}
+
+// the leaf entry mapping virt in the kernel tables, and its shift, or 0 if virt isn't mapped
+static uint64_t _find_leaf(uintptr_t virt, unsigned* out_shift) {
+    if ( !_table_allocator || virt >= VIRTUAL_ADDRESS_LIMIT ) {
+        return 0;
+    }
+    page_table_t* table = _pml4;
+    for ( unsigned shift = PAGE_SHIFT_512GB; ; shift -= 9 ) {
+        const uint64_t entry = table->entries[(virt >> shift) & 0x1ff];
+        // inaccessible pages are still mapped, see _prot_flags_to_page_flags
+        if ( !(entry & (PAGE_BIT_P_PRESENT | PAGE_BIT_SW_MAPPED)) ) {
+            return 0;
+        }
+        if ( _is_leaf(entry, shift) ) {
+            *out_shift = shift;
+            return entry;
+        }
+        table = _entry_table(entry);
+    }
+}
+
+_JOS_API_FUNC jo_status_t pagetables_virtual_to_physical(void* at, uintptr_t* out_phys) {
+    const uintptr_t virt = (uintptr_t)at;
+    unsigned shift;
+    const uint64_t entry = _find_leaf(virt, &shift);
+    if ( !entry ) {
+        return _JO_STATUS_NOT_FOUND;
+    }
+    *out_phys = _leaf_address(entry, shift) + (virt & ((1ull << shift) - 1));
+    return _JO_STATUS_SUCCESS;
+}
+
+_JOS_API_FUNC bool pagetables_is_present(void* at) {
+    unsigned shift;
+    return (_find_leaf((uintptr_t)at, &shift) & PAGE_BIT_P_PRESENT) != 0;
+}
+
+_JOS_API_FUNC pagetables_address_space_t* pagetables_kernel_address_space(void) {
+    return _kernel_address_space._pml4 ? &_kernel_address_space : 0;
+}
+
+_JOS_API_FUNC pagetables_address_space_t* pagetables_create_address_space(void) {
+
+    if ( !_table_allocator ) {
+        return 0;
     }
-    //ZZZ:
-    return 0;
+    // the table allocator is the kernel's static pool which never frees, so address spaces are made of frames; 
+    // the pml4 in one and the rest of the address space at the start of another
+    const uintptr_t space_frame = memory_frame_alloc_zeroed();
+    if ( !space_frame ) {
+        return 0;
+    }
+    const uintptr_t pml4_frame = memory_frame_alloc_zeroed();
+    if ( !pml4_frame ) {
+        memory_frame_free(space_frame);
+        return 0;
+    }
+    pagetables_address_space_t* space = (pagetables_address_space_t*)space_frame;
+    space->_pml4 = (page_table_t*)pml4_frame;
+    tlb_context_create(&space->_tlb_context);
+
+    _lock_tables();
+    memcpy(space->_pml4, _pml4, sizeof(page_table_t));
+    space->_next = _address_spaces;
+    _address_spaces = space;
+    lock_unlock(&_tables_lock);
+    return space;
 }
 
+_JOS_API_FUNC void pagetables_destroy_address_space(pagetables_address_space_t* space) {
+
+    _JOS_ASSERT(space && space != &_kernel_address_space);
+    _JOS_ASSERT((x86_64_read_cr3() & PAGE_ADDR_MASK) != (uintptr_t)space->_pml4);
+
+    _lock_tables();
+    pagetables_address_space_t** link = &_address_spaces;
+    while ( *link && *link != space ) {
+        link = &(*link)->_next;
+    }
+    _JOS_ASSERT(*link);
+    *link = space->_next;
+    lock_unlock(&_tables_lock);
+
+    // PCIDs still tagged with this context are never matched again since context ids aren't re-used
+    memory_frame_free((uintptr_t)space->_pml4);
+    memory_frame_free((uintptr_t)space);
+}
+
+_JOS_API_FUNC void pagetables_switch_address_space(pagetables_address_space_t* space) {
+    _JOS_ASSERT(space && space->_pml4);
+    tlb_switch_context(&space->_tlb_context, (uintptr_t)space->_pml4);
+}
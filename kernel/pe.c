@@ -7,6 +7,9 @@
 #endif
 
 #define RVA2VA(base, rva) ((uintptr_t)(base) + (uintptr_t)(rva))
+#ifndef IMAGE_SCN_MEM_EXECUTE
+#define IMAGE_SCN_MEM_EXECUTE 0x20000000
+#endif
 
 //TODO: 64 bit guard
 
@@ -46,6 +49,15 @@ bool peutil_bind(peutil_pe_context_t* ctx, const void* ptr, peutil_instance_type
                     break;
                 }
 			}
+
+            range_map_create_fixed(&ctx->_section_map, ctx->_section_map_entries, PEUTIL_MAX_MAPPED_SECTIONS);
+            if (ctx->_numSections <= PEUTIL_MAX_MAPPED_SECTIONS) {
+                for (WORD section = 0; section < ctx->_numSections; ++section) {
+                    const IMAGE_SECTION_HEADER* header = ctx->_imageSections + section;
+                    // empty sections can't contain anything, range_map_insert will reject them
+                    range_map_insert(&ctx->_section_map, header->VirtualAddress, (uintptr_t)header->VirtualAddress + header->SizeOfRawData, section);
+                }
+            }
             return true;
         }
     }
@@ -69,7 +81,11 @@ bool peutil_phys_is_executable(peutil_pe_context_t* ctx, uintptr_t phys, uintptr
     if (out_rva) {
         *out_rva = rva;
     }
-    return rva < ctx->_text_end;
+    if (rva > 0xffffffff) {
+        return false;
+    }
+    const IMAGE_SECTION_HEADER* section = peutil_section_for_rva(ctx, (DWORD)rva);
+    return section && (section->Characteristics & IMAGE_SCN_MEM_EXECUTE);
 }
 
 const void* peutil_rva_to_phys(peutil_pe_context_t* ctx, DWORD rva) {
@@ -88,6 +104,10 @@ const void* peutil_rva_to_phys(peutil_pe_context_t* ctx, DWORD rva) {
 /// given an RVA, returns the section it is in (or nullptr)
 const IMAGE_SECTION_HEADER* peutil_section_for_rva(peutil_pe_context_t* ctx, DWORD rva)
 {
+    if (ctx->_numSections <= PEUTIL_MAX_MAPPED_SECTIONS) {
+        range_map_entry_t* entry = range_map_find(&ctx->_section_map, rva);
+        return entry ? ctx->_imageSections + entry->_value : 0;
+    }
     for(WORD section = 0; section < ctx->_numSections; ++section)
     {
         if(rva >= ctx->_imageSections[section].VirtualAddress && rva < ctx->_imageSections[section].VirtualAddress + ctx->_imageSections[section].SizeOfRawData)
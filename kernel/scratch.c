@@ -0,0 +1,55 @@
+#include <jos.h>
+#include <smp.h>
+#include <memory.h>
+#include <scratch.h>
+
+static const char* kScratchChannel = "scratch";
+
+// used until the per-CPU arenas are ready; only the BSP (or one AP at a time during smp_initialise) runs kernel code then
+static _JOS_ALIGNED_TYPE(char, _boot_arena_memory[JOSX_SCRATCH_BOOT_SIZE], 16);
+static linear_allocator_t* _boot_arena = 0;
+// linear_allocator_t* per CPU
+static per_cpu_ptr_t _per_cpu_arenas = 0;
+
+_JOS_API_FUNC jo_status_t scratch_initialise(static_allocation_policy_t* static_allocation_policy) {
+
+    _JOS_ASSERT(!_per_cpu_arenas);
+    generic_allocator_t* allocator = static_allocation_policy->allocator;
+    per_cpu_ptr_t arenas = per_cpu_create_ptr();
+    if (!arenas) {
+        return _JO_STATUS_RESOURCE_EXHAUSTED;
+    }
+
+    const size_t num_cpus = smp_get_processor_count();
+    for (size_t cpu = 0; cpu < num_cpus; ++cpu) {
+        // each CPU's arena lives in its own node's memory, if it has any
+        generic_allocator_t* node_allocator = memory_node_allocator(smp_get_processor_node(cpu));
+        void* memory = node_allocator ? allocator_alloc_aligned(node_allocator, JOSX_SCRATCH_SIZE_PER_CPU, kAllocAlign_64) : 0;
+        if (!memory) {
+            memory = allocator_alloc_aligned(allocator, JOSX_SCRATCH_SIZE_PER_CPU, kAllocAlign_64);
+        }
+        if (!memory) {
+            return _JO_STATUS_RESOURCE_EXHAUSTED;
+        }
+        _JOS_PER_CPU_PTR(arenas, cpu) = (uintptr_t)linear_allocator_create(memory, JOSX_SCRATCH_SIZE_PER_CPU);
+    }
+    _per_cpu_arenas = arenas;
+
+    _JOS_KTRACE_CHANNEL(kScratchChannel, "%d KB scratch for each of %d processors", JOSX_SCRATCH_SIZE_PER_CPU/1024, num_cpus);
+    return _JO_STATUS_SUCCESS;
+}
+
+_JOS_API_FUNC scratch_t scratch_begin(void) {
+
+    linear_allocator_t* arena;
+    if (_per_cpu_arenas) {
+        arena = (linear_allocator_t*)_JOS_PER_CPU_THIS_PTR(_per_cpu_arenas);
+    }
+    else {
+        if (!_boot_arena) {
+            _boot_arena = linear_allocator_create(_boot_arena_memory, sizeof(_boot_arena_memory));
+        }
+        arena = _boot_arena;
+    }
+    return (scratch_t){ ._arena = arena, ._marker = linear_allocator_mark(arena) };
+}
@@ -7,7 +7,7 @@
 #include <collections.h>
 #include <smp.h>
 #include <apic.h>
-#include <linear_allocator.h>
+#include <acpi.h>
 
 // in efi_main.c
 static CEfiMultiProcessorProtocol*  _mpp = 0;
@@ -16,14 +16,39 @@ static size_t   _bsp_id = 0;
 //NOTE: we can't use any PER_CPU storage before smp_initialise setus up this 
 static size_t   _num_processors = 0;
 static size_t   _num_enabled_processors = 0;
-static processor_information_t* _processors = 0;
+// processor information is written by each AP on startup and read through gs, keep each on its own cache line
+static per_cpu_block_t _processors = {0};
 static const char* kSmpChannel = "smp";
-static linear_allocator_t* _smp_allocator = NULL;
+// per CPU structures are allocated as they're created, from the static pool given to smp_initialise
+static generic_allocator_t* _smp_allocator = NULL;
 
 // ==================================================================================================
 
+#define _processor(p) _JOS_PER_CPU_BLOCK(_processors, processor_information_t, (p))
+
 #define CPUID_FEATURE_FLAG_ENABLED(reg, index) (((reg) & (1u<<(index))) == (1u<<(index)))
 
+// the full (x2)APIC ID of this processor, as used by the MADT and SRAT. the xAPIC ID register only holds 8 bits
+// so we use the topology leaves, 0x1f or 0xb, if they are available and the initial APIC ID from leaf 1 otherwise.
+// see Intel Dev Guide Vol 3 10.12.8.1 and Vol 2A CPUID
+static uint32_t this_cpu_apic_id(processor_information_t* info) {
+    uint32_t eax,ebx,ecx,edx;
+    if ( info->_max_basic_cpuid >= 0x1f ) {
+        __get_cpuid_count(0x1f, 0, &eax, &ebx, &ecx, &edx);
+        if ( ebx & 0xffff ) {
+            return edx;
+        }
+    }
+    if ( info->_max_basic_cpuid >= 0xb ) {
+        __get_cpuid_count(0xb, 0, &eax, &ebx, &ecx, &edx);
+        if ( ebx & 0xffff ) {
+            return edx;
+        }
+    }
+    __get_cpuid_count(0x1, 0, &eax, &ebx, &ecx, &edx);
+    return ebx >> 24;
+}
+
 static void collect_this_cpu_information(processor_information_t* info) {
 
     info->_max_basic_cpuid = __get_cpuid_max(0, NULL);
@@ -49,6 +74,8 @@ static void collect_this_cpu_information(processor_information_t* info) {
     info->_has_tsc = CPUID_FEATURE_FLAG_ENABLED(edx, 5);
     info->_has_msr = CPUID_FEATURE_FLAG_ENABLED(edx, 6);
     info->_xsave = CPUID_FEATURE_FLAG_ENABLED(ecx, 26);
+    info->_has_pcid = CPUID_FEATURE_FLAG_ENABLED(ecx, 17);
+    info->_has_pat = CPUID_FEATURE_FLAG_ENABLED(edx, 16);
 
     //NOTE: this should ALWAYS be true for x64
     info->_has_local_apic = CPUID_FEATURE_FLAG_ENABLED(edx, 9);
@@ -69,15 +96,22 @@ static void collect_this_cpu_information(processor_information_t* info) {
         info->_xsave_info._xsave_area_size = 0;
     }
     
+    if ( info->_max_basic_cpuid >= 7 ) {
+        __get_cpuid_count(0x7, 0, &eax, &ebx, &ecx, &edx);
+        info->_has_invpcid = CPUID_FEATURE_FLAG_ENABLED(ebx, 10);
+    }
+
     __get_cpuid_count(0x80000001, 0, &eax, &ebx, &ecx, &edx);
     info->_intel_64_arch = CPUID_FEATURE_FLAG_ENABLED(edx, 29);
     info->_has_1GB_pages = CPUID_FEATURE_FLAG_ENABLED(edx, 26);
     
-    //NOTE: if x2APIC is supported we can use 1b or b CPUID functions for topology information as well
+    info->_numa_node = info->_has_local_apic ? acpi_numa_node_for_apic_id(this_cpu_apic_id(info)) : 0;
     
     info->_is_good = true;
 }
 
+//NOTE: runs under the UEFI MP protocol, on the firmware's page tables and before tlb_initialise, so the AP 
+//      is not brought online for TLB shootdowns here (see tlb_cpu_online)
 static void initialise_this_ap(void* arg) {
 
     processor_information_t* proc_info = (processor_information_t*)arg;
@@ -98,8 +132,6 @@ static void initialise_this_ap(void* arg) {
 
 jo_status_t    smp_initialise(static_allocation_policy_t* static_allocator_policy, CEfiBootServices *boot_services) {
 
-    static const size_t kSMP_PER_CPU_MEMORY_ARENA_SIZE = 1024*1024;
-
     CEfiHandle handle_buffer[3];
     CEfiUSize handle_buffer_size = sizeof(handle_buffer);
     memset(handle_buffer,0,sizeof(handle_buffer));
@@ -135,28 +167,25 @@ jo_status_t    smp_initialise(static_allocation_policy_t* static_allocator_polic
             _JOS_KTRACE_CHANNEL(kSmpChannel, "BSP id is %d, %d processors present", _bsp_id, _num_processors);
 
             // now we have the information we need to register this module
-            // we'll set aside one meg per core for misc            
-            _smp_allocator = linear_allocator_create(static_allocator_policy->allocator->alloc(static_allocator_policy->allocator, 
-                                kSMP_PER_CPU_MEMORY_ARENA_SIZE*_num_enabled_processors), 
-                            kSMP_PER_CPU_MEMORY_ARENA_SIZE*_num_enabled_processors);
-
-            _processors = (processor_information_t*)linear_allocator_alloc(_smp_allocator, sizeof(processor_information_t) * _num_processors);
-            memset(_processors, 0, sizeof(processor_information_t) * _num_processors);
-            _processors[_bsp_id]._id = _bsp_id;
-            initialise_this_ap((void*)&_processors[_bsp_id]);
+            _smp_allocator = static_allocator_policy->allocator;
+            if ( per_cpu_create_block(&_processors, sizeof(processor_information_t)) != _JO_STATUS_SUCCESS ) {
+                return _JO_STATUS_RESOURCE_EXHAUSTED;
+            }
+            _processor(_bsp_id)->_id = _bsp_id;
+            initialise_this_ap((void*)_processor(_bsp_id));
             
             for(size_t p = 0; p < _num_processors; ++p) {
 
                 // assigning the id this way ensures we don't depend on any hw particulars
-                _processors[p]._id = p;
+                _processor(p)->_id = p;
                 if( p != _bsp_id ) {
-                    efi_status = _mpp->get_processor_info(_mpp, p, &_processors[p]._uefi_info);
+                    efi_status = _mpp->get_processor_info(_mpp, p, &_processor(p)->_uefi_info);
                     if ( efi_status == C_EFI_SUCCESS ) {
                         // execute the information collect function on this processor
                         //NOTE: infinite timeout here because the callback is quick, if that changes this has to be re-considered
-                        efi_status = _mpp->startup_this_ap(_mpp, initialise_this_ap, p, NULL, 0, (void*)(_processors+p), NULL);
+                        efi_status = _mpp->startup_this_ap(_mpp, initialise_this_ap, p, NULL, 0, (void*)_processor(p), NULL);
                         if ( efi_status != C_EFI_SUCCESS ) {
-                            _processors[p]._is_good = false;
+                            _processor(p)->_is_good = false;
                         }
                     }
                 }
@@ -166,15 +195,16 @@ jo_status_t    smp_initialise(static_allocation_policy_t* static_allocator_polic
     else
     {
         // uni processor
-        _smp_allocator = linear_allocator_alloc(static_allocator_policy->allocator->alloc(static_allocator_policy->allocator, 
-                kSMP_PER_CPU_MEMORY_ARENA_SIZE), kSMP_PER_CPU_MEMORY_ARENA_SIZE);
+        _smp_allocator = static_allocator_policy->allocator;
         _JOS_KTRACE_CHANNEL(kSmpChannel, "uni processor system, or no UEFI MP protocol handler available");
-        _processors = (processor_information_t*)linear_allocator_alloc(_smp_allocator, sizeof(processor_information_t));
-        _processors->_id = 0;
-        initialise_this_ap(_processors);        
-        _processors->_is_good = true;
         _num_processors = 1;
         _num_enabled_processors = 1;
+        if ( per_cpu_create_block(&_processors, sizeof(processor_information_t)) != _JO_STATUS_SUCCESS ) {
+            return _JO_STATUS_RESOURCE_EXHAUSTED;
+        }
+        _processor(0)->_id = 0;
+        initialise_this_ap(_processor(0));        
+        _processor(0)->_is_good = true;
     }
 
     return _JO_STATUS_SUCCESS;        
@@ -194,24 +224,41 @@ jo_status_t        smp_get_processor_information(processor_information_t* out_in
     if ( processor_index >= _num_processors ) {
         return _JO_STATUS_OUT_OF_RANGE;
     }
-    memcpy(out_info, _processors+processor_index, sizeof(processor_information_t));
+    memcpy(out_info, _processor(processor_index), sizeof(processor_information_t));
     return _JO_STATUS_SUCCESS;
 }
 
+size_t smp_get_processor_node(size_t processor_index) {
+    _JOS_ASSERT(processor_index < _num_processors);
+    return _processor(processor_index)->_numa_node;
+}
+
 // ====================================================================================
 // per CPU 
 
 per_cpu_ptr_t       per_cpu_create_ptr(void) {
     _JOS_ASSERT(_num_processors);
-    return (per_cpu_ptr_t)linear_allocator_alloc(_smp_allocator, sizeof(uintptr_t)*_num_processors);
+    return (per_cpu_ptr_t)_smp_allocator->alloc(_smp_allocator, sizeof(uintptr_t)*_num_processors);
 }
 
 per_cpu_queue_t     per_cpu_create_queue(void) {
     _JOS_ASSERT(_num_processors);
-    return (per_cpu_queue_t)linear_allocator_alloc(_smp_allocator, sizeof(queue_t)*_num_processors);
+    return (per_cpu_queue_t)_smp_allocator->alloc(_smp_allocator, sizeof(queue_t)*_num_processors);
 }
 
 per_cpu_qword_t     per_cpu_create_qword(void) {
     _JOS_ASSERT(_num_processors);
-    return (per_cpu_qword_t)linear_allocator_alloc(_smp_allocator, sizeof(uint64_t)*_num_processors);
+    return (per_cpu_qword_t)_smp_allocator->alloc(_smp_allocator, sizeof(uint64_t)*_num_processors);
+}
+
+jo_status_t         per_cpu_create_block(per_cpu_block_t* block, size_t size) {
+    _JOS_ASSERT(_num_processors);
+    block->_stride = _JOS_ALIGN(size, JOSX_CACHE_LINE_SIZE);
+    block->_base = allocator_alloc_aligned(_smp_allocator, block->_stride*_num_processors, kAllocAlign_64);
+    if ( !block->_base ) {
+        block->_stride = 0;
+        return _JO_STATUS_RESOURCE_EXHAUSTED;
+    }
+    memset(block->_base, 0, block->_stride*_num_processors);
+    return _JO_STATUS_SUCCESS;
 }
\ No newline at end of file
@@ -14,8 +14,11 @@
 #include <debugger.h>
 #include <x86_64.h>
 #include <tasks.h>
+#include <tlb.h>
 #include <internal/_tasks.h>
 #include <linear_allocator.h>
+#include <vmm.h>
+#include <memory.h>
 
 #include <stdlib.h>
 #include <string.h>
@@ -81,10 +84,11 @@ extern void x86_64_xsave(uint64_t xsave_bitmap, uintptr_t save_area_64_byte_alig
 extern void x86_64_xrstor(uint64_t xsave_bitmap, uintptr_t save_area_64_byte_aligned);
 
 // handle to per-cpu context instances
-static per_cpu_ptr_t _per_cpu_ctx;
+// each CPU's scheduler context lives on its own cache line(s)
+static per_cpu_block_t _per_cpu_ctx;
 
 _JOS_API_FUNC _tasks_debugger_task_iterator_t _tasks_debugger_task_iterator_begin(void) {
-    return ((cpu_task_context_t*)_JOS_PER_CPU_THIS_PTR(_per_cpu_ctx))->_running_task;
+    return _JOS_PER_CPU_THIS_BLOCK(_per_cpu_ctx, cpu_task_context_t)->_running_task;
 }
 
 _JOS_API_FUNC uint32_t _tasks_debugger_num_tasks(void) {
@@ -101,7 +105,7 @@ static task_context_t*  _select_next_task_to_run(void) {
     //      running co-operatively, and no CPUs can interfere with each other's task queues.
     //      IF that changes this has to be made re-entrant safe
 
-    cpu_task_context_t* cpu_ctx = (cpu_task_context_t*)_JOS_PER_CPU_THIS_PTR(_per_cpu_ctx);
+    cpu_task_context_t* cpu_ctx = _JOS_PER_CPU_THIS_BLOCK(_per_cpu_ctx, cpu_task_context_t);
     // pick the next highest priority task available
     for(int pri = (int)kTaskPri_Highest; pri < (int)kTaskPri_NumPris; ++pri) {
         
@@ -119,8 +123,8 @@ static task_context_t*  _select_next_task_to_run(void) {
                 
                 //_JOS_KTRACE_CHANNEL(kTaskChannel, "switching out \"%s\"", cpu_ctx->_running_task->_name);
 
-                // move currently running back to the end of the queue
-                cpu_context_push_task(cpu_ctx, pri, cpu_ctx->_running_task);
+                // move currently running back to the end of its queue
+                cpu_context_push_task(cpu_ctx, cpu_ctx->_running_task->_pri, cpu_ctx->_running_task);
             }
             
             // enable new running task
@@ -136,7 +140,7 @@ static task_context_t*  _select_next_task_to_run(void) {
 static void _task_wrapper(task_context_t* ctx);
 
 static void _yield_to_next_task(void) {
-    cpu_task_context_t* cpu_ctx = (cpu_task_context_t*)_JOS_PER_CPU_THIS_PTR(_per_cpu_ctx);
+    cpu_task_context_t* cpu_ctx = _JOS_PER_CPU_THIS_BLOCK(_per_cpu_ctx, cpu_task_context_t);
     task_context_t* prev = cpu_ctx->_running_task;
     task_context_t* next_task = _select_next_task_to_run();
     if (next_task && next_task == prev) {
@@ -185,7 +189,14 @@ static jo_status_t _idle_task(void* ptr) {
     //ZZZ: not so much "true" as wait for a kernel shutdown signal   
     while(true) {
         _yield_to_next_task();
+        // zero freed frames while there's nothing else to do, so that memory_frame_alloc_zeroed doesn't have to
+        if ( memory_zero_free_frames(JOSX_FRAME_ZEROING_BATCH) ) {
+            continue;
+        }
+        // there's nothing at all to do so we don't need to be interrupted by TLB shootdowns
+        tlb_enter_lazy();
         x86_64_pause_cpu();
+        tlb_leave_lazy();
     }
     _JOS_UNREACHABLE();
     return _JO_STATUS_SUCCESS;
@@ -196,7 +207,7 @@ static void _task_wrapper(task_context_t* ctx) {
     jo_status_t status _JOS_MAYBE_UNUSED = ctx->_func(ctx->_ptr);
 
     // post-amble: remove this task and switch to a new one
-    cpu_task_context_t* cpu_ctx = (cpu_task_context_t*)_JOS_PER_CPU_THIS_PTR(_per_cpu_ctx);
+    cpu_task_context_t* cpu_ctx = _JOS_PER_CPU_THIS_BLOCK(_per_cpu_ctx, cpu_task_context_t);
     _JOS_ASSERT(cpu_ctx->_running_task == ctx);
     // pick a fresh task, or idle
     // TODO: remove the task, i.e. destroy it properly (this is a LEAK)
@@ -205,6 +216,12 @@ static void _task_wrapper(task_context_t* ctx) {
 }
 
 #define TASK_STACK_CONTEXT_SIZE TASK_STACK_SIZE + sizeof(task_context_t)
+// task contexts are page aligned so without an offset every context (and the hot top of every stack) 
+// would map to the same cache sets; each one is offset by a cycling "colour" of whole cache lines
+#define TASK_CONTEXT_COLOURS        8
+#define TASK_SLAB_SIZE              (TASK_STACK_CONTEXT_SIZE + (TASK_CONTEXT_COLOURS-1)*JOSX_CACHE_LINE_SIZE)
+static size_t _next_task_colour = 0;
+
 static task_context_t* _create_task_context(task_func_t func, void* ptr, const char* name) {
 
     // allocate memory for the stack and the task context object
@@ -221,16 +238,21 @@ static task_context_t* _create_task_context(task_func_t func, void* ptr, const c
             ___________________________
             | ctx                     |
             ---------------------------
+            | colour                  |
+            --------------------------- slab (page aligned)
     */
-    task_context_t* ctx = (task_context_t*)_tasks_allocator->_super.alloc((generic_allocator_t*)_tasks_allocator, TASK_STACK_CONTEXT_SIZE);
-    _JOS_ASSERT(ctx);
+    void* slab = linear_allocator_alloc_aligned(_tasks_allocator, TASK_SLAB_SIZE, kAllocAlign_4k);
+    _JOS_ASSERT(slab);
+    // if the pool is committed lazily the stack must still be committed now, see vmm_commit
+    const jo_status_t commit_status _JOS_MAYBE_UNUSED = vmm_commit(slab, TASK_SLAB_SIZE);
+    _JOS_ASSERT(_JO_SUCCEEDED(commit_status) || commit_status == _JO_STATUS_NOT_FOUND);
+    task_context_t* ctx = (task_context_t*)((uintptr_t)slab + _next_task_colour*JOSX_CACHE_LINE_SIZE);
+    _next_task_colour = (_next_task_colour + 1) % TASK_CONTEXT_COLOURS;
 
     // set aside space for XSAVE if we use it
     processor_information_t* this_cpu_info = per_cpu_this_cpu_info();
     if (this_cpu_info->_xsave && this_cpu_info->_xsave_info._xsave_area_size) {
-        //TODO: LEAKING
-        void* base_alloc_ptr;
-        aligned_alloc((generic_allocator_t*)_tasks_allocator, this_cpu_info->_xsave_info._xsave_area_size, kAllocAlign_64, &base_alloc_ptr, &ctx->_xsave_area);
+        ctx->_xsave_area = allocator_alloc_aligned((generic_allocator_t*)_tasks_allocator, this_cpu_info->_xsave_info._xsave_area_size, kAllocAlign_64);
         _JOS_ASSERT(ctx->_xsave_area);
     } else {
         ctx->_xsave_area = 0;
@@ -274,7 +296,7 @@ static task_context_t* _create_task_context(task_func_t func, void* ptr, const c
 // ------------------------------------------------------
 
 _JOS_API_FUNC task_context_t* tasks_this_task(void) {
-    cpu_task_context_t* cpu_ctx = (cpu_task_context_t*)_JOS_PER_CPU_THIS_PTR(_per_cpu_ctx);    
+    cpu_task_context_t* cpu_ctx = _JOS_PER_CPU_THIS_BLOCK(_per_cpu_ctx, cpu_task_context_t);    
     return cpu_ctx->_running_task;
 }
 
@@ -284,7 +306,8 @@ task_handle_t   tasks_create(task_create_args_t* args) {
         args->name, args->func, args->ptr, args->pri);
 
     task_context_t* ctx = _create_task_context(args->func, args->ptr, args->name);
-    cpu_task_context_t* cpu_ctx = (cpu_task_context_t*)_JOS_PER_CPU_THIS_PTR(_per_cpu_ctx);    
+    ctx->_pri = args->pri;
+    cpu_task_context_t* cpu_ctx = _JOS_PER_CPU_THIS_BLOCK(_per_cpu_ctx, cpu_task_context_t);    
 
     //ZZZ: this should probably be done in a separate "start" function?    
     cpu_context_push_task(cpu_ctx, args->pri, ctx);
@@ -302,30 +325,34 @@ void tasks_initialise(generic_allocator_t* allocator) {
 
     //NOTE: called on the BSP *only*
     _JOS_ASSERT(smp_get_bsp_id() == per_cpu_this_cpu_id());
-    _per_cpu_ctx = per_cpu_create_ptr();
+    const jo_status_t block_status _JOS_MAYBE_UNUSED = per_cpu_create_block(&_per_cpu_ctx, sizeof(cpu_task_context_t));
+    _JOS_ASSERT(_JO_SUCCEEDED(block_status));
 
     // fixed pool of memory for the per-cpu IDLE tasks, this is all we allocate up front    
-    size_t idle_task_pool_size = sizeof(linear_allocator_t) + smp_get_processor_count() * (sizeof(cpu_task_context_t) + TASK_STACK_CONTEXT_SIZE);
+    size_t idle_task_pool_size = sizeof(linear_allocator_t) + smp_get_processor_count() * (TASK_SLAB_SIZE + kAllocAlign_4k);
     //TODO: we need enough memory to allocate and manage tasks!
     idle_task_pool_size += 8*1024*1024;
 
-    void* allocator_arena = allocator->alloc(allocator, idle_task_pool_size);
+    // most of this is never used so it's only committed as tasks are created, if we can
+    void* allocator_arena = vmm_reserve_lazy(idle_task_pool_size, PAGE_READWRITE);
+    if ( !allocator_arena ) {
+        allocator_arena = allocator->alloc(allocator, idle_task_pool_size);
+    }
     _JOS_ASSERT(allocator_arena);
     _tasks_allocator = linear_allocator_create(allocator_arena, idle_task_pool_size);
     
     for(size_t cpu = 0; cpu < smp_get_processor_count(); ++cpu ) {
         
-        cpu_task_context_t* cpu_ctx = (cpu_task_context_t*)linear_allocator_alloc(_tasks_allocator, sizeof(cpu_task_context_t));
+        cpu_task_context_t* cpu_ctx = _JOS_PER_CPU_BLOCK(_per_cpu_ctx, cpu_task_context_t, cpu);
         cpu_context_initialise(cpu_ctx);
         _JOS_KTRACE_CHANNEL(kTaskChannel, "initialising for ap %d (ctx 0x%llx)", cpu, cpu_ctx);
-        _JOS_PER_CPU_PTR(_per_cpu_ctx, cpu) = (uintptr_t)cpu_ctx;        
     }
 }
 
 //NOTE: called on each AP (+BSP)
 void tasks_start_idle(void) {
     
-    cpu_task_context_t* ctx = (cpu_task_context_t*)_JOS_PER_CPU_THIS_PTR(_per_cpu_ctx);
+    cpu_task_context_t* ctx = _JOS_PER_CPU_THIS_BLOCK(_per_cpu_ctx, cpu_task_context_t);
     ctx->_running_task = 0;
     ctx->_cpu_idle = _create_task_context(_idle_task, 0, "cpu_idle");
     //NOTE: idle priority is special, and lower than anything else
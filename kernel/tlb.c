@@ -0,0 +1,327 @@
+#include <jos.h>
+#include <kernel.h>
+#include <smp.h>
+#include <apic.h>
+#include <interrupts.h>
+#include <x86_64.h>
+#include <scratch.h>
+#include <tlb.h>
+#include <string.h>
+
+static const char* kTlbChannel = "tlb";
+
+#define _RFLAGS_IF  (1<<9)
+
+#define _CR4_PCIDE      (1<<17)
+#define _CR3_NOFLUSH    0x8000000000000000ull
+#define _CR3_PCID_MASK  0xfffull
+
+typedef enum _tlb_cpu_state {
+
+    // not using the kernel page tables (yet), nothing to invalidate
+    kTlbCpu_Offline = 0,
+    // will be sent an IPI for every shootdown
+    kTlbCpu_Active,
+    // idle; shootdowns are queued but not signalled
+    kTlbCpu_Lazy,
+
+} tlb_cpu_state_t;
+
+// shootdown state for each processor
+typedef struct _tlb_cpu {
+
+    lock_t          _lock;
+    volatile int    _state;
+    // set when something has been queued, cleared by the owning processor when processed
+    volatile int    _pending;
+    // tickets for queued and completed requests, initiators wait for _completed to catch up with their ticket
+    volatile int    _requested;
+    volatile int    _completed;
+    bool            _flush_all;
+    size_t          _num_ranges;
+    tlb_range_t     _ranges[TLB_MAX_INVALIDATE_RANGES];
+    uint32_t        _apic_id;
+
+    // PCIDs are only touched by the owning processor, with interrupts disabled.
+    // the context each PCID is tagged with and the generation it was last valid in
+    int             _pcid_context[TLB_NUM_PCIDS];
+    int             _pcid_generation[TLB_NUM_PCIDS];
+    size_t          _current_pcid;
+    size_t          _next_pcid;
+
+} tlb_cpu_t;
+
+static tlb_cpu_t*   _cpus = 0;
+static size_t       _num_cpus = 0;
+static bool         _use_pcid = false;
+// bumped by every shootdown, see tlb.h
+static volatile int _generation = 0;
+// context ids, 0 is never used
+static volatile int _next_context_id = 1;
+
+static void _invalidate_local(const tlb_range_t* ranges, size_t num_ranges, bool flush_all) {
+
+    // read before we invalidate; if another shootdown bumps it in the meantime we'll just flush once too many
+    const int generation = _generation;
+
+    if ( !flush_all ) {
+        size_t num_pages = 0;
+        for ( size_t r = 0; r < num_ranges; ++r ) {
+            num_pages += ranges[r]._count;
+        }
+        flush_all = num_pages > TLB_FLUSH_ALL_THRESHOLD;
+    }
+    if ( flush_all ) {
+        if ( _use_pcid ) {
+            // every PCID on this processor is now clean, not just the current one
+            x86_64_invpcid(X86_64_INVPCID_ALL_NON_GLOBAL, 0, 0);
+            if ( _cpus ) {
+                tlb_cpu_t* cpu = _cpus + per_cpu_this_cpu_id();
+                for ( size_t p = 0; p < TLB_NUM_PCIDS; ++p ) {
+                    cpu->_pcid_generation[p] = generation;
+                }
+            }
+            return;
+        }
+        // we don't use global pages so reloading cr3 flushes everything (for the current PCID)
+        x86_64_write_cr3(x86_64_read_cr3());
+    }
+    else {
+        // invlpg only invalidates the current PCID
+        for ( size_t r = 0; r < num_ranges; ++r ) {
+            uintptr_t at = ranges[r]._at;
+            for ( size_t p = 0; p < ranges[r]._count; ++p ) {
+                x86_64_flush_tlb_for_address(at);
+                at += ranges[r]._stride;
+            }
+        }
+    }
+    if ( _use_pcid && _cpus ) {
+        tlb_cpu_t* cpu = _cpus + per_cpu_this_cpu_id();
+        cpu->_pcid_generation[cpu->_current_pcid] = generation;
+    }
+}
+
+// queue ranges on cpu, returns the ticket for the request
+static int _enqueue(tlb_cpu_t* cpu, const tlb_range_t* ranges, size_t num_ranges, bool flush_all) {
+
+    lock_spinlock(&cpu->_lock);
+    if ( flush_all || cpu->_num_ranges + num_ranges > TLB_MAX_INVALIDATE_RANGES ) {
+        cpu->_flush_all = true;
+    }
+    if ( !cpu->_flush_all ) {
+        memcpy(cpu->_ranges + cpu->_num_ranges, ranges, num_ranges*sizeof(tlb_range_t));
+        cpu->_num_ranges += num_ranges;
+    }
+    cpu->_pending = 1;
+    const int ticket = ++cpu->_requested;
+    lock_unlock(&cpu->_lock);
+    return ticket;
+}
+
+static void _tlb_shootdown_handler(interrupt_stack_t* stack) {
+    (void)stack;
+    tlb_process_pending();
+    apic_eoi();
+}
+
+_JOS_API_FUNC void tlb_process_pending(void) {
+
+    if ( !_cpus ) {
+        return;
+    }
+    tlb_cpu_t* cpu = _cpus + per_cpu_this_cpu_id();
+    if ( !cpu->_pending ) {
+        return;
+    }
+
+    // an interrupt on this processor could otherwise re-enter while we hold our own lock
+    const uint64_t rflags = x86_64_get_rflags();
+    x86_64_cli();
+
+    // take a copy so that we don't hold the lock while invalidating
+    tlb_range_t ranges[TLB_MAX_INVALIDATE_RANGES];
+    lock_spinlock(&cpu->_lock);
+    const bool flush_all = cpu->_flush_all;
+    const size_t num_ranges = cpu->_num_ranges;
+    memcpy(ranges, cpu->_ranges, num_ranges*sizeof(tlb_range_t));
+    const int ticket = cpu->_requested;
+    cpu->_flush_all = false;
+    cpu->_num_ranges = 0;
+    cpu->_pending = 0;
+    lock_unlock(&cpu->_lock);
+
+    _invalidate_local(ranges, num_ranges, flush_all);
+    // only now can the initiators carry on
+    cpu->_completed = ticket;
+
+    if ( rflags & _RFLAGS_IF ) {
+        x86_64_sti();
+    }
+}
+
+_JOS_API_FUNC void tlb_invalidate(const tlb_range_t* ranges, size_t num_ranges, bool flush_all) {
+
+    if ( _use_pcid ) {
+        // whatever is cached under a PCID that isn't current on some processor is now stale
+        atomic_fetch_add(&_generation, 1);
+    }
+    _invalidate_local(ranges, num_ranges, flush_all);
+    if ( !_cpus || _num_cpus == 1 ) {
+        return;
+    }
+
+    const size_t this_cpu = per_cpu_this_cpu_id();
+    scratch_t scratch = scratch_begin();
+    int* tickets = (int*)scratch_alloc(&scratch, _num_cpus*sizeof(int));
+    _JOS_ASSERT(tickets);
+
+    const uint64_t rflags = x86_64_get_rflags();
+    x86_64_cli();
+    for ( size_t c = 0; c < _num_cpus; ++c ) {
+        tickets[c] = 0;
+        tlb_cpu_t* cpu = _cpus + c;
+        if ( c == this_cpu || cpu->_state == kTlbCpu_Offline ) {
+            continue;
+        }
+        const int ticket = _enqueue(cpu, ranges, num_ranges, flush_all);
+        // the locked cmpxchg is a full barrier between publishing the request and reading the state; 
+        // pairs with tlb_leave_lazy so that either we see the processor as active or it sees the request
+        const int state = atomic_compare_exchange_strong(&cpu->_state, kTlbCpu_Active, kTlbCpu_Active);
+        if ( state == kTlbCpu_Active ) {
+            tickets[c] = ticket;
+            apic_send_ipi(cpu->_apic_id, _JOS_KERNEL_IPI_TLB_SHOOTDOWN);
+        }
+    }
+    if ( rflags & _RFLAGS_IF ) {
+        x86_64_sti();
+    }
+
+    for ( size_t c = 0; c < _num_cpus; ++c ) {
+        if ( !tickets[c] ) {
+            continue;
+        }
+        while ( (int)(_cpus[c]._completed - tickets[c]) < 0 ) {
+            // the processor we are waiting for may itself be waiting for us with interrupts disabled
+            tlb_process_pending();
+            x86_64_pause_cpu();
+        }
+    }
+    scratch_end(&scratch);
+}
+
+_JOS_API_FUNC void tlb_enter_lazy(void) {
+    if ( _cpus ) {
+        _cpus[per_cpu_this_cpu_id()]._state = kTlbCpu_Lazy;
+    }
+}
+
+_JOS_API_FUNC void tlb_leave_lazy(void) {
+    if ( _cpus ) {
+        // full barrier, see tlb_invalidate
+        atomic_compare_exchange_strong(&_cpus[per_cpu_this_cpu_id()]._state, kTlbCpu_Lazy, kTlbCpu_Active);
+        tlb_process_pending();
+    }
+}
+
+_JOS_API_FUNC void tlb_context_create(tlb_context_t* context) {
+    context->_id = atomic_fetch_add(&_next_context_id, 1);
+}
+
+_JOS_API_FUNC bool tlb_pcid_enabled(void) {
+    return _use_pcid;
+}
+
+_JOS_API_FUNC void tlb_switch_context(tlb_context_t* context, uintptr_t pml4) {
+
+    _JOS_ASSERT(_JOS_PTR_IS_ALIGNED(pml4, 0x1000));
+    if ( !_use_pcid ) {
+        // without PCIDs every switch is a full flush, but we can at least avoid reloading the same tables
+        if ( (x86_64_read_cr3() & ~_CR3_PCID_MASK) != pml4 ) {
+            x86_64_write_cr3(pml4);
+        }
+        return;
+    }
+
+    const uint64_t rflags = x86_64_get_rflags();
+    x86_64_cli();
+
+    tlb_cpu_t* cpu = _cpus + per_cpu_this_cpu_id();
+    const int generation = _generation;
+    bool flush = true;
+    size_t pcid = TLB_NUM_PCIDS;
+    for ( size_t p = 0; p < TLB_NUM_PCIDS; ++p ) {
+        if ( cpu->_pcid_context[p] == context->_id ) {
+            pcid = p;
+            break;
+        }
+    }
+    if ( pcid < TLB_NUM_PCIDS ) {
+        // if a shootdown has happened since we last ran with this PCID it may hold stale entries
+        flush = cpu->_pcid_generation[pcid] != generation;
+    }
+    else {
+        // recycle the next PCID round-robin, whatever it held belongs to another context and is flushed below
+        pcid = cpu->_next_pcid;
+        cpu->_next_pcid = (pcid + 1) % TLB_NUM_PCIDS;
+        cpu->_pcid_context[pcid] = context->_id;
+    }
+    cpu->_pcid_generation[pcid] = generation;
+    cpu->_current_pcid = pcid;
+
+    x86_64_write_cr3(pml4 | pcid | (flush ? 0 : _CR3_NOFLUSH));
+
+    if ( rflags & _RFLAGS_IF ) {
+        x86_64_sti();
+    }
+}
+
+// PCID 0 is current when PCIDE is enabled (cr3[11:0] must be 0), it isn't tagged with any context yet
+static void _enable_pcid(void) {
+    if ( _use_pcid ) {
+        x86_64_write_cr4(x86_64_read_cr4() | _CR4_PCIDE);
+    }
+}
+
+_JOS_API_FUNC void tlb_cpu_online(void) {
+    _JOS_ASSERT(_cpus);
+    _enable_pcid();
+    // whatever we have cached from before is potentially stale
+    _invalidate_local(0, 0, true);
+    atomic_compare_exchange_strong(&_cpus[per_cpu_this_cpu_id()]._state, kTlbCpu_Offline, kTlbCpu_Active);
+}
+
+_JOS_API_FUNC jo_status_t tlb_initialise(static_allocation_policy_t* static_allocation_policy) {
+
+    const size_t num_cpus = smp_get_processor_count();
+    tlb_cpu_t* cpus = (tlb_cpu_t*)allocator_alloc_aligned(static_allocation_policy->allocator, num_cpus*sizeof(tlb_cpu_t), kAllocAlign_64);
+    if ( !cpus ) {
+        return _JO_STATUS_RESOURCE_EXHAUSTED;
+    }
+    memset(cpus, 0, num_cpus*sizeof(tlb_cpu_t));
+    
+    for ( size_t c = 0; c < num_cpus; ++c ) {
+        processor_information_t info;
+        if ( _JO_SUCCEEDED(smp_get_processor_information(&info, c)) ) {
+            cpus[c]._apic_id = info._local_apic_info._id >> 24;
+        }
+        lock_initialise(&cpus[c]._lock);
+        cpus[c]._state = kTlbCpu_Offline;
+    }
+    // we're running on the BSP, which obviously uses the kernel page tables
+    cpus[per_cpu_this_cpu_id()]._state = kTlbCpu_Active;
+
+    // we need INVPCID as well as PCID; without it we can't flush other PCIDs than the current one 
+    // when a shootdown asks for everything to be flushed
+    const processor_information_t* this_cpu_info = per_cpu_this_cpu_info();
+    _use_pcid = this_cpu_info->_has_pcid && this_cpu_info->_has_invpcid
+        && (x86_64_read_cr3() & _CR3_PCID_MASK) == 0;
+
+    interrupts_set_isr_handler(&(isr_handler_def_t){ ._isr_number = _JOS_KERNEL_IPI_TLB_SHOOTDOWN, ._handler = _tlb_shootdown_handler });
+    _num_cpus = num_cpus;
+    _cpus = cpus;
+    _enable_pcid();
+
+    _JOS_KTRACE_CHANNEL(kTlbChannel, "initialised for %d processors, PCIDs %s", num_cpus, _use_pcid ? "enabled" : "not supported");
+    return _JO_STATUS_SUCCESS;
+}
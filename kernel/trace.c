@@ -3,49 +3,67 @@
 #include <serial.h>
 #include <trace.h>
 #include <debugger.h>
+#include <scratch.h>
 #include <stdio.h>
 #include <string.h>
 
+// trace lines are formatted in scratch memory, not on the (potentially small) stack of the caller
+#define _TRACE_BUFFER_SIZE 1024
+
 void trace_buf(const char* __restrict channel, const void* __restrict data, size_t length) {
 
     if(!data || !length)
         return;
-    char buffer[1024];
+    scratch_t scratch = scratch_begin();
+    char* buffer = (char*)scratch_alloc(&scratch, _TRACE_BUFFER_SIZE);
+    if (!buffer) {
+        scratch_end(&scratch);
+        return;
+    }
 	int written;
 	if(channel)
-		written = snprintf(buffer, sizeof(buffer), "[%s] ", channel);
+		written = snprintf(buffer, _TRACE_BUFFER_SIZE, "[%s] ", channel);
 	else
-		written = snprintf(buffer, sizeof(buffer), "[.] ");
+		written = snprintf(buffer, _TRACE_BUFFER_SIZE, "[.] ");
 
-    length = length < (sizeof(buffer)-written-2) ? length:(sizeof(buffer)-written-2);
+    length = length < (size_t)(_TRACE_BUFFER_SIZE-written-3) ? length:(size_t)(_TRACE_BUFFER_SIZE-written-3);
     memcpy(buffer+written, data, length);
     
     if (!debugger_is_connected()) {    
-        buffer[written+0] = '\r';
-        buffer[written+1] = '\n';
-        buffer[written+2] = 0;
+        buffer[written+length+0] = '\r';
+        buffer[written+length+1] = '\n';
+        buffer[written+length+2] = 0;
         serial_write(kCom1, buffer, written+length+3);
     }
     else {
         debugger_send_packet(kDebuggerPacket_Trace, buffer, written+length);
     }
+    scratch_end(&scratch);
 }
 
 void trace(const char* __restrict channel, const char* __restrict format,...) {
 
     if(!format || !format[0])
         return;
-    //ZZZ:
-    char buffer[1024];
+    scratch_t scratch = scratch_begin();
+    char* buffer = (char*)scratch_alloc(&scratch, _TRACE_BUFFER_SIZE);
+    if (!buffer) {
+        scratch_end(&scratch);
+        return;
+    }
     va_list parameters;
     va_start(parameters, format);
 	int written;
 	if(channel)
-		written = snprintf(buffer, sizeof(buffer), "[%s] ", channel);
+		written = snprintf(buffer, _TRACE_BUFFER_SIZE, "[%s] ", channel);
 	else
-		written = snprintf(buffer, sizeof(buffer), "[.] ");
-    written += vsnprintf(buffer+written, sizeof(buffer)-written, format, parameters);
+		written = snprintf(buffer, _TRACE_BUFFER_SIZE, "[.] ");
+    written += vsnprintf(buffer+written, _TRACE_BUFFER_SIZE-written, format, parameters);
     va_end(parameters);
+    // leave room for the line terminator if the output was truncated
+    if (written > _TRACE_BUFFER_SIZE-3) {
+        written = _TRACE_BUFFER_SIZE-3;
+    }
     
     if (!debugger_is_connected()) {        
         buffer[written+0] = '\r';
@@ -56,4 +74,5 @@ void trace(const char* __restrict channel, const char* __restrict format,...) {
     else {
         debugger_send_packet(kDebuggerPacket_Trace, buffer, written);
     }
+    scratch_end(&scratch);
 }
@@ -2,6 +2,8 @@
 #ifdef _JOS_KERNEL_BUILD
 #include <c-efi.h>
 #include <c-efi-protocol-graphics-output.h>
+#include <pagetables.h>
+#include <x86_64.h>
 #endif 
 
 #include <stdbool.h>
@@ -41,6 +43,10 @@ CEfiGraphicsOutputModeInformation _info;
 
 // copy of active mode info
 static size_t _framebuffer_base = 0;
+#ifdef _JOS_KERNEL_BUILD
+// size of the whole framebuffer aperture, as reported by GOP
+static size_t _framebuffer_aperture_size = 0;
+#endif
 static size_t _red_shift;
 static size_t _green_shift;
 static size_t _blue_shift;
@@ -133,6 +139,7 @@ jo_status_t video_initialise(static_allocation_policy_t* static_allocation_polic
                 if (efi_status == C_EFI_SUCCESS) {
 
                     _framebuffer_base = _gop->mode->frame_buffer_base;
+                    _framebuffer_aperture_size = _gop->mode->frame_buffer_size;
 
                     switch (_info.pixel_format)
                     {
@@ -174,6 +181,20 @@ jo_status_t video_initialise(static_allocation_policy_t* static_allocation_polic
     return status;
 }
 
+#ifdef _JOS_KERNEL_BUILD
+jo_status_t video_runtime_init(void) {
+    if ( !_framebuffer_base || !_framebuffer_aperture_size ) {
+        return _JO_STATUS_FAILED_PRECONDITION;
+    }
+    // the framebuffer is only ever written to, in full lines by video_present, which is exactly what write-combining is for.
+    // the aperture is remapped in place so that it doesn't alias the direct map with a different memory type; 
+    // apertures are usually 2MB aligned and sized which gets us large pages.
+    const uintptr_t base = _framebuffer_base & ~(uintptr_t)0xfff;
+    const size_t size = _JOS_ALIGN(_framebuffer_base + _framebuffer_aperture_size, 0x1000) - base;
+    return pagetables_map_range((void*)base, base, size, PAGE_READWRITE | PAGE_WRITECOMBINE);
+}
+#endif
+
 void video_present(void) {
 #ifdef _JOS_KERNEL_BUILD
     uint32_t* framebuffer = (uint32_t*)_framebuffer_base;
@@ -181,6 +202,10 @@ void video_present(void) {
     uint32_t* framebuffer = framebuffer_base();
 #endif
     memcpy(framebuffer, _backbuffer, _info.pixels_per_scan_line * _info.vertical_resolution * 4);
+#ifdef _JOS_KERNEL_BUILD
+    // WC stores are weakly ordered and buffered, make sure the frame is out
+    x86_64_sfence();
+#endif
 }
 
 uint32_t video_make_color(uint8_t r, uint8_t g, uint8_t b) {
@@ -0,0 +1,330 @@
+#include <jos.h>
+#include <kernel.h>
+#include <memory.h>
+#include <pagetables.h>
+#include <vmem.h>
+#include <vmm.h>
+#include <x86_64.h>
+#include <tlb.h>
+
+static const char* kVmmChannel = "vmm";
+
+#define VMM_PAGE_SIZE       0x1000ull
+// frames are released in batches of this many pages, after the batch has been unmapped
+#define VMM_RELEASE_BATCH   64
+
+// #PF error code bits
+#define PF_ERROR_PRESENT    (1<<0)
+
+#define _RFLAGS_IF          (1<<9)
+
+// a reservation committed page by page as it is touched
+typedef struct _vmm_lazy_region {
+    uintptr_t                   _base;
+    size_t                      _size;
+    int                         _prot_flags;
+    struct _vmm_lazy_region*    _next;
+} vmm_lazy_region_t;
+
+static vmem_t _arena;
+static lock_t _arena_lock;
+static bool _initialised = false;
+// allocates the vmem segment tags and the lazy region list, only ever used with _arena_lock held
+static generic_allocator_t* _allocator = 0;
+static vmm_lazy_region_t* _lazy_regions = 0;
+// also serialises committing pages on fault, so it is only ever held with interrupts disabled; 
+// a fault or IRQ on the holding processor would otherwise spin on it forever
+static lock_t _lazy_lock;
+
+// returns the rflags to pass to _lazy_lock_release
+static uint64_t _lazy_lock_acquire(void) {
+    const uint64_t rflags = x86_64_get_rflags();
+    x86_64_cli();
+    // the holder may be waiting for us to complete a shootdown, so keep servicing those while we wait
+    while ( atomic_compare_exchange_weak(&_lazy_lock.atomic_val.value, 0, 1) != 0 ) {
+        tlb_process_pending();
+        x86_64_pause_cpu();
+    }
+    return rflags;
+}
+
+static void _lazy_lock_release(uint64_t rflags) {
+    lock_unlock(&_lazy_lock);
+    if ( rflags & _RFLAGS_IF ) {
+        x86_64_sti();
+    }
+}
+
+static void _release_frames(uintptr_t virt, size_t size) {
+
+    uintptr_t frames[VMM_RELEASE_BATCH];
+    const uintptr_t end = virt + size;
+    while ( virt < end ) {
+        const uintptr_t batch_start = virt;
+        size_t num_frames = 0;
+        while ( virt < end && num_frames < VMM_RELEASE_BATCH ) {
+            uintptr_t phys;
+            if ( _JO_SUCCEEDED(pagetables_virtual_to_physical((void*)virt, &phys)) ) {
+                frames[num_frames++] = phys;
+            }
+            virt += VMM_PAGE_SIZE;
+        }
+        // no frame can be re-used until no processor can reach it anymore
+        pagetables_unmap_range((void*)batch_start, virt - batch_start);
+        for ( size_t f = 0; f < num_frames; ++f ) {
+            memory_frame_free(frames[f]);
+        }
+    }
+}
+
+// give back the frames of a run that isn't mapped (anymore)
+static void _free_run(uintptr_t phys, size_t size) {
+    for ( size_t offset = 0; offset < size; offset += VMM_PAGE_SIZE ) {
+        memory_frame_free(phys + offset);
+    }
+}
+
+static jo_status_t _map_run(uintptr_t virt, uintptr_t phys, size_t size, int prot_flags) {
+    const jo_status_t status = pagetables_map_range((void*)virt, phys, size, prot_flags);
+    if ( _JO_FAILED(status) ) {
+        // part of it may have been mapped before we ran out of tables
+        pagetables_unmap_range((void*)virt, size);
+        _free_run(phys, size);
+    }
+    return status;
+}
+
+// back [virt, virt+size) with frames, mapping runs of physically contiguous frames in one go.
+// on failure whatever was mapped before the failing run is left for _release_frames
+static jo_status_t _commit(uintptr_t virt, size_t size, int prot_flags) {
+
+    uintptr_t run_virt = virt;
+    uintptr_t run_phys = 0;
+    size_t run_size = 0;
+    for ( uintptr_t at = virt; at < virt + size; at += VMM_PAGE_SIZE ) {
+        const uintptr_t frame = memory_frame_alloc_zeroed();
+        if ( !frame ) {
+            _free_run(run_phys, run_size);
+            return _JO_STATUS_RESOURCE_EXHAUSTED;
+        }
+
+        if ( run_size && frame == run_phys + run_size ) {
+            run_size += VMM_PAGE_SIZE;
+            continue;
+        }
+        if ( run_size ) {
+            const jo_status_t status = _map_run(run_virt, run_phys, run_size, prot_flags);
+            if ( _JO_FAILED(status) ) {
+                memory_frame_free(frame);
+                return status;
+            }
+        }
+        run_virt = at;
+        run_phys = frame;
+        run_size = VMM_PAGE_SIZE;
+    }
+    return _map_run(run_virt, run_phys, run_size, prot_flags);
+}
+
+static void* _page_alloc(page_allocator_t* allocator, size_t size, unsigned int flags) {
+    (void)allocator;
+    void* ptr = vmm_reserve(size);
+    if ( !ptr ) {
+        return 0;
+    }
+    size = _JOS_ALIGN(size, VMM_PAGE_SIZE);
+    if ( _JO_FAILED(_commit((uintptr_t)ptr, size, (int)flags)) ) {
+        _JOS_KTRACE_CHANNEL(kVmmChannel, "out of frames committing 0x%llx bytes", size);
+        // anything that did get mapped is released 
+        _release_frames((uintptr_t)ptr, size);
+        vmm_release(ptr);
+        return 0;
+    }
+    return ptr;
+}
+
+static void* _page_free(page_allocator_t* allocator, void* ptr) {
+    (void)allocator;
+    if ( !ptr ) {
+        return 0;
+    }
+    lock_spinlock(&_arena_lock);
+    const size_t size = vmem_allocation_size(&_arena, (uintptr_t)ptr);
+    lock_unlock(&_arena_lock);
+    _JOS_ASSERT(size);
+    if ( !size ) {
+        return 0;
+    }
+
+    // once the region is unlinked no fault or vmm_commit can find it, and any that already had it 
+    // finished committing before we got the lock, so the frames can be released (and shot down) 
+    // afterwards without holding up faults on other processors or keeping interrupts disabled here
+    vmm_lazy_region_t* lazy_region = 0;
+    const uint64_t rflags = _lazy_lock_acquire();
+    vmm_lazy_region_t** link = &_lazy_regions;
+    while ( *link && (*link)->_base != (uintptr_t)ptr ) {
+        link = &(*link)->_next;
+    }
+    if ( *link ) {
+        lazy_region = *link;
+        *link = lazy_region->_next;
+    }
+    _lazy_lock_release(rflags);
+    _release_frames((uintptr_t)ptr, size);
+
+    lock_spinlock(&_arena_lock);
+    if ( lazy_region ) {
+        _allocator->free(_allocator, lazy_region);
+    }
+    vmem_free(&_arena, (uintptr_t)ptr);
+    lock_unlock(&_arena_lock);
+    return 0;
+}
+
+static void* _page_protect(page_allocator_t* allocator, void* ptr, size_t size, unsigned int flags) {
+    (void)allocator;
+    if ( _JO_FAILED(pagetables_protect_range(ptr, _JOS_ALIGN(size, VMM_PAGE_SIZE), (int)flags)) ) {
+        return 0;
+    }
+    return ptr;
+}
+
+static page_allocator_t _page_allocator = {
+    .alloc = _page_alloc,
+    .free = _page_free,
+    .protect = _page_protect,
+};
+
+_JOS_API_FUNC void* vmm_reserve(size_t size) {
+    _JOS_ASSERT(_initialised);
+    lock_spinlock(&_arena_lock);
+    const uintptr_t at = vmem_alloc(&_arena, size);
+    lock_unlock(&_arena_lock);
+    return (void*)at;
+}
+
+_JOS_API_FUNC void vmm_release(void* at) {
+    _JOS_ASSERT(_initialised);
+    lock_spinlock(&_arena_lock);
+    const size_t size = vmem_free(&_arena, (uintptr_t)at);
+    lock_unlock(&_arena_lock);
+    _JOS_ASSERT(size);
+    (void)size;
+}
+
+_JOS_API_FUNC void* vmm_reserve_lazy(size_t size, int prot_flags) {
+
+    if ( !_initialised ) {
+        return 0;
+    }
+    lock_spinlock(&_arena_lock);
+    vmm_lazy_region_t* region = (vmm_lazy_region_t*)_allocator->alloc(_allocator, sizeof(vmm_lazy_region_t));
+    void* ptr = region ? (void*)vmem_alloc(&_arena, size) : 0;
+    if ( region && !ptr ) {
+        _allocator->free(_allocator, region);
+    }
+    lock_unlock(&_arena_lock);
+    if ( !ptr ) {
+        return 0;
+    }
+    region->_base = (uintptr_t)ptr;
+    region->_size = _JOS_ALIGN(size, VMM_PAGE_SIZE);
+    region->_prot_flags = prot_flags;
+    const uint64_t rflags = _lazy_lock_acquire();
+    region->_next = _lazy_regions;
+    _lazy_regions = region;
+    _lazy_lock_release(rflags);
+    return ptr;
+}
+
+// the lazy region containing all of [at, at+size), called with _lazy_lock held
+static vmm_lazy_region_t* _find_lazy_region(uintptr_t at, size_t size) {
+    vmm_lazy_region_t* region = _lazy_regions;
+    while ( region && (at < region->_base || at - region->_base + size > region->_size) ) {
+        region = region->_next;
+    }
+    return region;
+}
+
+static jo_status_t _commit_lazy_page(uintptr_t page, int prot_flags) {
+    const uintptr_t frame = memory_frame_alloc_zeroed();
+    if ( !frame ) {
+        return _JO_STATUS_RESOURCE_EXHAUSTED;
+    }
+    const jo_status_t status = pagetables_map_range((void*)page, frame, VMM_PAGE_SIZE, prot_flags);
+    if ( _JO_FAILED(status) ) {
+        memory_frame_free(frame);
+    }
+    return status;
+}
+
+_JOS_API_FUNC bool vmm_handle_page_fault(uintptr_t addr, uint64_t error_code) {
+
+    if ( !_initialised || (error_code & PF_ERROR_PRESENT) ) {
+        // protection violations are never ours
+        return false;
+    }
+    const uintptr_t page = addr & ~(VMM_PAGE_SIZE - 1);
+    bool handled = false;
+
+    const uint64_t rflags = _lazy_lock_acquire();
+    vmm_lazy_region_t* region = _find_lazy_region(page, VMM_PAGE_SIZE);
+    if ( region ) {
+        uintptr_t phys;
+        if ( _JO_SUCCEEDED(pagetables_virtual_to_physical((void*)page, &phys)) ) {
+            // someone else committed it first, unless it's been made inaccessible (a guard page, say)
+            handled = pagetables_is_present((void*)page);
+        }
+        else {
+            handled = _JO_SUCCEEDED(_commit_lazy_page(page, region->_prot_flags));
+        }
+    }
+    _lazy_lock_release(rflags);
+    return handled;
+}
+
+_JOS_API_FUNC jo_status_t vmm_commit(void* at, size_t size) {
+
+    const uintptr_t begin = (uintptr_t)at & ~(VMM_PAGE_SIZE - 1);
+    const uintptr_t end = _JOS_ALIGN((uintptr_t)at + size, VMM_PAGE_SIZE);
+    jo_status_t status = _JO_STATUS_SUCCESS;
+
+    const uint64_t rflags = _lazy_lock_acquire();
+    vmm_lazy_region_t* region = _find_lazy_region(begin, end - begin);
+    if ( !region ) {
+        status = _JO_STATUS_NOT_FOUND;
+    }
+    for ( uintptr_t page = begin; region && page < end && _JO_SUCCEEDED(status); page += VMM_PAGE_SIZE ) {
+        uintptr_t phys;
+        if ( _JO_FAILED(pagetables_virtual_to_physical((void*)page, &phys)) ) {
+            status = _commit_lazy_page(page, region->_prot_flags);
+        }
+    }
+    _lazy_lock_release(rflags);
+    return status;
+}
+
+_JOS_API_FUNC page_allocator_t* vmm_page_allocator(void) {
+    return _initialised ? &_page_allocator : 0;
+}
+
+_JOS_API_FUNC jo_status_t vmm_initialise(dynamic_allocation_policy_t* dynamic_allocation_policy) {
+
+    _JOS_ASSERT(!_initialised);
+    if ( memory_get_highest_physical_address() > JOSX_VMM_BASE ) {
+        // we'd overlap the direct map
+        return _JO_STATUS_OUT_OF_RANGE;
+    }
+    lock_initialise(&_arena_lock);
+    lock_initialise(&_lazy_lock);
+    _allocator = dynamic_allocation_policy->allocator;
+    const jo_status_t status = vmem_create(&_arena, "kernel:vmm", JOSX_VMM_BASE, JOSX_VMM_SIZE, VMM_PAGE_SIZE, 
+                                    JOSX_VMM_QCACHE_MAX, dynamic_allocation_policy->allocator);
+    if ( _JO_FAILED(status) ) {
+        return status;
+    }
+    _initialised = true;
+    _JOS_KTRACE_CHANNEL(kVmmChannel, "initialised, 0x%llx bytes @ 0x%llx, %d frames available", 
+        JOSX_VMM_SIZE, JOSX_VMM_BASE, memory_frames_available());
+    return _JO_STATUS_SUCCESS;
+}
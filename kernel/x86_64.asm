@@ -268,6 +268,10 @@ ISR_HANDLER_ERROR_CODE 30
 ; "fpu error interrupt"
 ISR_HANDLER 31
 
+; IPIs
+; TLB shootdown, see _JOS_KERNEL_IPI_TLB_SHOOTDOWN
+ISR_HANDLER 240
+
 ; =====================================================================================
 ; IRQs
 
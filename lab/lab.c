@@ -494,11 +494,24 @@ int main(void)
         );
 */
     test_load_dll();
+    test_vector_bulk(&_malloc_allocator);
     test_unordered_map(&_malloc_allocator);
+    test_hash();
+    test_hashmap(&_malloc_allocator);
     test_hive(&_malloc_allocator);
+    test_hive_interned(&_malloc_allocator);
+    test_hive_prefix(&_malloc_allocator);
+    test_hive_snapshot(&_malloc_allocator);
     
     test_page_allocator();
+    test_aligned_allocators(&_malloc_allocator);
+    test_tracking_allocator(&_malloc_allocator);
+    test_vmem(&_malloc_allocator);
+    test_allocator_stats();
     test_binary_search_tree(&_malloc_allocator);
+    test_btree(&_malloc_allocator);
+    test_range_map(&_malloc_allocator);
+    test_rings(&_malloc_allocator);
 
     /* alloc_tests();
 
@@ -15,6 +15,8 @@
 #include "../kernel/include/linear_allocator.h"
 #include "../kernel/include/arena_allocator.h"
 #include "../kernel/include/bb_page_allocator.h"
+#include "../kernel/include/tracking_allocator.h"
+#include "../kernel/include/vmem.h"
 
 
 static void _dump_bb_allocator(bb_page_allocator_t* allocator) {
@@ -97,6 +99,21 @@ void test_linear_allocator(void) {
 	void* data2 = allocator->alloc(allocator, 9);
 	assert(_JOS_PTR_IS_ALIGNED(data2, kAllocAlign_8));
 	memset(data2, 0, 9);
+
+	// nested marks rewind in reverse order, releasing everything allocated after them
+	const size_t available = linear_allocator_available(linear_allocator);
+	linear_allocator_marker_t outer = linear_allocator_mark(linear_allocator);
+	void* data3 = allocator->alloc(allocator, 16);
+	assert(data3);
+	linear_allocator_marker_t inner = linear_allocator_mark(linear_allocator);
+	void* data4 = allocator->alloc(allocator, 24);
+	assert(data4);
+	linear_allocator_rewind(linear_allocator, inner);
+	// the space used by data4 is handed out again
+	assert(allocator->alloc(allocator, 24) == data4);
+	linear_allocator_rewind(linear_allocator, outer);
+	assert(linear_allocator_available(linear_allocator) == available);
+	assert(allocator->alloc(allocator, 16) == data3);
 }
 
 void test_arena_allocator(void) {
@@ -116,3 +133,198 @@ void test_arena_allocator(void) {
 
 	allocator->free(allocator, allocated);
 }
+
+void test_aligned_allocators(generic_allocator_t* fallback_allocator) {
+
+	static char buffer[16*1024];
+	static const alloc_alignment_t kAlignments[] = { kAllocAlign_16, kAllocAlign_64, kAllocAlign_256, kAllocAlign_4k };
+	void* allocated[sizeof(kAlignments)/sizeof(kAlignments[0])];
+
+	generic_allocator_t* allocator = (generic_allocator_t*)linear_allocator_create(buffer, sizeof(buffer));
+	for (size_t n = 0; n < sizeof(kAlignments) / sizeof(kAlignments[0]); ++n) {
+		allocated[n] = allocator_alloc_aligned(allocator, 42, kAlignments[n]);
+		assert(allocated[n] && _JOS_PTR_IS_ALIGNED(allocated[n], kAlignments[n]));
+	}
+
+	arena_allocator_t* arena = arena_allocator_create(buffer, sizeof(buffer));
+	allocator = (generic_allocator_t*)arena;
+	const size_t arena_available = allocator->available(allocator);
+	for (size_t n = 0; n < sizeof(kAlignments) / sizeof(kAlignments[0]); ++n) {
+		allocated[n] = allocator_alloc_aligned(allocator, 42, kAlignments[n]);
+		assert(allocated[n] && _JOS_PTR_IS_ALIGNED(allocated[n], kAlignments[n]));
+		memset(allocated[n], 0xff, 42);
+	}
+	// free out of order, the arena should coalesce back into a single free block
+	allocator_free_aligned(allocator, allocated[1]);
+	allocator_free_aligned(allocator, allocated[3]);
+	allocator_free_aligned(allocator, allocated[0]);
+	allocator_free_aligned(allocator, allocated[2]);
+	assert(allocator->available(allocator) == arena_available);
+	assert(arena->_free_head && !arena->_free_head->_links[1]);
+
+	// falls back to over-allocating if the allocator doesn't support alignment natively
+	void* ptr = allocator_alloc_aligned(fallback_allocator, 42, kAllocAlign_4k);
+	assert(_JOS_PTR_IS_ALIGNED(ptr, kAllocAlign_4k));
+	allocator_free_aligned(fallback_allocator, ptr);
+}
+
+static void _count_call_sites(const tracking_call_site_t* site, void* user_data) {
+	(void)site;
+	++*(size_t*)user_data;
+}
+
+static void* _tracked_alloc(generic_allocator_t* allocator, size_t size) {
+	// a distinct call site
+	return allocator->alloc(allocator, size);
+}
+
+void test_tracking_allocator(generic_allocator_t* allocator) {
+
+	static char bookkeeping[64*1024];
+	generic_allocator_t* bookkeeping_allocator = (generic_allocator_t*)linear_allocator_create(bookkeeping, sizeof(bookkeeping));
+	tracking_allocator_t* tracker = tracking_allocator_create(allocator, bookkeeping_allocator, 256, 16, "test");
+	assert(tracker);
+	generic_allocator_t* tracked = (generic_allocator_t*)tracker;
+
+	void* blocks[100];
+	for (size_t n = 0; n < 100; ++n) {
+		blocks[n] = tracked->alloc(tracked, 10);
+	}
+	void* other = _tracked_alloc(tracked, 1000);
+	assert(tracker->_live_bytes == 100*10 + 1000);
+	assert(tracker->_alloc_count == 101);
+
+	size_t num_call_sites = 0;
+	tracking_allocator_visit_call_sites(tracker, _count_call_sites, &num_call_sites);
+	assert(num_call_sites == 2);
+
+	for (size_t n = 0; n < 100; n += 2) {
+		tracked->free(tracked, blocks[n]);
+	}
+	assert(tracker->_live_bytes == 50*10 + 1000);
+	other = tracked->realloc(tracked, other, 2000);
+	assert(tracker->_live_bytes == 50*10 + 2000);
+	tracked->free(tracked, other);
+	for (size_t n = 1; n < 100; n += 2) {
+		tracked->free(tracked, blocks[n]);
+	}
+	assert(tracker->_live_bytes == 0);
+	assert(tracker->_peak_bytes == 100*10 + 2000 - 50*10);
+	assert(tracker->_allocations_count == 0);
+	assert(tracker->_untracked_count == 0);
+}
+
+void test_vmem(generic_allocator_t* allocator) {
+
+	static const uintptr_t kBase = 0x100000;
+	static const size_t kQuantum = 0x1000;
+	vmem_t vmem;
+	jo_status_t status = vmem_create(&vmem, "test", kBase, 256*kQuantum, kQuantum, 4*kQuantum, allocator);
+	assert(_JO_SUCCEEDED(status));
+
+	// sizes are rounded up to the quantum and ranges are handed out in address order from a fresh arena
+	uintptr_t a = vmem_alloc(&vmem, 1);
+	uintptr_t b = vmem_alloc(&vmem, 3*kQuantum);
+	uintptr_t c = vmem_alloc(&vmem, 64*kQuantum);
+	assert(a == kBase && b == a + kQuantum && c == b + 3*kQuantum);
+	assert(vmem_allocation_size(&vmem, b) == 3*kQuantum);
+	assert(vmem_allocation_size(&vmem, b + kQuantum) == 0);
+	assert(vmem._in_use == 68*kQuantum);
+
+	// too large
+	assert(vmem_alloc(&vmem, 256*kQuantum) == 0);
+
+	// small frees go to the quantum caches and come straight back
+	assert(vmem_free(&vmem, b) == 3*kQuantum);
+	assert(vmem_free(&vmem, b) == 0);
+	assert(vmem_alloc(&vmem, 3*kQuantum) == b);
+
+	// larger frees coalesce with their free neighbours
+	assert(vmem_free(&vmem, c) == 64*kQuantum);
+	uintptr_t d = vmem_alloc(&vmem, 252*kQuantum);
+	assert(d == c);
+	assert(vmem_alloc(&vmem, kQuantum) == 0);
+	vmem_free(&vmem, d);
+
+	// ranges added later are used too, and coalesce with adjacent ones
+	status = vmem_add(&vmem, kBase + 256*kQuantum, 256*kQuantum);
+	assert(_JO_SUCCEEDED(status));
+	assert(_JO_FAILED(vmem_add(&vmem, kBase + 300*kQuantum, kQuantum)));
+	d = vmem_alloc(&vmem, 500*kQuantum);
+	assert(d == c);
+	vmem_free(&vmem, d);
+
+	vmem_free(&vmem, a);
+	vmem_free(&vmem, b);
+	assert(vmem._in_use == 4*kQuantum);
+
+	// the quantum caches are drained back into the arena before an allocation fails
+	d = vmem_alloc(&vmem, 512*kQuantum);
+	assert(d == kBase);
+	assert(vmem_free(&vmem, d) == 512*kQuantum);
+	assert(vmem._in_use == 0);
+	vmem_destroy(&vmem);
+}
+
+void test_allocator_stats(void) {
+
+	static char buffer[0x4000];
+	allocator_stats_t stats;
+
+	linear_allocator_t* linear_allocator = linear_allocator_create(buffer, sizeof(buffer));
+	generic_allocator_t* allocator = (generic_allocator_t*)linear_allocator;
+	allocator->alloc(allocator, 100);
+	allocator_alloc_aligned(allocator, 100, kAllocAlign_64);
+	assert(allocator_get_stats(allocator, &stats));
+	assert(stats._alloc_count == 2 && stats._allocated_blocks == 2 && stats._free_count == 0);
+	assert(stats._free == linear_allocator_available(linear_allocator) && stats._largest_free == stats._free);
+	assert(stats._used + stats._free + sizeof(linear_allocator_t) == sizeof(buffer));
+	assert(stats._fragmentation == 0);
+
+	arena_allocator_t* arena = arena_allocator_create(buffer, sizeof(buffer));
+	allocator = (generic_allocator_t*)arena;
+	void* blocks[8];
+	for (size_t n = 0; n < 8; ++n) {
+		blocks[n] = allocator->alloc(allocator, 256);
+	}
+	assert(allocator_get_stats(allocator, &stats));
+	assert(stats._allocated_blocks == 8 && stats._free_blocks == 1 && stats._fragmentation == 0);
+	const size_t free_before = stats._free;
+	// free every other block; the holes can't coalesce so the free memory is fragmented
+	for (size_t n = 0; n < 8; n += 2) {
+		allocator->free(allocator, blocks[n]);
+	}
+	assert(allocator_get_stats(allocator, &stats));
+	assert(stats._alloc_count == 8 && stats._free_count == 4 && stats._allocated_blocks == 4);
+	assert(stats._free_blocks == 5 && stats._free > free_before);
+	assert(stats._largest_free < stats._free && stats._fragmentation > 0);
+	assert(allocator->alloc(allocator, stats._largest_free) != 0);
+	for (size_t n = 1; n < 8; n += 2) {
+		allocator->free(allocator, blocks[n]);
+	}
+
+	fixed_allocator_t* fixed_allocator = fixed_allocator_create(buffer, 16*64 + sizeof(fixed_allocator_t), 6);
+	allocator = (generic_allocator_t*)fixed_allocator;
+	void* unit = allocator->alloc(allocator, 64);
+	allocator->alloc(allocator, 8);
+	assert(allocator_get_stats(allocator, &stats));
+	assert(stats._used == 2*64 && stats._free == 14*64 && stats._free_blocks == 14 && stats._largest_free == 64);
+	assert(allocator->available(allocator) == stats._free);
+	allocator->free(allocator, unit);
+	assert(allocator_get_stats(allocator, &stats) && stats._allocated_blocks == 1 && stats._free_count == 1);
+
+	static const size_t kPageCount = 64;
+	void* page_pool = malloc(kAllocAlign_4k * kPageCount);
+	bb_page_allocator_t page_allocator;
+	bb_page_allocator_create(&page_allocator, page_pool, kPageCount, NULL);
+	bb_page_allocator_stats(&page_allocator, &stats);
+	const size_t pages = stats._free / kAllocAlign_4k;
+	void* page_block = bb_page_allocator_allocate(&page_allocator, 3);
+	bb_page_allocator_stats(&page_allocator, &stats);
+	assert(stats._used == 3*kAllocAlign_4k && stats._free == (pages - 3)*kAllocAlign_4k && stats._allocated_blocks == 1);
+	assert(stats._largest_free && stats._largest_free <= stats._free);
+	bb_page_allocator_free(&page_allocator, page_block, 3);
+	bb_page_allocator_stats(&page_allocator, &stats);
+	assert(stats._used == 0 && stats._free_count == 1);
+	free(page_pool);
+}
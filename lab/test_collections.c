@@ -1,14 +1,22 @@
 
 #define _JOS_IMPLEMENT_CONTAINERS
+#define _JOS_IMPLEMENT_HASH
 #define _JOS_IMPLEMENT_HIVE
 #define _JOS_IMPLEMENT_BINARY_SEARCH_TREE
+#define _JOS_IMPLEMENT_BTREE
+#define _JOS_IMPLEMENT_RANGE_MAP
+#define _JOS_IMPLEMENT_RING
 
 #pragma warning(disable:4005)
 
 #include <jos.h>
 #include "../kernel/include/collections.h"
 #include "../kernel/include/hive.h"
+#include "../kernel/include/hashmap.h"
 #include "../kernel/include/binary_search_tree.h"
+#include "../kernel/include/btree.h"
+#include "../kernel/include/range_map.h"
+#include "../kernel/include/ring.h"
 
 #include <stdio.h>
 
@@ -81,6 +89,63 @@ void test_vector_aligned(generic_allocator_t* allocator) {
 	printf("passed\n");
 }
 
+void test_vector_bulk(generic_allocator_t* allocator) {
+
+	printf("test_vector_bulk...");
+
+	test_item_t items[100];
+	for (int n = 0; n < 100; ++n) {
+		items[n] = (test_item_t){ ._a = n, ._b = (char)n };
+	}
+
+	// starts out in caller storage, then moves to the allocator
+	test_item_t storage[4];
+	vector_t vector;
+	vector_create_with_storage(&vector, storage, 4, sizeof(test_item_t), allocator);
+	vector_push_back_n(&vector, items, 3);
+	assert(vector_data(&vector) == storage && vector_size(&vector) == 3);
+	vector_push_back(&vector, items + 3);
+	assert(vector_data(&vector) == storage && vector_is_full(&vector));
+	vector_push_back_n(&vector, items + 4, 96);
+	assert(vector_data(&vector) != storage && vector_size(&vector) == 100);
+	for (int n = 0; n < 100; ++n) {
+		test_item_t* t = vector_at(&vector, n);
+		assert(t->_a == n && t->_b == n);
+	}
+
+	vector_reserve(&vector, 500);
+	assert(vector_capacity(&vector) >= 500 && vector_size(&vector) == 100);
+	vector_resize(&vector, 110);
+	assert(((test_item_t*)vector_at(&vector, 99))->_a == 99 && ((test_item_t*)vector_at(&vector, 109))->_a == 0);
+	vector_resize(&vector, 10);
+	assert(vector_size(&vector) == 10);
+
+	// appending aligned to packed, and back
+	vector_t aligned;
+	vector_create_aligned(&aligned, 2, sizeof(test_item_t), 16, allocator);
+	vector_push_back_n(&aligned, items, 100);
+	vector_append(&aligned, &vector);
+	assert(vector_size(&aligned) == 110);
+	for (int n = 0; n < 110; ++n) {
+		test_item_t* t = vector_at(&aligned, n);
+		assert(((uintptr_t)t & 0xf) == 0);
+		assert(t->_a == n % 100);
+	}
+	vector_append(&vector, &aligned);
+	assert(vector_size(&vector) == 120 && ((test_item_t*)vector_at(&vector, 119))->_a == 9);
+
+	vector_t small;
+	vector_create_with_storage(&small, storage, 4, sizeof(test_item_t), allocator);
+	vector_swap(&small, &vector);
+	assert(vector_size(&small) == 120 && vector_data(&vector) == storage);
+
+	vector_destroy(&aligned);
+	vector_destroy(&small);
+	vector_destroy(&vector);
+
+	printf("passed\n");
+}
+
 //TODO: change iterator to use at_end kliche from unordered_map instead of has_next
 void test_paged_list(generic_allocator_t* allocator) {
 
@@ -213,20 +278,275 @@ void test_hive(generic_allocator_t* allocator) {
 	printf("passed\n");
 }
 
-void unordered_map_dump_stats(unordered_map_t* umap) {
-	printf("unordered_map:\n");
-	for (int i = 0; i < umap->_num_slots; ++i) {
-		const size_t count = vector_size(umap->_slots + i);
-		if (count) {
-			printf("\t");
-			for (int j = 0; j < vector_size(umap->_slots + i); ++j) {
-				printf("=");
+static void _count_hive_key(const char* key, vector_t* values, void* user_data) {
+	(void)key;
+	(void)values;
+	++*(size_t*)user_data;
+}
+
+void test_hive_interned(generic_allocator_t* allocator) {
+
+	printf("test_hive_interned...");
+
+	hive_t hive;
+	hive_create(&hive, allocator);
+
+	hive_key_t pool = hive_intern(&hive, "kernel:pool");
+	assert(pool != HIVE_KEY_INVALID);
+	// the same string, not the same pointer
+	char pool_str[] = "kernel:pool";
+	assert(hive_intern(&hive, pool_str) == pool);
+	hive_key_t name = hive_intern(&hive, "kernel:name");
+	assert(name != pool);
+
+	long long int_value;
+	const char* str_value;
+	uintptr_t ptr_value;
+	assert(!hive_get_int(&hive, pool, &int_value));
+	assert(!hive_get_int(&hive, HIVE_KEY_INVALID, &int_value));
+
+	hive_set_int(&hive, pool, 4096);
+	assert(hive_get_int(&hive, pool, &int_value) && int_value == 4096);
+	assert(!hive_get_str(&hive, pool, &str_value));
+	assert(hive_add_int(&hive, pool, -1024) == 3072);
+	assert(hive_get_int(&hive, pool, &int_value) && int_value == 3072);
+
+	hive_set_str(&hive, name, "josx64");
+	assert(hive_get_str(&hive, name, &str_value) && !strcmp(str_value, "josx64"));
+	assert(!hive_get_ptr(&hive, name, &ptr_value));
+	// a different type replaces the value and adding to a non-int starts from 0
+	hive_set_ptr(&hive, name, 0xf00baa);
+	assert(hive_get_ptr(&hive, name, &ptr_value) && ptr_value == 0xf00baa);
+	assert(hive_add_int(&hive, name, 7) == 7);
+
+	// enough keys to need more than one chunk of slots
+	static char keys[HIVE_INTERNED_CHUNK_SLOTS * 2][16];
+	for (int n = 0; n < HIVE_INTERNED_CHUNK_SLOTS * 2; ++n) {
+		snprintf(keys[n], sizeof(keys[n]), "key%d", n);
+		hive_key_t key = hive_intern(&hive, keys[n]);
+		assert(key != HIVE_KEY_INVALID);
+		hive_set_int(&hive, key, n);
+	}
+	assert(hive_get_int(&hive, hive_intern(&hive, "key100"), &int_value) && int_value == 100);
+
+	// interned keys are visible through the string API
+	vector_t values;
+	vector_create(&values, 4, sizeof(hive_value_t), allocator);
+	assert(_JO_SUCCEEDED(hive_get(&hive, "kernel:pool", &values)));
+	assert(vector_size(&values) == 1 && ((hive_value_t*)vector_at(&values, 0))->value.as_int == 3072);
+	assert(hive_get(&hive, "kernel:nothing", 0) == _JO_STATUS_NOT_FOUND);
+
+	hive_set(&hive, "foo", HIVE_VALUE_INT(1), HIVE_VALUELIST_END);
+	size_t count = 0;
+	vector_reset(&values);
+	hive_visit_values(&hive, _count_hive_key, &values, &count);
+	assert(count == 2 + HIVE_INTERNED_CHUNK_SLOTS * 2 + 1);
+
+	vector_destroy(&values);
+
+	printf("passed\n");
+}
+
+typedef struct _hive_prefix_visit {
+	const char* keys[8];
+	size_t count;
+} _hive_prefix_visit_t;
+
+static void _collect_hive_key(const char* key, vector_t* values, void* user_data) {
+	(void)values;
+	_hive_prefix_visit_t* visit = (_hive_prefix_visit_t*)user_data;
+	assert(visit->count < 8);
+	visit->keys[visit->count++] = key;
+}
+
+void test_hive_prefix(generic_allocator_t* allocator) {
+
+	printf("test_hive_prefix...");
+
+	hive_t hive;
+	hive_create(&hive, allocator);
+
+	hive_set(&hive, "kernel:pool", HIVE_VALUE_INT(1), HIVE_VALUELIST_END);
+	hive_set(&hive, "acpi:config_table_entries", HIVE_VALUE_INT(42), HIVE_VALUELIST_END);
+	hive_set(&hive, "sdt:2.0", HIVE_VALUELIST_END);
+	hive_lpush(&hive, "kernel:heap_sites", HIVE_VALUE_PTR(0xf00baa), HIVE_VALUE_INT(16), HIVE_VALUELIST_END);
+	hive_set(&hive, "kernel", HIVE_VALUE_STR("not in the namespace"), HIVE_VALUELIST_END);
+	hive_set(&hive, "kernel:booted", HIVE_VALUELIST_END);
+	hive_key_t heap = hive_intern(&hive, "kernel:heap");
+	hive_set_int(&hive, heap, 4096);
+	// interned but never set, so not visited
+	hive_intern(&hive, "kernel:unset");
+
+	vector_t values;
+	vector_create(&values, 4, sizeof(hive_value_t), allocator);
+
+	_hive_prefix_visit_t visit = { .count = 0 };
+	hive_visit_prefix(&hive, "kernel:", _collect_hive_key, &values, &visit);
+	assert(visit.count == 4);
+	assert(!strcmp(visit.keys[0], "kernel:booted"));
+	assert(!strcmp(visit.keys[1], "kernel:heap"));
+	assert(!strcmp(visit.keys[2], "kernel:heap_sites"));
+	assert(!strcmp(visit.keys[3], "kernel:pool"));
+
+	visit.count = 0;
+	hive_visit_prefix(&hive, "nothing:", _collect_hive_key, &values, &visit);
+	assert(visit.count == 0);
+
+	hive_delete(&hive, "kernel:heap_sites");
+	hive_delete(&hive, "acpi:config_table_entries");
+	visit.count = 0;
+	hive_visit_values(&hive, _collect_hive_key, &values, &visit);
+	assert(visit.count == 5);
+	assert(!strcmp(visit.keys[0], "kernel"));
+	assert(!strcmp(visit.keys[4], "sdt:2.0"));
+
+	vector_destroy(&values);
+
+	printf("passed\n");
+}
+
+typedef struct _hive_snapshot_records {
+	uint64_t since;
+	uint64_t version;
+	size_t count;
+	hive_record_kind_t kinds[16];
+	char keys[16][32];
+	// the first value of each record, if it's an int
+	long long ints[16];
+} _hive_snapshot_records_t;
+
+static size_t _write_hive_snapshot(hive_t* hive, uint64_t since, uint8_t* buffer, size_t buffer_size) {
+	FILE* stream = tmpfile();
+	assert(stream);
+	assert(_JO_SUCCEEDED(hive_write_snapshot(hive, since, stream)));
+	const size_t size = (size_t)ftell(stream);
+	assert(size <= buffer_size);
+	rewind(stream);
+	assert(fread(buffer, 1, size, stream) == size);
+	fclose(stream);
+	return size;
+}
+
+static void _read_hive_snapshot(const uint8_t* p, size_t size, _hive_snapshot_records_t* records) {
+	const uint8_t* end = p + size;
+	uint32_t magic;
+	uint16_t format, flags;
+	memcpy(&magic, p, 4); p += 4;
+	memcpy(&format, p, 2); p += 2;
+	memcpy(&flags, p, 2); p += 2;
+	memcpy(&records->since, p, 8); p += 8;
+	memcpy(&records->version, p, 8); p += 8;
+	assert(magic == HIVE_SNAPSHOT_MAGIC && format == HIVE_SNAPSHOT_FORMAT);
+	assert(!!(flags & HIVE_SNAPSHOT_FLAG_DELTA) == !!records->since);
+
+	records->count = 0;
+	while (*p != kHiveRecord_End) {
+		assert(records->count < 16);
+		const size_t r = records->count++;
+		records->kinds[r] = (hive_record_kind_t)*p++;
+		uint16_t len;
+		memcpy(&len, p, 2); p += 2;
+		assert(len < 32);
+		memcpy(records->keys[r], p, len); p += len;
+		records->keys[r][len] = 0;
+		records->ints[r] = 0;
+		if (records->kinds[r] == kHiveRecord_Deleted) {
+			continue;
+		}
+		uint32_t count;
+		memcpy(&count, p, 4); p += 4;
+		for (uint32_t n = 0; n < count; ++n) {
+			const hive_value_type_t type = (hive_value_type_t)*p++;
+			if (type == kHiveValue_Str) {
+				memcpy(&len, p, 2); p += 2 + len;
+			}
+			else {
+				if (n == 0 && type == kHiveValue_Int) {
+					memcpy(&records->ints[r], p, 8);
+				}
+				p += 8;
 			}
-			printf("\n");
 		}
-		else {
-			printf("\t.\n");
+		assert(p < end);
+	}
+	assert(p + 1 == end);
+}
+
+void test_hive_snapshot(generic_allocator_t* allocator) {
+
+	printf("test_hive_snapshot...");
+
+	hive_t hive;
+	hive_create(&hive, allocator);
+
+	hive_set(&hive, "acpi:numa_nodes", HIVE_VALUE_INT(2), HIVE_VALUELIST_END);
+	hive_set(&hive, "sdt:2.0", HIVE_VALUE_PTR(0xf00baa), HIVE_VALUE_INT(12), HIVE_VALUE_STR("RSDP"), HIVE_VALUELIST_END);
+	hive_lpush(&hive, "kernel:heap_sites", HIVE_VALUE_PTR(0x1000), HIVE_VALUE_INT(16), HIVE_VALUELIST_END);
+	hive_key_t pool = hive_intern(&hive, "kernel:pool");
+	hive_set_int(&hive, pool, 4096);
+	hive_intern(&hive, "kernel:unset");
+
+	static uint8_t buffer[1024];
+	_hive_snapshot_records_t records;
+	const uint64_t version = hive_version(&hive);
+	size_t size = _write_hive_snapshot(&hive, 0, buffer, sizeof(buffer));
+	_read_hive_snapshot(buffer, size, &records);
+	// taking a snapshot moves the hive on to the next version
+	assert(records.since == 0 && records.version == version && hive_version(&hive) == version + 1);
+	assert(records.count == 4);
+	assert(!strcmp(records.keys[0], "acpi:numa_nodes") && records.kinds[0] == kHiveRecord_Key && records.ints[0] == 2);
+	assert(!strcmp(records.keys[1], "kernel:heap_sites") && records.kinds[1] == kHiveRecord_List);
+	assert(!strcmp(records.keys[2], "kernel:pool") && records.ints[2] == 4096);
+	assert(!strcmp(records.keys[3], "sdt:2.0"));
+
+	// nothing has changed
+	size = _write_hive_snapshot(&hive, version, buffer, sizeof(buffer));
+	_read_hive_snapshot(buffer, size, &records);
+	assert(records.count == 0 && records.version == version + 1);
+
+	hive_add_int(&hive, pool, 1);
+	hive_delete(&hive, "kernel:heap_sites");
+	hive_set(&hive, "acpi:numa_nodes", HIVE_VALUE_INT(4), HIVE_VALUELIST_END);
+	size = _write_hive_snapshot(&hive, version, buffer, sizeof(buffer));
+	_read_hive_snapshot(buffer, size, &records);
+	assert(records.since == version && records.version > version);
+	assert(records.count == 3);
+	assert(!strcmp(records.keys[0], "acpi:numa_nodes") && records.ints[0] == 4);
+	assert(!strcmp(records.keys[1], "kernel:pool") && records.ints[1] == 4097);
+	assert(!strcmp(records.keys[2], "kernel:heap_sites") && records.kinds[2] == kHiveRecord_Deleted);
+
+	// a deleted key which comes back is just changed
+	const uint64_t version2 = records.version;
+	hive_lpush(&hive, "kernel:heap_sites", HIVE_VALUE_PTR(0x2000), HIVE_VALUE_INT(32), HIVE_VALUELIST_END);
+	size = _write_hive_snapshot(&hive, version2, buffer, sizeof(buffer));
+	_read_hive_snapshot(buffer, size, &records);
+	assert(records.count == 1 && records.kinds[0] == kHiveRecord_List);
+
+	// value counts aren't limited to 16 bits
+	const uint64_t version3 = records.version;
+	for (long long n = 0; n < 0x10001; ++n) {
+		hive_lpush(&hive, "big", HIVE_VALUE_INT(n), HIVE_VALUELIST_END);
+	}
+	FILE* stream = tmpfile();
+	assert(stream);
+	assert(_JO_SUCCEEDED(hive_write_snapshot(&hive, version3, stream)));
+	// header, kind, key length, "big"
+	fseek(stream, 24 + 1 + 2 + 3, SEEK_SET);
+	uint32_t count = 0;
+	assert(fread(&count, 1, sizeof(count), stream) == sizeof(count) && count == 0x10001);
+	fclose(stream);
+
+	printf("passed\n");
+}
+
+void unordered_map_dump_stats(unordered_map_t* umap) {
+	printf("unordered_map: %zu/%zu\n", umap->_occupancy, umap->_capacity);
+	for (size_t g = 0; g < umap->_capacity / UNORDERED_MAP_GROUP_SIZE; ++g) {
+		printf("\t");
+		for (size_t i = 0; i < UNORDERED_MAP_GROUP_SIZE; ++i) {
+			printf((umap->_ctrl[g * UNORDERED_MAP_GROUP_SIZE + i] & UNORDERED_MAP_CTRL_EMPTY) ? "." : "=");
 		}
+		printf(" %d\n", umap->_overflow[g]);
 	}
 }
 
@@ -234,6 +554,10 @@ static bool int_cmp_func(const void* a, const void* b) {
 	return *(const int*)a == *(const int*)b;
 }
 
+static uint32_t int_hash_func(const void* key) {
+	return hash_fold32(hash_mix64((uint64_t)*(const int*)key));
+}
+
 static bool str_cmp_func(const void* a, const void* b) {
 	return strcmp((const char*)a, (const char*)b) == 0;
 }
@@ -260,10 +584,12 @@ void test_unordered_map(generic_allocator_t* allocator) {
 	const void* value = unordered_map_find(&umap, (map_key_t)"foo");
 	assert(value == NULL);
 
+	// pointer keys are stored as-is so they have to outlive the map
+	static char keys[1000][16];
 	size_t inserted = 0;
 	for (int n = 0; n < 1000; ++n) {
-		char key[64];
-		sprintf_s(key, sizeof(key), "foo%d", n);
+		char* key = keys[n];
+		sprintf_s(key, sizeof(keys[n]), "foo%d", n);
 		test_data_t v = (struct _test_data){ ._a = n + 1, ._b = n & 0xff };
 		inserted += unordered_map_insert(&umap, (map_key_t)key, (map_value_t)&v) ? 1 : 0;
 		value = unordered_map_find(&umap, (map_key_t)key);
@@ -274,6 +600,170 @@ void test_unordered_map(generic_allocator_t* allocator) {
 	assert(unordered_map_size(&umap) == inserted);
 	//unordered_map_dump_stats(&umap);
 	unordered_map_destroy(&umap);
+
+	// value keys; grow well past the initial capacity, then remove every other key and make sure 
+	// the rest can still be found and iterated
+	unordered_map_create(&umap, &(unordered_map_create_args_t){
+		.value_size = sizeof(test_data_t),
+			.key_size = sizeof(int),
+			.hash_func = int_hash_func,
+			.cmp_func = int_cmp_func,
+			.key_type = kMap_Type_Value
+	},
+	allocator);
+	assert(unordered_map_memory_footprint(&umap) == 0);
+	for (int n = 0; n < 5000; ++n) {
+		test_data_t v = (struct _test_data){ ._a = n, ._b = n & 0xff };
+		assert(unordered_map_insert(&umap, (map_key_t)&n, (map_value_t)&v));
+	}
+	assert(unordered_map_size(&umap) == 5000);
+	assert(umap._capacity * 7 >= 5000 * 8);
+	for (int n = 0; n < 5000; n += 2) {
+		assert(unordered_map_remove(&umap, (map_key_t)&n));
+		assert(!unordered_map_remove(&umap, (map_key_t)&n));
+	}
+	assert(unordered_map_size(&umap) == 2500);
+	for (int n = 0; n < 5000; ++n) {
+		value = unordered_map_find(&umap, (map_key_t)&n);
+		assert((value != NULL) == ((n & 1) == 1));
+		assert(!value || ((const test_data_t*)value)->_a == n);
+	}
+	size_t visited = 0;
+	unordered_map_iterator_t iter = unordered_map_iterator_begin(&umap);
+	while (!unordered_map_iterator_at_end(&iter)) {
+		const int key = *(const int*)unordered_map_iterator_key(&iter);
+		assert((key & 1) && ((const test_data_t*)unordered_map_iterator_value(&iter))->_a == key);
+		++visited;
+		unordered_map_iterator_next(&iter);
+	}
+	assert(visited == 2500);
+	// removed slots are re-used
+	const size_t capacity = umap._capacity;
+	for (int n = 0; n < 5000; n += 2) {
+		test_data_t v = (struct _test_data){ ._a = n, ._b = n & 0xff };
+		assert(unordered_map_insert(&umap, (map_key_t)&n, (map_value_t)&v));
+	}
+	assert(umap._capacity == capacity);
+	unordered_map_destroy(&umap);
+	printf("passed\n");
+}
+
+typedef struct _test_point {
+	int _x;
+	int _y;
+} test_point_t;
+
+static uint32_t point_hash(test_point_t p) {
+	return hashmap_u64_hash(((uint64_t)(uint32_t)p._x << 32) | (uint32_t)p._y);
+}
+
+static bool point_eq(test_point_t a, test_point_t b) {
+	return a._x == b._x && a._y == b._y;
+}
+
+_JOS_DEFINE_HASHMAP(test_point_map, test_point_t, uint16_t, point_hash, point_eq)
+
+void test_hash(void) {
+
+	printf("test_hash...");
+
+	// the standard check value
+	assert(hash_crc32c("123456789", 9, 0) == 0xe3069283);
+	assert(hash_crc32c("123456789", 9, hash_crc32c(0, 0, 0)) == 0xe3069283);
+	assert(hash_crc32c("56789", 5, hash_crc32c("1234", 4, 0)) == 0xe3069283);
+	// 8 byte steps and a tail
+	const char* long_str = "kernel:hive_boot_size:kernel:hive_boot_size";
+	const size_t long_len = strlen(long_str);
+	assert(hash_crc32c(long_str + 13, long_len - 13, hash_crc32c(long_str, 13, 0)) == hash_crc32c(long_str, long_len, 0));
+
+	// every length path of wyhash, no two prefixes of the same string should collide
+	char buffer[128];
+	for (size_t n = 0; n < sizeof(buffer); ++n) {
+		buffer[n] = (char)('a' + n % 26);
+	}
+	for (size_t i = 0; i < sizeof(buffer); ++i) {
+		const uint64_t hi = hash_wy64(buffer, i, HASH_WY64_DEFAULT_SEED);
+		assert(hi == hash_wy64(buffer, i, HASH_WY64_DEFAULT_SEED));
+		assert(hi != hash_wy64(buffer, i, 1));
+		for (size_t j = i + 1; j < sizeof(buffer); ++j) {
+			assert(hi != hash_wy64(buffer, j, HASH_WY64_DEFAULT_SEED));
+		}
+	}
+	assert(hash_str64("kernel:hive_boot_size") != hash_str64("kernel:hive_boot_sizf"));
+	assert(hash_str64(0) == 0);
+
+	// sequential integers must spread evenly over the low bits
+	size_t buckets[64] = { 0 };
+	for (uint64_t n = 0; n < 64 * 256; ++n) {
+		++buckets[hash_mix64(n) & 63];
+	}
+	for (size_t n = 0; n < 64; ++n) {
+		assert(buckets[n] > 128 && buckets[n] < 384);
+	}
+
+	printf("passed\n");
+}
+
+void test_hashmap(generic_allocator_t* allocator) {
+
+	printf("test_hashmap...");
+
+	u64_ptr_map_t ptrs;
+	u64_ptr_map_create(&ptrs, allocator);
+	assert(u64_ptr_map_find(&ptrs, 0) == NULL);
+	for (uint64_t n = 0; n < 10000; ++n) {
+		assert(u64_ptr_map_insert(&ptrs, n << 12, (void*)(uintptr_t)(n + 1)));
+	}
+	assert(!u64_ptr_map_insert(&ptrs, 42 << 12, (void*)(uintptr_t)42));
+	assert(u64_ptr_map_size(&ptrs) == 10000);
+	for (uint64_t n = 0; n < 10000; n += 3) {
+		assert(u64_ptr_map_remove(&ptrs, n << 12));
+	}
+	for (uint64_t n = 0; n < 10000; ++n) {
+		void** value = u64_ptr_map_find(&ptrs, n << 12);
+		assert((value != NULL) == ((n % 3) != 0));
+		assert(!value || *value == (void*)(uintptr_t)(n == 42 ? 42 : n + 1));
+	}
+	size_t cursor = 0;
+	size_t visited = 0;
+	while (u64_ptr_map_iterate(&ptrs, &cursor)) {
+		++visited;
+	}
+	assert(visited == u64_ptr_map_size(&ptrs));
+	u64_ptr_map_destroy(&ptrs);
+	assert(u64_ptr_map_memory_footprint(&ptrs) == 0);
+
+	static char keys[1000][16];
+	str_u32_map_t strs;
+	str_u32_map_create(&strs, allocator);
+	for (uint32_t n = 0; n < 1000; ++n) {
+		sprintf_s(keys[n], sizeof(keys[n]), "kernel:key%u", n);
+		assert(str_u32_map_insert(&strs, keys[n], n));
+	}
+	for (uint32_t n = 0; n < 1000; ++n) {
+		char key[16];
+		sprintf_s(key, sizeof(key), "kernel:key%u", n);
+		uint32_t* value = str_u32_map_find(&strs, key);
+		assert(value && *value == n);
+	}
+	assert(str_u32_map_find(&strs, "kernel:key1000") == NULL);
+	str_u32_map_destroy(&strs);
+
+	test_point_map_t points;
+	test_point_map_create(&points, allocator);
+	for (int x = -50; x < 50; ++x) {
+		for (int y = -50; y < 50; ++y) {
+			assert(test_point_map_insert(&points, (test_point_t){ x, y }, (uint16_t)((x + 50) * 100 + y + 50)));
+		}
+	}
+	for (int x = -50; x < 50; ++x) {
+		for (int y = -50; y < 50; ++y) {
+			uint16_t* value = test_point_map_find(&points, (test_point_t){ x, y });
+			assert(value && *value == (uint16_t)((x + 50) * 100 + y + 50));
+		}
+	}
+	test_point_map_destroy(&points);
+
 	printf("passed\n");
 }
 
@@ -338,3 +828,248 @@ void test_binary_search_tree(generic_allocator_t* allocator) {
 	binary_search_tree_destroy(&tree);
 	assert(binary_search_tree_size(&tree) == 0);
 }
+
+void test_btree(generic_allocator_t* allocator) {
+
+	printf("test_btree...");
+
+	enum { kCount = 20000 };
+	static bool present[kCount];
+
+	btree_t tree;
+	btree_create(&tree, allocator);
+	assert(!btree_find(&tree, 0, NULL));
+	btree_iterator_t iter = btree_iterator_begin(&tree);
+	assert(btree_iterator_at_end(&iter));
+	// 7919 is prime so this visits every key once, out of order
+	for (size_t n = 0; n < kCount; ++n) {
+		const uintptr_t key = (n * 7919) % kCount;
+		assert(btree_insert(&tree, key << 12, key));
+		present[key] = true;
+	}
+	assert(!btree_insert(&tree, 42 << 12, 4242));
+	assert(btree_size(&tree) == kCount);
+	uintptr_t value;
+	assert(btree_find(&tree, 42 << 12, &value) && value == 4242);
+	assert(!btree_find(&tree, (42 << 12) + 1, NULL));
+
+	for (size_t n = 0; n < kCount; n += 3) {
+		const uintptr_t key = (n * 7919) % kCount;
+		assert(btree_remove(&tree, key << 12));
+		present[key] = false;
+	}
+	assert(!btree_remove(&tree, 1));
+
+	size_t count = 0;
+	uintptr_t prev = 0;
+	iter = btree_iterator_begin(&tree);
+	while (!btree_iterator_at_end(&iter)) {
+		const uintptr_t key = btree_iterator_key(&iter);
+		assert(!count || key > prev);
+		assert(present[key >> 12]);
+		assert(btree_iterator_value(&iter) == (key == (42 << 12) ? 4242 : key >> 12));
+		prev = key;
+		++count;
+		btree_iterator_next(&iter);
+	}
+	assert(count == btree_size(&tree));
+
+	for (size_t key = 0; key < kCount; ++key) {
+		uintptr_t floor_key;
+		const bool found = btree_floor(&tree, (key << 12) + 0x800, &floor_key, NULL);
+		size_t expected = key + 1;
+		while (expected && !present[expected - 1]) {
+			--expected;
+		}
+		assert(found == (expected != 0));
+		assert(!found || floor_key == (expected - 1) << 12);
+
+		iter = btree_iterator_lower_bound(&tree, (key << 12) + 1);
+		expected = key + 1;
+		while (expected < kCount && !present[expected]) {
+			++expected;
+		}
+		assert(btree_iterator_at_end(&iter) == (expected == kCount));
+		assert(btree_iterator_at_end(&iter) || btree_iterator_key(&iter) == expected << 12);
+	}
+
+	// remove everything; the tree collapses back to nothing
+	for (size_t key = 0; key < kCount; ++key) {
+		assert(btree_remove(&tree, key << 12) == present[key]);
+	}
+	assert(btree_size(&tree) == 0);
+	iter = btree_iterator_begin(&tree);
+	assert(btree_iterator_at_end(&iter));
+	btree_destroy(&tree);
+
+	static uintptr_t keys[kCount];
+	static uintptr_t values[kCount];
+	for (size_t n = 0; n < kCount; ++n) {
+		keys[n] = (n << 4) + 1;
+		values[n] = n;
+	}
+	btree_create(&tree, allocator);
+	assert(btree_bulk_load(&tree, keys, values, kCount) == _JO_STATUS_SUCCESS);
+	assert(btree_bulk_load(&tree, keys, values, kCount) == _JO_STATUS_FAILED_PRECONDITION);
+	assert(btree_size(&tree) == kCount);
+	for (size_t n = 0; n < kCount; ++n) {
+		assert(btree_find(&tree, keys[n], &value) && value == n);
+	}
+	// a bulk loaded tree is a regular tree
+	for (size_t n = 0; n < kCount; n += 2) {
+		assert(btree_remove(&tree, keys[n]));
+	}
+	for (size_t n = 0; n < kCount; n += 2) {
+		assert(btree_insert(&tree, keys[n] + 1, n));
+	}
+	count = 0;
+	iter = btree_iterator_begin(&tree);
+	while (!btree_iterator_at_end(&iter)) {
+		assert(btree_iterator_value(&iter) == count);
+		++count;
+		btree_iterator_next(&iter);
+	}
+	assert(count == kCount);
+	btree_destroy(&tree);
+
+	btree_create(&tree, allocator);
+	keys[1] = keys[0];
+	assert(btree_bulk_load(&tree, keys, values, kCount) == _JO_STATUS_INVALID_INPUT);
+	assert(btree_size(&tree) == 0);
+	btree_destroy(&tree);
+
+	printf("passed\n");
+}
+
+void test_range_map(generic_allocator_t* allocator) {
+
+	printf("test_range_map...");
+
+	range_map_t map;
+	range_map_create(&map, 0, allocator);
+	assert(range_map_find(&map, 0) == NULL);
+	assert(range_map_insert(&map, 0x2000, 0x2000, 0) == _JO_STATUS_INVALID_INPUT);
+
+	// non-overlapping, inserted out of order
+	for (uintptr_t n = 0; n < 1000; ++n) {
+		const uintptr_t start = ((n * 389) % 1000) << 12;
+		assert(range_map_insert(&map, start, start + 0x800, start >> 12) == _JO_STATUS_SUCCESS);
+	}
+	assert(range_map_size(&map) == 1000);
+	for (uintptr_t n = 0; n < 1000; ++n) {
+		range_map_entry_t* entry = range_map_find(&map, (n << 12) + 0x7ff);
+		assert(entry && entry->_value == n);
+		assert(range_map_find_next(&map, (n << 12) + 0x7ff, entry) == NULL);
+		// the cached entry isn't used for the gap after it
+		assert(range_map_find(&map, (n << 12) + 0x800) == NULL);
+	}
+	assert(range_map_remove(&map, 42 << 12, (42 << 12) + 0x800));
+	assert(!range_map_remove(&map, 42 << 12, (42 << 12) + 0x800));
+	assert(range_map_find(&map, 42 << 12) == NULL);
+	assert(range_map_find(&map, 43 << 12)->_value == 43);
+	range_map_destroy(&map);
+
+	// nested and overlapping
+	range_map_entry_t storage[4];
+	range_map_create_fixed(&map, storage, 4);
+	assert(range_map_insert(&map, 0x1000, 0x9000, 1) == _JO_STATUS_SUCCESS);
+	assert(range_map_insert(&map, 0x2000, 0x3000, 2) == _JO_STATUS_SUCCESS);
+	assert(range_map_insert(&map, 0x2800, 0x5000, 3) == _JO_STATUS_SUCCESS);
+	assert(range_map_insert(&map, 0x6000, 0x7000, 4) == _JO_STATUS_SUCCESS);
+	assert(range_map_insert(&map, 0x8000, 0x9000, 5) == _JO_STATUS_RESOURCE_EXHAUSTED);
+
+	range_map_entry_t* entry = range_map_find(&map, 0x2900);
+	assert(entry && entry->_value == 3);
+	entry = range_map_find_next(&map, 0x2900, entry);
+	assert(entry && entry->_value == 2);
+	entry = range_map_find_next(&map, 0x2900, entry);
+	assert(entry && entry->_value == 1);
+	assert(range_map_find_next(&map, 0x2900, entry) == NULL);
+
+	assert(range_map_find(&map, 0x3800)->_value == 3);
+	// the long range is found behind ones which have ended
+	assert(range_map_find(&map, 0x5800)->_value == 1);
+	assert(range_map_find(&map, 0x6000)->_value == 4);
+	assert(range_map_find(&map, 0x8fff)->_value == 1);
+	assert(range_map_find(&map, 0x9000) == NULL);
+	assert(range_map_find(&map, 0xfff) == NULL);
+
+	assert(range_map_remove(&map, 0x1000, 0x9000));
+	assert(range_map_find(&map, 0x5800) == NULL);
+	assert(range_map_find(&map, 0x2900)->_value == 3);
+	range_map_destroy(&map);
+
+	printf("passed\n");
+}
+
+void test_rings(generic_allocator_t* allocator) {
+
+	printf("test_rings...");
+
+	spsc_ring_t spsc;
+	assert(spsc_ring_create(&spsc, 100, sizeof(uint32_t), allocator) == _JO_STATUS_SUCCESS);
+	assert(spsc_ring_capacity(&spsc) == 128);
+	assert(spsc_ring_is_empty(&spsc));
+	uint32_t value;
+	assert(!spsc_ring_pop(&spsc, &value));
+
+	// wrap around a few times, in odd sized batches
+	uint32_t next_in = 0;
+	uint32_t next_out = 0;
+	uint32_t batch[50];
+	for (int round = 0; round < 100; ++round) {
+		for (uint32_t n = 0; n < 37; ++n) {
+			batch[n] = next_in + n;
+		}
+		next_in += (uint32_t)spsc_ring_push_n(&spsc, batch, 37);
+		const size_t popped = spsc_ring_pop_n(&spsc, batch, 23 + (size_t)(round % 20));
+		for (size_t n = 0; n < popped; ++n) {
+			assert(batch[n] == next_out++);
+		}
+		assert(spsc_ring_size(&spsc) == next_in - next_out);
+	}
+	while (spsc_ring_push(&spsc, &next_in)) {
+		++next_in;
+	}
+	assert(spsc_ring_size(&spsc) == 128);
+	while (spsc_ring_pop(&spsc, &value)) {
+		assert(value == next_out++);
+	}
+	assert(next_out == next_in);
+	spsc_ring_destroy(&spsc);
+
+	uint8_t storage[16];
+	assert(spsc_ring_create_fixed(&spsc, storage, 12, 1) == _JO_STATUS_INVALID_INPUT);
+	assert(spsc_ring_create_fixed(&spsc, storage, 16, 1) == _JO_STATUS_SUCCESS);
+	assert(spsc_ring_push_n(&spsc, "0123456789abcdefXYZ", 19) == 16);
+	char out[17] = { 0 };
+	assert(spsc_ring_pop_n(&spsc, out, 17) == 16);
+	assert(strcmp(out, "0123456789abcdef") == 0);
+
+	mpmc_ring_t mpmc;
+	assert(mpmc_ring_create(&mpmc, 64, sizeof(uint32_t), allocator) == _JO_STATUS_SUCCESS);
+	assert(!mpmc_ring_pop(&mpmc, &value));
+	next_in = next_out = 0;
+	for (int round = 0; round < 100; ++round) {
+		for (uint32_t n = 0; n < 29; ++n) {
+			batch[n] = next_in + n;
+		}
+		next_in += (uint32_t)mpmc_ring_push_n(&mpmc, batch, 29);
+		if (round & 1) {
+			const size_t popped = mpmc_ring_pop_n(&mpmc, batch, 50);
+			for (size_t n = 0; n < popped; ++n) {
+				assert(batch[n] == next_out++);
+			}
+		}
+		else if (mpmc_ring_pop(&mpmc, &value)) {
+			assert(value == next_out++);
+		}
+		assert(mpmc_ring_size(&mpmc) == next_in - next_out);
+	}
+	for (value = 0; mpmc_ring_push(&mpmc, &value); ++value) {
+	}
+	assert(mpmc_ring_size(&mpmc) == 64);
+	mpmc_ring_destroy(&mpmc);
+
+	printf("passed\n");
+}
@@ -3,9 +3,22 @@
 void test_vector(generic_allocator_t* allocator);
 void test_paged_list(generic_allocator_t* allocator);
 void test_vector_aligned(generic_allocator_t* allocator);
+void test_vector_bulk(generic_allocator_t* allocator);
 void test_hive(generic_allocator_t* allocator);
+void test_hive_interned(generic_allocator_t* allocator);
+void test_hive_prefix(generic_allocator_t* allocator);
+void test_hive_snapshot(generic_allocator_t* allocator);
 void test_unordered_map(generic_allocator_t* allocator);
+void test_hashmap(generic_allocator_t* allocator);
+void test_hash(void);
+void test_btree(generic_allocator_t* allocator);
+void test_range_map(generic_allocator_t* allocator);
+void test_rings(generic_allocator_t* allocator);
 
 void test_fixed_allocator(void);
 void test_linear_allocator(void);
+void test_aligned_allocators(generic_allocator_t* fallback_allocator);
+void test_tracking_allocator(generic_allocator_t* allocator);
+void test_vmem(generic_allocator_t* allocator);
+void test_allocator_stats(void);
 